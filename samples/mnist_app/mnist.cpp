@@ -1,6 +1,7 @@
 #include <random>
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include "mnist.hpp"
 #include "utils.hpp"
 
@@ -17,46 +18,19 @@ using namespace std;
 
 typedef unsigned char uchar;
 
+Neural::IdxFile * map_mnist_images(string full_path) {
+    Neural::IdxFile *file = new Neural::IdxFile(full_path);
+    if(file->magic() != 2051) {
+        delete file;
+        throw runtime_error("Invalid MNIST image file!");
+    }
+    return file;
+}
+
 template<class T>
 Tensor4D<T> * read_mnist_images(string full_path) {
-    auto reverseInt = [](int i) {
-        unsigned char c1, c2, c3, c4;
-        c1 = i & 255, c2 = (i >> 8) & 255, c3 = (i >> 16) & 255, c4 = (i >> 24) & 255;
-        return ((int)c1 << 24) + ((int)c2 << 16) + ((int)c3 << 8) + c4;
-    };
-
-    ifstream file(full_path, ios::binary);
-
-    if(file.is_open()) {
-        int magic_number = 0, number_of_images = 0, n_rows = 0, n_cols = 0;
-
-        file.read((char *)&magic_number, sizeof(magic_number));
-        magic_number = reverseInt(magic_number);
-
-        if(magic_number != 2051) throw runtime_error("Invalid MNIST image file!");
-
-        file.read((char *)&number_of_images, sizeof(number_of_images)), number_of_images = reverseInt(number_of_images);
-        file.read((char *)&n_rows, sizeof(n_rows)), n_rows = reverseInt(n_rows);
-        file.read((char *)&n_cols, sizeof(n_cols)), n_cols = reverseInt(n_cols);
-
-        int image_size = n_rows * n_cols;
-
-        Shape4D data_shape(number_of_images, 1, n_rows, n_cols);
-        Tensor4D<T> * _dataset = new Tensor4D<T>(data_shape);
-
-        for(int i = 0; i < number_of_images; i++) {
-            uchar *__row = new uchar[image_size];
-            file.read((char *)__row, image_size);
-
-            for(int r = 0; r < image_size; r++) {
-                _dataset->iat(i*image_size + r) = __row[r];
-            } 
-            delete[] __row;
-        }
-        return _dataset;
-    } else {
-        throw runtime_error("Cannot open file `" + full_path + "`!");
-    }
+    unique_ptr<Neural::IdxFile> file(map_mnist_images(full_path));
+    return new Tensor4D<T>(file->data(), file->shape());
 }
 
 template Tensor4D<double> *read_mnist_images(string full_path);
@@ -113,47 +87,26 @@ Tensor4D<int> * read_mnist_labels(string full_path) {
     }
 }
 
-/// @brief 
-/// @tparam T datatype of dataset (double, float)
+/// @brief Splits the dataset into train and valid parts without copying
+/// @tparam T datatype of dataset (double, float, uint8_t)
 /// @param original_data dataset
 /// @param original_labels labels in 1-hot encoding
 /// @param percentile percentage of dataset to be designated as valid
-/// @return 
+/// @return train and valid tensors borrowing original_data/original_labels, which must outlive them
 template<class T>
 vector<LabeledData<T>> split_dataset(Tensor4D<T> * original_data , Tensor4D<int> *original_labels, float percentile) {
     LOGI << "split_dataset";  
     Shape4D data_shape = original_data->shape(), labels_shape = original_labels->shape();
-    int B = data_shape[0], C = data_shape[1], H = data_shape[2], W = data_shape[3], M = labels_shape[1];
+    int B = data_shape[0];
     
     assert(B==labels_shape[0]);
 
-    int CHW = C*H*W;
     int B_train = (1-percentile)*B;
     int B_valid = B - B_train;
     LOGI.printf("B: %d, B_train: %d, B_valid: %d", B, B_train, B_valid);
 
-    Tensor4D<T> *train_data = new Tensor4D<T>(B_train, C, H, W), *valid_data = new Tensor4D<T>(B_valid, C, H, W);
-    Tensor4D<int> *train_labels = new Tensor4D<int>(B_train, M, 1, 1), *valid_labels = new Tensor4D<int>(B_valid, M, 1, 1);
-
-    LOGI << "Populating train_data";
-    for(int i = 0; i < B_train; i++) {
-        for(int j = 0; j < CHW; j++) {
-            train_data->iat(i*CHW + j) = original_data->iat(i*CHW + j);
-        }
-        for(int j = 0; j < M; j++) {
-            train_labels->iat(i*M + j) = original_labels->iat(i*M + j);
-        }
-    }
-    
-    LOGI << "Populating valid_data";
-    for(int i = 0; i < B_valid; i++) {
-        for(int j = 0; j < CHW; j++) {
-            valid_data->iat(i*CHW + j) = original_data->iat((i + B_train)*CHW + j);
-        }
-        for(int j = 0; j < M; j++) {
-            valid_labels->iat(i*M + j) = original_labels->iat((i + B_train)*M + j);
-        }
-    }
+    Tensor4D<T> *train_data = new Tensor4D<T>(original_data->view().slice(0, B_train)), *valid_data = new Tensor4D<T>(original_data->view().slice(B_train, B_valid));
+    Tensor4D<int> *train_labels = new Tensor4D<int>(original_labels->view().slice(0, B_train)), *valid_labels = new Tensor4D<int>(original_labels->view().slice(B_train, B_valid));
 
     LOGV << "/split_data";
     return vector<LabeledData<T>>{LabeledData<T>(train_data, train_labels), LabeledData<T>(valid_data, valid_labels)};
@@ -162,4 +115,5 @@ vector<LabeledData<T>> split_dataset(Tensor4D<T> * original_data , Tensor4D<int>
 
 template vector<LabeledData<double>> split_dataset<double>(Tensor4D<double> *, Tensor4D<int> *,  float );
 template vector<LabeledData<float>> split_dataset<float>(Tensor4D<float> *, Tensor4D<int> *,  float );
+template vector<LabeledData<uint8_t>> split_dataset<uint8_t>(Tensor4D<uint8_t> *, Tensor4D<int> *,  float );
 
@@ -3,9 +3,12 @@
 
 #include <vector>
 #include "tensor.hpp"
+#include "idx.hpp"
 
 #define DEPSILON 0.5E-15
 
+// the images as their uint8 pixels in a read-only mapping of the file, converted per batch by Network::train/eval
+Neural::IdxFile *map_mnist_images(std::string);
 template <class T> Neural::Tensor4D<T> *read_mnist_images(std::string);
 Neural::Tensor4D<int> *read_mnist_labels(std::string);
 template<class T> std::vector<Neural::LabeledData<T>> split_dataset(Neural::Tensor4D<T> *  , Neural::Tensor4D<int> *, float );
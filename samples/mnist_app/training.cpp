@@ -1,4 +1,5 @@
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <iomanip>
 #include <stdexcept>
@@ -15,6 +16,10 @@
 #include "network.hpp"
 #include "layer.hpp"
 #include "mnist.hpp"
+#include "isa.hpp"
+#include "parallel.hpp"
+#include "quantize.hpp"
+#include "idx.hpp"
 #include <plog/Initializers/RollingFileInitializer.h>
 #include <plog/Formatters/TxtFormatter.h>
 #include <plog/Appenders/ColorConsoleAppender.h>
@@ -26,70 +31,35 @@ using Neural::LabeledData;
 using Neural::Network;
 using namespace std;
 
-vector<Neural::LabeledData<double>> read_mnist_data() {
+// The images stay uint8 in read-only mappings of the IDX files, converted to T one batch at a time by
+// Network::train/eval. train/valid/test borrow the mappings and original_labels, the caller keeps them alive
+vector<Neural::LabeledData<uint8_t>> read_mnist_data(unique_ptr<Neural::IdxFile> &train_file, unique_ptr<Neural::IdxFile> &test_file, unique_ptr<Tensor4D<uint8_t>> &original_data, unique_ptr<Tensor4D<int>> &original_labels) {
     // Load the data
-    LOGI << "Reading mnist data new";
-    Tensor4D<double> * original_data = read_mnist_images<double>("data/train-images-idx3-ubyte");
+    LOGI << "Mapping mnist data";
+    train_file.reset(map_mnist_images("data/train-images-idx3-ubyte"));
+    original_data.reset(new Tensor4D<uint8_t>(train_file->view()));
     
     LOGI << "Reading mnist labels";
-    Tensor4D<int>* original_labels = read_mnist_labels("data/train-labels-idx1-ubyte");
+    original_labels.reset(read_mnist_labels("data/train-labels-idx1-ubyte"));
 
     LOGI << "Spliting dataset";
-    vector<LabeledData<double>> train_valid_test = split_dataset(original_data, original_labels, 0.2);
+    vector<LabeledData<uint8_t>> train_valid_test = split_dataset(original_data.get(), original_labels.get(), 0.2);
 
-    LOGI << "Deleting original_data";
-    delete original_data;
-
-    LOGI << "Deleting original_labels";
-    delete original_labels;
-
-    LOGI << "Reading test_data, test_labels";
-    LabeledData<double> test_data_labeled(read_mnist_images<double>("data/t10k-images-idx3-ubyte"), read_mnist_labels("data/t10k-labels-idx1-ubyte"));
+    LOGI << "Mapping test_data, reading test_labels";
+    test_file.reset(map_mnist_images("data/t10k-images-idx3-ubyte"));
+    LabeledData<uint8_t> test_data_labeled(new Tensor4D<uint8_t>(test_file->view()), read_mnist_labels("data/t10k-labels-idx1-ubyte"));
 
     train_valid_test.push_back(test_data_labeled);
 
     return train_valid_test;
 }
 
-int main(int argc, char *argv[]) {
-    printf("Hello World Classes training all while new\n");
-    cout << "__FILE__ = " << __FILE__ << endl;
-    cout << "logging_level = atoi(argv[1])" << endl;
-    string logging_level_str = argv[1];
-    plog::Severity logging_level;
-
-    /*
-        enum Severity {
-            none = 0,
-            fatal = 1,
-            error = 2,
-            warning = 3,
-            info = 4,
-            debug = 5,
-            verbose = 6
-        }
-    */
-
-    if(logging_level_str == "fatal") logging_level = plog::fatal;
-    else if(logging_level_str == "error") logging_level = plog::error;
-    else if(logging_level_str == "warning") logging_level = plog::warning;
-    else if(logging_level_str == "info") logging_level = plog::info;
-    else if(logging_level_str == "debug") logging_level = plog::debug;
-    else if(logging_level_str == "verbose") logging_level = plog::verbose;
-    else if(logging_level_str == "none") logging_level = plog::none;
-    else {
-        throw(std::invalid_argument("Logging level invalid"));
-    }
-    cout << "Init plog" << endl;
-    plog::ColorConsoleAppender<plog::MyFormatter> consoleAppender;
-    plog::init(logging_level, &consoleAppender ); // Initialize logging to the file.
-    
-    LOGI << "Neural::get_device_type(gpu=4, host=2): " << Neural::get_device_type();
-
-    // // cout << type_name<decltype(std::function{acc_deviceptr})>() << endl;
-    // // cout << type_name<decltype(std::function{Neural::deviceptr})>() << endl;
-
-    unique_ptr<Tensor4D<double>> train_data, valid_data, test_data;
+template<class T>
+int train_mnist(int argc, char *argv[], string storage) {
+    unique_ptr<Neural::IdxFile> train_file, test_file;
+    unique_ptr<Tensor4D<uint8_t>> original_data;
+    unique_ptr<Tensor4D<int>> original_labels;
+    unique_ptr<Tensor4D<uint8_t>> train_data, valid_data, test_data;
     unique_ptr<Tensor4D<int>> train_labels, valid_labels, test_labels;
 
     vector<int> filter_size_conv1, filter_size_conv2, stride_conv1, stride_conv2;
@@ -97,7 +67,7 @@ int main(int argc, char *argv[]) {
     string padding_conv1, padding_conv2;
 
     PLOGI << "calling read_mnist_data()";
-    auto mnist_data = read_mnist_data();
+    auto mnist_data = read_mnist_data(train_file, test_file, original_data, original_labels);
     train_data.reset(mnist_data[0].get_data());
     train_labels.reset(mnist_data[0].get_labels());
     valid_data.reset(mnist_data[1].get_data());
@@ -108,13 +78,13 @@ int main(int argc, char *argv[]) {
     Shape4D train_data_shape = train_data->shape();
     int B = train_data_shape[0], C = train_data_shape[1], H = train_data_shape[2], W = train_data_shape[3];
 
-    double *train_data_data = train_data->data();
+    uint8_t *train_data_data = train_data->data();
     PLOGD << "train_data[1]";
     for(int b = 0; b < 1; b++) {
         for(int c = 0; c < C; c++) {
             for(int h = 0; h < H; h++) {
                 for(int w = 0; w < W; w++) {
-                    PLOGD << train_data_data[b*C*H*W + c *H*W + h*W + w];
+                    PLOGD << (int)train_data_data[b*C*H*W + c *H*W + h*W + w];
                 }
             }
         }
@@ -132,19 +102,37 @@ int main(int argc, char *argv[]) {
     num_outputs = 10;
 //TODO find solution to data locality, relative? cmd argument ?, work only by running inside app folder?
 
-    Network testnet(train_data->shape()); //destructor?
+    Network<T> testnet(train_data->shape()); //destructor?
+    testnet.set_storage(storage);
+    // NEURAL_LAYOUT: "nchw" (default) or "nhwc", the activation layout of every layer
+    const char *layout = getenv("NEURAL_LAYOUT");
+    if(layout && *layout) {
+        testnet.set_layout(layout);
+    }
 
     PLOGI << "testnet.add_layer<Neural::Layers::Conv>(" << depth_conv1 << ", \"relu\", " << filter_size_conv1[0] << ", " << stride_conv1[0] << ", \"" << padding_conv1 << "\")";
-    testnet.add_layer<Neural::Layers::Conv>(depth_conv1, "relu", filter_size_conv1, stride_conv1, padding_conv1);
+    testnet.template add_layer<Neural::Layers::Conv>(depth_conv1, "relu", filter_size_conv1, stride_conv1, padding_conv1);
    
-    PLOGI << "testnet.add_layer<Neural::Layers::Conv>(" << depth_conv2 << ", \"relu\", " << filter_size_conv2[0] << ", " << stride_conv2[0] << ", \"" << padding_conv2 << "\")";
-    testnet.add_layer<Neural::Layers::Conv>(depth_conv2, "relu", filter_size_conv2, stride_conv2, padding_conv2);
-    
-    PLOGI << "testnet.add_layer<Neural::Layers::Fc>(" << num_hidden_nodes << ", \"relu\")";
-    testnet.add_layer<Neural::Layers::Fc>(num_hidden_nodes, "relu");
+    // argv[6]: "int8" quantizes the trained model, "binary" binarizes the hidden layers, the first and the output
+    // layer stay full precision
+    string mode = (argc>=7) ? argv[6] : "";
+    if(mode == "binary") {
+        PLOGI << "testnet.add_layer<Neural::Layers::BinaryConv>(" << depth_conv2 << ", \"relu\", " << filter_size_conv2[0] << ", " << stride_conv2[0] << ", \"" << padding_conv2 << "\")";
+        testnet.template add_layer<Neural::Layers::BinaryConv>(depth_conv2, "relu", filter_size_conv2, stride_conv2, padding_conv2);
+
+        PLOGI << "testnet.add_layer<Neural::Layers::BinaryFc>(" << num_hidden_nodes << ", \"relu\")";
+        testnet.template add_layer<Neural::Layers::BinaryFc>(num_hidden_nodes, "relu");
+    }
+    else {
+        PLOGI << "testnet.add_layer<Neural::Layers::Conv>(" << depth_conv2 << ", \"relu\", " << filter_size_conv2[0] << ", " << stride_conv2[0] << ", \"" << padding_conv2 << "\")";
+        testnet.template add_layer<Neural::Layers::Conv>(depth_conv2, "relu", filter_size_conv2, stride_conv2, padding_conv2);
+
+        PLOGI << "testnet.add_layer<Neural::Layers::Fc>(" << num_hidden_nodes << ", \"relu\")";
+        testnet.template add_layer<Neural::Layers::Fc>(num_hidden_nodes, "relu");
+    }
     
     PLOGI << "testnet.add_layer<Neural::Layers::Fc>(" << num_outputs << ", \"softmax\")";
-    testnet.add_layer<Neural::Layers::Fc>(num_outputs, "softmax");
+    testnet.template add_layer<Neural::Layers::Fc>(num_outputs, "softmax");
 
     int batch_size;
     PLOGI << "batch_size = atoi(argv[2])";
@@ -168,6 +156,71 @@ int main(int argc, char *argv[]) {
     LOGW << endl << endl;
     LOGW << "Precision: " << precision_test << " | Recall: " << recall_test << " | Accuracy: " << accuracy_test << " | F1_score: " << f1_score_test;
     LOGW << endl << endl;
+
+    // post-training int8 quantization, calibrated on the validation set
+    if(mode == "int8") {
+        LOGW << "Neural::Quantize::quantize(testnet, *valid_data.get(), 1000)";
+        Neural::Quantize::Int8Network int8net = Neural::Quantize::quantize(testnet, *valid_data.get(), 1000);
+        Neural::Quantize::Report report = Neural::Quantize::report(testnet, int8net, *test_data.get(), *test_labels.get());
+        LOGW << endl << endl;
+        LOGW << "int8 Precision: " << report.quantized.precision << " | Recall: " << report.quantized.recall << " | Accuracy: " << report.quantized.accuracy << " | F1_score: " << report.quantized.f1_score;
+        LOGW << "int8 Accuracy delta: " << report.quantized.accuracy - report.reference.accuracy << " | Weights: " << report.quantized_bytes << " bytes (reference " << report.reference_bytes << ")";
+        LOGW << endl << endl;
+    }
     return 0;
 }
 
+int main(int argc, char *argv[]) {
+    printf("Hello World Classes training all while new\n");
+    cout << "__FILE__ = " << __FILE__ << endl;
+    cout << "logging_level = atoi(argv[1])" << endl;
+    string logging_level_str = argv[1];
+    plog::Severity logging_level;
+
+    /*
+        enum Severity {
+            none = 0,
+            fatal = 1,
+            error = 2,
+            warning = 3,
+            info = 4,
+            debug = 5,
+            verbose = 6
+        }
+    */
+
+    if(logging_level_str == "fatal") logging_level = plog::fatal;
+    else if(logging_level_str == "error") logging_level = plog::error;
+    else if(logging_level_str == "warning") logging_level = plog::warning;
+    else if(logging_level_str == "info") logging_level = plog::info;
+    else if(logging_level_str == "debug") logging_level = plog::debug;
+    else if(logging_level_str == "verbose") logging_level = plog::verbose;
+    else if(logging_level_str == "none") logging_level = plog::none;
+    else {
+        throw(std::invalid_argument("Logging level invalid"));
+    }
+    cout << "Init plog" << endl;
+    plog::ColorConsoleAppender<plog::MyFormatter> consoleAppender;
+    plog::init(logging_level, &consoleAppender ); // Initialize logging to the file.
+    
+    LOGI << "Neural::get_device_type(gpu=4, host=2): " << Neural::get_device_type();
+    LOGI << "Neural::get_isa(): " << Neural::isa_name(Neural::get_isa()) << " (cpu: " << Neural::isa_name(Neural::cpu_isa()) << ")";
+    LOGI << "Neural::Parallel::num_threads(): " << Neural::Parallel::num_threads();
+
+    // // cout << type_name<decltype(std::function{acc_deviceptr})>() << endl;
+    // // cout << type_name<decltype(std::function{Neural::deviceptr})>() << endl;
+
+    // compute type of the whole model, argv[5]: "double" (default), "float" or "bf16" (float with bf16 storage)
+    string precision = (argc>=6) ? argv[5] : "double";
+    LOGI << "precision: " << precision;
+    if(precision == "float") {
+        return train_mnist<float>(argc, argv, "native");
+    }
+    else if(precision == "bf16") {
+        return train_mnist<float>(argc, argv, "bf16");
+    }
+    else if(precision != "double") {
+        throw(std::invalid_argument("Precision invalid"));
+    }
+    return train_mnist<double>(argc, argv, "native");
+}
@@ -0,0 +1,140 @@
+#include "autotune.hpp"
+#include "gemm.hpp"
+#include "parallel.hpp"
+#include "utils.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <mutex>
+#include <filesystem>
+
+using namespace std;
+
+namespace {
+    mutex cache_mtx;
+    map<string, Neural::Autotune::ConvPlan> plans;
+    bool loaded = false;
+
+    // the part of the key a plan is only valid for
+    string machine_key() {
+        return Neural::Autotune::cpu_model() + "\t" + Neural::Kernels::gemm_isa() + "\t" + to_string(Neural::Parallel::num_threads());
+    }
+
+    void load() {
+        loaded = true;
+        string path = Neural::Autotune::cache_path();
+        if(path.empty()) {
+            return;
+        }
+
+        ifstream in(path);
+        string line, machine = machine_key() + "\t";
+        while(getline(in, line)) {
+            if(line.compare(0, machine.size(), machine) != 0) {
+                continue;
+            }
+
+            size_t tab = line.find('\t', machine.size());
+            if(tab == string::npos) {
+                continue;
+            }
+
+            Neural::Autotune::ConvPlan plan;
+            istringstream algorithms(line.substr(tab + 1));
+            if(algorithms >> plan.forward >> plan.wgrad >> plan.dgrad) {
+                // later lines win, the file is only ever appended to
+                plans[line.substr(machine.size(), tab - machine.size())] = plan;
+            }
+        }
+        LOGD << "plan cache " << path << ": " << plans.size() << " plans for this machine";
+    }
+}
+
+string Neural::Autotune::conv_shape_key(int batch, int channels, int height, int width, int features, const vector<int> &filter_size, const vector<int> &stride, const vector<int> &padding) {
+    ostringstream key;
+    key << batch << "x" << channels << "x" << height << "x" << width << "_" << features << "x" << filter_size[0] << "x" << filter_size[1];
+    key << "_s" << stride[0] << "x" << stride[1] << "_p" << padding[0] << "." << padding[1] << "." << padding[2] << "." << padding[3];
+    return key.str();
+}
+
+bool Neural::Autotune::lookup(const string &shape_key, ConvPlan &plan) {
+    lock_guard<mutex> lock(cache_mtx);
+    if(!loaded) {
+        load();
+    }
+
+    auto it = plans.find(shape_key);
+    if(it == plans.end()) {
+        return false;
+    }
+    plan = it->second;
+    return true;
+}
+
+void Neural::Autotune::store(const string &shape_key, const ConvPlan &plan) {
+    lock_guard<mutex> lock(cache_mtx);
+    if(!loaded) {
+        load();
+    }
+    plans[shape_key] = plan;
+
+    string path = cache_path();
+    if(path.empty()) {
+        return;
+    }
+
+    error_code ec;
+    filesystem::path parent = filesystem::path(path).parent_path();
+    if(!parent.empty()) {
+        filesystem::create_directories(parent, ec);
+    }
+
+    ofstream out(path, ios::app);
+    if(!out) {
+        LOGW << "plan cache " << path << " not writable, the plan is kept for this run only";
+        return;
+    }
+    out << machine_key() << "\t" << shape_key << "\t" << plan.forward << " " << plan.wgrad << " " << plan.dgrad << "\n";
+}
+
+const string &Neural::Autotune::cpu_model() {
+    static const string model = [] {
+        ifstream cpuinfo("/proc/cpuinfo");
+        string line;
+        while(getline(cpuinfo, line)) {
+            if(line.compare(0, 10, "model name") == 0) {
+                size_t colon = line.find(':');
+                if(colon != string::npos && colon + 2 <= line.size()) {
+                    string name = line.substr(colon + 2);
+                    for(char &c: name) {
+                        if(c == '\t') {
+                            c = ' ';
+                        }
+                    }
+                    return name;
+                }
+            }
+        }
+        return string("unknown");
+    }();
+    return model;
+}
+
+string Neural::Autotune::cache_path() {
+    const char *env = getenv("NEURAL_PLAN_CACHE");
+    if(env) {
+        return env;
+    }
+
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    if(xdg && *xdg) {
+        return string(xdg) + "/neural/conv_plans";
+    }
+
+    const char *home = getenv("HOME");
+    if(home && *home) {
+        return string(home) + "/.cache/neural/conv_plans";
+    }
+    return "";
+}
@@ -0,0 +1,463 @@
+#include "backend.hpp"
+#include "ops.hpp"
+#include "utils.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+using Neural::Backend;
+using Neural::Tensor4D;
+using Neural::Shape4D;
+
+namespace {
+    // loop nests of the openmp (PARALLEL) and reference backends, host memory only
+
+    template<class T, bool PARALLEL>
+    void loop_matrix_multiply(const Tensor4D<T> &A, const Tensor4D<T> &B, Tensor4D<T> *C, bool transA, bool transB, const Neural::Kernels::Epilogue<T> &epilogue) {
+        Shape4D a_shape_flat = A.shape().flat(1), b_shape = B.shape();
+        int lda = a_shape_flat[1], ldb = b_shape[1];
+        int N = transA ? a_shape_flat[1] : a_shape_flat[0], K = transA ? a_shape_flat[0] : a_shape_flat[1];
+        int M = transB ? b_shape[0] : b_shape[1];
+
+        if(K != (transB ? b_shape[1] : b_shape[0]) || N != C->shape()[0] || M != C->shape()[1]) {
+            throw(std::invalid_argument("Error: matrix_multiply shapes not compatible"));
+        }
+
+        int rsa = transA ? 1 : lda, csa = transA ? lda : 1, rsb = transB ? 1 : ldb, csb = transB ? ldb : 1;
+        const T *a_data = A.data(), *b_data = B.data();
+        T *c_data = C->data();
+
+        #pragma omp parallel for collapse(2) schedule(static) if(PARALLEL)
+        for(int i = 0; i < N; i++) {
+            for(int j = 0; j < M; j++) {
+                T csum = 0;
+                for(int t = 0; t < K; t++) {
+                    csum += a_data[i*rsa + t*csa] * b_data[t*rsb + j*csb];
+                }
+                c_data[i*M + j] = Neural::Kernels::apply_epilogue(epilogue, csum, i, j);
+            }
+        }
+    }
+
+    template<class T, bool PARALLEL>
+    void loop_convolution2D(const Tensor4D<T> &input, const Tensor4D<T> &filters, Tensor4D<T> *output, const vector<int> &stride, const vector<int> &padding, const Neural::Kernels::Epilogue<T> &epilogue) {
+        Shape4D in_shape = input.shape(), filter_shape = filters.shape(), out_shape = output->shape();
+        int batch = in_shape[0], in_channels = in_shape[1], in_rows = in_shape[2], in_cols = in_shape[3];
+        int out_channels = filter_shape[0], out_rows = out_shape[2], out_cols = out_shape[3];
+        int filter_height = filter_shape[2], filter_width = filter_shape[3];
+        int stride_r = stride[0], stride_c = stride[1], padding_top = padding[0], padding_left = padding[2];
+
+        if(in_channels != filter_shape[1] || out_channels != out_shape[1] || batch != out_shape[0]) {
+            throw(std::invalid_argument("Error: convolution2D shapes not compatible"));
+        }
+
+        // indexed through Tensor4D::at, any layout of the activations
+        const T *filter_data = filters.data();
+
+        #pragma omp parallel for collapse(3) schedule(static) if(PARALLEL)
+        for(int b = 0; b < batch; b++) {
+            for(int oc = 0; oc < out_channels; oc++) {
+                for(int oh = 0; oh < out_rows; oh++) {
+                    for(int ow = 0; ow < out_cols; ow++) {
+                        T sum = 0;
+                        for(int ic = 0; ic < in_channels; ic++) {
+                            for(int fi = 0; fi < filter_height; fi++) {
+                                for(int fj = 0; fj < filter_width; fj++) {
+                                    int ih = oh*stride_r + fi - padding_top, iw = ow*stride_c + fj - padding_left;
+                                    if(ih < 0 || ih >= in_rows || iw < 0 || iw >= in_cols) {
+                                        continue;
+                                    }
+                                    sum += input.at(b, ic, ih, iw) * filter_data[((oc*in_channels + ic)*filter_height + fi)*filter_width + fj];
+                                }
+                            }
+                        }
+                        output->at(b, oc, oh, ow) = Neural::Kernels::apply_epilogue(epilogue, sum, oc, 0);
+                    }
+                }
+            }
+        }
+    }
+
+    template<class T, bool PARALLEL>
+    void loop_convolution2D_wgrad(const Tensor4D<T> &input, const Tensor4D<T> &drv_error_output, Tensor4D<T> *drv_error_filters, Tensor4D<T> *drv_error_biases, const vector<int> &stride, const vector<int> &padding, T scale) {
+        Shape4D in_shape = input.shape(), out_shape = drv_error_output.shape(), filter_shape = drv_error_filters->shape();
+        int batch = in_shape[0], in_channels = in_shape[1], in_rows = in_shape[2], in_cols = in_shape[3];
+        int out_channels = out_shape[1], out_rows = out_shape[2], out_cols = out_shape[3];
+        int filter_height = filter_shape[2], filter_width = filter_shape[3];
+        int stride_r = stride[0], stride_c = stride[1], padding_top = padding[0], padding_left = padding[2];
+
+        if(in_channels != filter_shape[1] || out_channels != filter_shape[0] || out_channels != drv_error_biases->shape()[1] || batch != out_shape[0]) {
+            throw(std::invalid_argument("Error: convolution2D_wgrad shapes not compatible"));
+        }
+
+        T *dw_data = drv_error_filters->data(), *db_data = drv_error_biases->data();
+
+        #pragma omp parallel for schedule(static) if(PARALLEL)
+        for(int oc = 0; oc < out_channels; oc++) {
+            T bsum = 0;
+            for(int b = 0; b < batch; b++) {
+                for(int oh = 0; oh < out_rows; oh++) {
+                    for(int ow = 0; ow < out_cols; ow++) {
+                        bsum += drv_error_output.at(b, oc, oh, ow);
+                    }
+                }
+            }
+            db_data[oc] = scale * bsum;
+
+            for(int ic = 0; ic < in_channels; ic++) {
+                for(int fi = 0; fi < filter_height; fi++) {
+                    for(int fj = 0; fj < filter_width; fj++) {
+                        T wsum = 0;
+                        for(int b = 0; b < batch; b++) {
+                            for(int oh = 0; oh < out_rows; oh++) {
+                                for(int ow = 0; ow < out_cols; ow++) {
+                                    int ih = oh*stride_r + fi - padding_top, iw = ow*stride_c + fj - padding_left;
+                                    if(ih < 0 || ih >= in_rows || iw < 0 || iw >= in_cols) {
+                                        continue;
+                                    }
+                                    wsum += input.at(b, ic, ih, iw) * drv_error_output.at(b, oc, oh, ow);
+                                }
+                            }
+                        }
+                        dw_data[((oc*in_channels + ic)*filter_height + fi)*filter_width + fj] = scale * wsum;
+                    }
+                }
+            }
+        }
+    }
+
+    template<class T, bool PARALLEL>
+    void loop_convolution2D_dgrad(const Tensor4D<T> &drv_error_output, const Tensor4D<T> &filters, Tensor4D<T> *drv_error_input, const vector<int> &stride, const vector<int> &padding) {
+        Shape4D out_shape = drv_error_output.shape(), filter_shape = filters.shape(), in_shape = drv_error_input->shape();
+        int batch = in_shape[0], in_channels = in_shape[1], in_rows = in_shape[2], in_cols = in_shape[3];
+        int out_channels = out_shape[1], out_rows = out_shape[2], out_cols = out_shape[3];
+        int filter_height = filter_shape[2], filter_width = filter_shape[3];
+        int stride_r = stride[0], stride_c = stride[1], padding_top = padding[0], padding_left = padding[2];
+
+        if(in_channels != filter_shape[1] || out_channels != filter_shape[0] || batch != out_shape[0]) {
+            throw(std::invalid_argument("Error: convolution2D_dgrad shapes not compatible"));
+        }
+
+        const T *filter_data = filters.data();
+
+        // scatters every output error back over the inputs its window read, one input plane per iteration
+        #pragma omp parallel for collapse(2) schedule(static) if(PARALLEL)
+        for(int b = 0; b < batch; b++) {
+            for(int ic = 0; ic < in_channels; ic++) {
+                for(int ih = 0; ih < in_rows; ih++) {
+                    for(int iw = 0; iw < in_cols; iw++) {
+                        drv_error_input->at(b, ic, ih, iw) = 0;
+                    }
+                }
+
+                for(int oc = 0; oc < out_channels; oc++) {
+                    for(int oh = 0; oh < out_rows; oh++) {
+                        for(int ow = 0; ow < out_cols; ow++) {
+                            T dout = drv_error_output.at(b, oc, oh, ow);
+                            for(int fi = 0; fi < filter_height; fi++) {
+                                for(int fj = 0; fj < filter_width; fj++) {
+                                    int ih = oh*stride_r + fi - padding_top, iw = ow*stride_c + fj - padding_left;
+                                    if(ih < 0 || ih >= in_rows || iw < 0 || iw >= in_cols) {
+                                        continue;
+                                    }
+                                    drv_error_input->at(b, ic, ih, iw) += dout * filter_data[((oc*in_channels + ic)*filter_height + fi)*filter_width + fj];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    template<class T, bool PARALLEL>
+    void loop_relu(const Tensor4D<T> &input, Tensor4D<T> *output) {
+        int size = input.size();
+        const T *in_data = input.data();
+        T *out_data = output->data();
+
+        #pragma omp parallel for schedule(static) if(PARALLEL)
+        for(int i = 0; i < size; i++) {
+            out_data[i] = (in_data[i] > 0) ? in_data[i] : (T)0;
+        }
+    }
+
+    template<class T, bool PARALLEL>
+    void loop_relu_backprop(const Tensor4D<T> &drv_error_output, const Tensor4D<T> &output, Tensor4D<T> *drv_error_output_preact) {
+        int size = output.size();
+        const T *dout_data = drv_error_output.data(), *out_data = output.data();
+        T *dpre_data = drv_error_output_preact->data();
+
+        #pragma omp parallel for schedule(static) if(PARALLEL)
+        for(int i = 0; i < size; i++) {
+            dpre_data[i] = (out_data[i] > 0) ? dout_data[i] : (T)0;
+        }
+    }
+
+    template<class T, bool PARALLEL>
+    void loop_sigmoid(const Tensor4D<T> &input, Tensor4D<T> *output) {
+        int size = input.size();
+        const T *in_data = input.data();
+        T *out_data = output->data();
+
+        #pragma omp parallel for schedule(static) if(PARALLEL)
+        for(int i = 0; i < size; i++) {
+            out_data[i] = (T)1 / ((T)1 + std::exp(-in_data[i]));
+        }
+    }
+
+    template<class T, bool PARALLEL>
+    void loop_sigmoid_backprop(const Tensor4D<T> &drv_error_output, const Tensor4D<T> &output, Tensor4D<T> *drv_error_output_preact) {
+        int size = output.size();
+        const T *dout_data = drv_error_output.data(), *out_data = output.data();
+        T *dpre_data = drv_error_output_preact->data();
+
+        #pragma omp parallel for schedule(static) if(PARALLEL)
+        for(int i = 0; i < size; i++) {
+            dpre_data[i] = dout_data[i] * out_data[i] * (1 - out_data[i]);
+        }
+    }
+
+    template<class T, bool PARALLEL>
+    void loop_softmax(const Tensor4D<T> &input, Tensor4D<T> *output) {
+        Shape4D flat = input.shape().flat(1);
+        int B = flat[0], M = flat[1];
+        const T *in_data = input.data();
+        T *out_data = output->data();
+
+        #pragma omp parallel for schedule(static) if(PARALLEL)
+        for(int i = 0; i < B; i++) {
+            T inmax = in_data[i*M];
+            for(int j = 1; j < M; j++) {
+                inmax = std::fmax(inmax, in_data[i*M + j]);
+            }
+
+            T outsum = 0;
+            for(int j = 0; j < M; j++) {
+                out_data[i*M + j] = std::exp(in_data[i*M + j] - inmax);
+                outsum += out_data[i*M + j];
+            }
+            for(int j = 0; j < M; j++) {
+                out_data[i*M + j] /= outsum;
+            }
+        }
+    }
+
+    template<class T, bool PARALLEL>
+    void loop_softmax_backprop(const Tensor4D<T> &drv_error_output, const Tensor4D<T> &output, Tensor4D<T> *drv_error_output_preact) {
+        Shape4D flat = output.shape().flat(1);
+        int B = flat[0], M = flat[1];
+        const T *dout_data = drv_error_output.data(), *out_data = output.data();
+        T *dpre_data = drv_error_output_preact->data();
+
+        #pragma omp parallel for schedule(static) if(PARALLEL)
+        for(int i = 0; i < B; i++) {
+            T dot = 0;
+            for(int k = 0; k < M; k++) {
+                dot += dout_data[i*M + k] * out_data[i*M + k];
+            }
+            for(int j = 0; j < M; j++) {
+                dpre_data[i*M + j] = out_data[i*M + j] * (dout_data[i*M + j] - dot);
+            }
+        }
+    }
+
+    template<class T, bool PARALLEL>
+    T loop_softmax_cross_entropy(const Tensor4D<T> &logits, const Tensor4D<int> &labels, Tensor4D<T> *output, Tensor4D<T> *drv_error_logits) {
+        Shape4D flat = logits.shape().flat(1);
+        int B = flat[0], M = flat[1];
+        const T *z_data = logits.data();
+        const int *labels_data = labels.data();
+        T *out_data = output->data(), *drv_data = drv_error_logits->data();
+        T loss_value = 0;
+
+        #pragma omp parallel for reduction(+:loss_value) schedule(static) if(PARALLEL)
+        for(int i = 0; i < B; i++) {
+            T zmax = z_data[i*M];
+            for(int j = 1; j < M; j++) {
+                zmax = std::fmax(zmax, z_data[i*M + j]);
+            }
+
+            T expsum = 0;
+            for(int j = 0; j < M; j++) {
+                out_data[i*M + j] = std::exp(z_data[i*M + j] - zmax);
+                expsum += out_data[i*M + j];
+            }
+
+            T lse = zmax + std::log(expsum);
+            for(int j = 0; j < M; j++) {
+                T lbl = (T)labels_data[i*M + j];
+                out_data[i*M + j] /= expsum;
+                drv_data[i*M + j] = out_data[i*M + j] - lbl;
+                loss_value += lbl * (lse - z_data[i*M + j]);
+            }
+        }
+
+        return loss_value / B;
+    }
+
+    template<class T, bool PARALLEL>
+    void loop_add(Tensor4D<T> *a, const Tensor4D<T> &b) {
+        int size = a->size();
+        T *a_data = a->data();
+        const T *b_data = b.data();
+
+        #pragma omp parallel for schedule(static) if(PARALLEL)
+        for(int i = 0; i < size; i++) {
+            a_data[i] += b_data[i];
+        }
+    }
+
+    template<class T, bool PARALLEL>
+    void loop_mltp(Tensor4D<T> *a, T mltp) {
+        int size = a->size();
+        T *a_data = a->data();
+
+        #pragma omp parallel for schedule(static) if(PARALLEL)
+        for(int i = 0; i < size; i++) {
+            a_data[i] *= mltp;
+        }
+    }
+
+    template<class T, bool PARALLEL>
+    void loop_accumulate(const Tensor4D<T> &a, Tensor4D<T> *b) {
+        Shape4D a_shape = a.shape();
+        int B = a_shape[0], M = a_shape[1], H = a_shape[2], W = a_shape[3];
+        T *b_data = b->data();
+
+        #pragma omp parallel for schedule(static) if(PARALLEL)
+        for(int j = 0; j < M; j++) {
+            T sum = 0;
+            for(int i = 0; i < B; i++) {
+                for(int k = 0; k < H; k++) {
+                    for(int l = 0; l < W; l++) {
+                        sum += a.at(i, j, k, l);
+                    }
+                }
+            }
+            b_data[j] = sum;
+        }
+    }
+
+    template<class T, bool PARALLEL>
+    Backend<T> loop_backend(const string &name) {
+        Backend<T> backend;
+        backend.name = name;
+        backend.matrix_multiply = loop_matrix_multiply<T, PARALLEL>;
+        backend.convolution2D = loop_convolution2D<T, PARALLEL>;
+        backend.convolution2D_wgrad = loop_convolution2D_wgrad<T, PARALLEL>;
+        backend.convolution2D_dgrad = loop_convolution2D_dgrad<T, PARALLEL>;
+        backend.relu = loop_relu<T, PARALLEL>;
+        backend.relu_backprop = loop_relu_backprop<T, PARALLEL>;
+        backend.sigmoid = loop_sigmoid<T, PARALLEL>;
+        backend.sigmoid_backprop = loop_sigmoid_backprop<T, PARALLEL>;
+        backend.softmax = loop_softmax<T, PARALLEL>;
+        backend.softmax_backprop = loop_softmax_backprop<T, PARALLEL>;
+        backend.softmax_cross_entropy = loop_softmax_cross_entropy<T, PARALLEL>;
+        backend.add = loop_add<T, PARALLEL>;
+        backend.mltp = loop_mltp<T, PARALLEL>;
+        backend.accumulate = loop_accumulate<T, PARALLEL>;
+        return backend;
+    }
+
+    template<class T>
+    Backend<T> simd_backend() {
+        Backend<T> backend;
+        backend.name = "simd";
+        backend.matrix_multiply = acc_matrix_multiply<T>;
+        backend.convolution2D = acc_convolution2D<T>;
+        backend.convolution2D_wgrad = acc_convolution2D_wgrad<T>;
+        backend.convolution2D_dgrad = acc_convolution2D_dgrad<T>;
+        backend.relu = acc_relu<T>;
+        backend.relu_backprop = acc_relu_backprop<T>;
+        backend.sigmoid = acc_sigmoid<T>;
+        backend.sigmoid_backprop = acc_sigmoid_backprop<T>;
+        backend.softmax = acc_softmax<T>;
+        backend.softmax_backprop = acc_softmax_backprop<T>;
+        backend.softmax_cross_entropy = acc_softmax_cross_entropy<T>;
+        backend.add = acc_add<T>;
+        backend.mltp = acc_mltp<T>;
+        backend.accumulate = acc_accumulate<T>;
+        return backend;
+    }
+
+    template<class T>
+    Backend<T> named_backend(const string &name) {
+        if(name == "simd") {
+            return simd_backend<T>();
+        }
+
+        if(name != "openmp" && name != "reference") {
+            throw(std::invalid_argument("Backend not supported: " + name));
+        }
+        if(Neural::get_device_type() == Neural::device_type_gpu) {
+            throw(std::invalid_argument("Backend " + name + " runs on the host only"));
+        }
+#ifndef _OPENMP
+        if(name == "openmp") {
+            LOGW << "backend openmp: the library is built without OpenMP, its loops run serially";
+        }
+#endif
+        return (name == "openmp") ? loop_backend<T, true>(name) : loop_backend<T, false>(name);
+    }
+
+    template<class T>
+    bool override_op(Backend<T> &backend, const string &op, const Backend<T> &from) {
+        if(op == "matrix_multiply") backend.matrix_multiply = from.matrix_multiply;
+        else if(op == "convolution2D") backend.convolution2D = from.convolution2D;
+        else if(op == "convolution2D_wgrad") backend.convolution2D_wgrad = from.convolution2D_wgrad;
+        else if(op == "convolution2D_dgrad") backend.convolution2D_dgrad = from.convolution2D_dgrad;
+        else if(op == "relu") backend.relu = from.relu;
+        else if(op == "relu_backprop") backend.relu_backprop = from.relu_backprop;
+        else if(op == "sigmoid") backend.sigmoid = from.sigmoid;
+        else if(op == "sigmoid_backprop") backend.sigmoid_backprop = from.sigmoid_backprop;
+        else if(op == "softmax") backend.softmax = from.softmax;
+        else if(op == "softmax_backprop") backend.softmax_backprop = from.softmax_backprop;
+        else if(op == "softmax_cross_entropy") backend.softmax_cross_entropy = from.softmax_cross_entropy;
+        else if(op == "add") backend.add = from.add;
+        else if(op == "mltp") backend.mltp = from.mltp;
+        else if(op == "accumulate") backend.accumulate = from.accumulate;
+        else return false;
+        return true;
+    }
+}
+
+template<class T>
+shared_ptr<const Backend<T>> Neural::make_backend(const string &spec) {
+    istringstream parts(spec);
+    string part;
+    getline(parts, part, ',');
+
+    Backend<T> backend = named_backend<T>(part);
+    while(getline(parts, part, ',')) {
+        size_t eq = part.find('=');
+        if(eq == string::npos || !override_op(backend, part.substr(0, eq), named_backend<T>(part.substr(eq + 1)))) {
+            throw(std::invalid_argument("Backend override not supported: " + part));
+        }
+    }
+    backend.name = spec;
+
+    LOGD << "make_backend " << spec;
+    return make_shared<const Backend<T>>(backend);
+}
+
+template shared_ptr<const Backend<double>> Neural::make_backend<double>(const string &);
+template shared_ptr<const Backend<float>> Neural::make_backend<float>(const string &);
+
+template<class T>
+shared_ptr<const Backend<T>> Neural::default_backend() {
+    static const shared_ptr<const Backend<T>> backend = [] {
+        const char *env = getenv("NEURAL_BACKEND");
+        return make_backend<T>((env && *env) ? env : "simd");
+    }();
+    return backend;
+}
+
+template shared_ptr<const Backend<double>> Neural::default_backend<double>();
+template shared_ptr<const Backend<float>> Neural::default_backend<float>();
+
+vector<string> Neural::backend_names() {
+    return {"simd", "openmp", "reference"};
+}
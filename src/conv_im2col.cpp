@@ -0,0 +1,449 @@
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include "ops.hpp"
+#include "tensor.hpp"
+#include "gemm.hpp"
+#include "parallel.hpp"
+#include "pool.hpp"
+
+using Neural::Tensor4D;
+using Neural::Shape4D;
+
+using namespace std;
+
+// Convolutions lowered to GEMM on the host. Per image the input is unrolled into
+// col[C*FH*FW x OH*OW], so that
+//   forward: out[OC x OH*OW]  = filters[OC x C*FH*FW] * col
+//   wgrad:   dfilters        += dout[OC x OH*OW] * col^T
+//   dgrad:   dcol            = filters^T * dout, scattered back into the input by col2im
+// The input is never padded in memory, im2col writes zeros for taps on the padding border
+// and col2im drops them.
+// Channels-last (nhwc) tensors unroll into patches[OH*OW x FH*FW*C] instead, each tap a contiguous run of C
+// channels, against the filters repacked OHWI[OC x FH*FW*C]:
+//   forward: out[OH*OW x OC]   = patches * filters^T
+//   wgrad:   dfilters         += dout^T * patches
+//   dgrad:   dpatches          = dout * filters
+// The filters side of the forward and dgrad gemms can come packed ahead (acc_pack_im2col_filters), the layers keep
+// them packed per weights version so that the per-image gemms only pack the image side.
+namespace {
+    struct ConvDims {
+        int batch, in_channels, in_rows, in_cols;
+        int out_channels, out_rows, out_cols;
+        int filter_height, filter_width, stride_r, stride_c;
+        int padding_top, padding_left;
+
+        int in_size() const { return in_channels * in_rows * in_cols; }
+        int out_size() const { return out_channels * out_rows * out_cols; }
+        int ckk() const { return in_channels * filter_height * filter_width; }
+        int ohw() const { return out_rows * out_cols; }
+        // 1x1 filters with unit stride need no unrolling, the image already is col
+        bool is_pointwise() const { return filter_height == 1 && filter_width == 1 && stride_r == 1 && stride_c == 1 && padding_top == 0 && padding_left == 0; }
+
+        // output columns [ow_begin, ow_end) read tap fj inside the unpadded row
+        int ow_begin(int fj) const { int x = padding_left - fj; return (x <= 0) ? 0 : min(out_cols, (x + stride_c - 1) / stride_c); }
+        int ow_end(int fj) const { int x = in_cols + padding_left - fj; return (x <= 0) ? 0 : min(out_cols, (x + stride_c - 1) / stride_c); }
+    };
+
+    // OIHW <-> OHWI, the filter order of the channels-last patches
+    template<class T>
+    void filters_to_ohwi(const T *oihw, const ConvDims &d, T *ohwi) {
+        int kk = d.filter_height*d.filter_width;
+        for(int o = 0; o < d.out_channels; o++) {
+            for(int c = 0; c < d.in_channels; c++) {
+                for(int k = 0; k < kk; k++) {
+                    ohwi[(o*kk + k)*d.in_channels + c] = oihw[(o*d.in_channels + c)*kk + k];
+                }
+            }
+        }
+    }
+
+    template<class T>
+    void filters_to_oihw(const T *ohwi, const ConvDims &d, T *oihw) {
+        int kk = d.filter_height*d.filter_width;
+        for(int o = 0; o < d.out_channels; o++) {
+            for(int c = 0; c < d.in_channels; c++) {
+                for(int k = 0; k < kk; k++) {
+                    oihw[(o*d.in_channels + c)*kk + k] = ohwi[(o*kk + k)*d.in_channels + c];
+                }
+            }
+        }
+    }
+
+    ConvDims conv_dims(const Shape4D &in_shape, const Shape4D &filter_shape, const Shape4D &out_shape, const vector<int> &stride, const vector<int> &padding) {
+        ConvDims d;
+        d.batch = in_shape[0];
+        d.in_channels = in_shape[1];
+        d.in_rows = in_shape[2];
+        d.in_cols = in_shape[3];
+        d.out_channels = filter_shape[0];
+        d.filter_height = filter_shape[2];
+        d.filter_width = filter_shape[3];
+        d.out_rows = out_shape[2];
+        d.out_cols = out_shape[3];
+        d.stride_r = stride[0];
+        d.stride_c = stride[1];
+        d.padding_top = padding[0];
+        d.padding_left = padding[2];
+
+        if(d.in_channels != filter_shape[1]) {
+            throw(std::invalid_argument("Error: input channels != filter_shape[1]"));
+        }
+
+        if(d.out_channels != out_shape[1]) {
+            throw(std::invalid_argument("Error: output channels != output_shape[1]"));
+        }
+
+        if(d.batch != out_shape[0]) {
+            throw(std::invalid_argument("Error: batch != output_shape[0]"));
+        }
+
+        return d;
+    }
+
+    template<class T>
+    void im2col(const T *in, const ConvDims &d, T *col) {
+        int ohw = d.ohw();
+
+        for(int c = 0; c < d.in_channels; c++) {
+            for(int fi = 0; fi < d.filter_height; fi++) {
+                for(int fj = 0; fj < d.filter_width; fj++) {
+                    T *dst = col + ((c*d.filter_height + fi)*d.filter_width + fj)*ohw;
+                    int ow_begin = d.ow_begin(fj), ow_end = d.ow_end(fj);
+
+                    for(int oh = 0; oh < d.out_rows; oh++) {
+                        T *dst_row = dst + oh*d.out_cols;
+                        int ih = oh*d.stride_r + fi - d.padding_top;
+
+                        if(ih < 0 || ih >= d.in_rows) {
+                            fill(dst_row, dst_row + d.out_cols, (T)0);
+                            continue;
+                        }
+
+                        const T *src = in + (c*d.in_rows + ih)*d.in_cols + fj - d.padding_left;
+                        fill(dst_row, dst_row + ow_begin, (T)0);
+                        for(int ow = ow_begin; ow < ow_end; ow++) {
+                            dst_row[ow] = src[ow*d.stride_c];
+                        }
+                        fill(dst_row + ow_end, dst_row + d.out_cols, (T)0);
+                    }
+                }
+            }
+        }
+    }
+
+    // one channels-last image into patches[OH*OW x FH*FW*C]
+    template<class T>
+    void im2col_nhwc(const T *in, const ConvDims &d, T *patches) {
+        int C = d.in_channels, ckk = d.ckk();
+
+        for(int oh = 0; oh < d.out_rows; oh++) {
+            for(int ow = 0; ow < d.out_cols; ow++) {
+                T *dst = patches + (oh*d.out_cols + ow)*ckk;
+                for(int fi = 0; fi < d.filter_height; fi++) {
+                    int ih = oh*d.stride_r + fi - d.padding_top;
+                    for(int fj = 0; fj < d.filter_width; fj++, dst += C) {
+                        int iw = ow*d.stride_c + fj - d.padding_left;
+                        if(ih < 0 || ih >= d.in_rows || iw < 0 || iw >= d.in_cols) {
+                            fill(dst, dst + C, (T)0);
+                            continue;
+                        }
+                        copy(in + (ih*d.in_cols + iw)*C, in + (ih*d.in_cols + iw + 1)*C, dst);
+                    }
+                }
+            }
+        }
+    }
+
+    template<class T>
+    void col2im_nhwc(const T *patches, const ConvDims &d, T *in) {
+        int C = d.in_channels, ckk = d.ckk();
+
+        for(int oh = 0; oh < d.out_rows; oh++) {
+            for(int ow = 0; ow < d.out_cols; ow++) {
+                const T *src = patches + (oh*d.out_cols + ow)*ckk;
+                for(int fi = 0; fi < d.filter_height; fi++) {
+                    int ih = oh*d.stride_r + fi - d.padding_top;
+                    for(int fj = 0; fj < d.filter_width; fj++, src += C) {
+                        int iw = ow*d.stride_c + fj - d.padding_left;
+                        if(ih < 0 || ih >= d.in_rows || iw < 0 || iw >= d.in_cols) {
+                            continue;
+                        }
+                        T *dst = in + (ih*d.in_cols + iw)*C;
+                        for(int c = 0; c < C; c++) {
+                            dst[c] += src[c];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // in += col2im(col), overlapping windows accumulate
+    template<class T>
+    void col2im(const T *col, const ConvDims &d, T *in) {
+        int ohw = d.ohw();
+
+        for(int c = 0; c < d.in_channels; c++) {
+            for(int fi = 0; fi < d.filter_height; fi++) {
+                for(int fj = 0; fj < d.filter_width; fj++) {
+                    const T *src = col + ((c*d.filter_height + fi)*d.filter_width + fj)*ohw;
+                    int ow_begin = d.ow_begin(fj), ow_end = d.ow_end(fj);
+
+                    for(int oh = 0; oh < d.out_rows; oh++) {
+                        int ih = oh*d.stride_r + fi - d.padding_top;
+                        if(ih < 0 || ih >= d.in_rows) {
+                            continue;
+                        }
+
+                        T *dst = in + (c*d.in_rows + ih)*d.in_cols + fj - d.padding_left;
+                        for(int ow = ow_begin; ow < ow_end; ow++) {
+                            dst[ow*d.stride_c] += src[oh*d.out_cols + ow];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+template<class T>
+void acc_convolution2D_im2col(const Tensor4D<T> &input, const Tensor4D<T> &filters, Tensor4D<T> *output, const vector<int> &stride, const vector<int> &padding, const Neural::Kernels::Epilogue<T> &epilogue, const Neural::Kernels::PackedMatrix<T> *packed_filters) {
+    ConvDims d = conv_dims(input.shape(), filters.shape(), output->shape(), stride, padding);
+    int ckk = d.ckk(), ohw = d.ohw();
+
+    const T *in_data = input.data(), *filter_data = filters.data();
+    T *out_data = output->data();
+
+    if(input.layout() == Neural::Layout::nhwc) {
+        bool packed = packed_filters && packed_filters->matches(true, ckk, d.out_channels);
+        T *ohwi = packed ? nullptr : Neural::Pool::acquire<T>(d.out_channels*ckk);
+        if(!packed) {
+            filters_to_ohwi(filter_data, d, ohwi);
+        }
+        // the output channels are the gemm columns, so is their bias
+        Neural::Kernels::Epilogue<T> ep{nullptr, epilogue.row_bias, epilogue.activation};
+
+        Neural::Parallel::run_outer(d.batch, [&](int i) {
+            const T *patches = in_data + i*d.in_size();
+
+            if(!d.is_pointwise()) {
+                T *scratch = Neural::Parallel::thread_scratch<T>((size_t)ohw*ckk);
+                im2col_nhwc(in_data + i*d.in_size(), d, scratch);
+                patches = scratch;
+            }
+
+            if(packed) {
+                Neural::Kernels::gemm<T>(false, ohw, (T)1, patches, ckk, *packed_filters, (T)0, out_data + i*d.out_size(), d.out_channels, &ep);
+            }
+            else {
+                Neural::Kernels::gemm<T>(false, true, ohw, d.out_channels, ckk, (T)1, patches, ckk, ohwi, ckk, (T)0, out_data + i*d.out_size(), d.out_channels, &ep);
+            }
+        });
+
+        if(!packed) {
+            Neural::Pool::release<T>(ohwi, d.out_channels*ckk);
+        }
+        return;
+    }
+
+    bool packed = packed_filters && packed_filters->matches(false, d.out_channels, ckk);
+
+    Neural::Parallel::run_outer(d.batch, [&](int i) {
+        const T *col = in_data + i*d.in_size();
+
+        if(!d.is_pointwise()) {
+            T *scratch = Neural::Parallel::thread_scratch<T>((size_t)ckk*ohw);
+            im2col(in_data + i*d.in_size(), d, scratch);
+            col = scratch;
+        }
+
+        if(packed) {
+            Neural::Kernels::gemm<T>(*packed_filters, false, ohw, (T)1, col, ohw, (T)0, out_data + i*d.out_size(), ohw, &epilogue);
+        }
+        else {
+            Neural::Kernels::gemm<T>(d.out_channels, ohw, ckk, (T)1, filter_data, ckk, col, ohw, (T)0, out_data + i*d.out_size(), ohw, &epilogue);
+        }
+    });
+}
+
+template void acc_convolution2D_im2col(const Tensor4D<double> &, const Tensor4D<double> &, Tensor4D<double> *, const vector<int> &, const vector<int> &, const Neural::Kernels::Epilogue<double> &, const Neural::Kernels::PackedMatrix<double> *);
+template void acc_convolution2D_im2col(const Tensor4D<float> &, const Tensor4D<float> &, Tensor4D<float> *, const vector<int> &, const vector<int> &, const Neural::Kernels::Epilogue<float> &, const Neural::Kernels::PackedMatrix<float> *);
+
+template<class T>
+void acc_convolution2D_im2col_wgrad(const Tensor4D<T> &input, const Tensor4D<T> &drv_error_output, Tensor4D<T> *drv_error_filters, const vector<int> &stride, const vector<int> &padding) {
+    ConvDims d = conv_dims(input.shape(), drv_error_filters->shape(), drv_error_output.shape(), stride, padding);
+    int ckk = d.ckk(), ohw = d.ohw(), wsize = d.out_channels * ckk;
+
+    const T *in_data = input.data(), *dout_data = drv_error_output.data();
+    T *dw_data = drv_error_filters->data();
+
+    bool nhwc = input.layout() == Neural::Layout::nhwc;
+    // channels-last sums OHWI filters, permuted to OIHW at the end
+    T *ohwi = nhwc ? Neural::Pool::acquire<T>(wsize) : nullptr;
+    T *dw_sum = nhwc ? ohwi : dw_data;
+
+    // contiguous image ranges per worker, each summed into its own partial gradient
+    int ngroups = min(d.batch, Neural::Parallel::num_threads());
+    T *partial = (ngroups > 1) ? Neural::Pool::acquire<T>(ngroups * wsize) : nullptr;
+
+    Neural::Parallel::run(ngroups, [&](int g) {
+        T *dw = (ngroups > 1) ? partial + g*wsize : dw_sum;
+        int first = g * d.batch / ngroups, last = (g + 1) * d.batch / ngroups;
+
+        for(int i = first; i < last; i++) {
+            const T *col = in_data + i*d.in_size();
+
+            if(!d.is_pointwise()) {
+                T *scratch = Neural::Parallel::thread_scratch<T>((size_t)ckk*ohw);
+                if(nhwc) {
+                    im2col_nhwc(in_data + i*d.in_size(), d, scratch);
+                }
+                else {
+                    im2col(in_data + i*d.in_size(), d, scratch);
+                }
+                col = scratch;
+            }
+
+            if(nhwc) {
+                Neural::Kernels::gemm<T>(true, false, d.out_channels, ckk, ohw, (T)1, dout_data + i*d.out_size(), d.out_channels, col, ckk, (i == first) ? (T)0 : (T)1, dw, ckk);
+            }
+            else {
+                Neural::Kernels::gemm<T>(false, true, d.out_channels, ckk, ohw, (T)1, dout_data + i*d.out_size(), ohw, col, ohw, (i == first) ? (T)0 : (T)1, dw, ckk);
+            }
+        }
+    });
+
+    if(ngroups > 1) {
+        for(int k = 0; k < wsize; k++) {
+            T sum = 0;
+            for(int g = 0; g < ngroups; g++) {
+                sum += partial[g*wsize + k];
+            }
+            dw_sum[k] = sum;
+        }
+
+        Neural::Pool::release<T>(partial, ngroups * wsize);
+    }
+
+    if(nhwc) {
+        filters_to_oihw(ohwi, d, dw_data);
+        Neural::Pool::release<T>(ohwi, wsize);
+    }
+}
+
+template void acc_convolution2D_im2col_wgrad(const Tensor4D<double> &, const Tensor4D<double> &, Tensor4D<double> *, const vector<int> &, const vector<int> &);
+template void acc_convolution2D_im2col_wgrad(const Tensor4D<float> &, const Tensor4D<float> &, Tensor4D<float> *, const vector<int> &, const vector<int> &);
+
+template<class T>
+void acc_convolution2D_im2col_dgrad(const Tensor4D<T> &drv_error_output, const Tensor4D<T> &filters, Tensor4D<T> *drv_error_input, const vector<int> &stride, const vector<int> &padding, const Neural::Kernels::PackedMatrix<T> *packed_filters) {
+    ConvDims d = conv_dims(drv_error_input->shape(), filters.shape(), drv_error_output.shape(), stride, padding);
+    int ckk = d.ckk(), ohw = d.ohw();
+
+    const T *dout_data = drv_error_output.data(), *filter_data = filters.data();
+    T *din_data = drv_error_input->data();
+
+    if(drv_error_output.layout() == Neural::Layout::nhwc) {
+        bool packed = packed_filters && packed_filters->matches(true, d.out_channels, ckk);
+        T *ohwi = packed ? nullptr : Neural::Pool::acquire<T>(d.out_channels*ckk);
+        if(!packed) {
+            filters_to_ohwi(filter_data, d, ohwi);
+        }
+
+        // dpatches[OH*OW x FH*FW*C] = dout * filters
+        auto dpatches_gemm = [&](const T *dout, T *dpatches) {
+            if(packed) {
+                Neural::Kernels::gemm<T>(false, ohw, (T)1, dout, d.out_channels, *packed_filters, (T)0, dpatches, ckk);
+            }
+            else {
+                Neural::Kernels::gemm<T>(false, false, ohw, ckk, d.out_channels, (T)1, dout, d.out_channels, ohwi, ckk, (T)0, dpatches, ckk);
+            }
+        };
+
+        Neural::Parallel::run_outer(d.batch, [&](int i) {
+            T *din = din_data + i*d.in_size();
+
+            if(d.is_pointwise()) {
+                dpatches_gemm(dout_data + i*d.out_size(), din);
+                return;
+            }
+
+            T *dpatches = Neural::Parallel::thread_scratch<T>((size_t)ohw*ckk);
+            dpatches_gemm(dout_data + i*d.out_size(), dpatches);
+
+            fill(din, din + d.in_size(), (T)0);
+            col2im_nhwc(dpatches, d, din);
+        });
+
+        if(!packed) {
+            Neural::Pool::release<T>(ohwi, d.out_channels*ckk);
+        }
+        return;
+    }
+
+    bool packed = packed_filters && packed_filters->matches(false, ckk, d.out_channels);
+
+    // dcol[C*FH*FW x OH*OW] = filters^T * dout
+    auto dcol_gemm = [&](const T *dout, T *dcol) {
+        if(packed) {
+            Neural::Kernels::gemm<T>(*packed_filters, false, ohw, (T)1, dout, ohw, (T)0, dcol, ohw);
+        }
+        else {
+            Neural::Kernels::gemm<T>(true, false, ckk, ohw, d.out_channels, (T)1, filter_data, ckk, dout, ohw, (T)0, dcol, ohw);
+        }
+    };
+
+    Neural::Parallel::run_outer(d.batch, [&](int i) {
+        T *din = din_data + i*d.in_size();
+
+        if(d.is_pointwise()) {
+            dcol_gemm(dout_data + i*d.out_size(), din);
+            return;
+        }
+
+        T *dcol = Neural::Parallel::thread_scratch<T>((size_t)ckk*ohw);
+        dcol_gemm(dout_data + i*d.out_size(), dcol);
+
+        fill(din, din + d.in_size(), (T)0);
+        col2im(dcol, d, din);
+    });
+}
+
+template void acc_convolution2D_im2col_dgrad(const Tensor4D<double> &, const Tensor4D<double> &, Tensor4D<double> *, const vector<int> &, const vector<int> &, const Neural::Kernels::PackedMatrix<double> *);
+template void acc_convolution2D_im2col_dgrad(const Tensor4D<float> &, const Tensor4D<float> &, Tensor4D<float> *, const vector<int> &, const vector<int> &, const Neural::Kernels::PackedMatrix<float> *);
+
+template<class T>
+void acc_pack_im2col_filters(const Tensor4D<T> &filters, Neural::Layout layout, bool dgrad, Neural::Kernels::PackedMatrix<T> *packed, long version) {
+    Shape4D f = filters.shape();
+    int out_channels = f[0], ckk = f[1]*f[2]*f[3];
+
+    if(layout == Neural::Layout::nchw) {
+        // forward: filters[OC x ckk], dgrad: filters^T
+        if(dgrad) {
+            packed->pack_a(true, ckk, out_channels, filters.data(), ckk, version);
+        }
+        else {
+            packed->pack_a(false, out_channels, ckk, filters.data(), ckk, version);
+        }
+        return;
+    }
+
+    ConvDims d{};
+    d.out_channels = out_channels;
+    d.in_channels = f[1];
+    d.filter_height = f[2];
+    d.filter_width = f[3];
+    T *ohwi = Neural::Pool::acquire<T>(out_channels*ckk);
+    filters_to_ohwi(filters.data(), d, ohwi);
+    // forward: OHWI^T[ckk x OC], dgrad: OHWI
+    if(dgrad) {
+        packed->pack_b(false, out_channels, ckk, ohwi, ckk, version);
+    }
+    else {
+        packed->pack_b(true, ckk, out_channels, ohwi, ckk, version);
+    }
+    Neural::Pool::release<T>(ohwi, out_channels*ckk);
+}
+
+template void acc_pack_im2col_filters(const Tensor4D<double> &, Neural::Layout, bool, Neural::Kernels::PackedMatrix<double> *, long);
+template void acc_pack_im2col_filters(const Tensor4D<float> &, Neural::Layout, bool, Neural::Kernels::PackedMatrix<float> *, long);
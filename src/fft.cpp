@@ -0,0 +1,407 @@
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+#include "fft.hpp"
+#include "parallel.hpp"
+#include "pool.hpp"
+
+using Neural::Tensor4D;
+using Neural::Shape4D;
+using Neural::Kernels::FFT;
+using Neural::Kernels::RealFFT2D;
+using Neural::Kernels::FFTConvolution;
+
+using namespace std;
+
+namespace {
+    // plain products, std::complex operator* goes through the NaN/inf-checked library call
+    template<class T>
+    inline complex<T> cmul(const complex<T> &a, const complex<T> &b) {
+        return complex<T>(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
+    }
+
+    // a * conj(b)
+    template<class T>
+    inline complex<T> cmulc(const complex<T> &a, const complex<T> &b) {
+        return complex<T>(a.real()*b.real() + a.imag()*b.imag(), a.imag()*b.real() - a.real()*b.imag());
+    }
+
+    // -i * a
+    template<class T>
+    inline complex<T> mul_mi(const complex<T> &a) {
+        return complex<T>(a.imag(), -a.real());
+    }
+}
+
+////////////////////////////// <FFT> //////////////////////////////////////////////////
+template<class T>
+FFT<T>::FFT(int n) : _n(n) {
+    if(n < 1) {
+        throw(std::invalid_argument("FFT: size must be positive"));
+    }
+
+    int rest = n;
+    for(int p: {4, 2, 3, 5}) {
+        while(rest % p == 0) {
+            factors.push_back(p);
+            rest /= p;
+        }
+    }
+    for(int p = 7; rest > 1; p += 2) {
+        while(rest % p == 0) {
+            factors.push_back(p);
+            rest /= p;
+        }
+    }
+
+    twiddles.resize(n);
+    for(int k = 0; k < n; k++) {
+        double phase = -2.0 * M_PI * k / n;
+        twiddles[k] = complex<T>((T)cos(phase), (T)sin(phase));
+    }
+}
+
+// Decimation in time: the p interleaved sub-sequences of in (stride in_stride) are transformed
+// into consecutive blocks of out, then combined with radix-p butterflies.
+template<class T>
+void FFT<T>::pass(const complex<T> *in, complex<T> *out, int n, int in_stride, int fidx, bool inverse) const {
+    int p = factors[fidx], m = n / p;
+
+    if(m == 1) {
+        for(int q = 0; q < p; q++) {
+            out[q] = in[q*in_stride];
+        }
+    }
+    else {
+        for(int q = 0; q < p; q++) {
+            pass(in + q*in_stride, out + q*m, m, in_stride*p, fidx + 1, inverse);
+        }
+    }
+
+    int tstep = _n / n;
+    auto tw = [&](int idx) { const complex<T> &w = twiddles[idx % _n]; return inverse ? conj(w) : w; };
+
+    if(p == 2) {
+        for(int k = 0; k < m; k++) {
+            complex<T> a0 = out[k], a1 = cmul(out[m + k], tw(k*tstep));
+            out[k] = a0 + a1;
+            out[m + k] = a0 - a1;
+        }
+    }
+    else if(p == 4) {
+        for(int k = 0; k < m; k++) {
+            complex<T> a0 = out[k];
+            complex<T> a1 = cmul(out[m + k], tw(k*tstep));
+            complex<T> a2 = cmul(out[2*m + k], tw(2*k*tstep));
+            complex<T> a3 = cmul(out[3*m + k], tw(3*k*tstep));
+
+            complex<T> b0 = a0 + a2, b1 = a0 - a2, b2 = a1 + a3, b3 = mul_mi(a1 - a3);
+            if(inverse) {
+                b3 = -b3;
+            }
+
+            out[k] = b0 + b2;
+            out[m + k] = b1 + b3;
+            out[2*m + k] = b0 - b2;
+            out[3*m + k] = b1 - b3;
+        }
+    }
+    else {
+        vector<complex<T>> t(p);
+        for(int k = 0; k < m; k++) {
+            for(int q = 0; q < p; q++) {
+                t[q] = cmul(out[q*m + k], tw(q*k*tstep));
+            }
+            for(int u = 0; u < p; u++) {
+                complex<T> sum = t[0];
+                for(int q = 1; q < p; q++) {
+                    sum += cmul(t[q], tw(q*u*m*tstep));
+                }
+                out[u*m + k] = sum;
+            }
+        }
+    }
+}
+
+template<class T>
+void FFT<T>::transform(complex<T> *data, bool inverse) const {
+    if(_n == 1) {
+        return;
+    }
+
+    complex<T> *work = Neural::Parallel::thread_scratch<complex<T>, 7>(_n);
+    copy(data, data + _n, work);
+    pass(work, data, _n, 1, 0, inverse);
+}
+
+template class Neural::Kernels::FFT<double>;
+template class Neural::Kernels::FFT<float>;
+////////////////////////////// </FFT> /////////////////////////////////////////////////
+
+////////////////////////////// <RealFFT2D> ////////////////////////////////////////////
+template<class T>
+RealFFT2D<T>::RealFFT2D(int rows, int cols) : _rows(rows), _cols(cols), row_fft(cols / 2), col_fft(rows) {
+    if(cols < 2 || cols % 2 != 0) {
+        throw(std::invalid_argument("RealFFT2D: cols must be even"));
+    }
+
+    row_twiddles.resize(cols / 2 + 1);
+    for(int k = 0; k <= cols / 2; k++) {
+        double phase = -2.0 * M_PI * k / cols;
+        row_twiddles[k] = complex<T>((T)cos(phase), (T)sin(phase));
+    }
+}
+
+template<class T>
+int RealFFT2D<T>::good_size(int n) {
+    for(int size = max(n, 2); ; size++) {
+        int rest = size;
+        for(int p: {2, 3, 5}) {
+            while(rest % p == 0) {
+                rest /= p;
+            }
+        }
+        if(rest == 1 && size % 2 == 0) {
+            return size;
+        }
+    }
+}
+
+template<class T>
+void RealFFT2D<T>::forward(const T *in, int h, int w, int ld, complex<T> *spectrum, int row0, int col0) const {
+    int half = _cols / 2, scols = spectrum_cols();
+    int row_end = min(row0 + h, _rows), col_end = min(col0 + w, _cols);
+    complex<T> *z = Neural::Parallel::thread_scratch<complex<T>, 6>(max(half, _rows));
+
+    fill(spectrum, spectrum + (size_t)row0*scols, complex<T>(0, 0));
+    fill(spectrum + (size_t)row_end*scols, spectrum + (size_t)_rows*scols, complex<T>(0, 0));
+
+    // real rows as half-length complex sequences, even samples real and odd samples imaginary
+    for(int y = row0; y < row_end; y++) {
+        const T *row = in + (size_t)(y - row0)*ld;
+        for(int k = 0; k < half; k++) {
+            int x = 2*k;
+            T re = (x >= col0 && x < col_end) ? row[x - col0] : (T)0, im = (x + 1 >= col0 && x + 1 < col_end) ? row[x + 1 - col0] : (T)0;
+            z[k] = complex<T>(re, im);
+        }
+
+        row_fft.transform(z, false);
+
+        complex<T> *s = spectrum + (size_t)y*scols;
+        for(int k = 0; k <= half; k++) {
+            complex<T> zk = z[k % half], zc = conj(z[(half - k) % half]);
+            complex<T> even = (zk + zc) * (T)0.5, odd = mul_mi(zk - zc) * (T)0.5;
+            s[k] = even + cmul(row_twiddles[k], odd);
+        }
+    }
+
+    for(int k = 0; k < scols; k++) {
+        for(int y = 0; y < _rows; y++) {
+            z[y] = spectrum[(size_t)y*scols + k];
+        }
+        col_fft.transform(z, false);
+        for(int y = 0; y < _rows; y++) {
+            spectrum[(size_t)y*scols + k] = z[y];
+        }
+    }
+}
+
+template<class T>
+void RealFFT2D<T>::inverse(complex<T> *spectrum, T *out, int h, int w, int ld) const {
+    int half = _cols / 2, scols = spectrum_cols();
+    complex<T> *z = Neural::Parallel::thread_scratch<complex<T>, 6>(max(half, _rows));
+
+    for(int k = 0; k < scols; k++) {
+        for(int y = 0; y < _rows; y++) {
+            z[y] = spectrum[(size_t)y*scols + k];
+        }
+        col_fft.transform(z, true);
+        for(int y = 0; y < _rows; y++) {
+            spectrum[(size_t)y*scols + k] = z[y];
+        }
+    }
+
+    // undo the even/odd split, scaled so the row inverse also multiplies by cols
+    for(int y = 0; y < min(h, _rows); y++) {
+        const complex<T> *s = spectrum + (size_t)y*scols;
+        for(int k = 0; k < half; k++) {
+            complex<T> xk = s[k], xc = conj(s[half - k]);
+            complex<T> even = xk + xc, odd = cmul(xk - xc, conj(row_twiddles[k]));
+            // z = even + i * odd
+            z[k] = complex<T>(even.real() - odd.imag(), even.imag() + odd.real());
+        }
+
+        row_fft.transform(z, true);
+
+        T *row = out + (size_t)y*ld;
+        for(int k = 0; k < half; k++) {
+            if(2*k < w) row[2*k] = z[k].real();
+            if(2*k + 1 < w) row[2*k + 1] = z[k].imag();
+        }
+    }
+}
+
+template class Neural::Kernels::RealFFT2D<double>;
+template class Neural::Kernels::RealFFT2D<float>;
+////////////////////////////// </RealFFT2D> ///////////////////////////////////////////
+
+////////////////////////////// <FFTConvolution> ///////////////////////////////////////
+// A circular correlation over a grid at least as large as the padded input never wraps for the
+// outputs that are kept, so the plan only needs to cover the padded input. The padding is the
+// offset of the input inside the zero-filled grid.
+template<class T>
+FFTConvolution<T>::FFTConvolution(int _in_rows, int _in_cols, int _filter_height, int _filter_width, int _stride_r, int _stride_c, const vector<int> &padding) :
+    plan(RealFFT2D<T>::good_size(_in_rows + padding[0] + padding[1]), RealFFT2D<T>::good_size(_in_cols + padding[2] + padding[3])), in_rows(_in_rows), in_cols(_in_cols),
+    filter_height(_filter_height), filter_width(_filter_width), stride_r(_stride_r), stride_c(_stride_c), padding_top(padding[0]), padding_left(padding[2]) {}
+
+template<class T>
+void FFTConvolution<T>::transform_filters(const Tensor4D<T> &filters, long version) {
+    Shape4D shape = filters.shape();
+
+    if(shape[2] != filter_height || shape[3] != filter_width) {
+        throw(std::invalid_argument("FFTConvolution: filter shape does not match the plan"));
+    }
+
+    out_channels = shape[0];
+    in_channels = shape[1];
+    int S = plan.spectrum_size(), pairs = out_channels * in_channels;
+    T scale = (T)1 / (T)(plan.rows() * plan.cols());
+
+    filter_spectra.resize((size_t)pairs * S);
+    const T *w = filters.data();
+
+    Neural::Parallel::run(pairs, [&](int pair) {
+        complex<T> *spec = filter_spectra.data() + (size_t)pair*S;
+        plan.forward(w + (size_t)pair*filter_height*filter_width, filter_height, filter_width, filter_width, spec);
+        for(int f = 0; f < S; f++) {
+            spec[f] *= scale;
+        }
+    });
+
+    _version = version;
+}
+
+template<class T>
+void FFTConvolution<T>::forward(const Tensor4D<T> &input, Tensor4D<T> *output, const Epilogue<T> &epilogue) const {
+    Shape4D in_shape = input.shape(), out_shape = output->shape();
+    int batch = in_shape[0], C = in_shape[1], OC = out_shape[1], OH = out_shape[2], OW = out_shape[3];
+
+    if(C != in_channels || OC != out_channels || in_shape[2] != in_rows || in_shape[3] != in_cols || batch != out_shape[0]) {
+        throw(std::invalid_argument("FFTConvolution::forward: shapes do not match the plan"));
+    }
+
+    int S = plan.spectrum_size();
+    // full-resolution rows/cols needed before striding
+    int full_h = (OH - 1)*stride_r + 1, full_w = (OW - 1)*stride_c + 1;
+    const T *in_data = input.data();
+    T *out_data = output->data();
+
+    Neural::Parallel::run_outer(batch, [&](int i) {
+        complex<T> *X = Neural::Parallel::thread_scratch<complex<T>, 0>((size_t)C*S);
+        complex<T> *Y = Neural::Parallel::thread_scratch<complex<T>, 1>(S);
+        T *full = Neural::Parallel::thread_scratch<T, 0>((size_t)full_h*full_w);
+
+        for(int c = 0; c < C; c++) {
+            plan.forward(in_data + ((size_t)i*C + c)*in_rows*in_cols, in_rows, in_cols, in_cols, X + (size_t)c*S, padding_top, padding_left);
+        }
+
+        for(int oc = 0; oc < OC; oc++) {
+            const complex<T> *Wf = filter_spectra.data() + (size_t)oc*C*S;
+
+            for(int f = 0; f < S; f++) {
+                Y[f] = cmulc(X[f], Wf[f]);
+            }
+            for(int c = 1; c < C; c++) {
+                const complex<T> *Xc = X + (size_t)c*S, *Wc = Wf + (size_t)c*S;
+                for(int f = 0; f < S; f++) {
+                    Y[f] += cmulc(Xc[f], Wc[f]);
+                }
+            }
+
+            T *out_oc = out_data + ((size_t)i*OC + oc)*OH*OW;
+            if(stride_r == 1 && stride_c == 1) {
+                plan.inverse(Y, out_oc, OH, OW, OW);
+            }
+            else {
+                plan.inverse(Y, full, full_h, full_w, full_w);
+                for(int oh = 0; oh < OH; oh++) {
+                    for(int ow = 0; ow < OW; ow++) {
+                        out_oc[oh*OW + ow] = full[(oh*stride_r)*full_w + ow*stride_c];
+                    }
+                }
+            }
+
+            // the plane is still in cache from the inverse, one row with the channel's bias
+            if(epilogue.row_bias || epilogue.activation != Activation::none) {
+                apply_epilogue(epilogue, out_oc, 1, OH*OW, OH*OW, oc, 0);
+            }
+        }
+    });
+}
+
+template<class T>
+void FFTConvolution<T>::backward_filters(const Tensor4D<T> &input, const Tensor4D<T> &drv_error_output, Tensor4D<T> *drv_error_filters) const {
+    Shape4D in_shape = input.shape(), out_shape = drv_error_output.shape(), filter_shape = drv_error_filters->shape();
+    int batch = in_shape[0], C = in_shape[1], OC = out_shape[1], OH = out_shape[2], OW = out_shape[3];
+
+    if(in_shape[2] != in_rows || in_shape[3] != in_cols || filter_shape[0] != OC || filter_shape[1] != C || filter_shape[2] != filter_height || filter_shape[3] != filter_width || batch != out_shape[0]) {
+        throw(std::invalid_argument("FFTConvolution::backward_filters: shapes do not match the plan"));
+    }
+
+    int S = plan.spectrum_size();
+    int dil_h = (OH - 1)*stride_r + 1, dil_w = (OW - 1)*stride_c + 1;
+    T scale = (T)1 / (T)(plan.rows() * plan.cols());
+    const T *in_data = input.data(), *dout_data = drv_error_output.data();
+    T *dw_data = drv_error_filters->data();
+
+    complex<T> *X = Neural::Pool::acquire<complex<T>>(batch*C*S);
+    complex<T> *DY = Neural::Pool::acquire<complex<T>>(batch*OC*S);
+
+    Neural::Parallel::run(batch*C, [&](int bc) {
+        plan.forward(in_data + (size_t)bc*in_rows*in_cols, in_rows, in_cols, in_cols, X + (size_t)bc*S, padding_top, padding_left);
+    });
+
+    // the output error is the filter here, spread out by the stride
+    Neural::Parallel::run(batch*OC, [&](int bo) {
+        const T *dy = dout_data + (size_t)bo*OH*OW;
+
+        if(stride_r == 1 && stride_c == 1) {
+            plan.forward(dy, OH, OW, OW, DY + (size_t)bo*S);
+            return;
+        }
+
+        T *dilated = Neural::Parallel::thread_scratch<T, 0>((size_t)dil_h*dil_w);
+        fill(dilated, dilated + (size_t)dil_h*dil_w, (T)0);
+        for(int oh = 0; oh < OH; oh++) {
+            for(int ow = 0; ow < OW; ow++) {
+                dilated[(oh*stride_r)*dil_w + ow*stride_c] = dy[oh*OW + ow];
+            }
+        }
+        plan.forward(dilated, dil_h, dil_w, dil_w, DY + (size_t)bo*S);
+    });
+
+    Neural::Parallel::run(OC*C, [&](int pair) {
+        int oc = pair / C, c = pair % C;
+        complex<T> *acc = Neural::Parallel::thread_scratch<complex<T>, 1>(S);
+
+        fill(acc, acc + S, complex<T>(0, 0));
+        for(int i = 0; i < batch; i++) {
+            const complex<T> *Xi = X + ((size_t)i*C + c)*S, *Di = DY + ((size_t)i*OC + oc)*S;
+            for(int f = 0; f < S; f++) {
+                acc[f] += cmulc(Xi[f], Di[f]);
+            }
+        }
+        for(int f = 0; f < S; f++) {
+            acc[f] *= scale;
+        }
+
+        plan.inverse(acc, dw_data + (size_t)pair*filter_height*filter_width, filter_height, filter_width, filter_width);
+    });
+
+    Neural::Pool::release<complex<T>>(X, batch*C*S);
+    Neural::Pool::release<complex<T>>(DY, batch*OC*S);
+}
+
+template class Neural::Kernels::FFTConvolution<double>;
+template class Neural::Kernels::FFTConvolution<float>;
+////////////////////////////// </FFTConvolution> //////////////////////////////////////
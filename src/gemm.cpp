@@ -0,0 +1,88 @@
+#include <stdexcept>
+#include "gemm.hpp"
+#include "host_kernels.hpp"
+
+using Neural::Kernels::Epilogue;
+using Neural::Kernels::HostKernels;
+using Neural::Kernels::host_kernels;
+using Neural::Kernels::host_kernel_set;
+
+template<class T>
+void Neural::Kernels::apply_epilogue(const Epilogue<T> &ep, T *C, int m, int n, int ldc, int row, int col) {
+    host_kernels<T>().apply_epilogue(ep, C, m, n, ldc, row, col);
+}
+
+template void Neural::Kernels::apply_epilogue<double>(const Epilogue<double> &, double *, int, int, int, int, int);
+template void Neural::Kernels::apply_epilogue<float>(const Epilogue<float> &, float *, int, int, int, int, int);
+
+template<class T>
+void Neural::Kernels::gemm(int M, int N, int K, T alpha, const T *A, int lda, const T *B, int ldb, T beta, T *C, int ldc, const Epilogue<T> *epilogue) {
+    host_kernels<T>().gemm(M, N, K, alpha, A, lda, 1, B, ldb, 1, beta, C, ldc, epilogue);
+}
+
+template<class T>
+void Neural::Kernels::gemm(bool transA, bool transB, int M, int N, int K, T alpha, const T *A, int lda, const T *B, int ldb, T beta, T *C, int ldc, const Epilogue<T> *epilogue) {
+    host_kernels<T>().gemm(M, N, K, alpha, A, transA ? 1 : lda, transA ? lda : 1, B, transB ? 1 : ldb, transB ? ldb : 1, beta, C, ldc, epilogue);
+}
+
+template void Neural::Kernels::gemm<double>(int, int, int, double, const double *, int, const double *, int, double, double *, int, const Neural::Kernels::Epilogue<double> *);
+template void Neural::Kernels::gemm<float>(int, int, int, float, const float *, int, const float *, int, float, float *, int, const Neural::Kernels::Epilogue<float> *);
+template void Neural::Kernels::gemm<double>(bool, bool, int, int, int, double, const double *, int, const double *, int, double, double *, int, const Neural::Kernels::Epilogue<double> *);
+template void Neural::Kernels::gemm<float>(bool, bool, int, int, int, float, const float *, int, const float *, int, float, float *, int, const Neural::Kernels::Epilogue<float> *);
+
+template<class T>
+void Neural::Kernels::PackedMatrix<T>::pack_a(bool transA, int M, int K, const T *A, int lda, long version) {
+    const HostKernels<T> &k = host_kernels<T>();
+    panels.resize((size_t)((M + k.mr - 1) / k.mr) * k.mr * K);
+    k.pack_a(M, K, A, transA ? 1 : lda, transA ? lda : 1, panels.data());
+    _rows = M;
+    _cols = K;
+    _is_b = false;
+    kernels = &k;
+    _version = version;
+}
+
+template<class T>
+void Neural::Kernels::PackedMatrix<T>::pack_b(bool transB, int K, int N, const T *B, int ldb, long version) {
+    const HostKernels<T> &k = host_kernels<T>();
+    panels.resize((size_t)((N + k.nr - 1) / k.nr) * k.nr * K);
+    k.pack_b(K, N, B, transB ? 1 : ldb, transB ? ldb : 1, panels.data());
+    _rows = K;
+    _cols = N;
+    _is_b = true;
+    kernels = &k;
+    _version = version;
+}
+
+template<class T>
+bool Neural::Kernels::PackedMatrix<T>::matches(bool is_b, int rows, int cols) const {
+    return kernels == &host_kernels<T>() && _is_b == is_b && _rows == rows && _cols == cols;
+}
+
+template class Neural::Kernels::PackedMatrix<double>;
+template class Neural::Kernels::PackedMatrix<float>;
+
+template<class T>
+void Neural::Kernels::gemm(const PackedMatrix<T> &A, bool transB, int N, T alpha, const T *B, int ldb, T beta, T *C, int ldc, const Epilogue<T> *epilogue) {
+    if(!A.matches(false, A.rows(), A.cols())) {
+        throw(std::invalid_argument("Error: gemm A packed for another kernel set"));
+    }
+    host_kernels<T>().gemm_packed(A.rows(), N, A.cols(), alpha, nullptr, 0, 0, A.data(), B, transB ? 1 : ldb, transB ? ldb : 1, nullptr, beta, C, ldc, epilogue);
+}
+
+template<class T>
+void Neural::Kernels::gemm(bool transA, int M, T alpha, const T *A, int lda, const PackedMatrix<T> &B, T beta, T *C, int ldc, const Epilogue<T> *epilogue) {
+    if(!B.matches(true, B.rows(), B.cols())) {
+        throw(std::invalid_argument("Error: gemm B packed for another kernel set"));
+    }
+    host_kernels<T>().gemm_packed(M, B.cols(), B.rows(), alpha, A, transA ? 1 : lda, transA ? lda : 1, nullptr, nullptr, 0, 0, B.data(), beta, C, ldc, epilogue);
+}
+
+template void Neural::Kernels::gemm<double>(const PackedMatrix<double> &, bool, int, double, const double *, int, double, double *, int, const Neural::Kernels::Epilogue<double> *);
+template void Neural::Kernels::gemm<float>(const PackedMatrix<float> &, bool, int, float, const float *, int, float, float *, int, const Neural::Kernels::Epilogue<float> *);
+template void Neural::Kernels::gemm<double>(bool, int, double, const double *, int, const PackedMatrix<double> &, double, double *, int, const Neural::Kernels::Epilogue<double> *);
+template void Neural::Kernels::gemm<float>(bool, int, float, const float *, int, const PackedMatrix<float> &, float, float *, int, const Neural::Kernels::Epilogue<float> *);
+
+const char *Neural::Kernels::gemm_isa() {
+    return host_kernel_set().isa;
+}
@@ -0,0 +1,3 @@
+// Host kernels for AVX2+FMA, built with ISA_FLAGS_avx2 of the Makefile
+#define HOST_KERNELS_ISA avx2
+#include "kernels/host_kernels.inl"
@@ -0,0 +1,3 @@
+// Host kernels for AVX-512F, built with ISA_FLAGS_avx512 of the Makefile
+#define HOST_KERNELS_ISA avx512
+#include "kernels/host_kernels.inl"
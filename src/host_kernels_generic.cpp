@@ -0,0 +1,3 @@
+// Host kernels for portable C++, built with the base flags
+#define HOST_KERNELS_ISA generic
+#include "kernels/host_kernels.inl"
@@ -0,0 +1,74 @@
+#include <climits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "idx.hpp"
+
+using Neural::IdxFile;
+using Neural::Shape4D;
+using namespace std;
+
+namespace {
+    uint32_t read_be32(const uint8_t *p) {
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+    }
+}
+
+IdxFile::IdxFile(const string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        throw runtime_error("Cannot open file `" + path + "`!");
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < 4) {
+        close(fd);
+        throw runtime_error("Invalid IDX file `" + path + "`!");
+    }
+    map_size = st.st_size;
+    // shared read-only: the pages stay in the page cache for every process mapping the file
+    map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        map = nullptr;
+        throw runtime_error("Cannot map file `" + path + "`!");
+    }
+
+    const uint8_t *bytes = static_cast<const uint8_t *>(map);
+    int type = bytes[2], ndims = bytes[3];
+    size_t header = 4 + 4*(size_t)ndims;
+    if(bytes[0] != 0 || bytes[1] != 0 || type != 0x08 || ndims < 1 || ndims > 4 || map_size < header) {
+        munmap(map, map_size);
+        throw runtime_error("Invalid IDX file `" + path + "`, only unsigned byte data of 1 to 4 dimensions is supported!");
+    }
+    _magic = (type << 8) | ndims;
+
+    // every dimension and the element count have to fit the int indexing of Shape4D and the tensors
+    _shape = Shape4D(1, 1, 1, 1);
+    size_t count = 1;
+    for(int d = 0; d < ndims; d++) {
+        uint32_t dim = read_be32(bytes + 4 + 4*d);
+        if(dim == 0 || dim > INT_MAX || count > INT_MAX / dim) {
+            munmap(map, map_size);
+            throw runtime_error("Invalid IDX file `" + path + "`, dimensions out of range!");
+        }
+        count *= dim;
+        _shape[d == 0 ? 0 : 4 - ndims + d] = (int)dim;
+    }
+
+    if(map_size - header < count) {
+        munmap(map, map_size);
+        throw runtime_error("Truncated IDX file `" + path + "`!");
+    }
+    _data = bytes + header;
+    // start reading the pages in the background, the constructor does not wait for them
+    madvise(map, map_size, MADV_WILLNEED);
+}
+
+IdxFile::~IdxFile() {
+    if(map) {
+        munmap(map, map_size);
+    }
+}
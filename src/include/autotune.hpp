@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Plan cache for the convolution autotuner (Conv::autotune).
+// The plans are kept one per line as "<cpu model>\t<simd isa>\t<threads>\t<shape key>\t<forward> <wgrad> <dgrad>"
+// in NEURAL_PLAN_CACHE, by default $XDG_CACHE_HOME/neural/conv_plans or $HOME/.cache/neural/conv_plans.
+// NEURAL_PLAN_CACHE="" keeps the plans in memory only. The file is read once, on the first lookup, and only
+// the lines of this machine (cpu model, isa and thread count) are kept.
+namespace Neural::Autotune {
+    // kernel per pass, forward: direct, im2col, winograd_f2, winograd_f4 or fft
+    // wgrad: direct, im2col or fft, dgrad: direct, im2col, winograd_f2 or winograd_f4
+    struct ConvPlan {
+        std::string forward, wgrad, dgrad;
+    };
+
+    // batch, channels, height, width, features, filter, stride and padding {top, bottom, left, right}
+    std::string conv_shape_key(int, int, int, int, int, const std::vector<int> &, const std::vector<int> &, const std::vector<int> &);
+
+    bool lookup(const std::string &shape_key, ConvPlan &plan);
+    // keeps the plan for the following lookups and appends it to the cache file
+    void store(const std::string &shape_key, const ConvPlan &plan);
+
+    // "model name" of /proc/cpuinfo, "unknown" where it is not available
+    const std::string &cpu_model();
+    std::string cache_path();
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "tensor.hpp"
+#include "gemm.hpp"
+
+// Kernels the layers run their ops with, one function pointer per op with the arguments of the acc_* op
+// of the same name (ops.hpp). A Network picks its backend at runtime and hands it to its layers:
+//   "simd"      the acc_* ops: ISA-dispatched host kernels on the worker pool, OpenACC on the gpu
+//   "openmp"    plain loop nests parallelized with OpenMP (serial where the library is built without it)
+//   "reference" the same loop nests run serially, the baseline the other backends are checked against
+// "openmp" and "reference" work on host memory and are not available when running on the gpu.
+// Each op can come from another backend: "simd,convolution2D=reference,relu=openmp".
+namespace Neural {
+    template<class T>
+    struct Backend {
+        typedef void (*ActivationFn)(const Tensor4D<T> &, Tensor4D<T> *);
+        typedef void (*ActivationBackFn)(const Tensor4D<T> &, const Tensor4D<T> &, Tensor4D<T> *);
+
+        // the spec the backend was made from
+        std::string name;
+
+        void (*matrix_multiply)(const Tensor4D<T> &, const Tensor4D<T> &, Tensor4D<T> *, bool, bool, const Kernels::Epilogue<T> &);
+        void (*convolution2D)(const Tensor4D<T> &, const Tensor4D<T> &, Tensor4D<T> *, const std::vector<int> &, const std::vector<int> &, const Kernels::Epilogue<T> &);
+        void (*convolution2D_wgrad)(const Tensor4D<T> &, const Tensor4D<T> &, Tensor4D<T> *, Tensor4D<T> *, const std::vector<int> &, const std::vector<int> &, T);
+        void (*convolution2D_dgrad)(const Tensor4D<T> &, const Tensor4D<T> &, Tensor4D<T> *, const std::vector<int> &, const std::vector<int> &);
+
+        ActivationFn relu, sigmoid, softmax;
+        ActivationBackFn relu_backprop, sigmoid_backprop, softmax_backprop;
+        T (*softmax_cross_entropy)(const Tensor4D<T> &, const Tensor4D<int> &, Tensor4D<T> *, Tensor4D<T> *);
+
+        void (*add)(Tensor4D<T> *, const Tensor4D<T> &);
+        void (*mltp)(Tensor4D<T> *, T);
+        void (*accumulate)(const Tensor4D<T> &, Tensor4D<T> *);
+    };
+
+    // "simd", "openmp" or "reference", optionally followed by ",<op>=<backend>" overrides
+    template<class T> std::shared_ptr<const Backend<T>> make_backend(const std::string &spec);
+    // make_backend(NEURAL_BACKEND), "simd" when it is not set
+    template<class T> std::shared_ptr<const Backend<T>> default_backend();
+
+    std::vector<std::string> backend_names();
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+// bfloat16 in software: the upper 16 bits of an IEEE float (sign, 8 exponent bits, 7 mantissa bits), so it keeps
+// the float range at 3 significant digits. Only a storage type, the kernels widen it back to float or double and
+// accumulate there. Conversions round to nearest even, NaNs stay (quiet) NaNs.
+namespace Neural {
+    struct bfloat16 {
+        uint16_t bits{0};
+
+        bfloat16() = default;
+        explicit bfloat16(float value) : bits(round_bits(value)) {}
+
+        operator float() const {
+            uint32_t u = (uint32_t)bits << 16;
+            float value;
+            std::memcpy(&value, &u, sizeof(value));
+            return value;
+        }
+
+        static uint16_t round_bits(float value) {
+            uint32_t u;
+            std::memcpy(&u, &value, sizeof(u));
+            if((u & 0x7fffffffu) > 0x7f800000u) {
+                return (uint16_t)((u >> 16) | 0x40);
+            }
+            return (uint16_t)((u + 0x7fffu + ((u >> 16) & 1)) >> 16);
+        }
+    };
+}
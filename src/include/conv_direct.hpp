@@ -0,0 +1,92 @@
+#pragma once
+
+// Per output channel / per input plane kernels of the direct convolution gradients, shared by the gpu loops
+// of ops.cpp and the host kernels (host_kernels.hpp). Static, every translation unit keeps its own build.
+
+// first output row/column whose tap at offset f lands at or after input position lo,
+// i.e. ceil((lo + padding - f) / stride) clamped to [0, out]
+static inline int conv_out_begin(int lo, int padding, int f, int stride, int out) {
+    int x = lo + padding - f;
+    return (x <= 0) ? 0 : ((x + stride - 1) / stride < out ? (x + stride - 1) / stride : out);
+}
+
+// Filter and bias gradient of one output channel, both scaled:
+//   dw[oc][c][fi][fj] = scale * sum_{b, oh, ow} dout[b][oc][oh][ow] * in[b][c][oh*sr + fi - pt][ow*sc + fj - pl]
+//   db[oc]            = scale * sum_{b, oh, ow} dout[b][oc][oh][ow]
+// Taps on the padding border are skipped by clamping the output ranges instead of testing every element.
+#pragma acc routine vector
+template<class T>
+static void conv_wgrad_channel(int oc, const T *in_data, const T *dout_data, T *dw_data, T *db_data, int batch, int in_channels, int in_rows, int in_cols, int out_channels, int out_rows, int out_cols, int filter_height, int filter_width, int stride_r, int stride_c, int padding_top, int padding_left, T scale) {
+    T bsum = 0;
+    #pragma acc loop vector collapse(3) reduction(+:bsum)
+    for(int b = 0; b < batch; b++) {
+        for(int oh = 0; oh < out_rows; oh++) {
+            for(int ow = 0; ow < out_cols; ow++) {
+                bsum += dout_data[((b*out_channels + oc)*out_rows + oh)*out_cols + ow];
+            }
+        }
+    }
+    db_data[oc] = bsum * scale;
+
+    #pragma acc loop vector collapse(3)
+    for(int c = 0; c < in_channels; c++) {
+        for(int fi = 0; fi < filter_height; fi++) {
+            for(int fj = 0; fj < filter_width; fj++) {
+                int oh_begin = conv_out_begin(0, padding_top, fi, stride_r, out_rows), oh_end = conv_out_begin(in_rows, padding_top, fi, stride_r, out_rows);
+                int ow_begin = conv_out_begin(0, padding_left, fj, stride_c, out_cols), ow_end = conv_out_begin(in_cols, padding_left, fj, stride_c, out_cols);
+
+                T sum = 0;
+                for(int b = 0; b < batch; b++) {
+                    const T *dout = dout_data + (b*out_channels + oc)*out_rows*out_cols;
+                    const T *in = in_data + (b*in_channels + c)*in_rows*in_cols;
+                    for(int oh = oh_begin; oh < oh_end; oh++) {
+                        const T *in_row = in + (oh*stride_r + fi - padding_top)*in_cols + fj - padding_left;
+                        for(int ow = ow_begin; ow < ow_end; ow++) {
+                            sum += dout[oh*out_cols + ow] * in_row[ow*stride_c];
+                        }
+                    }
+                }
+                dw_data[((oc*in_channels + c)*filter_height + fi)*filter_width + fj] = sum * scale;
+            }
+        }
+    }
+}
+
+// Input gradient of one (image, input channel) plane, the transposed convolution
+//   din[b][c][oh*sr + fi - pt][ow*sc + fj - pl] += dout[b][oc][oh][ow] * w[oc][c][fi][fj]
+// Every output error element is scattered to the input positions its taps read, so the zeros a
+// dilated output error would hold are never visited. Within one output row the targets are
+// distinct, the vector lanes run over it without conflicts.
+#pragma acc routine vector
+template<class T>
+static void conv_dgrad_plane(int b, int c, const T *dout_data, const T *filter_data, T *din_data, int in_channels, int in_rows, int in_cols, int out_channels, int out_rows, int out_cols, int filter_height, int filter_width, int stride_r, int stride_c, int padding_top, int padding_left) {
+    T *din = din_data + (b*in_channels + c)*in_rows*in_cols;
+
+    #pragma acc loop vector
+    for(int k = 0; k < in_rows*in_cols; k++) {
+        din[k] = 0;
+    }
+
+    for(int oc = 0; oc < out_channels; oc++) {
+        const T *dout = dout_data + (b*out_channels + oc)*out_rows*out_cols;
+        const T *w = filter_data + (oc*in_channels + c)*filter_height*filter_width;
+
+        for(int fi = 0; fi < filter_height; fi++) {
+            int oh_begin = conv_out_begin(0, padding_top, fi, stride_r, out_rows), oh_end = conv_out_begin(in_rows, padding_top, fi, stride_r, out_rows);
+
+            for(int fj = 0; fj < filter_width; fj++) {
+                int ow_begin = conv_out_begin(0, padding_left, fj, stride_c, out_cols), ow_end = conv_out_begin(in_cols, padding_left, fj, stride_c, out_cols);
+                T wv = w[fi*filter_width + fj];
+
+                for(int oh = oh_begin; oh < oh_end; oh++) {
+                    T *din_row = din + (oh*stride_r + fi - padding_top)*in_cols + fj - padding_left;
+                    const T *dout_row = dout + oh*out_cols;
+                    #pragma acc loop vector
+                    for(int ow = ow_begin; ow < ow_end; ow++) {
+                        din_row[ow*stride_c] += wv * dout_row[ow];
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+#include <complex>
+#include "tensor.hpp"
+#include "gemm.hpp"
+
+// Self-contained FFTs and the FFT convolution built on them, host only.
+namespace Neural::Kernels {
+    // In-place complex FFT of any length, mixed radix 4/2/3/5 with a generic prime butterfly.
+    // Unnormalized, the inverse of the forward returns size() * x.
+    template<class T>
+    class FFT {
+        int _n;
+        std::vector<int> factors;
+        // exp(-2*pi*i*k/n) for k < n
+        std::vector<std::complex<T>> twiddles;
+
+        void pass(const std::complex<T> *, std::complex<T> *, int, int, int, bool) const;
+
+    public:
+        explicit FFT(int n = 1);
+
+        int size() const { return _n; }
+        void transform(std::complex<T> *data, bool inverse) const;
+    };
+
+    // 2D real FFT of a rows x cols grid (cols even) to rows x (cols/2 + 1) spectra.
+    // Rows go through a half-length complex FFT, columns through a full-length one.
+    template<class T>
+    class RealFFT2D {
+        int _rows, _cols;
+        FFT<T> row_fft, col_fft;
+        // exp(-2*pi*i*k/cols) for k <= cols/2
+        std::vector<std::complex<T>> row_twiddles;
+
+    public:
+        RealFFT2D(int rows, int cols);
+
+        // smallest even 2^a 3^b 5^c >= n
+        static int good_size(int n);
+
+        int rows() const { return _rows; }
+        int cols() const { return _cols; }
+        int spectrum_cols() const { return _cols / 2 + 1; }
+        int spectrum_size() const { return _rows * spectrum_cols(); }
+
+        // in is h x w with leading dimension ld, placed at (row0, col0) of a rows x cols grid of zeros
+        void forward(const T *in, int h, int w, int ld, std::complex<T> *spectrum, int row0 = 0, int col0 = 0) const;
+        // out (leading dimension ld) = top-left h x w of the unnormalized inverse, spectrum is overwritten
+        void inverse(std::complex<T> *spectrum, T *out, int h, int w, int ld) const;
+    };
+
+    // Convolution (cross-correlation, as acc_convolution2D) by pointwise products of 2D spectra.
+    // Filter spectra are cached and refreshed by version like the Winograd transforms.
+    template<class T>
+    class FFTConvolution {
+        RealFFT2D<T> plan;
+        int in_rows, in_cols, filter_height, filter_width, stride_r, stride_c, padding_top, padding_left;
+        int out_channels{0}, in_channels{0};
+        // [OC][C][spectrum_size], scaled by the inverse's 1/(rows*cols)
+        std::vector<std::complex<T>> filter_spectra;
+        long _version{-1};
+
+    public:
+        // sizes of the unpadded input, padding {top, bottom, left, right} is placed around it in the FFT grid
+        FFTConvolution(int in_rows, int in_cols, int filter_height, int filter_width, int stride_r, int stride_c, const std::vector<int> &padding = {0, 0, 0, 0});
+
+        long version() const { return _version; }
+
+        void transform_filters(const Neural::Tensor4D<T> &filters, long version);
+
+        // output = input (*) filters, input unpadded, the epilogue (row_bias per output channel) applied per output plane
+        void forward(const Neural::Tensor4D<T> &input, Neural::Tensor4D<T> *output, const Epilogue<T> &epilogue = {}) const;
+        // drv_error_filters = sum over the batch of input (*) drv_error_output, the output error acting
+        // as an (out_rows x out_cols, dilated by the stride) filter
+        void backward_filters(const Neural::Tensor4D<T> &input, const Neural::Tensor4D<T> &drv_error_output, Neural::Tensor4D<T> *drv_error_filters) const;
+    };
+}
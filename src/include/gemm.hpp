@@ -0,0 +1,99 @@
+#pragma once
+
+// Host GEMM used by acc_matrix_multiply when running on the host.
+// Blocked BLIS-style: B is packed into KC x NC panels of NR-wide micro-panels, A into MC x KC
+// blocks of MR-tall micro-panels, and a register-blocked MR x NR microkernel (AVX-512, AVX2+FMA or
+// portable C++, picked at startup, see host_kernels.hpp) walks the packed panels. Row/column panels
+// are spread over Neural::Parallel workers. Weights multiplied many times between updates can be packed once
+// into a PackedMatrix and passed in its place.
+#include <cmath>
+#include <vector>
+
+namespace Neural::Kernels {
+    enum class Activation { none, relu, sigmoid };
+
+    // Applied to each element of C after the product, before it is stored:
+    // C[i][j] = activation(C[i][j] + row_bias[i] + col_bias[j]), null biases are skipped.
+    template<class T>
+    struct Epilogue {
+        const T *row_bias{nullptr};
+        const T *col_bias{nullptr};
+        Activation activation{Activation::none};
+    };
+
+    #pragma acc routine seq
+    template<class T>
+    inline T activate(T x, Activation activation) {
+        switch(activation) {
+            case Activation::relu: return (x > (T)0) ? x : (T)0;
+            case Activation::sigmoid: return (T)1 / ((T)1 + std::exp(-x));
+            default: return x;
+        }
+    }
+
+    template<class T>
+    inline T apply_epilogue(const Epilogue<T> &ep, T x, int row, int col) {
+        if(ep.row_bias) {
+            x += ep.row_bias[row];
+        }
+        if(ep.col_bias) {
+            x += ep.col_bias[col];
+        }
+        return activate(x, ep.activation);
+    }
+
+    // apply_epilogue over the m x n block at C (leading dimension ldc), whose first element is (row, col)
+    // of the whole matrix. Host only, sigmoid goes through the vector math of vmath.hpp.
+    template<class T>
+    void apply_epilogue(const Epilogue<T> &ep, T *C, int m, int n, int ldc, int row, int col);
+
+    // C[M x N] = alpha * A[M x K] * B[K x N] + beta * C, all row-major with leading dimensions.
+    // C is not read when beta == 0. The epilogue, if any, runs on each C tile while it is in registers.
+    template<class T>
+    void gemm(int M, int N, int K, T alpha, const T *A, int lda, const T *B, int ldb, T beta, T *C, int ldc, const Epilogue<T> *epilogue = nullptr);
+
+    // C[M x N] = alpha * op(A) * op(B) + beta * C, op(X) = X^T when its flag is set.
+    // lda/ldb are the leading dimensions of A and B as stored, the transposes are folded into packing.
+    template<class T>
+    void gemm(bool transA, bool transB, int M, int N, int K, T alpha, const T *A, int lda, const T *B, int ldb, T beta, T *C, int ldc, const Epilogue<T> *epilogue = nullptr);
+
+    // A gemm operand packed ahead of time into the panels gemm would pack it into on every call: the MR-tall
+    // micro-panels of A or the NR-wide micro-panels of B, KC block after KC block. For weights, packed once per
+    // weights version instead of once per multiply. The panel sizes are those of the host kernel set it was
+    // packed with, matches() is false once set_isa() picks another one.
+    template<class T>
+    class PackedMatrix {
+        std::vector<T> panels;
+        int _rows{0}, _cols{0};
+        bool _is_b{false};
+        // HostKernels<T> the panels were packed for
+        const void *kernels{nullptr};
+        long _version{-1};
+
+    public:
+        // op(A)[M x K] as the left operand
+        void pack_a(bool transA, int M, int K, const T *A, int lda, long version);
+        // op(B)[K x N] as the right operand
+        void pack_b(bool transB, int K, int N, const T *B, int ldb, long version);
+
+        // weights version the panels were packed from, -1 before the first pack
+        long version() const { return _version; }
+        // packed as the left (is_b false) or right operand of rows x cols for the kernel set in use
+        bool matches(bool is_b, int rows, int cols) const;
+
+        int rows() const { return _rows; }
+        int cols() const { return _cols; }
+        const T *data() const { return panels.data(); }
+    };
+
+    // C[M x N] = alpha * A * op(B) + beta * C with A[M x K] packed
+    template<class T>
+    void gemm(const PackedMatrix<T> &A, bool transB, int N, T alpha, const T *B, int ldb, T beta, T *C, int ldc, const Epilogue<T> *epilogue = nullptr);
+
+    // C[M x N] = alpha * op(A) * B + beta * C with B[K x N] packed
+    template<class T>
+    void gemm(bool transA, int M, T alpha, const T *A, int lda, const PackedMatrix<T> &B, T beta, T *C, int ldc, const Epilogue<T> *epilogue = nullptr);
+
+    // ISA of the microkernel in use, e.g. "avx2"
+    const char *gemm_isa();
+}
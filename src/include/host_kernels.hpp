@@ -0,0 +1,101 @@
+#pragma once
+#include <cstdint>
+#include "gemm.hpp"
+#include "isa.hpp"
+
+// Host kernels compiled once per ISA: src/host_kernels_<isa>.cpp include src/kernels/host_kernels.inl and
+// the Makefile builds each of them with the target flags of its ISA. host_kernels<T>() returns the set of
+// Neural::get_isa(), gemm, the vmath functions and the host branches of the acc_* ops call through it.
+namespace Neural::Kernels {
+    template<class T>
+    struct HostKernels {
+        // C[M x N] = alpha * A * B + beta * C with A[i][p] = A[i*rsa + p*csa], B[p][j] = B[p*rsb + j*csb]
+        void (*gemm)(int, int, int, T, const T *, int, int, const T *, int, int, T, T *, int, const Epilogue<T> *);
+        // gemm with A and/or B already packed by pack_a / pack_b, a null Ap or Bp is packed per call as in gemm: (M, N, K,
+        // alpha, A, rsa, csa, Ap, B, rsb, csb, Bp, beta, C, ldc, epilogue)
+        void (*gemm_packed)(int, int, int, T, const T *, int, int, const T *, const T *, int, int, const T *, T, T *, int, const Epilogue<T> *);
+        // the whole of A[M x K] / B[K x N] into the panels gemm packs block by block: (M, K, A, rsa, csa, Ap) and
+        // (K, N, B, rsb, csb, Bp), Ap of M rounded up to mr times K elements, Bp of N rounded up to nr times K
+        void (*pack_a)(int, int, const T *, int, int, T *);
+        void (*pack_b)(int, int, const T *, int, int, T *);
+        int mr, nr;
+        // block apply_epilogue: C, m, n, ldc, row, col
+        void (*apply_epilogue)(const Epilogue<T> &, T *, int, int, int, int, int);
+
+        void (*vexp)(int, const T *, T *);
+        void (*vlog)(int, const T *, T *);
+        void (*vsigmoid)(int, const T *, T *);
+        void (*vtanh)(int, const T *, T *);
+
+        // output = max(input, 0)
+        void (*relu)(int, const T *, T *);
+        // drv_error_output_preact = (output > 0) ? drv_error_output : 0, from (drv_error_output, output)
+        void (*relu_backprop)(int, const T *, const T *, T *);
+        // a += b
+        void (*add)(int, T *, const T *);
+        // a *= mltp
+        void (*mltp)(int, T *, T);
+
+        // planes of rows x cols into padded_rows x padded_cols planes at (top, left), inner_rows / inner_cols zeros
+        // between the elements and zeros everywhere else: (in, out, planes, rows, cols, padded_rows, padded_cols,
+        // top, left, inner_rows, inner_cols)
+        void (*pad2D)(const T *, T *, int, int, int, int, int, int, int, int, int);
+        // the rows x cols window at (top, left) of each padded plane: (in, out, planes, rows, cols, padded_rows,
+        // padded_cols, top, left)
+        void (*crop2D)(const T *, T *, int, int, int, int, int, int, int);
+        // contiguous out[shape] = in read with strides[4], the transposed and sliced views of acc_copy
+        void (*gather4D)(const T *, T *, const int *, const int *);
+
+        // acc_convolution2D_wgrad / acc_convolution2D_dgrad, the arguments of conv_wgrad_channel / conv_dgrad_plane
+        void (*conv_wgrad)(const T *, const T *, T *, T *, int, int, int, int, int, int, int, int, int, int, int, int, int, T);
+        void (*conv_dgrad)(const T *, const T *, T *, int, int, int, int, int, int, int, int, int, int, int, int, int);
+    };
+
+    // int8 GEMM epilogue: real = (acc + bias[c]) * scale[c] with c the row (per_row) or the column of C, then the
+    // activation, then requantized to round(real * output_scale_inv) in [-127, 127] (or stored as is in float)
+    struct Int8Epilogue {
+        const int32_t *bias{nullptr};
+        const float *scale{nullptr};
+        bool per_row{false};
+        Activation activation{Activation::none};
+        float output_scale_inv{1.0f};
+    };
+
+    // kernels of the int8 inference engine (quantize.hpp)
+    struct Int8Kernels {
+        // C[i][j] = epilogue(sum_k A[i*lda + k] * B[j*ldb + k]) into int8 C or, when given, float Cf: (M, N, K, A, lda,
+        // B, ldb, epilogue, C, Cf, ldc)
+        void (*gemm)(int, int, int, const int8_t *, int, const int8_t *, int, const Int8Epilogue &, int8_t *, float *, int);
+        // patch rows of one image for gemm: (in, patches, channels, rows, cols, filter_rows, filter_cols, stride_rows,
+        // stride_cols, pad_top, pad_left, out_rows, out_cols)
+        void (*im2col)(const int8_t *, int8_t *, int, int, int, int, int, int, int, int, int, int, int);
+    };
+
+    // kernels of the sign-binarized layers (xnor.hpp), +-1 vectors packed as bits, set for +1, in 64-bit words
+    struct XnorKernels {
+        // C[i][j] = sum_k a_ik * b_jk over the +-1 bits of A's rows and B's rows = valid_j - 2 * popcount((A_i ^ B_j) &
+        // Bmask_j), valid_j = popcount(Bmask_j), the bits of B outside its mask (padding) count as 0. Without Bmask
+        // all K bits are valid and the tail bits of the last word must be 0 in both: (M, N, words, K, A, lda, B,
+        // Bmask, ldb, C, ldc)
+        void (*gemm)(int, int, int, int, const uint64_t *, int, const uint64_t *, const uint64_t *, int, int32_t *, int);
+    };
+
+    struct HostKernelSet {
+        // SIMD_ISA the set was compiled with, "generic" when its target flags were missing
+        const char *isa;
+        HostKernels<double> d;
+        HostKernels<float> f;
+        Int8Kernels i8;
+        XnorKernels xnor;
+    };
+
+    namespace generic { extern const HostKernelSet kernel_set; }
+    namespace avx2 { extern const HostKernelSet kernel_set; }
+    namespace avx512 { extern const HostKernelSet kernel_set; }
+
+    const HostKernelSet &host_kernel_set();
+
+    template<class T> const HostKernels<T> &host_kernels();
+    template<> inline const HostKernels<double> &host_kernels<double>() { return host_kernel_set().d; }
+    template<> inline const HostKernels<float> &host_kernels<float>() { return host_kernel_set().f; }
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "tensor.hpp"
+
+// Read-only memory mapping of an unsigned byte IDX file (the MNIST format: big-endian header of magic 0x0000 08 nd
+// and nd dimensions, then the elements row-major). The elements are never copied or widened on load: view()
+// borrows them from the mapping as uint8, and the training loop converts one batch at a time while normalizing it
+// (acc_normalize_img). The pages come from the page cache on first touch and processes mapping the same file
+// share them.
+namespace Neural {
+    class IdxFile {
+        void *map{nullptr};
+        size_t map_size{0};
+        int _magic{0};
+        Shape4D _shape;
+        const uint8_t *_data{nullptr};
+
+    public:
+        explicit IdxFile(const std::string &path);
+        ~IdxFile();
+        IdxFile(const IdxFile &) = delete;
+        IdxFile &operator=(const IdxFile &) = delete;
+
+        // 0x0800 + number of dimensions, e.g. 2051 for MNIST images
+        int magic() const { return _magic; }
+        // the first dimension is the count, the others fill the trailing dims: [n, 1, rows, cols] for images,
+        // [n, 1, 1, 1] for labels
+        Shape4D shape() const { return _shape; }
+        const uint8_t *data() const { return _data; }
+        // borrowed view of the mapped elements, valid while the IdxFile lives. The mapping is read-only
+        TensorView4D<uint8_t> view() const { return TensorView4D<uint8_t>(const_cast<uint8_t *>(_data), _shape); }
+    };
+}
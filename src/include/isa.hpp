@@ -0,0 +1,17 @@
+#pragma once
+
+// Instruction set of the host kernels. The kernels are built once per ISA (host_kernels.hpp) and the
+// widest one the cpu and the OS support is picked at startup from CPUID, so one binary covers the
+// AVX2-only and the AVX-512 hosts.
+namespace Neural {
+    enum class Isa { generic, avx2, avx512 };
+
+    // best ISA of this cpu: AVX2+FMA / AVX-512F with the OS saving the ymm / zmm state
+    Isa cpu_isa();
+    // ISA the host kernels run with: cpu_isa(), capped by NEURAL_ISA=generic|avx2|avx512 or set_isa()
+    Isa get_isa();
+    // capped to cpu_isa(), for benchmarks and reference runs
+    void set_isa(Isa);
+
+    const char *isa_name(Isa);
+}
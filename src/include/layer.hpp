@@ -1,7 +1,13 @@
 #pragma once
 #include "tensor.hpp"
 #include "ops.hpp"
+#include "winograd.hpp"
+#include "fft.hpp"
+#include "xnor.hpp"
+#include "autotune.hpp"
+#include "backend.hpp"
 #include <memory>
+#include <map>
 #include <string>
 #include <iostream>
 #include <sstream>
@@ -13,18 +19,30 @@
 //TODO: require prev layer on constructor, set weight sizes
 //TODO: test batch now vs batch normal vs online (duration, accuracy)
 // TODO: Weights class including biases, dimensionality 2
+// The layers are templates on the compute type T (double or float), instantiated in layer.cpp: weights,
+// activations and gradients are all T, the loss and the learning rate stay double.
 namespace Neural::Layers {
 
     ////////////////////////////// <Layer> //////////////////////////////////////////////////
+    template<class T>
     class Layer {        
     protected:        
         std::string layerType{""}, layerOp{""};
-        Neural::Activations::Base<double> activation_fn;
+        Neural::Activations::Base<T> activation_fn;
+        // kernels of the ops, the Network's backend once the layer is added to one
+        std::shared_ptr<const Neural::Backend<T>> backend;
         Neural::Shape4D prev_shape_proto, input_shape_proto, output_shape_proto;
         int features, id;
         bool _acc{false};
+        // "native" keeps the tensors in T, "bf16" runs the forward on weights rounded to bfloat16 (Network::set_storage)
+        std::string storage{"native"};
+        // order of the activations the layer reads and writes (Network::set_layout)
+        Neural::Layout layout{Neural::Layout::nchw};
 
         std::string gph();
+        // prev_output in the layer's layout: borrowed when it already is, or when the two orders coincide (a
+        // single channel or a single pixel), otherwise converted into a copy the layer owns
+        Neural::Tensor4D<T> * input_in_layout(Neural::Tensor4D<T> &);
 
         static int nl;
     public:
@@ -35,73 +53,248 @@ namespace Neural::Layers {
         auto type() const { return layerType; }
         std::string get_activation_name() { return activation_fn.name(); }
         void set_acc(bool acc) { _acc = acc; }
+        const Neural::Backend<T> & get_backend() const { return *backend; }
+        void set_backend(std::shared_ptr<const Neural::Backend<T>> _backend) { backend = _backend; }
+        const std::string & get_storage() const { return storage; }
+        virtual void set_storage(const std::string &_storage) { storage = _storage; }
+        Neural::Layout get_layout() const { return layout; }
+        void set_layout(Neural::Layout _layout) { layout = _layout; }
+        Shape4D get_prev_shape_proto() { return prev_shape_proto; }
+        Shape4D get_input_shape_proto() { return input_shape_proto; }
         Shape4D get_output_shape_proto() { return output_shape_proto; }
         virtual void init() = 0;
+        // picks the kernels for the batch size the layer will run with, after init()
+        virtual void autotune(int) {}
 
-        virtual Neural::Tensor4D<double> * forward_calc_input(Neural::Tensor4D<double> &) = 0;
-        virtual Neural::Tensor4D<double> * forward_calc_output_preact(Neural::Tensor4D<double> &) = 0;
-        Neural::Tensor4D<double> * forward_activate(Neural::Tensor4D<double> &);
+        virtual Neural::Tensor4D<T> * forward_calc_input(Neural::Tensor4D<T> &) = 0;
+        virtual Neural::Tensor4D<T> * forward_calc_output_preact(Neural::Tensor4D<T> &) = 0;
+        Neural::Tensor4D<T> * forward_activate(Neural::Tensor4D<T> &);
+        // activated output from the input, forward_calc_output_preact followed by forward_activate unless
+        // the layer can fuse the two; backprop only reads the activated output
+        virtual Neural::Tensor4D<T> * forward_calc_output(Neural::Tensor4D<T> &);
 
-        Neural::Tensor4D<double> * backprop_calc_drv_error_output_preact(std::string, double &, Neural::Tensor4D<double> &, Neural::Tensor4D<int> &);
-        Neural::Tensor4D<double> * backprop_calc_drv_error_output_preact(Neural::Tensor4D<double> &, Neural::Tensor4D<double> &);
-        virtual Neural::Tensor4D<double> * backprop_calc_drv_error_prev_output(Neural::Tensor4D<double> &, Neural::Tensor4D<double> &) = 0;
-        virtual void backprop_update(double, Neural::Tensor4D<double> &, Neural::Tensor4D<double> &) = 0;
+        // output layer while training: forward_calc_output plus the loss and its drv_error_output_preact (returned
+        // through the last argument). Softmax with CrossEntropy runs fused on the logits
+        Neural::Tensor4D<T> * forward_calc_output_loss(Neural::Tensor4D<T> &, std::string, double &, Neural::Tensor4D<int> &, Neural::Tensor4D<T> *&);
+        Neural::Tensor4D<T> * backprop_calc_drv_error_output_preact(std::string, double &, Neural::Tensor4D<T> &, Neural::Tensor4D<int> &);
+        Neural::Tensor4D<T> * backprop_calc_drv_error_output_preact(Neural::Tensor4D<T> &, Neural::Tensor4D<T> &);
+        virtual Neural::Tensor4D<T> * backprop_calc_drv_error_prev_output(Neural::Tensor4D<T> &, Neural::Tensor4D<T> &) = 0;
+        virtual void backprop_update(double, Neural::Tensor4D<T> &, Neural::Tensor4D<T> &) = 0;
     };
     
-    class BatchNormal : public Layer {
+    template<class T>
+    class BatchNormal : public Layer<T> {
     };
     ////////////////////////////// </Layer> //////////////////////////////////////////////////
     
     ////////////////////////////// <Weighted> ////////////////////////////////////////////////
-    class Weighted : public Layer {
+    template<class T>
+    class Weighted : public Layer<T> {
     protected:
+        using Layer<T>::layerType; using Layer<T>::layerOp; using Layer<T>::activation_fn; using Layer<T>::backend;
+        using Layer<T>::prev_shape_proto; using Layer<T>::input_shape_proto; using Layer<T>::output_shape_proto;
+        using Layer<T>::features; using Layer<T>::id; using Layer<T>::_acc; using Layer<T>::gph; using Layer<T>::storage;
+        using Layer<T>::layout; using Layer<T>::input_in_layout;
+
         Weighted() {}
         Weighted(Neural::Shape4D , int, std::string);
         virtual ~Weighted();
         
         Neural::Shape4D weights_shape, biases_shape;
         
-        std::unique_ptr<Neural::Tensor4D<double>> weights, biases;
+        std::unique_ptr<Neural::Tensor4D<T>> weights, biases;
+        // bumped whenever weights change, so derived caches know when to refresh
+        long weights_version{0};
+        // weights rounded to bf16 for storage "bf16", widened to T for the kernels, of weights_bf16_version
+        std::unique_ptr<Neural::Tensor4D<T>> weights_bf16;
+        long weights_bf16_version{-1};
+
+        // the weights the forward and the input gradient read: weights, or its bf16 copy for storage "bf16" while
+        // weights stays the full precision master that backprop_update steps
+        virtual Neural::Tensor4D<T> & forward_weights();
+        // applied to the weights after each backprop_update step, before the derived forms are refreshed
+        virtual void constrain_weights() {}
+        // refresh the forms of forward_weights() packed for the host gemm that a pass has used, at the end of
+        // backprop_update so the following passes find them packed for the new weights version. The master
+        // weights keep the canonical layout: the gpu and the other backends read them as they are, and
+        // get_weights() / param2file_csv export them without unpacking
+        virtual void pack_weights() {}
 
         void init();
+        void set_storage(const std::string &);
+
+        // bias and the activation applied by the weights kernel's epilogue, the preact is never stored
+        virtual Neural::Tensor4D<T> * forward_calc_output_fused(Neural::Tensor4D<T> &, Neural::Kernels::Activation) = 0;
+        Neural::Tensor4D<T> * forward_calc_output_preact(Neural::Tensor4D<T> &);
+        Neural::Tensor4D<T> * forward_calc_output(Neural::Tensor4D<T> &);
         
-        void backprop_update(double, Neural::Tensor4D<double> &, Neural::Tensor4D<double> &);
-        virtual Neural::Tensor4D<double> * backprop_calc_drv_error_weights(Neural::Tensor4D<double> &, Neural::Tensor4D<double> &) = 0;
-        Neural::Tensor4D<double> * backprop_calc_drv_error_biases(Neural::Tensor4D<double> &);
+        void backprop_update(double, Neural::Tensor4D<T> &, Neural::Tensor4D<T> &);
+        virtual Neural::Tensor4D<T> * backprop_calc_drv_error_weights(Neural::Tensor4D<T> &, Neural::Tensor4D<T> &) = 0;
+        virtual Neural::Tensor4D<T> * backprop_calc_drv_error_biases(Neural::Tensor4D<T> &);
+
+    public:
+        // the full precision master weights and the biases, on the device when the layer runs there
+        Neural::Tensor4D<T> & get_weights() { return *weights.get(); }
+        Neural::Tensor4D<T> & get_biases() { return *biases.get(); }
     };
     
-    class Fc: public Weighted {
-    
+    template<class T>
+    class Fc: public Weighted<T> {
+    protected:
+        using Weighted<T>::layerType; using Weighted<T>::layerOp; using Weighted<T>::backend; using Weighted<T>::gph;
+        using Weighted<T>::prev_shape_proto; using Weighted<T>::input_shape_proto; using Weighted<T>::output_shape_proto;
+        using Weighted<T>::weights_shape; using Weighted<T>::biases_shape; using Weighted<T>::weights; using Weighted<T>::biases;
+        using Weighted<T>::forward_weights; using Weighted<T>::layout; using Weighted<T>::input_in_layout;
+        using Weighted<T>::weights_version;
+
+        // forward_weights() as the packed right operand of the host gemm, of its version()
+        Neural::Kernels::PackedMatrix<T> packed_weights;
+        // packed_weights of the current weights
+        const Neural::Kernels::PackedMatrix<T> & packed_forward_weights();
+        void pack_weights();
+
     public:
         Fc(Neural::Shape4D , int, std::string);
         ~Fc();
         
-        Neural::Tensor4D<double> * forward_calc_input(Neural::Tensor4D<double> &);
-        Neural::Tensor4D<double> * forward_calc_output_preact(Neural::Tensor4D<double> &);
+        Neural::Tensor4D<T> * forward_calc_input(Neural::Tensor4D<T> &);
+        Neural::Tensor4D<T> * forward_calc_output_fused(Neural::Tensor4D<T> &, Neural::Kernels::Activation);
 
-        Neural::Tensor4D<double> * backprop_calc_drv_error_weights(Neural::Tensor4D<double> &, Neural::Tensor4D<double> &);
-        Neural::Tensor4D<double> * backprop_calc_drv_error_prev_output(Neural::Tensor4D<double> &, Neural::Tensor4D<double> &);  
+        Neural::Tensor4D<T> * backprop_calc_drv_error_weights(Neural::Tensor4D<T> &, Neural::Tensor4D<T> &);
+        Neural::Tensor4D<T> * backprop_calc_drv_error_prev_output(Neural::Tensor4D<T> &, Neural::Tensor4D<T> &);  
     };
     
-    class Conv: public Weighted {
-    
+    template<class T>
+    class Conv: public Weighted<T> {
+    protected:
+        using Weighted<T>::layerType; using Weighted<T>::layerOp; using Weighted<T>::backend; using Weighted<T>::gph;
+        using Weighted<T>::prev_shape_proto; using Weighted<T>::input_shape_proto; using Weighted<T>::output_shape_proto;
+        using Weighted<T>::weights_shape; using Weighted<T>::biases_shape; using Weighted<T>::weights; using Weighted<T>::biases;
+        using Weighted<T>::weights_version; using Weighted<T>::forward_weights; using Weighted<T>::layout;
+        using Weighted<T>::input_in_layout;
+
     private:
-        std::vector<int> stride{0,0}, filter_size{0,0}, padding{0,0,0,0}, stride_bp_weights{0,0};
+        // padding {top, bottom, left, right} is never materialized, the kernels take it and index around it
+        std::vector<int> stride{0,0}, filter_size{0,0}, padding{0,0,0,0};
         int out_height, out_width;
-        std::string padding_type{""};
+        std::string padding_type{""}, algorithm{""};
+
+        // kernel per pass, set from the algorithm or by autotune()
+        Neural::Autotune::ConvPlan plan;
+        // one per tile size in the plan
+        std::map<int, std::unique_ptr<Neural::Kernels::Winograd<T>>> winograd;
+        std::unique_ptr<Neural::Kernels::FFTConvolution<T>> fft;
+        // bias gradient left by the direct weights pass for the following backprop_calc_drv_error_biases
+        std::unique_ptr<Neural::Tensor4D<T>> drv_error_biases_fused;
+
+        // kernel actually run for a pass of the plan, the GEMM, Winograd and FFT lowerings are host only
+        // so the gpu keeps the direct kernels. They stand in for the simd backend's direct kernel only,
+        // a pass whose kernel comes from another backend runs that one (lowered = false). Winograd and FFT
+        // transform nchw planes, channels-last runs im2col in their place
+        std::string active_algorithm(const std::string &, bool lowered);
+        // winograd of the tile size with filters transformed from the current weights
+        Neural::Kernels::Winograd<T> * winograd_filters(int);
+        // fft with filter spectra of the current weights
+        Neural::Kernels::FFTConvolution<T> * fft_filters();
+        // forward_weights() packed for the gemm of the im2col forward and input gradient, of their version()
+        Neural::Kernels::PackedMatrix<T> packed_filters, packed_filters_dgrad;
+        // the packed filters of the current weights and layout for the im2col forward (dgrad false) or input gradient
+        const Neural::Kernels::PackedMatrix<T> * im2col_filters(bool dgrad);
 
     protected:
-        Neural::Tensor4D<double> * forward_calc_input(Neural::Tensor4D<double> &);
-        Neural::Tensor4D<double> * forward_calc_output_preact(Neural::Tensor4D<double> &);
+        void pack_weights();
+
+        Neural::Tensor4D<T> * forward_calc_input(Neural::Tensor4D<T> &);
+        Neural::Tensor4D<T> * forward_calc_output_fused(Neural::Tensor4D<T> &, Neural::Kernels::Activation);
 
-        Neural::Tensor4D<double> * backprop_calc_drv_error_weights(Neural::Tensor4D<double> &, Neural::Tensor4D<double> &);
-        Neural::Tensor4D<double> * backprop_calc_drv_error_prev_output(Neural::Tensor4D<double> &, Neural::Tensor4D<double> &);  
+        Neural::Tensor4D<T> * backprop_calc_drv_error_weights(Neural::Tensor4D<T> &, Neural::Tensor4D<T> &);
+        Neural::Tensor4D<T> * backprop_calc_drv_error_biases(Neural::Tensor4D<T> &);
+        Neural::Tensor4D<T> * backprop_calc_drv_error_prev_output(Neural::Tensor4D<T> &, Neural::Tensor4D<T> &);  
         
         bool is_padded() { return padding[0] != 0 || padding[1] != 0 || padding[2]!=0 || padding[3]!=0; }
 
     public:
-        Conv(Neural::Shape4D , int, std::string, std::vector<int>, std::vector<int>, std::string);
+        // algorithm: "direct" (reference loop nests), "im2col" (lowered to GEMM) or, for 3x3 and 5x5
+        // stride-1 filters, "winograd" / "winograd_f4" (4x4 output tiles) or "winograd_f2" (2x2 output tiles),
+        // or "fft" (pointwise products of the 2D spectra, for large filters). Winograd covers forward and the
+        // input gradient and FFT forward and the filter gradient, im2col runs the other pass.
+        // "auto" runs im2col until autotune() has picked the fastest kernel per pass
+        Conv(Neural::Shape4D , int, std::string, std::vector<int>, std::vector<int>, std::string, std::string algorithm = "auto");
         ~Conv();
+
+        std::vector<int> get_filter_size() { return filter_size; }
+        std::vector<int> get_stride() { return stride; }
+        // {top, bottom, left, right}
+        std::vector<int> get_padding() { return padding; }
+        std::string get_algorithm() { return algorithm; }
+        void set_algorithm(std::string);
+        Neural::Autotune::ConvPlan get_plan() { return plan; }
+        void set_plan(const Neural::Autotune::ConvPlan &);
+
+        // "auto" only: the plan cached for this shape and machine, otherwise each candidate per pass is timed
+        // on random tensors of the batch size and the fastest ones are stored in the plan cache
+        void autotune(int);
+    };
+       
+    // Sign-binarized variants (XNOR-Net): the layer reads sign(x) of its input, +-1, and alpha_c * sign(w) with
+    // alpha_c the mean |w| of output channel c. On the host the forward runs on the packed sign bits, XOR and
+    // popcount over 64-bit words (xnor.hpp); the gradients and the gpu run the float kernels on the same values.
+    // Trained with the straight-through estimator: the gradients of sign(x) and alpha * sign(w) pass unchanged to
+    // x and w, Weighted::backprop_update steps the real weights, which constrain_weights() then clips to [-1, 1]:
+    // past +-1 the sign no longer changes and the straight-through gradient would only grow the weight.
+    // forward_calc_input returns sign(x) as a copy, the input it starts from borrows prev_output, which the previous
+    // layer's backprop still reads
+    template<class T>
+    class BinaryFc: public Fc<T> {
+    protected:
+        using Fc<T>::backend; using Fc<T>::gph; using Fc<T>::input_shape_proto; using Fc<T>::weights_shape;
+        using Fc<T>::weights; using Fc<T>::biases; using Fc<T>::weights_version;
+
+    private:
+        Neural::Kernels::Xnor<T> xnor;
+        // alpha * sign(weights) for the float kernels, of weights_binary_version
+        std::unique_ptr<Neural::Tensor4D<T>> weights_binary;
+        long weights_binary_version{-1};
+
+    protected:
+        Neural::Tensor4D<T> & forward_weights();
+        void constrain_weights();
+
+    public:
+        BinaryFc(Neural::Shape4D , int, std::string);
+
+        Neural::Tensor4D<T> * forward_calc_input(Neural::Tensor4D<T> &);
+        Neural::Tensor4D<T> * forward_calc_output_fused(Neural::Tensor4D<T> &, Neural::Kernels::Activation);
+
+        // bytes of the packed sign bits and scales, after the first host forward
+        size_t packed_bytes() const { return xnor.packed_bytes(); }
+    };
+
+    template<class T>
+    class BinaryConv: public Conv<T> {
+    protected:
+        using Conv<T>::backend; using Conv<T>::gph; using Conv<T>::input_shape_proto; using Conv<T>::weights_shape;
+        using Conv<T>::weights; using Conv<T>::biases; using Conv<T>::weights_version;
+
+    private:
+        Neural::Kernels::Xnor<T> xnor;
+        // alpha * sign(weights) for the float kernels, of weights_binary_version
+        std::unique_ptr<Neural::Tensor4D<T>> weights_binary;
+        long weights_binary_version{-1};
+
+    protected:
+        Neural::Tensor4D<T> & forward_weights();
+        void constrain_weights();
+
+    public:
+        // as Conv, the algorithm picks the kernels of the gradients (and of the gpu forward)
+        BinaryConv(Neural::Shape4D , int, std::string, std::vector<int>, std::vector<int>, std::string, std::string algorithm = "im2col");
+
+        Neural::Tensor4D<T> * forward_calc_input(Neural::Tensor4D<T> &);
+        Neural::Tensor4D<T> * forward_calc_output_fused(Neural::Tensor4D<T> &, Neural::Kernels::Activation);
+
+        // bytes of the packed sign bits and scales, after the first host forward
+        size_t packed_bytes() const { return xnor.packed_bytes(); }
     };
        
     ////////////////////////////// </Weighted> /////////////////////////////////////////////////
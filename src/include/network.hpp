@@ -13,24 +13,64 @@
 //TODO batch_size at train time? resize whole network? so init then? 33
 
 namespace Neural {
+    // T the compute type of every layer, double or float (instantiated in network.cpp). The datasets come in
+    // as T or as the raw uint8 pixels of a mapped IDX file (idx.hpp), converted to T batch by batch. The loss and
+    // the metrics are reported in double
+    template<class T = double>
     class Network {
     private:    
-        std::vector<Neural::Layers::Layer *> layers;
+        std::vector<Neural::Layers::Layer<T> *> layers;
         Neural::Shape4D __input_shape_proto;
+        std::shared_ptr<const Neural::Backend<T>> backend;
+        std::string storage{"native"};
+        std::string layout{"nchw"};
+        // storage "bf16": the layer outputs the training forward keeps for backward, narrowed to bf16 once the next
+        // layer has read them. Their slots in outputs, and the inputs borrowing them, are nullptr until unstash()
+        std::vector<std::unique_ptr<Neural::Tensor4D<Neural::bfloat16>>> stash;
+
+        void stash_output(int, std::vector<Neural::Tensor4D<T> *> &, std::vector<Neural::Tensor4D<T> *> &);
+        // widens back what layer i's backward reads, its output and the previous output its input borrows
+        void unstash(int, std::vector<Neural::Tensor4D<T> *> &, std::vector<Neural::Tensor4D<T> *> &);
         
     public:
         Network(const Neural::Shape4D &);
         ~Network();
 
-        void init();
+        // with the batch size the layers also autotune their kernels for it (Conv "auto")
+        void init(int batch_size = 0);
+
+        Neural::Shape4D get_input_shape_proto() const { return __input_shape_proto; }
+        const std::vector<Neural::Layers::Layer<T> *> & get_layers() const { return layers; }
+
+        // kernels of every layer's ops, Neural::default_backend() unless set. A spec as in backend.hpp,
+        // e.g. "reference" or "simd,convolution2D=openmp"
+        const Neural::Backend<T> & get_backend() const { return *backend; }
+        void set_backend(const std::string &);
+        void set_backend(std::shared_ptr<const Neural::Backend<T>>);
+
+        // "native" (default) keeps every tensor in T. "bf16" (mixed precision, for Network<float>) stores the
+        // activations kept for backward as bfloat16 and runs the forward on bf16 weights; the kernels still compute
+        // and accumulate in T and backprop_update steps the T master weights
+        const std::string & get_storage() const { return storage; }
+        void set_storage(const std::string &);
+
+        // order of the activations between the layers, "nchw" (default) or "nhwc" (channels-last). Set before
+        // init(), the layers read and write their activations in it, the datasets stay nchw and are converted by
+        // the first layer. Under nhwc an Fc flattens its input in (row, col, channel) order, Conv runs direct or
+        // im2col (winograd and fft plans fall back to im2col)
+        const std::string & get_layout() const { return layout; }
+        void set_layout(const std::string &);
 
-        void forward(Neural::Tensor4D<double> &, std::vector<Neural::Tensor4D<double> *> &, std::vector<Neural::Tensor4D<double> *> &);
-        Neural::Tensor4D<double> *forward(Neural::Tensor4D<double> &init_input);
+        // training forward: keeps every layer's input and output, and the output layer also gives the loss
+        // against the labels and its drv_error_output_preact
+        void forward(Neural::Tensor4D<T> &, std::vector<Neural::Tensor4D<T> *> &, std::vector<Neural::Tensor4D<T> *> &, std::string, Neural::Tensor4D<int> &, double &, Neural::Tensor4D<T> *&);
+        Neural::Tensor4D<T> *forward(Neural::Tensor4D<T> &init_input);
 
-        template<class L, class ... Args>
+        // L a layer template of Neural::Layers, instantiated on the network's T
+        template<template<class> class L, class ... Args>
         void add_layer(Args ...args) {
             LOGV << "Network::add_layer";
-            Neural::Layers::Layer *newl;
+            Neural::Layers::Layer<T> *newl;
             Neural::Shape4D prev_sh;          
             
             if(layers.size()==0) {
@@ -40,12 +80,16 @@ namespace Neural {
                 prev_sh = layers[layers.size()-1]->get_output_shape_proto();
             }
             
-            newl = new L(prev_sh, args...);
+            newl = new L<T>(prev_sh, args...);
+            newl->set_backend(backend);
+            newl->set_storage(storage);
+            newl->set_layout((layout == "nhwc") ? Neural::Layout::nhwc : Neural::Layout::nchw);
             layers.push_back(newl);
         }
         
-        void eval(const Tensor4D<double> &eval_dataset, const Tensor4D<int> &eval_labels, double &recall, double &precision, double &accuracy, double &f1_score);
-        void train(const Tensor4D<double> &, const Tensor4D<int> &, const Tensor4D<double> &, const Tensor4D<int> &, int, bool, double, std::string, int fepochs = 0, int fsteps = 0);
+        // D the dataset element type, T or uint8_t
+        template<class D> void eval(const Tensor4D<D> &eval_dataset, const Tensor4D<int> &eval_labels, double &recall, double &precision, double &accuracy, double &f1_score);
+        template<class D> void train(const Tensor4D<D> &, const Tensor4D<int> &, const Tensor4D<D> &, const Tensor4D<int> &, int, bool, double, std::string, int fepochs = 0, int fsteps = 0);
     };
 }
 
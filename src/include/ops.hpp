@@ -4,6 +4,10 @@
 #include <iostream>
 #include "tensor.hpp"
 #include "utils.hpp"
+#include "gemm.hpp"
+#include "backend.hpp"
+#include "random.hpp"
+#include "bfloat16.hpp"
 
 #if !defined(_OPENACC)
 #define SAFEDATA
@@ -16,26 +20,64 @@ void tparallel_conv5(double *conv_input, double *conv_filters, double *conv_outp
 std::vector<Neural::Tensor4D<double> *> calc_metrics(Neural::Tensor4D<int> &confusion_matrix);
 
 template<class T> void acc_copy(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
+template<class T> void acc_copy(const Neural::TensorView4D<T> &, Neural::Tensor4D<T> *);
+// same elements in the second tensor's layout (Tensor4D::layout), a plain copy when they match
+template<class T> void acc_convert_layout(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
 template<class T> void acc_add(Neural::Tensor4D<T> *, const Neural::Tensor4D<T> &);
 template<class T> void acc_val(Neural::Tensor4D<T> *, T );
 template<class T> void acc_zeros(Neural::Tensor4D<T> *);
 template<class T> void acc_mltp(Neural::Tensor4D<T> *, T );
 template<class T> void acc_accumulate(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
-template<class T> void acc_rng(Neural::Tensor4D<T> *, T );
+// normal numbers of the stream (random.hpp) scaled so that their max - min range is 2 * mltp
+template<class T> void acc_rng(Neural::Tensor4D<T> *, T , Neural::Random::Stream stream = {});
 template<class T> void acc_flip_spatial(Neural::Tensor4D<T> *);
-template<class T> void acc_matrix_multiply(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
-template<class T> void acc_convolution2D(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *, const std::vector<int> &);
+// bfloat16 storage (bfloat16.hpp): narrowing to bf16 and widening back, and the values of A rounded to bf16 in B
+template<class T> void acc_pack_bf16(const Neural::Tensor4D<T> &, Neural::Tensor4D<Neural::bfloat16> *);
+template<class T> void acc_unpack_bf16(const Neural::Tensor4D<Neural::bfloat16> &, Neural::Tensor4D<T> *);
+template<class T> void acc_round_bf16(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
+// sign binarization (BinaryFc, BinaryConv): B = +1 where A > 0, -1 elsewhere; the weights binarized per output
+// channel to alpha_c * sign(w), alpha_c = mean |w| of the channel, channels along the rows of the flattened
+// [shape[0] x rest] weights (conv filters) or along its columns (per_column, fc weights); A clipped to [lo, hi]
+template<class T> void acc_sign(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
+template<class T> void acc_binarize(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *, bool per_column);
+template<class T> void acc_clip(Neural::Tensor4D<T> *, T lo, T hi);
+// C = op(A) * op(B), op transposes the flattened 2D matrix when its flag is set, without copying it.
+// The epilogue (bias per row/column of C, activation) is applied before C is written
+template<class T> void acc_matrix_multiply(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *, bool transA = false, bool transB = false, const Neural::Kernels::Epilogue<T> &epilogue = {});
+// C = A * B with B [K x M] packed ahead for the host gemm (the weights of an Fc layer), host only
+template<class T> void acc_matrix_multiply_packed(const Neural::Tensor4D<T> &, const Neural::Kernels::PackedMatrix<T> &, Neural::Tensor4D<T> *, const Neural::Kernels::Epilogue<T> &epilogue = {});
+// padding {top, bottom, left, right} is applied by indexing: the input is read as if surrounded by that many zeros.
+// The epilogue's row_bias is indexed by output channel (col_bias is unused)
+template<class T> void acc_convolution2D(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *, const std::vector<int> &, const std::vector<int> &padding = {0, 0, 0, 0}, const Neural::Kernels::Epilogue<T> &epilogue = {});
+// filter gradient of acc_convolution2D and the bias gradient in one pass over the output error, both multiplied by scale
+template<class T> void acc_convolution2D_wgrad(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *, Neural::Tensor4D<T> *, const std::vector<int> &, const std::vector<int> &padding = {0, 0, 0, 0}, T scale = 1);
+// input gradient of acc_convolution2D (transposed convolution) into the unpadded input shape, strided outputs are not dilated
+template<class T> void acc_convolution2D_dgrad(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *, const std::vector<int> &, const std::vector<int> &padding = {0, 0, 0, 0});
+// im2col + GEMM lowering of acc_convolution2D (forward), its filter gradient (wgrad) and its input gradient (dgrad), host only.
+// Input and input gradient are the unpadded tensors, padding as in acc_convolution2D. Forward and dgrad take the filters
+// packed by acc_pack_im2col_filters when given, otherwise they are packed on each call
+template<class T> void acc_convolution2D_im2col(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *, const std::vector<int> &, const std::vector<int> &padding = {0, 0, 0, 0}, const Neural::Kernels::Epilogue<T> &epilogue = {}, const Neural::Kernels::PackedMatrix<T> *packed_filters = nullptr);
+template<class T> void acc_convolution2D_im2col_wgrad(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *, const std::vector<int> &, const std::vector<int> &padding = {0, 0, 0, 0});
+template<class T> void acc_convolution2D_im2col_dgrad(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *, const std::vector<int> &, const std::vector<int> &padding = {0, 0, 0, 0}, const Neural::Kernels::PackedMatrix<T> *packed_filters = nullptr);
+// OIHW filters packed as the gemm operand of acc_convolution2D_im2col (dgrad false) or acc_convolution2D_im2col_dgrad
+// (dgrad true) on tensors of the layout: the MR-tall output channel panels of [OC x C*FH*FW] for nchw, the NR-wide
+// ones of the OHWI filters for nhwc, tagged with the weights version
+template<class T> void acc_pack_im2col_filters(const Neural::Tensor4D<T> &, Neural::Layout, bool dgrad, Neural::Kernels::PackedMatrix<T> *, long version);
 template<class T> void acc_relu(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
 template<class T> void acc_relu_backprop(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
 template<class T> void acc_sigmoid(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
 template<class T> void acc_sigmoid_backprop(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
 template<class T> void acc_softmax(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
 template<class T> void acc_softmax_backprop(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
+// softmax of the logits into output, their gradient (output - labels) and the batch mean cross-entropy, stable for any logit range
+template<class T> T acc_softmax_cross_entropy(const Neural::Tensor4D<T> &, const Neural::Tensor4D<int> &, Neural::Tensor4D<T> *, Neural::Tensor4D<T> *);
 template<class T> void acc_pad2D_inner(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *, int , int , int , int , int , int );
 template<class T> void acc_pad2D(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *, int , int , int , int );
 template<class T> Neural::Tensor4D<T>* acc_padded2D_inner(const Neural::Tensor4D<T> &, int , int , int , int , int , int );
 template<class T> void acc_rev_pad2D(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *, int , int , int , int );
 template<class T> void acc_normalize_img(Neural::Tensor4D<T> *);
+// a batch window of raw pixels (the dataset's T, or uint8 from a mapped IDX file) normalized into a T batch
+template<class S, class T> void acc_normalize_img(const Neural::Tensor4D<S> &, Neural::Tensor4D<T> *);
 template<class T> void acc_make_batch(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *, int );
 template<class T> Neural::Tensor4D<int> * acc_calc_confusion_matrix(Neural::Tensor4D<T> &, Neural::Tensor4D<int> &);
 
@@ -43,30 +85,34 @@ template<class T> Neural::Tensor4D<int> * acc_calc_confusion_matrix(Neural::Tens
 namespace Neural {
     namespace Activations {
         
+        // the kernels come from the backend the layer runs with
         template<class T>
         class Base {
             std::string _name;
-            void (*_fn)(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
-            void (*_backfn)(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *);
+            typename Neural::Backend<T>::ActivationFn Neural::Backend<T>::*_fn{nullptr};
+            typename Neural::Backend<T>::ActivationBackFn Neural::Backend<T>::*_backfn{nullptr};
+            Neural::Kernels::Activation _epilogue{Neural::Kernels::Activation::none};
             
             public:
                 Base() {}
-                Base(std::string name, void (*fn)(const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *), void (*backfn)(const Neural::Tensor4D<T> &, const Neural::Tensor4D<T> &, Neural::Tensor4D<T> *)  ) : _name(name), _fn(fn), _backfn(backfn) {}
+                Base(std::string name, typename Neural::Backend<T>::ActivationFn Neural::Backend<T>::*fn, typename Neural::Backend<T>::ActivationBackFn Neural::Backend<T>::*backfn, Neural::Kernels::Activation epilogue = Neural::Kernels::Activation::none) : _name(name), _fn(fn), _backfn(backfn), _epilogue(epilogue) {}
                 
                 std::string name() { return _name; }
+                // elementwise activations can run in the producing kernel's epilogue, none for the rest (softmax)
+                Neural::Kernels::Activation epilogue() const { return _epilogue; }
                 
-                void apply(const Neural::Tensor4D<T> &input, Neural::Tensor4D<T> *output) {
-                    _fn(input, output);
+                void apply(const Neural::Backend<T> &backend, const Neural::Tensor4D<T> &input, Neural::Tensor4D<T> *output) {
+                    (backend.*_fn)(input, output);
                 }
                 
-                void backward(const Neural::Tensor4D<T> &drv_error_output, const Neural::Tensor4D<T> &output, Neural::Tensor4D<T> *drv_error_output_preact) {
-                    _backfn(drv_error_output, output, drv_error_output_preact);
+                void backward(const Neural::Backend<T> &backend, const Neural::Tensor4D<T> &drv_error_output, const Neural::Tensor4D<T> &output, Neural::Tensor4D<T> *drv_error_output_preact) {
+                    (backend.*_backfn)(drv_error_output, output, drv_error_output_preact);
                 }
         };
         
-        const Base<double> Relu("relu", acc_relu<double>, acc_relu_backprop<double>);
-        const Base<double> Softmax("softmax", acc_softmax<double>, acc_softmax_backprop<double>);
-        const Base<double> Sigmoid("sigmoid", acc_sigmoid<double>, acc_sigmoid_backprop<double>);
+        template<class T> const Base<T> Relu("relu", &Neural::Backend<T>::relu, &Neural::Backend<T>::relu_backprop, Neural::Kernels::Activation::relu);
+        template<class T> const Base<T> Softmax("softmax", &Neural::Backend<T>::softmax, &Neural::Backend<T>::softmax_backprop);
+        template<class T> const Base<T> Sigmoid("sigmoid", &Neural::Backend<T>::sigmoid, &Neural::Backend<T>::sigmoid_backprop, Neural::Kernels::Activation::sigmoid);
     }
 }
 
@@ -115,6 +161,7 @@ void AddVecDim(Neural::Tensor4D<T> *A, const Neural::Tensor4D<T> &B) {
     #pragma acc data present(a_data[:sizeA], b_data[:sizeB])
     {
     #pragma acc parallel loop collapse(4)
+    #pragma omp parallel for collapse(4) schedule(static)
     for(int i=0; i<a; i++) {
         for(int j=0; j<b; j++) {
             for(int k=0; k<c; k++) {
@@ -140,40 +187,16 @@ void AddVecDim(Neural::Tensor4D<T> *A, const Neural::Tensor4D<T> &B) {
 
 template<class T, int DIM1, int DIM2>
 Neural::Tensor4D<T>* acc_transposed(const Neural::Tensor4D<T> &input) {
-    Neural::Shape4D a_shape = input.shape(), t_shape = Neural::Shape4D(a_shape);
-    
     static_assert(DIM2>DIM1);
     static_assert(DIM1>=0 && DIM1 < 4);
     static_assert(DIM2>=0 && DIM2 < 4);
     
-    int a_mlt[4]{a_shape[1]*a_shape[2]*a_shape[3], a_shape[2]*a_shape[3], a_shape[3], 1};
-    int at_mlt[4]{a_mlt[0], a_mlt[1], a_mlt[2], a_mlt[3]};
-    
-    t_shape[DIM2] = a_shape[DIM1];
-    t_shape[DIM1] = a_shape[DIM2];
-    
-    at_mlt[DIM2] = a_mlt[DIM1];
-    at_mlt[DIM1] = a_mlt[DIM2];
+    Neural::TensorView4D<T> t_view = input.view().template transposed<DIM1, DIM2>();
     
-    Neural::Tensor4D<T> *ret = new Neural::Tensor4D<T>(t_shape);
+    Neural::Tensor4D<T> *ret = new Neural::Tensor4D<T>(t_view.shape());
     ret->create_acc();
     
-    const T* a_data = input.data();
-    T *t_data = ret->data();
-    
-    int AA = a_shape[0], AB = a_shape[1], AC = a_shape[2], AD = a_shape[3];
-    int TA = t_shape[0], TB = t_shape[1], TC = t_shape[2], TD = t_shape[3];
-    
-    #pragma acc parallel loop collapse(4) present(a_data[:AA*AB*AC*AD], t_data[:TA*TB*TC*TD])
-    for(int a = 0; a < TA; a++) {
-        for(int b = 0; b < TB; b++) {
-            for(int c = 0; c < TC; c++) {
-                for(int d = 0; d < TD; d++) {                    
-                    t_data[a*TB*TC*TD + b*TC*TD + c*TD + d] = a_data[a*at_mlt[0] + b*at_mlt[1] + c*at_mlt[2] + d*at_mlt[3]];                 
-                }
-            }
-        }
-    }
+    acc_copy(t_view, ret);
     
     return ret;
 }
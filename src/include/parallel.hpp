@@ -0,0 +1,32 @@
+#pragma once
+#include <functional>
+#include <vector>
+#include <cstddef>
+
+// Persistent worker pool for the host kernels.
+// run(n, fn) calls fn(i) for every i in [0, n) across the workers and the calling thread,
+// and returns once all calls have finished. Calls made from inside a worker run serially.
+namespace Neural::Parallel {
+    // defaults to std::thread::hardware_concurrency(), overridden by NEURAL_NUM_THREADS.
+    // The omp build runs the loops of the acc_* ops on as many threads.
+    int num_threads();
+    void set_num_threads(int);
+    bool in_parallel();
+
+    void run(int, const std::function<void(int)> &);
+
+    // run() when there are at least as many items as workers, otherwise a serial loop so that the
+    // kernels inside fn (e.g. gemm) get the workers instead
+    void run_outer(int, const std::function<void(int)> &);
+
+    // per-thread scratch buffer, grown on demand and kept for the thread's lifetime.
+    // SLOT tells apart buffers that are live at the same time.
+    template<class T, int SLOT = 0>
+    T *thread_scratch(size_t size) {
+        thread_local std::vector<T> scratch;
+        if(scratch.size() < size) {
+            scratch.resize(size);
+        }
+        return scratch.data();
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Size-bucketed buffer pool backing Tensor4D storage.
+// Buffers are rounded up to a size class (4 classes per power of two) and kept on free lists
+// when released, so repeated forward/backward steps with the same shapes reuse memory
+// instead of going through new[]/delete[]. Each thread keeps a small lock-free cache per class,
+// overflow goes to a shared mutex-protected free list.
+namespace Neural {
+    struct PoolStats {
+        std::size_t hits{0}, misses{0};
+        std::size_t bytes_held{0}, bytes_in_use{0};
+
+        std::string to_string() const;
+    };
+
+    namespace Pool {
+        constexpr std::size_t alignment = 64;
+
+        void *acquire(std::size_t);
+        void release(void *, std::size_t);
+
+        template<class T> T *acquire(int n) { return static_cast<T *>(acquire(n * sizeof(T))); }
+        template<class T> void release(T *ptr, int n) { release(static_cast<void *>(ptr), n * sizeof(T)); }
+
+        // hits/misses since start, bytes currently kept on free lists and bytes handed out
+        PoolStats stats();
+        // free every buffer kept on the shared free lists and on this thread's cache
+        void trim();
+    }
+}
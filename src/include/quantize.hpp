@@ -0,0 +1,73 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "tensor.hpp"
+#include "network.hpp"
+#include "host_kernels.hpp"
+
+// Post-training int8 quantization of a trained Network, for inference on the host (plain AVX2 is enough).
+// Symmetric with zero point 0, real = scale * q and q in [-127, 127]:
+//   weights      one scale per output channel, max |w| of the channel / 127
+//   activations  one scale per tensor, max |x| / 127 of each layer's input over a calibration sample run
+//                through the trained network
+//   biases       int32 in units of input scale * weight scale, added to the accumulator
+// Each layer accumulates in int32 and its epilogue dequantizes, applies relu / sigmoid and requantizes to the
+// next layer's input scale without leaving registers. The last layer dequantizes its logits for the softmax.
+namespace Neural::Quantize {
+    struct Int8Layer {
+        // "conv" or "fc"
+        std::string type;
+        Neural::Kernels::Activation activation{Neural::Kernels::Activation::none};
+        bool softmax{false};
+        Neural::Shape4D input_shape_proto, output_shape_proto;
+        // conv only, padding {top, bottom, left, right}
+        std::vector<int> filter_size, stride, padding;
+
+        // [features x patch], patch = channels * filter rows * filter cols for conv, the flattened input for fc
+        std::vector<int8_t> weights;
+        std::vector<int32_t> biases;
+        // per output channel, input_scale * weight scale: the accumulator to real
+        std::vector<float> scales;
+        // output_scale is the next layer's input_scale, 0 for the last layer (float output)
+        float input_scale{1.0f}, output_scale{0.0f};
+    };
+
+    struct Metrics {
+        double precision{0}, recall{0}, accuracy{0}, f1_score{0};
+    };
+
+    class Int8Network {
+        std::vector<Int8Layer> layers;
+        Neural::Shape4D input_shape_proto;
+
+    public:
+        Int8Network(const Neural::Shape4D &, std::vector<Int8Layer>);
+
+        const std::vector<Int8Layer> & get_layers() const { return layers; }
+        // bytes of the int8 weights and int32 biases
+        size_t size_bytes() const;
+
+        // as Network::forward: the outputs of the last layer for a batch of normalized inputs
+        template<class T> Neural::Tensor4D<T> * forward(Neural::Tensor4D<T> &);
+        // as Network::eval, macro averages over the classes
+        template<class T> Metrics eval(const Neural::Tensor4D<T> &, const Neural::Tensor4D<int> &);
+        // on the uint8 pixels of a mapped IDX file (idx.hpp), normalized to T batch by batch
+        template<class T> Metrics eval(const Neural::Tensor4D<uint8_t> &, const Neural::Tensor4D<int> &);
+
+    private:
+        template<class T, class D> Metrics eval_batches(const Neural::Tensor4D<D> &, const Neural::Tensor4D<int> &);
+    };
+
+    // Conv and Fc layers of an nchw Network only. Calibrates on the first `samples` images of dataset (raw images as T or
+    // uint8, normalized as for training), typically the validation set
+    template<class T, class D> Int8Network quantize(Neural::Network<T> &, const Neural::Tensor4D<D> &dataset, int samples = 1000);
+
+    struct Report {
+        Metrics reference, quantized;
+        size_t reference_bytes{0}, quantized_bytes{0};
+    };
+
+    // Network::eval and Int8Network::eval on the same data, logged side by side with the weight sizes
+    template<class T, class D> Report report(Neural::Network<T> &, Int8Network &, const Neural::Tensor4D<D> &, const Neural::Tensor4D<int> &);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+
+// Counter-based random numbers, Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+// Every value is a function of (seed, stream, element index) only, so tensors fill in parallel on the
+// Neural::Parallel workers and the numbers do not depend on the thread count or on the order of the calls.
+// The stream keeps the users apart: the layer id and a step, 0 for the weight initialization, the training
+// step for per-step draws such as dropout masks.
+namespace Neural::Random {
+    struct Stream {
+        uint32_t id{0}, step{0};
+    };
+
+    // NEURAL_SEED, 0 when it is not set
+    uint64_t seed();
+    void set_seed(uint64_t);
+
+    // the 4 words of Philox4x32-10 for counter and key
+    void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+
+    // element i comes from the counter {i/2, stream.id, stream.step} keyed by seed(), two 53-bit uniforms per
+    // counter and a Box-Muller pair for the normals
+    template<class T> void uniform(T *data, long n, T low, T high, Stream stream = {});
+    template<class T> void normal(T *data, long n, T mean, T stddev, Stream stream = {});
+}
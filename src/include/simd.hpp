@@ -0,0 +1,204 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX512F__)
+    #define SIMD_ISA "avx512"
+    #define SIMD_NAMESPACE avx512
+#elif defined(__AVX2__) && defined(__FMA__)
+    #define SIMD_ISA "avx2"
+    #define SIMD_NAMESPACE avx2
+#else
+    #define SIMD_ISA "generic"
+    #define SIMD_NAMESPACE generic
+#endif
+
+// Vector ops for the host kernels (gemm, vmath), the widest ISA the translation unit is compiled for.
+// VecD / VecF hold W doubles / floats in V, with I the same lanes as integers of the same width and
+// M a lane mask. Without AVX2+FMA the lanes are plain arrays left to the compiler's auto-vectorizer.
+// Each ISA gets its own inline namespace, so the per-ISA builds of the host kernels (host_kernels.hpp)
+// never share one of these inline functions at link time.
+namespace Neural::Simd {
+inline namespace SIMD_NAMESPACE {
+#if defined(__AVX512F__)
+    struct VecD {
+        typedef double T;
+        typedef __m512d V;
+        typedef __m512i I;
+        typedef __mmask8 M;
+        static constexpr int W = 8;
+        static V zero() { return _mm512_setzero_pd(); }
+        static V set1(double x) { return _mm512_set1_pd(x); }
+        static V load(const double *p) { return _mm512_loadu_pd(p); }
+        static void store(double *p, V v) { _mm512_storeu_pd(p, v); }
+        static V bcast(const double *p) { return _mm512_set1_pd(*p); }
+        static V mul(V a, V b) { return _mm512_mul_pd(a, b); }
+        static V fma(V a, V b, V c) { return _mm512_fmadd_pd(a, b, c); }
+        static V add(V a, V b) { return _mm512_add_pd(a, b); }
+        static V sub(V a, V b) { return _mm512_sub_pd(a, b); }
+        static V div(V a, V b) { return _mm512_div_pd(a, b); }
+        static V max(V a, V b) { return _mm512_max_pd(a, b); }
+        static V min(V a, V b) { return _mm512_min_pd(a, b); }
+        static M lt(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+        static M eq(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+        static M unord(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_UNORD_Q); }
+        // m ? a : b per lane
+        static V select(M m, V a, V b) { return _mm512_mask_blend_pd(m, b, a); }
+        static I as_int(V a) { return _mm512_castpd_si512(a); }
+        static V as_float(I a) { return _mm512_castsi512_pd(a); }
+        static I iset1(int64_t x) { return _mm512_set1_epi64(x); }
+        static I iadd(I a, I b) { return _mm512_add_epi64(a, b); }
+        static I isub(I a, I b) { return _mm512_sub_epi64(a, b); }
+        static I iand(I a, I b) { return _mm512_and_si512(a, b); }
+        static I ior(I a, I b) { return _mm512_or_si512(a, b); }
+        template<int N> static I sll(I a) { return _mm512_slli_epi64(a, N); }
+        template<int N> static I srl(I a) { return _mm512_srli_epi64(a, N); }
+    };
+
+    struct VecF {
+        typedef float T;
+        typedef __m512 V;
+        typedef __m512i I;
+        typedef __mmask16 M;
+        static constexpr int W = 16;
+        static V zero() { return _mm512_setzero_ps(); }
+        static V set1(float x) { return _mm512_set1_ps(x); }
+        static V load(const float *p) { return _mm512_loadu_ps(p); }
+        static void store(float *p, V v) { _mm512_storeu_ps(p, v); }
+        static V bcast(const float *p) { return _mm512_set1_ps(*p); }
+        static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+        static V fma(V a, V b, V c) { return _mm512_fmadd_ps(a, b, c); }
+        static V add(V a, V b) { return _mm512_add_ps(a, b); }
+        static V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+        static V div(V a, V b) { return _mm512_div_ps(a, b); }
+        static V max(V a, V b) { return _mm512_max_ps(a, b); }
+        static V min(V a, V b) { return _mm512_min_ps(a, b); }
+        static M lt(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+        static M eq(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+        static M unord(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_UNORD_Q); }
+        static V select(M m, V a, V b) { return _mm512_mask_blend_ps(m, b, a); }
+        static I as_int(V a) { return _mm512_castps_si512(a); }
+        static V as_float(I a) { return _mm512_castsi512_ps(a); }
+        static I iset1(int32_t x) { return _mm512_set1_epi32(x); }
+        static I iadd(I a, I b) { return _mm512_add_epi32(a, b); }
+        static I isub(I a, I b) { return _mm512_sub_epi32(a, b); }
+        static I iand(I a, I b) { return _mm512_and_si512(a, b); }
+        static I ior(I a, I b) { return _mm512_or_si512(a, b); }
+        template<int N> static I sll(I a) { return _mm512_slli_epi32(a, N); }
+        template<int N> static I srl(I a) { return _mm512_srli_epi32(a, N); }
+    };
+#elif defined(__AVX2__) && defined(__FMA__)
+    struct VecD {
+        typedef double T;
+        typedef __m256d V;
+        typedef __m256i I;
+        typedef __m256d M;
+        static constexpr int W = 4;
+        static V zero() { return _mm256_setzero_pd(); }
+        static V set1(double x) { return _mm256_set1_pd(x); }
+        static V load(const double *p) { return _mm256_loadu_pd(p); }
+        static void store(double *p, V v) { _mm256_storeu_pd(p, v); }
+        static V bcast(const double *p) { return _mm256_broadcast_sd(p); }
+        static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+        static V fma(V a, V b, V c) { return _mm256_fmadd_pd(a, b, c); }
+        static V add(V a, V b) { return _mm256_add_pd(a, b); }
+        static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+        static V div(V a, V b) { return _mm256_div_pd(a, b); }
+        static V max(V a, V b) { return _mm256_max_pd(a, b); }
+        static V min(V a, V b) { return _mm256_min_pd(a, b); }
+        static M lt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+        static M eq(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+        static M unord(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_UNORD_Q); }
+        static V select(M m, V a, V b) { return _mm256_blendv_pd(b, a, m); }
+        static I as_int(V a) { return _mm256_castpd_si256(a); }
+        static V as_float(I a) { return _mm256_castsi256_pd(a); }
+        static I iset1(int64_t x) { return _mm256_set1_epi64x(x); }
+        static I iadd(I a, I b) { return _mm256_add_epi64(a, b); }
+        static I isub(I a, I b) { return _mm256_sub_epi64(a, b); }
+        static I iand(I a, I b) { return _mm256_and_si256(a, b); }
+        static I ior(I a, I b) { return _mm256_or_si256(a, b); }
+        template<int N> static I sll(I a) { return _mm256_slli_epi64(a, N); }
+        template<int N> static I srl(I a) { return _mm256_srli_epi64(a, N); }
+    };
+
+    struct VecF {
+        typedef float T;
+        typedef __m256 V;
+        typedef __m256i I;
+        typedef __m256 M;
+        static constexpr int W = 8;
+        static V zero() { return _mm256_setzero_ps(); }
+        static V set1(float x) { return _mm256_set1_ps(x); }
+        static V load(const float *p) { return _mm256_loadu_ps(p); }
+        static void store(float *p, V v) { _mm256_storeu_ps(p, v); }
+        static V bcast(const float *p) { return _mm256_broadcast_ss(p); }
+        static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+        static V fma(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+        static V add(V a, V b) { return _mm256_add_ps(a, b); }
+        static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+        static V div(V a, V b) { return _mm256_div_ps(a, b); }
+        static V max(V a, V b) { return _mm256_max_ps(a, b); }
+        static V min(V a, V b) { return _mm256_min_ps(a, b); }
+        static M lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        static M eq(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+        static M unord(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_UNORD_Q); }
+        static V select(M m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+        static I as_int(V a) { return _mm256_castps_si256(a); }
+        static V as_float(I a) { return _mm256_castsi256_ps(a); }
+        static I iset1(int32_t x) { return _mm256_set1_epi32(x); }
+        static I iadd(I a, I b) { return _mm256_add_epi32(a, b); }
+        static I isub(I a, I b) { return _mm256_sub_epi32(a, b); }
+        static I iand(I a, I b) { return _mm256_and_si256(a, b); }
+        static I ior(I a, I b) { return _mm256_or_si256(a, b); }
+        template<int N> static I sll(I a) { return _mm256_slli_epi32(a, N); }
+        template<int N> static I srl(I a) { return _mm256_srli_epi32(a, N); }
+    };
+#else
+    // plain C++ lanes, IT is the unsigned integer of T's width
+    template<class FT, class IT, int WIDTH>
+    struct VecScalar {
+        typedef FT T;
+        struct V { T x[WIDTH]; };
+        struct I { IT x[WIDTH]; };
+        struct M { bool x[WIDTH]; };
+        static constexpr int W = WIDTH;
+        static V zero() { V v; for(int i = 0; i < W; i++) v.x[i] = 0; return v; }
+        static V set1(T s) { V v; for(int i = 0; i < W; i++) v.x[i] = s; return v; }
+        static V load(const T *p) { V v; for(int i = 0; i < W; i++) v.x[i] = p[i]; return v; }
+        static void store(T *p, V v) { for(int i = 0; i < W; i++) p[i] = v.x[i]; }
+        static V bcast(const T *p) { return set1(*p); }
+        static V mul(V a, V b) { V v; for(int i = 0; i < W; i++) v.x[i] = a.x[i] * b.x[i]; return v; }
+        static V fma(V a, V b, V c) { V v; for(int i = 0; i < W; i++) v.x[i] = a.x[i] * b.x[i] + c.x[i]; return v; }
+        static V add(V a, V b) { V v; for(int i = 0; i < W; i++) v.x[i] = a.x[i] + b.x[i]; return v; }
+        static V sub(V a, V b) { V v; for(int i = 0; i < W; i++) v.x[i] = a.x[i] - b.x[i]; return v; }
+        static V div(V a, V b) { V v; for(int i = 0; i < W; i++) v.x[i] = a.x[i] / b.x[i]; return v; }
+        // b when either is NaN, as maxpd/minpd
+        static V max(V a, V b) { V v; for(int i = 0; i < W; i++) v.x[i] = (a.x[i] > b.x[i]) ? a.x[i] : b.x[i]; return v; }
+        static V min(V a, V b) { V v; for(int i = 0; i < W; i++) v.x[i] = (a.x[i] < b.x[i]) ? a.x[i] : b.x[i]; return v; }
+        static M lt(V a, V b) { M m; for(int i = 0; i < W; i++) m.x[i] = a.x[i] < b.x[i]; return m; }
+        static M eq(V a, V b) { M m; for(int i = 0; i < W; i++) m.x[i] = a.x[i] == b.x[i]; return m; }
+        static M unord(V a, V b) { M m; for(int i = 0; i < W; i++) m.x[i] = (a.x[i] != a.x[i]) || (b.x[i] != b.x[i]); return m; }
+        static V select(M m, V a, V b) { V v; for(int i = 0; i < W; i++) v.x[i] = m.x[i] ? a.x[i] : b.x[i]; return v; }
+        static I as_int(V a) { I v; std::memcpy(&v, &a, sizeof(v)); return v; }
+        static V as_float(I a) { V v; std::memcpy(&v, &a, sizeof(v)); return v; }
+        static I iset1(IT s) { I v; for(int i = 0; i < W; i++) v.x[i] = s; return v; }
+        static I iadd(I a, I b) { I v; for(int i = 0; i < W; i++) v.x[i] = a.x[i] + b.x[i]; return v; }
+        static I isub(I a, I b) { I v; for(int i = 0; i < W; i++) v.x[i] = a.x[i] - b.x[i]; return v; }
+        static I iand(I a, I b) { I v; for(int i = 0; i < W; i++) v.x[i] = a.x[i] & b.x[i]; return v; }
+        static I ior(I a, I b) { I v; for(int i = 0; i < W; i++) v.x[i] = a.x[i] | b.x[i]; return v; }
+        template<int N> static I sll(I a) { I v; for(int i = 0; i < W; i++) v.x[i] = a.x[i] << N; return v; }
+        template<int N> static I srl(I a) { I v; for(int i = 0; i < W; i++) v.x[i] = a.x[i] >> N; return v; }
+    };
+
+    typedef VecScalar<double, uint64_t, 4> VecD;
+    typedef VecScalar<float, uint32_t, 8> VecF;
+#endif
+
+    template<class T> struct Vec;
+    template<> struct Vec<double> { typedef VecD Ops; };
+    template<> struct Vec<float> { typedef VecF Ops; };
+}
+}
@@ -5,7 +5,11 @@
 #include <sstream>
 #include <cassert>
 #include <iostream>
+#include <stdexcept>
+#ifdef _OPENACC
 #include "openacc.h"
+#endif
+#include "pool.hpp"
 
 namespace Neural {
     struct Shape4D {
@@ -28,6 +32,10 @@ namespace Neural {
         std::string to_string();
     };
 
+    // order of the activation elements in memory, the logical dims stay [batch, channels, rows, cols] either way.
+    // nchw keeps each channel's plane contiguous, nhwc (channels-last) the channels of each pixel
+    enum class Layout { nchw, nhwc };
+
     //TODO make template on acc? 2 versions? one serial one accelerated
 
     template<class T>
@@ -79,8 +87,6 @@ namespace Neural {
     class acc_shared_ptr : public std::shared_ptr<T> {
         
         ~acc_shared_ptr() {
-            std::shared_ptr::~shared_ptr();
-            
             T* tdata = this->get();
             
         }
@@ -88,13 +94,111 @@ namespace Neural {
     };
 
 
+    // Non-owning view: shape, element strides and a borrowed pointer.
+    // Reshape, dim-0 slices and transposes only rewrite the metadata, no data is touched.
+    template <class T=double>
+    class TensorView4D {
+        Shape4D _shape;
+        int _strides[4];
+        T *_data;
+
+    public:
+        TensorView4D(T *cdata, Shape4D cshape) : _shape(cshape), _data(cdata) {
+            _strides[3] = 1;
+            _strides[2] = _shape[3];
+            _strides[1] = _shape[2]*_shape[3];
+            _strides[0] = _shape[1]*_shape[2]*_shape[3];
+        }
+
+        TensorView4D(T *cdata, Shape4D cshape, const int cstrides[4]) : _shape(cshape), _data(cdata) {
+            for(int i = 0; i < 4; i++) {
+                _strides[i] = cstrides[i];
+            }
+        }
+
+        // dense view of data stored in the given layout
+        TensorView4D(T *cdata, Shape4D cshape, Layout layout) : TensorView4D(cdata, cshape) {
+            if(layout == Layout::nhwc) {
+                _strides[1] = 1;
+                _strides[3] = _shape[1];
+                _strides[2] = _shape[3]*_shape[1];
+                _strides[0] = _shape[2]*_shape[3]*_shape[1];
+            }
+        }
+
+        T* data() const { return _data; }
+        Shape4D shape() const { return _shape; }
+        int size() const { return _shape.size(); }
+        int stride(int dim) const { return _strides[dim]; }
+
+        // number of elements between the first and the last addressed element, inclusive
+        int extent() const {
+            int ext = 1;
+            for(int i = 0; i < 4; i++) {
+                ext += (_shape[i] - 1) * _strides[i];
+            }
+            return ext;
+        }
+
+        bool is_contiguous() const {
+            return (_strides[3] == 1) && (_strides[2] == _shape[3]) && (_strides[1] == _shape[2]*_shape[3]) && (_strides[0] == _shape[1]*_shape[2]*_shape[3]);
+        }
+
+        // dense in nhwc order
+        bool is_channels_last() const {
+            return (_strides[1] == 1) && (_strides[3] == _shape[1]) && (_strides[2] == _shape[3]*_shape[1]) && (_strides[0] == _shape[2]*_shape[3]*_shape[1]);
+        }
+
+        T& at(int i, int j, int k, int l) const {
+            return _data[i*_strides[0] + j*_strides[1] + k*_strides[2] + l*_strides[3]];
+        }
+
+        TensorView4D reshape(const Shape4D &new_shape) const {
+            if(!is_contiguous() || new_shape.size() != _shape.size()) {
+                throw(std::invalid_argument("Error: reshape needs a contiguous view of the same size"));
+            }
+            return TensorView4D(_data, new_shape);
+        }
+
+        // rows [start, start+count) of dimension 0
+        TensorView4D slice(int start, int count) const {
+            if(start < 0 || count < 0 || (start + count) > _shape[0]) {
+                throw(std::invalid_argument("Error: slice out of range"));
+            }
+            Shape4D new_shape = _shape;
+            new_shape[0] = count;
+            return TensorView4D(_data + start*_strides[0], new_shape, _strides);
+        }
+
+        template<int DIM1, int DIM2>
+        TensorView4D transposed() const {
+            static_assert(DIM1>=0 && DIM1 < 4);
+            static_assert(DIM2>=0 && DIM2 < 4);
+
+            Shape4D new_shape = _shape;
+            int new_strides[4]{_strides[0], _strides[1], _strides[2], _strides[3]};
+
+            new_shape[DIM1] = _shape[DIM2];
+            new_shape[DIM2] = _shape[DIM1];
+            new_strides[DIM1] = _strides[DIM2];
+            new_strides[DIM2] = _strides[DIM1];
+
+            return TensorView4D(_data, new_shape, new_strides);
+        }
+    };
+
     template <class T=double>
     class Tensor4D {
         
     private:
         Shape4D _shape;
-        T * _data; //TODO get rid of vector, replace with shared_ptr<double> ?
+        T * _data{nullptr}; //TODO get rid of vector, replace with shared_ptr<double> ?
         bool _allocated{false};
+        // borrowed tensors wrap memory owned elsewhere and never release it
+        bool _borrowed{false};
+        // device data regions entered through this tensor, borrowed tensors only exit their own
+        int _acc_entered{0};
+        Layout _layout{Layout::nchw};
         
         void reset_data(); 
         
@@ -108,11 +212,12 @@ namespace Neural {
             }
             
         }
-        template<class U> Tensor4D(U* cdata, int a, int b, int c, int d) : Tensor4D<U>(cdata, Shape4D(a,b,c,d));
+        template<class U> Tensor4D(U* cdata, int a, int b, int c, int d) : Tensor4D<U>(cdata, Shape4D(a,b,c,d)) {}
         Tensor4D();
 
         Tensor4D(Shape4D);
         Tensor4D(int, int, int, int);
+        explicit Tensor4D(const TensorView4D<T> &); //borrowing ctor, view must be contiguous or channels-last
         ~Tensor4D(); //destructor
         Tensor4D(const Tensor4D &); //copy ctor
         Tensor4D(Tensor4D &&); //move ctor
@@ -122,11 +227,16 @@ namespace Neural {
         const T* data() const { return _data; }
         Shape4D shape() const { return _shape; }
         int size() const { return _shape.size(); }
+        bool is_borrowed() const { return _borrowed; }
+        Layout layout() const { return _layout; }
+        TensorView4D<T> view() const { return TensorView4D<T>(_data, _shape, _layout); }
         
         //setters
+        // only retags, the data must already be in that order
+        void set_layout(Layout layout) { _layout = layout; }
         void reserve() {
-            if(!_allocated) {
-                this->_data = new T[this->size()];
+            if(!_allocated && !_borrowed) {
+                this->_data = Neural::Pool::acquire<T>(this->size());
                 _allocated=true;
             }
         }
@@ -141,6 +251,9 @@ namespace Neural {
         }
         
         T& at(int i, int j, int k, int l) const {
+            if(_layout == Layout::nhwc) {
+                return _data[((i*_shape[2] + k)*_shape[3] + l)*_shape[1] + j];
+            }
             return _data[i*_shape[1]*_shape[2]*_shape[3] + j*_shape[2]*_shape[3] + k*_shape[3] + l];
         }
         
@@ -41,7 +41,7 @@ namespace plog
 template <class... Args>
 double timeop(void (*fcnptr)(), Args... args) {
     clock_t start = clock();
-    (*fcnptr)(args);
+    (*fcnptr)(args...);
     double duration = (clock()-start)/CLOCKS_PER_SEC;
     return duration;
 }
@@ -0,0 +1,25 @@
+#pragma once
+
+// Vectorized elementary functions for the host kernels (activations, softmax, losses), polynomial
+// approximations evaluated on the vectors of simd.hpp, built per ISA (host_kernels.hpp).
+// Arrays may be updated in place (x == y).
+// Max error measured against a long double reference over the whole input range (double and float alike,
+// exp/log are within 0.9 ulp when the vectors have FMA):
+//   exp < 1.2 ulp, log < 0.9 ulp, sigmoid < 2.5 ulp, tanh < 2.6 ulp
+// sigmoid keeps that bound into its subnormal results (x down to -745 / -104, ulps of the subnormals).
+// exp flushes results near the smallest normal (x < -708.39 / -87.33) to 0. inf, 0 and NaN inputs give
+// the libm results.
+// With use_libm() set every call loops over the std:: functions instead, for bit-exact reference runs.
+// That is the default when the host kernels run generic (Neural::get_isa(), no AVX2+FMA), where the
+// polynomials are slower than libm.
+namespace Neural::Math {
+    // NEURAL_LIBM_MATH=1 / 0 overrides the default
+    bool use_libm();
+    void set_use_libm(bool);
+
+    template<class T> void vexp(int n, const T *x, T *y);
+    template<class T> void vlog(int n, const T *x, T *y);
+    // 1 / (1 + exp(-x))
+    template<class T> void vsigmoid(int n, const T *x, T *y);
+    template<class T> void vtanh(int n, const T *x, T *y);
+}
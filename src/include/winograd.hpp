@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+#include "tensor.hpp"
+#include "gemm.hpp"
+
+// Winograd minimal filtering F(m x m, r x r) for stride-1 convolutions on the host.
+// The transforms are built from Cook-Toom points (0, 1, -1, 2, -2, ...) for any m, r, the layers
+// use F(2x2, 3x3), F(4x4, 3x3), F(2x2, 5x5) and F(4x4, 5x5). Per image the input tiles are
+// transformed once, multiplied with the transformed filters by (m+r-1)^2 GEMMs over the channels,
+// and transformed back.
+namespace Neural::Kernels {
+    template<class T>
+    class Winograd {
+        int _m, _r, _n;
+        // AT[m x n], G[n x r], BT[n x n]
+        std::vector<T> AT, G, BT;
+        // transformed filters, [n*n][OC][C] for forward, [n*n][C][OC] flipped for the input gradient
+        std::vector<T> U_fwd, U_bwd;
+        int out_channels{0}, in_channels{0};
+        long _version{-1};
+
+        void correlate(const T *, int, int, int, int, int, const T *, int, T *, int, int, const Epilogue<T> *) const;
+
+    public:
+        Winograd(int m, int r);
+
+        // filter sizes the transforms are kept accurate for
+        static bool supports(int filter_height, int filter_width, int stride_r, int stride_c);
+
+        int tile() const { return _m; }
+        int filter_size() const { return _r; }
+        // weights version the cached filters were transformed from, -1 before the first transform
+        long version() const { return _version; }
+
+        void transform_filters(const Neural::Tensor4D<T> &filters, long version);
+
+        // output = input (*) filters, input unpadded and read with padding {top, bottom, left, right} zeros around it.
+        // The epilogue (row_bias per output channel) is applied as the tiles are written out
+        void forward(const Neural::Tensor4D<T> &input, Neural::Tensor4D<T> *output, const std::vector<int> &padding = {0, 0, 0, 0}, const Epilogue<T> &epilogue = {}) const;
+        // drv_error_input (unpadded input shape) = full correlation of drv_error_output with the flipped filters,
+        // cropped to the unpadded input
+        void backward_data(const Neural::Tensor4D<T> &drv_error_output, Neural::Tensor4D<T> *drv_error_input, const std::vector<int> &padding = {0, 0, 0, 0}) const;
+    };
+}
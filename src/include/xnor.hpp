@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "tensor.hpp"
+#include "gemm.hpp"
+
+// Sign-binarized convolution on the host (XNOR-Net): inputs and filters are +-1, packed as bits (set for +1) into
+// 64-bit words, and each dot product is valid bits - 2 * popcount(input XOR filter), scaled by alpha_c, the mean
+// |w| of output channel c. Channels are packed per pixel, so the patches of a filter position are runs of whole
+// words; padding is masked out of the count, so it stays 0 as in the float kernels.
+namespace Neural::Kernels {
+    template<class T>
+    class Xnor {
+        int out_channels{0}, in_channels{0}, filter_rows{1}, filter_cols{1};
+        // words per pixel of in_channels bits
+        int channel_words{0};
+        // [out_channels][filter_rows][filter_cols][channel_words]
+        std::vector<uint64_t> bits;
+        std::vector<T> alpha;
+        long _version{-1};
+
+        void pack(const T *, int, int, int, int, size_t, size_t, long);
+
+    public:
+        // weights version the bits were packed from, -1 before the first pack
+        long version() const { return _version; }
+        // bytes of the packed filters and their scales
+        size_t packed_bytes() const { return bits.size() * sizeof(uint64_t) + alpha.size() * sizeof(T); }
+
+        // filters [out_channels][in_channels][rows][cols] of a Conv
+        void pack_filters(const Neural::Tensor4D<T> &filters, long version);
+        // weights [inputs][features] of an Fc, packed as features 1x1 filters over the inputs
+        void pack_weights(const Neural::Tensor4D<T> &weights, long version);
+
+        // output = sign(input) (*) alpha * sign(filters), sign(x) = +1 for x > 0 and -1 otherwise, input unpadded and
+        // read with padding {top, bottom, left, right} around it. The epilogue (row_bias per output channel) is
+        // applied per image. Input and output in either layout (Tensor4D::layout)
+        void forward(const Neural::Tensor4D<T> &input, Neural::Tensor4D<T> *output, const std::vector<int> &stride, const std::vector<int> &padding, const Epilogue<T> &epilogue = {}) const;
+        // the Fc of pack_weights: output [batch x features] = sign(input [batch x inputs]) * alpha * sign(weights), one
+        // popcount GEMM over all the rows of the batch. The epilogue runs along the rows (col_bias per feature)
+        void forward_fc(const Neural::Tensor4D<T> &input, Neural::Tensor4D<T> *output, const Epilogue<T> &epilogue = {}) const;
+    };
+}
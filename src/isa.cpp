@@ -0,0 +1,130 @@
+#include "isa.hpp"
+#include "host_kernels.hpp"
+#include "utils.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define ISA_X86
+#endif
+
+using namespace std;
+using Neural::Isa;
+using Neural::Kernels::HostKernelSet;
+
+namespace {
+#ifdef ISA_X86
+    // XCR0, the register states the OS saves on context switches
+    uint64_t xgetbv0() {
+        uint32_t eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return ((uint64_t)edx << 32) | eax;
+    }
+#endif
+
+    Isa detect_isa() {
+#ifdef ISA_X86
+        unsigned int eax, ebx, ecx, edx;
+        if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+            return Isa::generic;
+        }
+
+        bool fma = ecx & (1u << 12), osxsave = ecx & (1u << 27), avx = ecx & (1u << 28);
+        if(!(fma && osxsave && avx)) {
+            return Isa::generic;
+        }
+
+        // xmm and ymm, then opmask and both zmm halves
+        uint64_t xcr0 = xgetbv0();
+        if((xcr0 & 0x6) != 0x6 || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+            return Isa::generic;
+        }
+
+        if((ebx & (1u << 16)) && (xcr0 & 0xe6) == 0xe6) {
+            return Isa::avx512;
+        }
+        if(ebx & (1u << 5)) {
+            return Isa::avx2;
+        }
+#endif
+        return Isa::generic;
+    }
+
+    const HostKernelSet &kernel_set_of(Isa isa) {
+        switch(isa) {
+            case Isa::avx512: return Neural::Kernels::avx512::kernel_set;
+            case Isa::avx2: return Neural::Kernels::avx2::kernel_set;
+            default: return Neural::Kernels::generic::kernel_set;
+        }
+    }
+
+    // the widest set up to isa that was really built for its ISA
+    const HostKernelSet *select_kernel_set(Isa isa) {
+        for(int i = (int)isa; i > (int)Isa::generic; i--) {
+            const HostKernelSet &set = kernel_set_of((Isa)i);
+            if(strcmp(set.isa, Neural::isa_name((Isa)i)) == 0) {
+                return &set;
+            }
+            LOGW << "host kernels for " << Neural::isa_name((Isa)i) << " were built as " << set.isa << ", skipped";
+        }
+        return &Neural::Kernels::generic::kernel_set;
+    }
+
+    Isa default_isa() {
+        Isa isa = Neural::cpu_isa();
+        const char *env = getenv("NEURAL_ISA");
+        if(env) {
+            for(Isa capped: {Isa::generic, Isa::avx2, Isa::avx512}) {
+                if(strcmp(env, Neural::isa_name(capped)) == 0) {
+                    return ((int)capped < (int)isa) ? capped : isa;
+                }
+            }
+            LOGW << "NEURAL_ISA=" << env << " unknown, using " << Neural::isa_name(isa);
+        }
+        return isa;
+    }
+
+    atomic<const HostKernelSet *> active_set{nullptr};
+}
+
+Isa Neural::cpu_isa() {
+    static const Isa isa = detect_isa();
+    return isa;
+}
+
+Isa Neural::get_isa() {
+    const char *name = Neural::Kernels::host_kernel_set().isa;
+    for(Isa isa: {Isa::avx512, Isa::avx2}) {
+        if(strcmp(name, isa_name(isa)) == 0) {
+            return isa;
+        }
+    }
+    return Isa::generic;
+}
+
+void Neural::set_isa(Isa isa) {
+    if((int)isa > (int)cpu_isa()) {
+        isa = cpu_isa();
+    }
+    active_set.store(select_kernel_set(isa));
+}
+
+const char *Neural::isa_name(Isa isa) {
+    switch(isa) {
+        case Isa::avx512: return "avx512";
+        case Isa::avx2: return "avx2";
+        default: return "generic";
+    }
+}
+
+const HostKernelSet &Neural::Kernels::host_kernel_set() {
+    const HostKernelSet *set = active_set.load(memory_order_acquire);
+    if(!set) {
+        // racing first calls pick the same set
+        set = select_kernel_set(default_isa());
+        active_set.store(set, memory_order_release);
+    }
+    return *set;
+}
@@ -0,0 +1,119 @@
+// Elementwise, padding, gather and direct convolution gradient kernels of the acc_* host branches, part of
+// host_kernels.inl. Plain loops, the compiler vectorizes them for the ISA of the build.
+namespace {
+    // elementwise loops are split over the workers in chunks of this many elements, shorter ones run inline
+    constexpr int ELTWISE_CHUNK = 1 << 15;
+
+    template<class F>
+    void for_chunks(int n, F fn) {
+        int nchunks = (n + ELTWISE_CHUNK - 1) / ELTWISE_CHUNK;
+        if(nchunks <= 1) {
+            fn(0, n);
+            return;
+        }
+
+        Neural::Parallel::run(nchunks, [&](int chunk) {
+            fn(chunk * ELTWISE_CHUNK, min(n, (chunk + 1) * ELTWISE_CHUNK));
+        });
+    }
+
+    template<class T>
+    void relu(int n, const T *x, T *y) {
+        for_chunks(n, [&](int begin, int end) {
+            for(int i = begin; i < end; i++) {
+                y[i] = (x[i] > (T)0) ? x[i] : (T)0;
+            }
+        });
+    }
+
+    template<class T>
+    void relu_backprop(int n, const T *drv_error_output, const T *output, T *drv_error_output_preact) {
+        for_chunks(n, [&](int begin, int end) {
+            for(int i = begin; i < end; i++) {
+                drv_error_output_preact[i] = (output[i] > (T)0) ? drv_error_output[i] : (T)0;
+            }
+        });
+    }
+
+    template<class T>
+    void add(int n, T *a, const T *b) {
+        for_chunks(n, [&](int begin, int end) {
+            for(int i = begin; i < end; i++) {
+                a[i] += b[i];
+            }
+        });
+    }
+
+    template<class T>
+    void mltp(int n, T *a, T mltp) {
+        for_chunks(n, [&](int begin, int end) {
+            for(int i = begin; i < end; i++) {
+                a[i] *= mltp;
+            }
+        });
+    }
+
+    template<class T>
+    void pad2D(const T *in, T *out, int planes, int rows, int cols, int padded_rows, int padded_cols, int top, int left, int inner_rows, int inner_cols) {
+        Neural::Parallel::run_outer(planes, [&](int p) {
+            const T *x = in + (size_t)p*rows*cols;
+            T *y = out + (size_t)p*padded_rows*padded_cols;
+            fill(y, y + padded_rows*padded_cols, (T)0);
+
+            for(int i = 0; i < rows; i++) {
+                const T *x_row = x + i*cols;
+                T *y_row = y + (top + i*(inner_rows + 1))*padded_cols + left;
+                if(inner_cols == 0) {
+                    copy(x_row, x_row + cols, y_row);
+                }
+                else {
+                    for(int j = 0; j < cols; j++) {
+                        y_row[j*(inner_cols + 1)] = x_row[j];
+                    }
+                }
+            }
+        });
+    }
+
+    template<class T>
+    void crop2D(const T *in, T *out, int planes, int rows, int cols, int padded_rows, int padded_cols, int top, int left) {
+        Neural::Parallel::run_outer(planes, [&](int p) {
+            const T *x = in + (size_t)p*padded_rows*padded_cols + top*padded_cols + left;
+            T *y = out + (size_t)p*rows*cols;
+            for(int i = 0; i < rows; i++) {
+                copy(x + i*padded_cols, x + i*padded_cols + cols, y + i*cols);
+            }
+        });
+    }
+
+    template<class T>
+    void gather4D(const T *in, T *out, const int *shape, const int *strides) {
+        int A = shape[0], B = shape[1], C = shape[2], D = shape[3];
+        int s0 = strides[0], s1 = strides[1], s2 = strides[2], s3 = strides[3];
+
+        Neural::Parallel::run_outer(A*B, [&](int ab) {
+            const T *x = in + (ab / B)*s0 + (ab % B)*s1;
+            T *y = out + (size_t)ab*C*D;
+            for(int c = 0; c < C; c++) {
+                for(int d = 0; d < D; d++) {
+                    y[c*D + d] = x[c*s2 + d*s3];
+                }
+            }
+        });
+    }
+
+    // output channels own disjoint slices of both gradients, no reduction across workers
+    template<class T>
+    void conv_wgrad(const T *in_data, const T *dout_data, T *dw_data, T *db_data, int batch, int in_channels, int in_rows, int in_cols, int out_channels, int out_rows, int out_cols, int filter_height, int filter_width, int stride_r, int stride_c, int padding_top, int padding_left, T scale) {
+        Neural::Parallel::run(out_channels, [&](int oc) {
+            conv_wgrad_channel(oc, in_data, dout_data, dw_data, db_data, batch, in_channels, in_rows, in_cols, out_channels, out_rows, out_cols, filter_height, filter_width, stride_r, stride_c, padding_top, padding_left, scale);
+        });
+    }
+
+    template<class T>
+    void conv_dgrad(const T *dout_data, const T *filter_data, T *din_data, int batch, int in_channels, int in_rows, int in_cols, int out_channels, int out_rows, int out_cols, int filter_height, int filter_width, int stride_r, int stride_c, int padding_top, int padding_left) {
+        Neural::Parallel::run(batch*in_channels, [&](int bc) {
+            conv_dgrad_plane(bc / in_channels, bc % in_channels, dout_data, filter_data, din_data, in_channels, in_rows, in_cols, out_channels, out_rows, out_cols, filter_height, filter_width, stride_r, stride_c, padding_top, padding_left);
+        });
+    }
+}
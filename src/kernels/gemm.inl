@@ -0,0 +1,390 @@
+// Blocked GEMM of gemm.hpp, part of host_kernels.inl
+namespace {
+    using Neural::Simd::VecD;
+    using Neural::Simd::VecF;
+
+    template<class T> struct Blocking;
+#if defined(__AVX512F__)
+    // 8 x 2 vectors of accumulators, 16 of the 32 zmm registers
+    template<> struct Blocking<double> { typedef VecD Ops; static constexpr int MR = 8, NV = 2, KC = 256, MC = 96, NC = 4096; };
+    template<> struct Blocking<float> { typedef VecF Ops; static constexpr int MR = 8, NV = 2, KC = 256, MC = 96, NC = 8192; };
+#elif defined(__AVX2__) && defined(__FMA__)
+    // 6 x 2 vectors of accumulators + 2 for B + 1 broadcast = 15 of the 16 ymm registers
+    template<> struct Blocking<double> { typedef VecD Ops; static constexpr int MR = 6, NV = 2, KC = 256, MC = 72, NC = 4096; };
+    template<> struct Blocking<float> { typedef VecF Ops; static constexpr int MR = 6, NV = 2, KC = 256, MC = 72, NC = 8192; };
+#else
+    template<> struct Blocking<double> { typedef VecD Ops; static constexpr int MR = 4, NV = 2, KC = 256, MC = 64, NC = 4096; };
+    template<> struct Blocking<float> { typedef VecF Ops; static constexpr int MR = 4, NV = 2, KC = 256, MC = 64, NC = 8192; };
+#endif
+
+    template<class T> constexpr int gemm_mr() { return Blocking<T>::MR; }
+    template<class T> constexpr int gemm_nr() { return Blocking<T>::NV * Blocking<T>::Ops::W; }
+
+    using Neural::Kernels::Epilogue;
+    using Neural::Kernels::Activation;
+
+    // Neural::Kernels::apply_epilogue over a block, sigmoid through the vector math
+    template<class T>
+    void epilogue_block(const Epilogue<T> &ep, T *C, int m, int n, int ldc, int row, int col) {
+        Epilogue<T> bias_relu = ep;
+        if(ep.activation == Activation::sigmoid) {
+            bias_relu.activation = Activation::none;
+        }
+
+        for(int i = 0; i < m; i++) {
+            T *c = C + (size_t)i*ldc;
+            if(bias_relu.row_bias || bias_relu.col_bias || bias_relu.activation != Activation::none) {
+                for(int j = 0; j < n; j++) {
+                    c[j] = Neural::Kernels::apply_epilogue(bias_relu, c[j], row + i, col + j);
+                }
+            }
+            if(ep.activation == Activation::sigmoid) {
+                vsigmoid(n, c, c);
+            }
+        }
+    }
+
+    // C[MR x NR] = alpha * Ap * Bp + beta * C over kc packed columns/rows, followed by the epilogue
+    // (when given) on the tile at (row, col) of the whole C while the results are still in registers.
+    template<class T>
+    void microkernel(int kc, const T *a, const T *b, T *c, int ldc, T alpha, T beta, const Epilogue<T> *ep = nullptr, int row = 0, int col = 0) {
+        typedef typename Blocking<T>::Ops Ops;
+        typedef typename Ops::V V;
+        constexpr int MR = Blocking<T>::MR, NV = Blocking<T>::NV, W = Ops::W, NR = NV * W;
+
+        V acc[MR][NV];
+        for(int i = 0; i < MR; i++) {
+            for(int v = 0; v < NV; v++) {
+                acc[i][v] = Ops::zero();
+            }
+        }
+
+        for(int p = 0; p < kc; p++) {
+            V bv[NV];
+            for(int v = 0; v < NV; v++) {
+                bv[v] = Ops::load(b + v*W);
+            }
+
+            for(int i = 0; i < MR; i++) {
+                V ai = Ops::bcast(a + i);
+                for(int v = 0; v < NV; v++) {
+                    acc[i][v] = Ops::fma(ai, bv[v], acc[i][v]);
+                }
+            }
+
+            a += MR;
+            b += NR;
+        }
+
+        V valpha = Ops::set1(alpha);
+        for(int i = 0; i < MR; i++) {
+            for(int v = 0; v < NV; v++) {
+                acc[i][v] = Ops::mul(valpha, acc[i][v]);
+            }
+        }
+
+        if(beta != (T)0) {
+            V vbeta = Ops::set1(beta);
+            for(int i = 0; i < MR; i++) {
+                for(int v = 0; v < NV; v++) {
+                    acc[i][v] = Ops::fma(vbeta, Ops::load(c + i*ldc + v*W), acc[i][v]);
+                }
+            }
+        }
+
+        if(ep) {
+            if(ep->row_bias) {
+                for(int i = 0; i < MR; i++) {
+                    V bias = Ops::bcast(ep->row_bias + row + i);
+                    for(int v = 0; v < NV; v++) {
+                        acc[i][v] = Ops::add(acc[i][v], bias);
+                    }
+                }
+            }
+            if(ep->col_bias) {
+                for(int v = 0; v < NV; v++) {
+                    V bias = Ops::load(ep->col_bias + col + v*W);
+                    for(int i = 0; i < MR; i++) {
+                        acc[i][v] = Ops::add(acc[i][v], bias);
+                    }
+                }
+            }
+            if(ep->activation == Activation::relu) {
+                V zero = Ops::zero();
+                for(int i = 0; i < MR; i++) {
+                    for(int v = 0; v < NV; v++) {
+                        acc[i][v] = Ops::max(acc[i][v], zero);
+                    }
+                }
+            }
+        }
+
+        for(int i = 0; i < MR; i++) {
+            for(int v = 0; v < NV; v++) {
+                Ops::store(c + i*ldc + v*W, acc[i][v]);
+            }
+        }
+
+        // sigmoid runs on the stored tile, still in L1
+        if(ep && ep->activation == Activation::sigmoid) {
+            for(int i = 0; i < MR; i++) {
+                vsigmoid(NR, c + i*ldc, c + i*ldc);
+            }
+        }
+    }
+
+    // partial tile at the right/bottom edge: run the full kernel into a scratch tile
+    template<class T>
+    void microkernel_edge(int kc, const T *a, const T *b, T *c, int ldc, T alpha, T beta, int m, int n, const Epilogue<T> *ep = nullptr, int row = 0, int col = 0) {
+        constexpr int MR = gemm_mr<T>(), NR = gemm_nr<T>();
+        alignas(64) T tile[MR * NR];
+
+        microkernel<T>(kc, a, b, tile, NR, alpha, (T)0);
+
+        for(int i = 0; i < m; i++) {
+            for(int j = 0; j < n; j++) {
+                T x = tile[i*NR + j];
+                if(beta != (T)0) {
+                    x += beta * c[i*ldc + j];
+                }
+                c[i*ldc + j] = x;
+            }
+        }
+
+        if(ep) {
+            epilogue_block(*ep, c, m, n, ldc, row, col);
+        }
+    }
+
+    // A block [mc x kc] -> MR-tall micro-panels, column by column, zero-padded to MR rows
+    template<class T>
+    void pack_A(int mc, int kc, const T *A, int rsa, int csa, T *Ap) {
+        constexpr int MR = gemm_mr<T>();
+
+        for(int ir = 0; ir < mc; ir += MR) {
+            int m = min(MR, mc - ir);
+            for(int p = 0; p < kc; p++) {
+                for(int i = 0; i < m; i++) {
+                    Ap[p*MR + i] = A[(ir + i)*rsa + p*csa];
+                }
+                for(int i = m; i < MR; i++) {
+                    Ap[p*MR + i] = (T)0;
+                }
+            }
+            Ap += MR * kc;
+        }
+    }
+
+    // B panels [kc x NR] of micro-panel range [panel_begin, panel_end), row by row, zero-padded to NR columns
+    template<class T>
+    void pack_B(int kc, int nc, const T *B, int rsb, int csb, T *Bp, int panel_begin, int panel_end) {
+        constexpr int NR = gemm_nr<T>();
+
+        for(int jp = panel_begin; jp < panel_end; jp++) {
+            int jr = jp * NR;
+            int n = min(NR, nc - jr);
+            T *dst = Bp + jp * NR * kc;
+
+            if(csb == 1) {
+                for(int p = 0; p < kc; p++) {
+                    const T *src = B + p*rsb + jr;
+                    for(int j = 0; j < n; j++) {
+                        dst[p*NR + j] = src[j];
+                    }
+                    for(int j = n; j < NR; j++) {
+                        dst[p*NR + j] = (T)0;
+                    }
+                }
+            }
+            else {
+                // transposed B: walk the stored rows so the reads stay contiguous
+                for(int j = 0; j < n; j++) {
+                    const T *src = B + (jr + j)*csb;
+                    for(int p = 0; p < kc; p++) {
+                        dst[p*NR + j] = src[p*rsb];
+                    }
+                }
+                for(int p = 0; p < kc; p++) {
+                    for(int j = n; j < NR; j++) {
+                        dst[p*NR + j] = (T)0;
+                    }
+                }
+            }
+        }
+    }
+
+    // packed A block times micro-panels [panel_begin, panel_end) of the packed B panel
+    template<class T>
+    // ep is only passed for the last kc block, (row, col) is the origin of C in the whole matrix
+    void macrokernel(int mc, int nc, int kc, const T *Ap, const T *Bp, T *C, int ldc, T alpha, T beta, int panel_begin, int panel_end, const Epilogue<T> *ep, int row, int col) {
+        constexpr int MR = gemm_mr<T>(), NR = gemm_nr<T>();
+
+        for(int jp = panel_begin; jp < panel_end; jp++) {
+            int jr = jp * NR;
+            int n = min(NR, nc - jr);
+
+            for(int ir = 0; ir < mc; ir += MR) {
+                int m = min(MR, mc - ir);
+                const T *a = Ap + ir * kc, *b = Bp + jr * kc;
+                T *c = C + ir*ldc + jr;
+
+                if(m == MR && n == NR) {
+                    microkernel<T>(kc, a, b, c, ldc, alpha, beta, ep, row + ir, col + jr);
+                }
+                else {
+                    microkernel_edge<T>(kc, a, b, c, ldc, alpha, beta, m, n, ep, row + ir, col + jr);
+                }
+            }
+        }
+    }
+
+    template<class T>
+    void scale_C(int M, int N, T beta, T *C, int ldc, const Epilogue<T> *ep) {
+        for(int i = 0; i < M; i++) {
+            for(int j = 0; j < N; j++) {
+                C[i*ldc + j] = (beta == (T)0) ? (T)0 : beta * C[i*ldc + j];
+            }
+        }
+
+        if(ep) {
+            epilogue_block(*ep, C, M, N, ldc, 0, 0);
+        }
+    }
+
+    // Operands packed whole for gemm_packed: the MC row blocks of A (NC column blocks of B) follow each other, each
+    // the run of its KC blocks as pack_A (pack_B) lays them out, so block (ic, pc) starts at ic*K + mc*pc with mc
+    // rounded up to MR (B: jc*K + nc*pc, nc rounded up to NR). MC and NC are multiples of MR and NR.
+    inline size_t packed_offset(int first, int size, int pc, int K, int R) {
+        return (size_t)first*K + (size_t)((size + R - 1) / R) * R * pc;
+    }
+
+    template<class T>
+    void pack_A_whole(int M, int K, const T *A, int rsa, int csa, T *Ap) {
+        constexpr int MR = gemm_mr<T>(), KC = Blocking<T>::KC, MC = Blocking<T>::MC;
+        int mblocks = (M + MC - 1) / MC;
+
+        Neural::Parallel::run(mblocks, [&](int ib) {
+            int ic = ib * MC, mc = min(MC, M - ic);
+            for(int pc = 0; pc < K; pc += KC) {
+                pack_A<T>(mc, min(KC, K - pc), A + ic*rsa + pc*csa, rsa, csa, Ap + packed_offset(ic, mc, pc, K, MR));
+            }
+        });
+    }
+
+    template<class T>
+    void pack_B_whole(int K, int N, const T *B, int rsb, int csb, T *Bp) {
+        constexpr int NR = gemm_nr<T>(), KC = Blocking<T>::KC, NC = Blocking<T>::NC;
+
+        for(int jc = 0; jc < N; jc += NC) {
+            int nc = min(NC, N - jc), npanels = (nc + NR - 1) / NR;
+            int ngroups = min(npanels, Neural::Parallel::in_parallel() ? 1 : Neural::Parallel::num_threads());
+
+            for(int pc = 0; pc < K; pc += KC) {
+                T *dst = Bp + packed_offset(jc, nc, pc, K, NR);
+                Neural::Parallel::run(ngroups, [&](int g) {
+                    pack_B<T>(min(KC, K - pc), nc, B + pc*rsb + jc*csb, rsb, csb, dst, g * npanels / ngroups, (g + 1) * npanels / ngroups);
+                });
+            }
+        }
+    }
+
+    // Logical A[i][p] = A[i*rsa + p*csa], B[p][j] = B[p*rsb + j*csb]. Ap / Bp, when given, hold A / B packed whole
+    // and the blocks are read from them instead of packed here
+    template<class T>
+    void gemm_packed(int M, int N, int K, T alpha, const T *A, int rsa, int csa, const T *Ap_whole, const T *B, int rsb, int csb, const T *Bp_whole, T beta, T *C, int ldc, const Epilogue<T> *epilogue) {
+        constexpr int MR = gemm_mr<T>(), NR = gemm_nr<T>();
+        constexpr int KC = Blocking<T>::KC, MC = Blocking<T>::MC, NC = Blocking<T>::NC;
+
+        if(M <= 0 || N <= 0) {
+            return;
+        }
+
+        if(K <= 0 || alpha == (T)0) {
+            scale_C(M, N, beta, C, ldc, epilogue);
+            return;
+        }
+
+        int nthreads = Neural::Parallel::in_parallel() ? 1 : Neural::Parallel::num_threads();
+        int nc_max = min(NC, N), kc_max = min(KC, K);
+        int bp_size = ((nc_max + NR - 1) / NR) * NR * kc_max;
+        T *Bp_buffer = Bp_whole ? nullptr : Neural::Pool::acquire<T>(bp_size);
+
+        for(int jc = 0; jc < N; jc += NC) {
+            int nc = min(NC, N - jc);
+            int npanels = (nc + NR - 1) / NR;
+            // spread micro-panels over at most nthreads contiguous groups
+            int ngroups = min(npanels, nthreads);
+
+            for(int pc = 0; pc < K; pc += KC) {
+                int kc = min(KC, K - pc);
+                T beta_eff = (pc == 0) ? beta : (T)1;
+                const Epilogue<T> *ep = (pc + kc == K) ? epilogue : nullptr;
+                const T *Ablock = Ap_whole ? nullptr : A + pc*csa;
+                T *Cblock = C + jc;
+                const T *Bp = Bp_buffer;
+
+                if(Bp_whole) {
+                    Bp = Bp_whole + packed_offset(jc, nc, pc, K, NR);
+                }
+                else {
+                    const T *Bblock = B + pc*rsb + jc*csb;
+                    Neural::Parallel::run(ngroups, [&](int g) {
+                        pack_B<T>(kc, nc, Bblock, rsb, csb, Bp_buffer, g * npanels / ngroups, (g + 1) * npanels / ngroups);
+                    });
+                }
+
+                int mblocks = (M + MC - 1) / MC;
+                int ap_size = ((MC + MR - 1) / MR) * MR * kc;
+
+                if(mblocks >= nthreads) {
+                    // tall C: every worker packs and computes whole row panels
+                    Neural::Parallel::run(mblocks, [&](int ib) {
+                        int ic = ib * MC, mc = min(MC, M - ic);
+
+                        if(Ap_whole) {
+                            macrokernel<T>(mc, nc, kc, Ap_whole + packed_offset(ic, mc, pc, K, MR), Bp, Cblock + ic*ldc, ldc, alpha, beta_eff, 0, npanels, ep, ic, jc);
+                            return;
+                        }
+
+                        T *Ap = Neural::Pool::acquire<T>(ap_size);
+                        pack_A<T>(mc, kc, Ablock + ic*rsa, rsa, csa, Ap);
+                        macrokernel<T>(mc, nc, kc, Ap, Bp, Cblock + ic*ldc, ldc, alpha, beta_eff, 0, npanels, ep, ic, jc);
+                        Neural::Pool::release(Ap, ap_size);
+                    });
+                }
+                else {
+                    // short C: pack each row panel once, split its column micro-panels over the workers
+                    T *Ap_buffer = Ap_whole ? nullptr : Neural::Pool::acquire<T>(ap_size);
+
+                    for(int ic = 0; ic < M; ic += MC) {
+                        int mc = min(MC, M - ic);
+                        const T *Ap = Ap_buffer;
+                        if(Ap_whole) {
+                            Ap = Ap_whole + packed_offset(ic, mc, pc, K, MR);
+                        }
+                        else {
+                            pack_A<T>(mc, kc, Ablock + ic*rsa, rsa, csa, Ap_buffer);
+                        }
+
+                        Neural::Parallel::run(ngroups, [&](int g) {
+                            macrokernel<T>(mc, nc, kc, Ap, Bp, Cblock + ic*ldc, ldc, alpha, beta_eff, g * npanels / ngroups, (g + 1) * npanels / ngroups, ep, ic, jc);
+                        });
+                    }
+
+                    if(Ap_buffer) {
+                        Neural::Pool::release(Ap_buffer, ap_size);
+                    }
+                }
+            }
+        }
+
+        if(Bp_buffer) {
+            Neural::Pool::release(Bp_buffer, bp_size);
+        }
+    }
+
+    template<class T>
+    void gemm_strided(int M, int N, int K, T alpha, const T *A, int rsa, int csa, const T *B, int rsb, int csb, T beta, T *C, int ldc, const Epilogue<T> *epilogue) {
+        gemm_packed<T>(M, N, K, alpha, A, rsa, csa, nullptr, B, rsb, csb, nullptr, beta, C, ldc, epilogue);
+    }
+}
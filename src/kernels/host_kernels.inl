@@ -0,0 +1,37 @@
+// Body of the per-ISA host kernel builds of host_kernels.hpp, included once by each src/host_kernels_<isa>.cpp
+// with HOST_KERNELS_ISA naming its kernel_set. Everything else in here has internal linkage, and simd.hpp puts
+// its vectors in a namespace per ISA, so the builds link together without sharing code.
+#include "host_kernels.hpp"
+#include "simd.hpp"
+#include "vmath.hpp"
+#include "parallel.hpp"
+#include "pool.hpp"
+#include "conv_direct.hpp"
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+
+using namespace std;
+
+#include "vmath.inl"
+#include "gemm.inl"
+#include "eltwise.inl"
+#include "int8.inl"
+#include "xnor.inl"
+
+namespace {
+    template<class T>
+    constexpr Neural::Kernels::HostKernels<T> kernel_table() {
+        return {
+            gemm_strided<T>, gemm_packed<T>, pack_A_whole<T>, pack_B_whole<T>, gemm_mr<T>(), gemm_nr<T>(),
+            epilogue_block<T>,
+            vexp<T>, vlog<T>, vsigmoid<T>, vtanh<T>,
+            relu<T>, relu_backprop<T>, add<T>, mltp<T>,
+            pad2D<T>, crop2D<T>, gather4D<T>,
+            conv_wgrad<T>, conv_dgrad<T>
+        };
+    }
+}
+
+const Neural::Kernels::HostKernelSet Neural::Kernels::HOST_KERNELS_ISA::kernel_set = { SIMD_ISA, kernel_table<double>(), kernel_table<float>(), {gemm_s8, im2col_s8}, {gemm_xnor} };
@@ -0,0 +1,99 @@
+// int8 GEMM and im2col of the quantized inference engine (quantize.hpp), part of host_kernels.inl.
+// Products are widened to int16 and summed in pairs into int32 lanes (vpmaddwd), so it needs AVX2 and
+// nothing newer; the avx512 build runs the same AVX2 loop, the generic one plain loops.
+namespace {
+    using Neural::Kernels::Int8Epilogue;
+
+    // out[r] = sum_k a[k] * b[r*ldb + k] for the 4 rows of b, each block of a widened once for all of them
+    inline void dot4_s8(int K, const int8_t *a, const int8_t *b, int ldb, int32_t out[4]) {
+        int k = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+        __m256i acc[4] = {_mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256()};
+        for(; k + 16 <= K; k += 16) {
+            __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + k)));
+            for(int r = 0; r < 4; r++) {
+                __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + (size_t)r*ldb + k)));
+                acc[r] = _mm256_add_epi32(acc[r], _mm256_madd_epi16(va, vb));
+            }
+        }
+        for(int r = 0; r < 4; r++) {
+            __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc[r]), _mm256_extracti128_si256(acc[r], 1));
+            s = _mm_hadd_epi32(s, s);
+            s = _mm_hadd_epi32(s, s);
+            out[r] = _mm_cvtsi128_si32(s);
+        }
+#else
+        out[0] = out[1] = out[2] = out[3] = 0;
+#endif
+        for(; k < K; k++) {
+            for(int r = 0; r < 4; r++) {
+                out[r] += (int32_t)a[k] * b[(size_t)r*ldb + k];
+            }
+        }
+    }
+
+    inline int32_t dot_s8(int K, const int8_t *a, const int8_t *b) {
+        int32_t sum = 0;
+        for(int k = 0; k < K; k++) {
+            sum += (int32_t)a[k] * b[k];
+        }
+        return sum;
+    }
+
+    // the epilogue on the accumulator of C[i][j]
+    inline void store_s8(const Int8Epilogue &ep, int32_t acc, int i, int j, int8_t *C, float *Cf, int ldc) {
+        int c = ep.per_row ? i : j;
+        float real = (float)(acc + (ep.bias ? ep.bias[c] : 0)) * ep.scale[c];
+        if(ep.activation == Neural::Kernels::Activation::relu) {
+            real = (real > 0.0f) ? real : 0.0f;
+        }
+        else if(ep.activation == Neural::Kernels::Activation::sigmoid) {
+            real = 1.0f / (1.0f + exp(-real));
+        }
+
+        if(Cf) {
+            Cf[(size_t)i*ldc + j] = real;
+            return;
+        }
+        float q = nearbyint(real * ep.output_scale_inv);
+        C[(size_t)i*ldc + j] = (int8_t)((q > 127.0f) ? 127.0f : ((q < -127.0f) ? -127.0f : q));
+    }
+
+    // C[i][j] = epilogue(sum_k A[i][k] * B[j][k]), rows of A and B contiguous along K, int8 C or float Cf
+    void gemm_s8(int M, int N, int K, const int8_t *A, int lda, const int8_t *B, int ldb, const Int8Epilogue &ep, int8_t *C, float *Cf, int ldc) {
+        Neural::Parallel::run(M, [&](int i) {
+            const int8_t *a = A + (size_t)i*lda;
+            int j = 0;
+            for(; j + 4 <= N; j += 4) {
+                int32_t acc[4];
+                dot4_s8(K, a, B + (size_t)j*ldb, ldb, acc);
+                for(int r = 0; r < 4; r++) {
+                    store_s8(ep, acc[r], i, j + r, C, Cf, ldc);
+                }
+            }
+            for(; j < N; j++) {
+                store_s8(ep, dot_s8(K, a, B + (size_t)j*ldb), i, j, C, Cf, ldc);
+            }
+        });
+    }
+
+    // one image of channels x rows x cols into patches[out_rows*out_cols][channels*filter_rows*filter_cols],
+    // zeros (the quantized 0) where a patch reaches into the padding
+    void im2col_s8(const int8_t *in, int8_t *patches, int channels, int rows, int cols, int filter_rows, int filter_cols, int stride_rows, int stride_cols, int pad_top, int pad_left, int out_rows, int out_cols) {
+        int patch = channels*filter_rows*filter_cols;
+        for(int oh = 0; oh < out_rows; oh++) {
+            for(int ow = 0; ow < out_cols; ow++) {
+                int8_t *p = patches + (size_t)(oh*out_cols + ow)*patch;
+                for(int c = 0; c < channels; c++) {
+                    for(int fh = 0; fh < filter_rows; fh++) {
+                        int h = oh*stride_rows + fh - pad_top;
+                        for(int fw = 0; fw < filter_cols; fw++) {
+                            int w = ow*stride_cols + fw - pad_left;
+                            *p++ = (h >= 0 && h < rows && w >= 0 && w < cols) ? in[((size_t)c*rows + h)*cols + w] : 0;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,302 @@
+// Vector exp / log / sigmoid / tanh behind vmath.hpp, part of host_kernels.inl
+namespace {
+    using Neural::Simd::Vec;
+
+    template<class T> struct Consts;
+
+    template<> struct Consts<double> {
+        typedef uint64_t U;
+        static constexpr int MANT = 52;
+        static constexpr U BIAS = 1023;
+        // 1.5 * 2^52: adding it rounds to an integer that lands in the low mantissa bits
+        static constexpr double SHIFTER = 6755399441055744.0;
+        static constexpr double TWO_MANT = 4503599627370496.0;
+        static constexpr double LOG2E = 1.4426950408889634074;
+        // ln2 = LN2_HI + LN2_LO, LN2_HI has its low bits clear so n * LN2_HI is exact
+        static constexpr double LN2_HI = 6.93147180369123816490e-01;
+        static constexpr double LN2_LO = 1.90821492927058770002e-10;
+        // exp results are normal in [EXP_LO, EXP_HI]
+        static constexpr double EXP_LO = -708.39;
+        static constexpr double EXP_HI = 709.782712893383973096;
+        // 1/k! for k = 13 .. 0, |r| <= ln2/2 leaves a truncation error below 1e-17
+        static constexpr int EXP_DEGREE = 13;
+        static constexpr double EXP_POLY[EXP_DEGREE + 1] = {
+            1.0/6227020800.0, 1.0/479001600.0, 1.0/39916800.0, 1.0/3628800.0, 1.0/362880.0, 1.0/40320.0, 1.0/5040.0,
+            1.0/720.0, 1.0/120.0, 1.0/24.0, 1.0/6.0, 1.0/2.0, 1.0, 1.0
+        };
+        // log(1+f) = f - f^2/2 + s (f^2/2 + R(s^2)), s = f / (2 + f), R from fdlibm (Lg7 .. Lg1)
+        static constexpr int LOG_DEGREE = 7;
+        static constexpr double LOG_POLY[LOG_DEGREE] = {
+            1.479819860511658591e-01, 1.531383769920937332e-01, 1.818357216161805012e-01, 2.222219843214978396e-01,
+            2.857142874366239149e-01, 3.999999999940941908e-01, 6.666666666666735130e-01
+        };
+        // bit patterns of sqrt(2)/2 and 1.0, the mantissa is reduced to [sqrt(2)/2, sqrt(2))
+        static constexpr U SQRT_HALF_BITS = 0x3fe6a09e667f3bcdULL;
+        static constexpr U ONE_BITS = 0x3ff0000000000000ULL;
+        static constexpr U SIGN_BITS = 0x8000000000000000ULL;
+        // subnormal inputs to log are scaled by 2^54 first
+        static constexpr double SUBNORMAL_SCALE = 18014398509481984.0;
+        static constexpr double SUBNORMAL_EXP = 54.0;
+        // tanh(x) rounds to +-1 beyond |x| = 20
+        static constexpr double TANH_CLAMP = 40.0;
+        // exp of [EXP_SUB_LO, EXP_LO) is subnormal, computed as 2^(n + SUB_SHIFT) p * 2^-SUB_SHIFT
+        static constexpr double EXP_SUB_LO = -745.2;
+        static constexpr int SUB_SHIFT = 64;
+        static constexpr double SUB_SCALE = 5.42101086242752217004e-20;
+        // below -SIGMOID_TAIL 1 + exp(x) rounds to 1 and sigmoid(x) is exp(x)
+        static constexpr double SIGMOID_TAIL = 40.0;
+    };
+
+    template<> struct Consts<float> {
+        typedef uint32_t U;
+        static constexpr int MANT = 23;
+        static constexpr U BIAS = 127;
+        static constexpr float SHIFTER = 12582912.0f;
+        static constexpr float TWO_MANT = 8388608.0f;
+        static constexpr float LOG2E = 1.44269504088896341f;
+        static constexpr float LN2_HI = 6.9313812256e-01f;
+        static constexpr float LN2_LO = 9.0580006145e-06f;
+        static constexpr float EXP_LO = -87.33f;
+        static constexpr float EXP_HI = 88.7228391116729996f;
+        static constexpr int EXP_DEGREE = 7;
+        static constexpr float EXP_POLY[EXP_DEGREE + 1] = {
+            1.0f/5040.0f, 1.0f/720.0f, 1.0f/120.0f, 1.0f/24.0f, 1.0f/6.0f, 1.0f/2.0f, 1.0f, 1.0f
+        };
+        static constexpr int LOG_DEGREE = 7;
+        static constexpr float LOG_POLY[LOG_DEGREE] = {
+            1.4798198640e-01f, 1.5313838422e-01f, 1.8183572590e-01f, 2.2222198546e-01f,
+            2.8571429849e-01f, 4.0000000596e-01f, 6.6666668653e-01f
+        };
+        static constexpr U SQRT_HALF_BITS = 0x3f3504f3U;
+        static constexpr U ONE_BITS = 0x3f800000U;
+        static constexpr U SIGN_BITS = 0x80000000U;
+        static constexpr float SUBNORMAL_SCALE = 33554432.0f;
+        static constexpr float SUBNORMAL_EXP = 25.0f;
+        static constexpr float TANH_CLAMP = 40.0f;
+        static constexpr float EXP_SUB_LO = -104.0f;
+        static constexpr int SUB_SHIFT = 32;
+        static constexpr float SUB_SCALE = 2.3283064365386963e-10f;
+        static constexpr float SIGMOID_TAIL = 20.0f;
+    };
+
+    // x = n ln2 + r, |r| <= ln2/2; k is n + SHIFTER, so (bits(k) << MANT) is n in the exponent field
+    template<class O>
+    void exp_reduce(typename O::V x, typename O::V &k, typename O::V &r) {
+        typedef typename O::T T;
+        typedef Consts<T> C;
+
+        k = O::fma(x, O::set1(C::LOG2E), O::set1(C::SHIFTER));
+        typename O::V n = O::sub(k, O::set1(C::SHIFTER));
+        r = O::fma(n, O::set1(-C::LN2_HI), x);
+        r = O::fma(n, O::set1(-C::LN2_LO), r);
+    }
+
+    template<class O>
+    typename O::V exp_kernel(typename O::V x) {
+        typedef typename O::T T;
+        typedef typename O::V V;
+        typedef Consts<T> C;
+
+        // max/min keep a NaN x (second operand)
+        V xc = O::min(O::set1(C::EXP_HI), O::max(O::set1(C::EXP_LO), x));
+        V k, r;
+        exp_reduce<O>(xc, k, r);
+
+        V p = O::set1(C::EXP_POLY[0]);
+        for(int i = 1; i <= C::EXP_DEGREE; i++) {
+            p = O::fma(p, r, O::set1(C::EXP_POLY[i]));
+        }
+
+        // p * 2^n by adding n to p's exponent field
+        V y = O::as_float(O::iadd(O::as_int(p), O::template sll<C::MANT>(O::as_int(k))));
+
+        y = O::select(O::lt(O::set1(C::EXP_HI), x), O::set1(numeric_limits<T>::infinity()), y);
+        y = O::select(O::lt(x, O::set1(C::EXP_LO)), O::zero(), y);
+        return O::select(O::unord(x, x), x, y);
+    }
+
+    // exp(x) for x <= 0 without the flush to 0 below EXP_LO: the exponent of p * 2^n is raised by SUB_SHIFT to stay
+    // normal and the final multiply by 2^-SUB_SHIFT rounds once into the subnormals
+    template<class O>
+    typename O::V exp_negative_kernel(typename O::V x) {
+        typedef typename O::T T;
+        typedef typename O::V V;
+        typedef Consts<T> C;
+
+        V xc = O::max(O::set1(C::EXP_SUB_LO), x);
+        V k, r;
+        exp_reduce<O>(xc, k, r);
+
+        V p = O::set1(C::EXP_POLY[0]);
+        for(int i = 1; i <= C::EXP_DEGREE; i++) {
+            p = O::fma(p, r, O::set1(C::EXP_POLY[i]));
+        }
+
+        V y = O::as_float(O::iadd(O::as_int(p), O::template sll<C::MANT>(O::iadd(O::as_int(k), O::iset1(C::SUB_SHIFT)))));
+        y = O::mul(y, O::set1(C::SUB_SCALE));
+        y = O::select(O::lt(x, O::set1(C::EXP_SUB_LO)), O::zero(), y);
+        return O::select(O::unord(x, x), x, y);
+    }
+
+    // exp(x) - 1 for 0 <= x <= TANH_CLAMP, accurate near 0
+    template<class O>
+    typename O::V expm1_positive_kernel(typename O::V x) {
+        typedef typename O::T T;
+        typedef typename O::V V;
+        typedef Consts<T> C;
+
+        V k, r;
+        exp_reduce<O>(x, k, r);
+
+        // q = exp(r) - 1 = r + r^2 (1/2 + r/6 + ...)
+        V q = O::set1(C::EXP_POLY[0]);
+        for(int i = 1; i < C::EXP_DEGREE - 1; i++) {
+            q = O::fma(q, r, O::set1(C::EXP_POLY[i]));
+        }
+        q = O::fma(O::mul(q, r), r, r);
+
+        // 2^n (1 + q) - 1 = 2^n q + (2^n - 1), the latter exact for the n reached here
+        V two_n = O::as_float(O::iadd(O::iset1(C::ONE_BITS), O::template sll<C::MANT>(O::as_int(k))));
+        return O::fma(two_n, q, O::sub(two_n, O::set1((T)1)));
+    }
+
+    template<class O>
+    typename O::V log_kernel(typename O::V x) {
+        typedef typename O::T T;
+        typedef typename O::V V;
+        typedef typename O::I I;
+        typedef Consts<T> C;
+
+        typename O::M subnormal = O::lt(x, O::set1(numeric_limits<T>::min()));
+        V xs = O::select(subnormal, O::mul(x, O::set1(C::SUBNORMAL_SCALE)), x);
+        V kadj = O::select(subnormal, O::set1(-C::SUBNORMAL_EXP), O::zero());
+
+        // biased exponent after rounding the mantissa into [sqrt(2)/2, sqrt(2)), then z = the mantissa
+        I ix = O::as_int(xs);
+        I kb = O::template srl<C::MANT>(O::iadd(ix, O::iset1(C::ONE_BITS - C::SQRT_HALF_BITS)));
+        I iz = O::iadd(O::isub(ix, O::template sll<C::MANT>(kb)), O::iset1(C::ONE_BITS));
+        V z = O::as_float(iz);
+
+        // small integer to float through the mantissa of 2^MANT
+        V k = O::sub(O::as_float(O::ior(kb, O::as_int(O::set1(C::TWO_MANT)))), O::set1(C::TWO_MANT + (T)C::BIAS));
+        k = O::add(k, kadj);
+
+        V f = O::sub(z, O::set1((T)1));
+        V s = O::div(f, O::add(O::set1((T)2), f));
+        V s2 = O::mul(s, s);
+        V R = O::set1(C::LOG_POLY[0]);
+        for(int i = 1; i < C::LOG_DEGREE; i++) {
+            R = O::fma(R, s2, O::set1(C::LOG_POLY[i]));
+        }
+        R = O::mul(R, s2);
+        V hfsq = O::mul(O::set1((T)0.5), O::mul(f, f));
+
+        // k ln2_hi - ((hfsq - (s (hfsq + R) + k ln2_lo)) - f)
+        V lo = O::fma(s, O::add(hfsq, R), O::mul(k, O::set1(C::LN2_LO)));
+        V y = O::fma(k, O::set1(C::LN2_HI), O::sub(f, O::sub(hfsq, lo)));
+
+        T inf = numeric_limits<T>::infinity();
+        y = O::select(O::eq(x, O::set1(inf)), x, y);
+        y = O::select(O::eq(x, O::zero()), O::set1(-inf), y);
+        y = O::select(O::lt(x, O::zero()), O::set1(numeric_limits<T>::quiet_NaN()), y);
+        return O::select(O::unord(x, x), x, y);
+    }
+
+    template<class O>
+    typename O::V sigmoid_kernel(typename O::V x) {
+        typedef typename O::T T;
+        typedef typename O::V V;
+        typedef Consts<T> C;
+
+        V e = exp_kernel<O>(O::sub(O::zero(), x));
+        V y = O::div(O::set1((T)1), O::add(O::set1((T)1), e));
+        // deep in the negative tail exp(-x) overflows while the sigmoid is still subnormal
+        typename O::M tail = O::lt(x, O::set1(-C::SIGMOID_TAIL));
+        return O::select(tail, exp_negative_kernel<O>(x), y);
+    }
+
+    template<class O>
+    typename O::V tanh_kernel(typename O::V x) {
+        typedef typename O::T T;
+        typedef typename O::V V;
+        typedef typename O::I I;
+        typedef Consts<T> C;
+
+        I sign = O::iand(O::as_int(x), O::iset1(C::SIGN_BITS));
+        V a = O::as_float(O::isub(O::as_int(x), sign));
+
+        // tanh(a) = u / (u + 2), u = exp(2a) - 1
+        V u = expm1_positive_kernel<O>(O::min(O::set1(C::TANH_CLAMP), O::add(a, a)));
+        V t = O::div(u, O::add(u, O::set1((T)2)));
+
+        V y = O::as_float(O::ior(O::as_int(t), sign));
+        return O::select(O::unord(x, x), x, y);
+    }
+
+    // runs kernel over full vectors, the tail through a zero-padded vector
+    template<class T, class F>
+    void apply(int n, const T *x, T *y, F kernel) {
+        typedef typename Vec<T>::Ops O;
+        constexpr int W = O::W;
+
+        int i = 0;
+        for(; i + W <= n; i += W) {
+            O::store(y + i, kernel(O::load(x + i)));
+        }
+
+        if(i < n) {
+            alignas(64) T tail[W] = {};
+            copy(x + i, x + n, tail);
+            O::store(tail, kernel(O::load(tail)));
+            copy(tail, tail + (n - i), y + i);
+        }
+    }
+
+    template<class T>
+    void vexp(int n, const T *x, T *y) {
+        if(Neural::Math::use_libm()) {
+            for(int i = 0; i < n; i++) {
+                y[i] = std::exp(x[i]);
+            }
+            return;
+        }
+        typedef typename Vec<T>::Ops O;
+        apply(n, x, y, [](typename O::V v) { return exp_kernel<O>(v); });
+    }
+
+    template<class T>
+    void vlog(int n, const T *x, T *y) {
+        if(Neural::Math::use_libm()) {
+            for(int i = 0; i < n; i++) {
+                y[i] = std::log(x[i]);
+            }
+            return;
+        }
+        typedef typename Vec<T>::Ops O;
+        apply(n, x, y, [](typename O::V v) { return log_kernel<O>(v); });
+    }
+
+    template<class T>
+    void vsigmoid(int n, const T *x, T *y) {
+        if(Neural::Math::use_libm()) {
+            for(int i = 0; i < n; i++) {
+                y[i] = (T)1 / ((T)1 + std::exp(-x[i]));
+            }
+            return;
+        }
+        typedef typename Vec<T>::Ops O;
+        apply(n, x, y, [](typename O::V v) { return sigmoid_kernel<O>(v); });
+    }
+
+    template<class T>
+    void vtanh(int n, const T *x, T *y) {
+        if(Neural::Math::use_libm()) {
+            for(int i = 0; i < n; i++) {
+                y[i] = std::tanh(x[i]);
+            }
+            return;
+        }
+        typedef typename Vec<T>::Ops O;
+        apply(n, x, y, [](typename O::V v) { return tanh_kernel<O>(v); });
+    }
+}
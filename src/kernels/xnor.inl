@@ -0,0 +1,62 @@
+// XOR + popcount GEMM of the sign-binarized layers (xnor.hpp), part of host_kernels.inl. One popcnt per 64
+// products: the avx2 and avx512 builds have the popcnt instruction (-mpopcnt), the generic one the
+// compiler's bit-twiddling fallback.
+namespace {
+    inline int popcount64(uint64_t x) {
+        return __builtin_popcountll(x);
+    }
+
+    // differing bits of a against the 4 rows of b, within their masks, and the valid bits of each row
+    inline void xor4_popcount(int words, const uint64_t *a, const uint64_t *b, const uint64_t *mask, int ldb, int32_t diff[4], int32_t valid[4]) {
+        int32_t d0 = 0, d1 = 0, d2 = 0, d3 = 0;
+        if(mask) {
+            int32_t v0 = 0, v1 = 0, v2 = 0, v3 = 0;
+            for(int w = 0; w < words; w++) {
+                uint64_t aw = a[w];
+                d0 += popcount64((aw ^ b[w]) & mask[w]);
+                d1 += popcount64((aw ^ b[ldb + w]) & mask[ldb + w]);
+                d2 += popcount64((aw ^ b[2*(size_t)ldb + w]) & mask[2*(size_t)ldb + w]);
+                d3 += popcount64((aw ^ b[3*(size_t)ldb + w]) & mask[3*(size_t)ldb + w]);
+                v0 += popcount64(mask[w]);
+                v1 += popcount64(mask[ldb + w]);
+                v2 += popcount64(mask[2*(size_t)ldb + w]);
+                v3 += popcount64(mask[3*(size_t)ldb + w]);
+            }
+            valid[0] = v0; valid[1] = v1; valid[2] = v2; valid[3] = v3;
+        }
+        else {
+            for(int w = 0; w < words; w++) {
+                uint64_t aw = a[w];
+                d0 += popcount64(aw ^ b[w]);
+                d1 += popcount64(aw ^ b[ldb + w]);
+                d2 += popcount64(aw ^ b[2*(size_t)ldb + w]);
+                d3 += popcount64(aw ^ b[3*(size_t)ldb + w]);
+            }
+        }
+        diff[0] = d0; diff[1] = d1; diff[2] = d2; diff[3] = d3;
+    }
+
+    void gemm_xnor(int M, int N, int words, int K, const uint64_t *A, int lda, const uint64_t *B, const uint64_t *Bmask, int ldb, int32_t *C, int ldc) {
+        Neural::Parallel::run(M, [&](int i) {
+            const uint64_t *a = A + (size_t)i*lda;
+            int32_t *c = C + (size_t)i*ldc;
+            int j = 0;
+            for(; j + 4 <= N; j += 4) {
+                int32_t diff[4], valid[4] = {K, K, K, K};
+                xor4_popcount(words, a, B + (size_t)j*ldb, Bmask ? Bmask + (size_t)j*ldb : nullptr, ldb, diff, valid);
+                for(int r = 0; r < 4; r++) {
+                    c[j + r] = valid[r] - 2*diff[r];
+                }
+            }
+            for(; j < N; j++) {
+                const uint64_t *b = B + (size_t)j*ldb, *mask = Bmask ? Bmask + (size_t)j*ldb : nullptr;
+                int32_t diff = 0, valid = mask ? 0 : K;
+                for(int w = 0; w < words; w++) {
+                    diff += popcount64(mask ? ((a[w] ^ b[w]) & mask[w]) : (a[w] ^ b[w]));
+                    valid += mask ? popcount64(mask[w]) : 0;
+                }
+                c[j] = valid - 2*diff;
+            }
+        });
+    }
+}
@@ -5,6 +5,9 @@
 #include <sstream>
 #include <cassert>
 #include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <type_traits>
 #include "layer.hpp"
 #include "utils.hpp"
 #include "ops.hpp"
@@ -12,7 +15,6 @@
 using Neural::Tensor4D;
 using Neural::Shape4D;
 
-typedef Tensor4D<double> t4d;
 
 using namespace std;
 
@@ -25,39 +27,64 @@ using namespace std;
  *
  */
 
+using Neural::Layers::BinaryConv;
+using Neural::Layers::BinaryFc;
 using Neural::Layers::Conv;
 using Neural::Layers::Fc;
 using Neural::Layers::Layer;
 using Neural::Layers::Weighted;
 
 ////////// <Layer> ////////////
-int Layer::nl = 0;
+template<class T>
+int Layer<T>::nl = 0;
 
-Layer::Layer(Shape4D prev_shape, int features, string afn) : prev_shape_proto(Shape4D(-1, prev_shape[1], prev_shape[2], prev_shape[3])), features(features) {
+template<class T>
+Layer<T>::Layer(Shape4D prev_shape, int features, string afn) : prev_shape_proto(Shape4D(-1, prev_shape[1], prev_shape[2], prev_shape[3])), features(features) {
     LOGD << "Layer::Layer";
 
     LOGD << "Layer::prev_shape: " << prev_shape.to_string() << ", prev_shape_proto: " << this->prev_shape_proto.to_string();
     LOGD << "Generating layer number from " << nl;
     id = ++nl;
     LOGD << "Generated " << id;
+    backend = Neural::default_backend<T>();
 
     if (afn == "relu") {
-        activation_fn = Neural::Activations::Relu;
+        activation_fn = Neural::Activations::Relu<T>;
     }
     else if (afn == "softmax") {
-        activation_fn = Neural::Activations::Softmax;
+        activation_fn = Neural::Activations::Softmax<T>;
     }
     else if (afn == "sigmoid") {
-        activation_fn = Neural::Activations::Sigmoid;
+        activation_fn = Neural::Activations::Sigmoid<T>;
     }
 }
 
-string Layer::gph() {
+template<class T>
+string Layer<T>::gph() {
     string ret("[Layer " + to_string(id) + "] [" + layerType + "]");
     return ret;
 }
 
-t4d * Layer::forward_activate(t4d &output_preact) {
+template<class T>
+Tensor4D<T> * Layer<T>::input_in_layout(Tensor4D<T> &prev_output) {
+    Shape4D prev_shape = prev_output.shape();
+    if(prev_output.layout() == layout) {
+        return new Tensor4D<T>(prev_output.view());
+    }
+    if(prev_shape[1] == 1 || prev_shape[2]*prev_shape[3] == 1) {
+        return new Tensor4D<T>(Neural::TensorView4D<T>(prev_output.data(), prev_shape, layout));
+    }
+
+    LOGD << gph() + "acc_convert_layout(prev_output, input)";
+    Tensor4D<T> *input = new Tensor4D<T>(prev_shape);
+    input->set_layout(layout);
+    input->create_acc();
+    acc_convert_layout(prev_output, input);
+    return input;
+}
+
+template<class T>
+Tensor4D<T> * Layer<T>::forward_activate(Tensor4D<T> &output_preact) {
     LOGD << gph() + "Activation: " + activation_fn.name();
 
     Shape4D output_shape = output_preact.shape();
@@ -65,16 +92,52 @@ t4d * Layer::forward_activate(t4d &output_preact) {
     assert_shape(output_shape, output_shape_proto);
 
     LOGD << "output = make_unique<t4d>(" + output_shape.to_string() + ", 1, " + to_string(_acc) + ")";
-    t4d * output = new t4d(output_shape);
+    Tensor4D<T> * output = new Tensor4D<T>(output_shape);
+    output->set_layout(output_preact.layout());
     output->create_acc();
 
     // helper_InnerActivate(*output_preact, output, activation_fn);
-    activation_fn.apply(output_preact, output);
+    activation_fn.apply(*backend, output_preact, output);
 
     return output;
 }
 
-t4d * Layer::backprop_calc_drv_error_output_preact(string loss_fn, double &loss_value, t4d & output, Tensor4D<int> &labels_batch) {
+template<class T>
+Tensor4D<T> * Layer<T>::forward_calc_output(Tensor4D<T> &input) {
+    unique_ptr<Tensor4D<T>> output_preact(forward_calc_output_preact(input));
+    _LLOG(debug, output_preact);
+    return forward_activate(*output_preact.get());
+}
+
+template<class T>
+Tensor4D<T> * Layer<T>::forward_calc_output_loss(Tensor4D<T> &input, string loss_fn, double &loss_value, Tensor4D<int> &labels_batch, Tensor4D<T> *&drv_error_output_preact) {
+    LOGD << gph() + "Layer::forward_calc_output_loss";
+
+    if((loss_fn == "CrossEntropy") && (activation_fn.name() == "softmax")) {
+        unique_ptr<Tensor4D<T>> logits(forward_calc_output_preact(input));
+        Shape4D output_shape = logits->shape();
+        assert_shape(output_shape, output_shape_proto);
+
+        Tensor4D<T> *output = new Tensor4D<T>(output_shape);
+        output->set_layout(logits->layout());
+        output->create_acc();
+        drv_error_output_preact = new Tensor4D<T>(output_shape);
+        drv_error_output_preact->set_layout(logits->layout());
+        drv_error_output_preact->create_acc();
+
+        LOGD << "backend->softmax_cross_entropy(*logits, labels_batch, output, drv_error_output_preact)";
+        loss_value = backend->softmax_cross_entropy(*logits.get(), labels_batch, output, drv_error_output_preact);
+        LOGD << "loss_value = " << loss_value;
+        return output;
+    }
+
+    Tensor4D<T> *output = forward_calc_output(input);
+    drv_error_output_preact = backprop_calc_drv_error_output_preact(loss_fn, loss_value, *output, labels_batch);
+    return output;
+}
+
+template<class T>
+Tensor4D<T> * Layer<T>::backprop_calc_drv_error_output_preact(string loss_fn, double &loss_value, Tensor4D<T> & output, Tensor4D<int> &labels_batch) {
     LOGD << gph() + "Layer::backprop_calc_loss";
     
     LOGD << "activation_type: " << this->get_activation_name();
@@ -85,11 +148,12 @@ t4d * Layer::backprop_calc_drv_error_output_preact(string loss_fn, double &loss_
     assert(labels_batch.shape() == output_shape);
 
     LOGD << "drv_error_output_preact = new t4d(" + output_shape.to_string() + ", 1, " + to_string(_acc) + ")";
-    t4d *drv_error_output_preact = new t4d(output_shape);
+    Tensor4D<T> *drv_error_output_preact = new Tensor4D<T>(output_shape);
+    drv_error_output_preact->set_layout(output.layout());
     drv_error_output_preact->create_acc();
 
     LOGD << "Layer::loss getting data pointers";
-    double *output_data = output.data(), *drv_error_output_preact_data = drv_error_output_preact->data();
+    T *output_data = output.data(), *drv_error_output_preact_data = drv_error_output_preact->data();
     int *labels_data = labels_batch.data();
 
     int B = output_shape[0], M = output_shape[1];
@@ -106,6 +170,7 @@ t4d * Layer::backprop_calc_drv_error_output_preact(string loss_fn, double &loss_
     if ((loss_fn == "CrossEntropy") && (activation_type == "softmax")) {
         //calculating loss
         #pragma acc parallel loop collapse(2) reduction(+:loss_value) present(labels_data[:lsize], output_data[:lsize])
+        #pragma omp parallel for collapse(2) reduction(+:loss_value) schedule(static)
         for (int i = 0; i < B; i++) {
             for (int j = 0; j < M; j++) {
                 int lblint = labels_data[i * M + j];
@@ -124,9 +189,10 @@ t4d * Layer::backprop_calc_drv_error_output_preact(string loss_fn, double &loss_
 
         //skiping de-derivation
         #pragma acc parallel loop collapse(2) present(labels_data[:lsize], output_data[:lsize], drv_error_output_preact_data[:lsize])
+        #pragma omp parallel for collapse(2) schedule(static)
         for (int i = 0; i < B; i++) {
             for (int j = 0; j < M; j++) {
-                double d_lbl = (double)labels_data[i * M + j];
+                T d_lbl = (T)labels_data[i * M + j];
                 drv_error_output_preact_data[i * M + j] = output_data[i * M + j] - d_lbl;
             }
         }
@@ -136,7 +202,8 @@ t4d * Layer::backprop_calc_drv_error_output_preact(string loss_fn, double &loss_
     return drv_error_output_preact;
 }
 
-t4d * Layer::backprop_calc_drv_error_output_preact(t4d &drv_error_output, t4d &output) {
+template<class T>
+Tensor4D<T> * Layer<T>::backprop_calc_drv_error_output_preact(Tensor4D<T> &drv_error_output, Tensor4D<T> &output) {
     LOGD << gph() + "backprop_delta_output";
 
     Shape4D output_shape = output.shape();
@@ -150,24 +217,28 @@ t4d * Layer::backprop_calc_drv_error_output_preact(t4d &drv_error_output, t4d &o
     _LLOG(debug, (&output));
 
     LOGD << "t4d * drv_error_output_preact = new t4d(" + output_shape.to_string() + ", 1, " + to_string(_acc) + ")";
-    t4d * drv_error_output_preact = new t4d(output_shape);
+    Tensor4D<T> * drv_error_output_preact = new Tensor4D<T>(output_shape);
+    drv_error_output_preact->set_layout(output.layout());
     drv_error_output_preact->create_acc();
 
-    activation_fn.backward(drv_error_output, output, drv_error_output_preact);
+    activation_fn.backward(*backend, drv_error_output, output, drv_error_output_preact);
 
     _LLOG(debug, drv_error_output_preact);
 
     return drv_error_output_preact;
 }
 
-Weighted::Weighted(Shape4D prev_shape_proto, int features, string afn) : Layer(prev_shape_proto, features, afn) {
+template<class T>
+Weighted<T>::Weighted(Shape4D prev_shape_proto, int features, string afn) : Layer<T>(prev_shape_proto, features, afn) {
 }
 
-Weighted::~Weighted() {
+template<class T>
+Weighted<T>::~Weighted() {
     LOGD << gph() + "destructor";
 }
 
-void Weighted::init() {
+template<class T>
+void Weighted<T>::init() {
     LOGI << gph() + "::init";
     LOGI << "features: " << features;
     LOGI << "prev_shape_proto: " << prev_shape_proto.to_string();
@@ -175,68 +246,116 @@ void Weighted::init() {
     LOGI << "output_shape_proto: " << output_shape_proto.to_string();
 
     LOGI << "weights = make_unique<t4d>(" << weights_shape.to_string() << ")";
-    weights = make_unique<t4d>(weights_shape);
+    weights = make_unique<Tensor4D<T>>(weights_shape);
     weights->create_acc();
-    LOGI << "weights rng";
-    acc_rng(weights.get(), (double)0.1f);
+    // stream of the layer id, the same weights for the same NEURAL_SEED
+    LOGI << "weights rng, seed " << Neural::Random::seed() << " stream " << id;
+    acc_rng(weights.get(), (T)0.1f, {(uint32_t)id, 0});
     _LLOG(debug, weights);
 
     LOGI << "biases = make_unique<t4d>(" << biases_shape.to_string()<< ")";
-    biases = make_unique<t4d>(biases_shape);
+    biases = make_unique<Tensor4D<T>>(biases_shape);
     biases->create_acc();
     LOGI << "acc_zeros(biases)";
     acc_zeros(biases.get());
     _LLOG(debug, biases);
+    weights_version++;
+}
+
+template<class T>
+void Weighted<T>::set_storage(const string &_storage) {
+    Layer<T>::set_storage(_storage);
+    weights_bf16.reset();
+    // the filter transforms cached for the previous forward weights are stale
+    weights_version++;
+}
+
+template<class T>
+Tensor4D<T> & Weighted<T>::forward_weights() {
+    if(storage != "bf16") {
+        return *weights.get();
+    }
+    if(!weights_bf16) {
+        weights_bf16 = make_unique<Tensor4D<T>>(weights_shape);
+        weights_bf16->create_acc();
+    }
+    if(weights_bf16_version != weights_version) {
+        LOGD << gph() + "forward weights: rounding weights version " << weights_version << " to bf16";
+        acc_round_bf16(*weights.get(), weights_bf16.get());
+        weights_bf16_version = weights_version;
+    }
+    return *weights_bf16.get();
 }
 
-void Weighted::backprop_update(double learning_rate, t4d &drv_error_output_preact, t4d &input) {
+template<class T>
+void Weighted<T>::backprop_update(double learning_rate, Tensor4D<T> &drv_error_output_preact, Tensor4D<T> &input) {
     LOGD << gph() + "Weighted::backprop_update";
     LOGD << "learning_rate: " << learning_rate;
     Shape4D output_shape = drv_error_output_preact.shape(), input_shape = input.shape();
     assert_shape(output_shape, output_shape_proto);
     assert_shape(input_shape, input_shape_proto);
 
-    unique_ptr<t4d> drv_error_weights(this->backprop_calc_drv_error_weights(drv_error_output_preact, input)), drv_error_biases(this->backprop_calc_drv_error_biases(drv_error_output_preact));
+    unique_ptr<Tensor4D<T>> drv_error_weights(this->backprop_calc_drv_error_weights(drv_error_output_preact, input)), drv_error_biases(this->backprop_calc_drv_error_biases(drv_error_output_preact));
 
     double mltp = -1.0f * learning_rate;
 
     _LLOG_A(debug, drv_error_weights, "drv_error_weights non learning-rate");
-    acc_mltp(drv_error_weights.get(), mltp);
+    backend->mltp(drv_error_weights.get(), mltp);
     _LLOG(debug, drv_error_weights);
-    LOGD << "acc_add(weights, *drv_error_weights)";
+    LOGD << "backend->add(weights, *drv_error_weights)";
     _LLOG_A(debug, weights, "weightes pre-add");
-    acc_add(weights.get(), *drv_error_weights.get());
+    backend->add(weights.get(), *drv_error_weights.get());
     _LLOG(debug, weights);
 
     _LLOG_A(debug, drv_error_biases, "drv_error_biases non learning_rate");
-    LOGD << "acc_mltp(drv_error_biases, mltp)";
-    acc_mltp(drv_error_biases.get(), mltp);
+    LOGD << "backend->mltp(drv_error_biases, mltp)";
+    backend->mltp(drv_error_biases.get(), mltp);
     _LLOG(debug, drv_error_biases);
     //update
-    LOGD << "acc_add(biases, *drv_error_biases)";
+    LOGD << "backend->add(biases, *drv_error_biases)";
     _LLOG_A(debug, biases, "biases pre-add");
-    acc_add(biases.get(),  *drv_error_biases.get());
+    backend->add(biases.get(),  *drv_error_biases.get());
     _LLOG(debug, biases);
+    constrain_weights();
+    weights_version++;
+    pack_weights();
+}
+
+template<class T>
+Tensor4D<T> * Weighted<T>::forward_calc_output_preact(Tensor4D<T> &input) {
+    return forward_calc_output_fused(input, Neural::Kernels::Activation::none);
 }
 
-t4d * Weighted::backprop_calc_drv_error_biases(t4d &drv_error_output_preact) {
+template<class T>
+Tensor4D<T> * Weighted<T>::forward_calc_output(Tensor4D<T> &input) {
+    Neural::Kernels::Activation activation = activation_fn.epilogue();
+    if(activation == Neural::Kernels::Activation::none) {
+        return Layer<T>::forward_calc_output(input);
+    }
+
+    LOGD << gph() + "Activation (fused): " + activation_fn.name();
+    return forward_calc_output_fused(input, activation);
+}
+
+template<class T>
+Tensor4D<T> * Weighted<T>::backprop_calc_drv_error_biases(Tensor4D<T> &drv_error_output_preact) {
     LOGD << gph() + "Weighted::backprop_calc_drv_error_biases";
     Shape4D output_shape = drv_error_output_preact.shape();
     assert_shape(output_shape, output_shape_proto);
 
     LOGD << "drv_error_biases = make_unique<t4d>(" + biases_shape.to_string() + ", 1, " + to_string(_acc) + ")";
-    t4d * drv_error_biases = new t4d(biases_shape); 
+    Tensor4D<T> * drv_error_biases = new Tensor4D<T>(biases_shape); 
     drv_error_biases->create_acc();
 
     _LLOG(debug, (&drv_error_output_preact));
-    LOGD << "acc_accumulate(*drv_error_output_preact, drv_error_biases)";
-    acc_accumulate(drv_error_output_preact, drv_error_biases);
+    LOGD << "backend->accumulate(*drv_error_output_preact, drv_error_biases)";
+    backend->accumulate(drv_error_output_preact, drv_error_biases);
     
     _LLOG_A(debug, drv_error_biases, "drv_error_biases non batch-normalized");
 
-    double mltp = (1.0f) / drv_error_output_preact.shape()[0];
+    double mltp = 1.0 / drv_error_output_preact.shape()[0];
     LOGD << "Normalizing biases by 1/" << drv_error_output_preact.shape()[0] << " = " << mltp;
-    acc_mltp(drv_error_biases, mltp);
+    backend->mltp(drv_error_biases, mltp);
     _LLOG(debug, drv_error_biases); 
 
     return drv_error_biases;
@@ -248,7 +367,8 @@ t4d * Weighted::backprop_calc_drv_error_biases(t4d &drv_error_output_preact) {
 /*
  */
 
-Fc::Fc(Shape4D prev_shape_proto, int features, string activation_fn) : Weighted(prev_shape_proto, features, activation_fn) {
+template<class T>
+Fc<T>::Fc(Shape4D prev_shape_proto, int features, string activation_fn) : Weighted<T>(prev_shape_proto, features, activation_fn) {
     layerType = "fc";
     layerOp = "acc_matrix_multiply";
     // TODO function pointers? prev->input, op, error_in->prev_error_out functions
@@ -263,88 +383,110 @@ Fc::Fc(Shape4D prev_shape_proto, int features, string activation_fn) : Weighted(
     LOGD << "biases_shape = " << biases_shape.to_string();
 }
 
-Fc::~Fc() {
+template<class T>
+Fc<T>::~Fc() {
     LOGD << gph() + " Fc destructor";
 }
 
-t4d * Fc::forward_calc_input(t4d &prev_output) {
+template<class T>
+Tensor4D<T> * Fc<T>::forward_calc_input(Tensor4D<T> &prev_output) {
     LOGD << gph() + "Fc::forward_calc_input";
     Shape4D prev_shape = prev_output.shape();
     assert_shape(prev_shape, prev_shape_proto);
 
     _LLOG(debug, (&prev_output));
-    t4d *input = new t4d(prev_shape[0], input_shape_proto[1], input_shape_proto[2], input_shape_proto[3]);
-    input->create_acc();
-    LOGD << "acc_copy(prev_output, input)";
-    acc_copy(prev_output, input);
+    // flattening only changes the logical shape, borrow prev_output's data. The features follow the memory order,
+    // (channel, row, col) for nchw and (row, col, channel) for nhwc
+    LOGD << "input = input_in_layout(prev_output)->reshape(...)";
+    Tensor4D<T> *input = input_in_layout(prev_output);
+    input->reshape(Shape4D(prev_shape[0], input_shape_proto[1], input_shape_proto[2], input_shape_proto[3]));
+    input->set_layout(Neural::Layout::nchw);
     _LLOG(debug, input);
     return input;
 }
 
-t4d * Fc::forward_calc_output_preact(t4d &input) {
+template<class T>
+Tensor4D<T> * Fc<T>::forward_calc_output_fused(Tensor4D<T> &input, Neural::Kernels::Activation activation) {
     LOGD << gph() + "Fc::forward_calc_output";
     Shape4D input_shape = input.shape();
     assert_shape(input_shape, input_shape_proto);
-    t4d * output_preact = new t4d(input_shape[0], output_shape_proto[1], output_shape_proto[2], output_shape_proto[3]);
-    output_preact->create_acc();
+    Tensor4D<T> * output = new Tensor4D<T>(input_shape[0], output_shape_proto[1], output_shape_proto[2], output_shape_proto[3]);
+    output->create_acc();
 
     _LLOG(debug, weights);
-    LOGD << "acc_matrix_multiply(input, *weights.get(), output_preact)";
-    acc_matrix_multiply(input, *weights.get(), output_preact);
-    _LLOG_A(debug, output_preact, "output_preact non-biases");
-
     _LLOG(debug, biases);
-    LOGD << "AddVecDim<double, 1>(output_preact, *biases.get())";
-    AddVecDim<double, 1>(output_preact, *biases.get());
-    return output_preact;
+    // output is [batch x features], the bias runs along its columns
+    Neural::Kernels::Epilogue<T> epilogue;
+    epilogue.col_bias = biases->data();
+    epilogue.activation = activation;
+    if(backend->matrix_multiply == acc_matrix_multiply<T> && Neural::get_device_type() != Neural::device_type_gpu) {
+        LOGD << "acc_matrix_multiply_packed(input, packed_forward_weights(), output, epilogue)";
+        acc_matrix_multiply_packed(input, packed_forward_weights(), output, epilogue);
+    }
+    else {
+        LOGD << "backend->matrix_multiply(input, forward_weights(), output, false, false, epilogue)";
+        backend->matrix_multiply(input, forward_weights(), output, false, false, epilogue);
+    }
+    _LLOG(debug, output);
+    return output;
+}
+
+template<class T>
+const Neural::Kernels::PackedMatrix<T> & Fc<T>::packed_forward_weights() {
+    if(packed_weights.version() != weights_version || !packed_weights.matches(true, weights_shape[0], weights_shape[1])) {
+        LOGD << gph() + "fc: packing weights version " << weights_version;
+        packed_weights.pack_b(false, weights_shape[0], weights_shape[1], forward_weights().data(), weights_shape[1], weights_version);
+    }
+    return packed_weights;
+}
+
+template<class T>
+void Fc<T>::pack_weights() {
+    if(packed_weights.version() >= 0) {
+        packed_forward_weights();
+    }
 }
 
-t4d * Fc::backprop_calc_drv_error_weights(t4d &drv_error_output_preact, t4d &input) {
+template<class T>
+Tensor4D<T> * Fc<T>::backprop_calc_drv_error_weights(Tensor4D<T> &drv_error_output_preact, Tensor4D<T> &input) {
     LOGD << gph() + "Fc::_backward_weights";
     Shape4D input_shape = input.shape(), output_shape = drv_error_output_preact.shape();
     assert_shape(input_shape, input_shape_proto);
     assert_shape(output_shape, output_shape_proto);
 
     _LLOG(debug, (&input));
-    LOGD << "unique_ptr<t4d> input_tranposed(acc_transposed<double, 0, 1>(*input.get()))";
-    unique_ptr<t4d> input_tranposed(acc_transposed<double, 0, 1>(input));
-    
-    _LLOG(debug, input_tranposed);
     
-    t4d * drv_error_weights = new t4d(weights->shape());
+    Tensor4D<T> * drv_error_weights = new Tensor4D<T>(weights->shape());
     drv_error_weights->create_acc();
-    // DRV ERROR_WEIGHTS = (DRV ERROR_OUTPUT OP) * INPUT prototype
-    LOGD << "acc_matrix_multiply(*input_tranposed.get(), *drv_error_output_preact, drv_error_weights)";
-    acc_matrix_multiply(*input_tranposed.get(), drv_error_output_preact, drv_error_weights);
+    // DRV ERROR_WEIGHTS = INPUT^T * DRV ERROR_OUTPUT_PREACT, transposed in the multiply
+    LOGD << "backend->matrix_multiply(input, drv_error_output_preact, drv_error_weights, true, false)";
+    backend->matrix_multiply(input, drv_error_output_preact, drv_error_weights, true, false, {});
     _LLOG_A(debug, drv_error_weights, "drv_error_weights non-batch-normalized");
     double mltp = 1.0f/input_shape[0];
-    acc_mltp(drv_error_weights, mltp);
+    backend->mltp(drv_error_weights, mltp);
     _LLOG(debug, drv_error_weights);
     return drv_error_weights;
 }
 
-t4d * Fc::backprop_calc_drv_error_prev_output(t4d &drv_error_output_preact, t4d &input) {
+template<class T>
+Tensor4D<T> * Fc<T>::backprop_calc_drv_error_prev_output(Tensor4D<T> &drv_error_output_preact, Tensor4D<T> &input) {
     LOGD << gph() + "Fc::_backward_input";
     Shape4D input_shape = input.shape(), output_shape = drv_error_output_preact.shape();
     assert_shape(input_shape, input_shape_proto);
     assert_shape(output_shape, output_shape_proto);
 
     _LLOG(debug, weights);
-    LOGD << "unique_ptr<t4d> weights_transposed(acc_transposed<double,  0, 1>(*weights))";
-    unique_ptr<t4d> weights_transposed(acc_transposed<double, 0, 1>(*weights.get()));
-    
-    _LLOG(debug, weights_transposed);
-
-    unique_ptr<t4d> drv_error_input = make_unique<t4d>(input_shape);
-    drv_error_input->create_acc();
-    LOGD << "acc_matrix_multiply(*drv_error_output_preact, *weights_transposed.get(), drv_error_input)";
-    acc_matrix_multiply(drv_error_output_preact, *weights_transposed.get(), drv_error_input.get());
-    _LLOG(debug, drv_error_input);
 
-    t4d * prev_drv_error_output = new t4d(Shape4D(output_shape[0], prev_shape_proto[1], prev_shape_proto[2], prev_shape_proto[3]));
+    Tensor4D<T> * prev_drv_error_output = new Tensor4D<T>(input_shape);
     prev_drv_error_output->create_acc();
-    LOGD << "acc_copy(*drv_error_input, *prev_drv_error_output)";
-    acc_copy(*drv_error_input.get(), prev_drv_error_output);
+    // DRV ERROR_INPUT = DRV ERROR_OUTPUT_PREACT * WEIGHTS^T, transposed in the multiply
+    LOGD << "backend->matrix_multiply(drv_error_output_preact, forward_weights(), prev_drv_error_output, false, true)";
+    backend->matrix_multiply(drv_error_output_preact, forward_weights(), prev_drv_error_output, false, true, {});
+    _LLOG_A(debug, prev_drv_error_output, "drv_error_input");
+
+    // un-flatten in place to the previous layer's output shape, in the order the input was flattened from
+    prev_drv_error_output->reshape(Shape4D(output_shape[0], prev_shape_proto[1], prev_shape_proto[2], prev_shape_proto[3]));
+    prev_drv_error_output->set_layout(layout);
     _LLOG(debug, prev_drv_error_output);
     return prev_drv_error_output;
 }
@@ -352,7 +494,8 @@ t4d * Fc::backprop_calc_drv_error_prev_output(t4d &drv_error_output_preact, t4d
 /////////////////////////// <Conv> //////////////////////////////////////
 /*
  */
-Conv::Conv(Shape4D prev_shape, int features, string activation_fn, vector<int> _filter_size, vector<int> _stride, string _padding_type) : Weighted(prev_shape, features, activation_fn), filter_size{_filter_size[0], _filter_size[1]}, stride{_stride[0], _stride[1]}, padding_type{_padding_type} {
+template<class T>
+Conv<T>::Conv(Shape4D prev_shape, int features, string activation_fn, vector<int> _filter_size, vector<int> _stride, string _padding_type, string _algorithm) : Weighted<T>(prev_shape, features, activation_fn), stride{_stride[0], _stride[1]}, filter_size{_filter_size[0], _filter_size[1]}, padding_type{_padding_type} {
     layerType = "conv";
     layerOp = "acc_convolution2D";
 
@@ -398,7 +541,8 @@ Conv::Conv(Shape4D prev_shape, int features, string activation_fn, vector<int> _
         throw(std::invalid_argument("Padding type not compatible."));
     }
     LOGD << "prev_shape_proto:" << prev_shape_proto.to_string();
-    input_shape_proto = Shape4D(-1, prev_shape_proto[1], prev_shape_proto[2] + padding[0] + padding[1], prev_shape_proto[3] + padding[2] + padding[3]);
+    // the kernels apply the padding by indexing, the input is the unpadded previous output
+    input_shape_proto = Shape4D(-1, prev_shape_proto[1], prev_shape_proto[2], prev_shape_proto[3]);
     LOGD << "input_shape_proto:" << input_shape_proto.to_string();
     output_shape_proto = Shape4D(-1, features, out_height, out_width);
     LOGD << "output_shape_proto:" << output_shape_proto.to_string();
@@ -406,104 +550,271 @@ Conv::Conv(Shape4D prev_shape, int features, string activation_fn, vector<int> _
     LOGD << "weights_shape = " << weights_shape.to_string();
     biases_shape = Shape4D(1, output_shape_proto[1], 1, 1);
     LOGD << "biases_shape = " << biases_shape.to_string();
+
+    set_algorithm(_algorithm);
 }
 
-Conv::~Conv() {
+template<class T>
+Conv<T>::~Conv() {
     LOGD << gph() + "Conv destructor";
 }
 
-t4d * Conv::forward_calc_input(t4d &prev_output) {
+namespace {
+    const vector<string> conv_forward_candidates{"direct", "im2col", "winograd_f2", "winograd_f4", "fft"};
+    const vector<string> conv_wgrad_candidates{"direct", "im2col", "fft"};
+    const vector<string> conv_dgrad_candidates{"direct", "im2col", "winograd_f2", "winograd_f4"};
+
+    bool is_winograd(const string &algo) {
+        return algo.compare(0, 8, "winograd") == 0;
+    }
+
+    int winograd_tile(const string &algo) {
+        return (algo == "winograd_f2") ? 2 : 4;
+    }
+}
+
+template<class T>
+void Conv<T>::set_algorithm(string _algorithm) {
+    Neural::Autotune::ConvPlan family_plan;
+    if(_algorithm == "winograd" || _algorithm == "winograd_f2" || _algorithm == "winograd_f4") {
+        string wino = "winograd_f" + to_string(winograd_tile(_algorithm));
+        family_plan = {wino, "im2col", wino};
+    }
+    else if(_algorithm == "fft") {
+        family_plan = {"fft", "fft", "im2col"};
+    }
+    else if(_algorithm == "direct" || _algorithm == "im2col") {
+        family_plan = {_algorithm, _algorithm, _algorithm};
+    }
+    else if(_algorithm == "auto") {
+        family_plan = {"im2col", "im2col", "im2col"};
+    }
+    else {
+        throw(std::invalid_argument("Conv algorithm not supported: " + _algorithm));
+    }
+    set_plan(family_plan);
+    LOGD << gph() + "algorithm: " << _algorithm;
+    algorithm = _algorithm;
+}
+
+template<class T>
+void Conv<T>::set_plan(const Neural::Autotune::ConvPlan &_plan) {
+    auto check = [&](const vector<string> &candidates, const string &algo, const string &pass) {
+        if(find(candidates.begin(), candidates.end(), algo) == candidates.end()) {
+            throw(std::invalid_argument("Conv " + pass + " algorithm not supported: " + algo));
+        }
+        if(is_winograd(algo) && !Neural::Kernels::Winograd<T>::supports(filter_size[0], filter_size[1], stride[0], stride[1])) {
+            throw(std::invalid_argument("Conv algorithm " + algo + " needs 3x3 or 5x5 filters with stride 1"));
+        }
+    };
+    check(conv_forward_candidates, _plan.forward, "forward");
+    check(conv_wgrad_candidates, _plan.wgrad, "wgrad");
+    check(conv_dgrad_candidates, _plan.dgrad, "dgrad");
+
+    // keep the transforms the plan still uses, their cached filters stay valid
+    map<int, unique_ptr<Neural::Kernels::Winograd<T>>> plan_winograd;
+    for(const string &algo: {_plan.forward, _plan.dgrad}) {
+        if(is_winograd(algo)) {
+            int tile = winograd_tile(algo);
+            // forward and dgrad on the same tile share one transform, already moved on the first pass
+            if(plan_winograd.count(tile)) {
+                continue;
+            }
+            auto it = winograd.find(tile);
+            if(it != winograd.end()) {
+                plan_winograd[tile] = std::move(it->second);
+            }
+            else {
+                plan_winograd[tile] = make_unique<Neural::Kernels::Winograd<T>>(tile, filter_size[0]);
+            }
+        }
+    }
+    winograd = std::move(plan_winograd);
+
+    if(_plan.forward == "fft" || _plan.wgrad == "fft") {
+        if(!fft) {
+            fft = make_unique<Neural::Kernels::FFTConvolution<T>>(input_shape_proto[2], input_shape_proto[3], filter_size[0], filter_size[1], stride[0], stride[1], padding);
+        }
+    }
+    else {
+        fft.reset();
+    }
+    LOGD << gph() + "plan: forward " << _plan.forward << ", wgrad " << _plan.wgrad << ", dgrad " << _plan.dgrad;
+    plan = _plan;
+}
+
+template<class T>
+string Conv<T>::active_algorithm(const string &algo, bool lowered) {
+    if(!lowered || Neural::get_device_type() == Neural::device_type_gpu) {
+        return "direct";
+    }
+    if(layout == Neural::Layout::nhwc && (is_winograd(algo) || algo == "fft")) {
+        return "im2col";
+    }
+    return algo;
+}
+
+template<class T>
+Neural::Kernels::Winograd<T> * Conv<T>::winograd_filters(int tile) {
+    Neural::Kernels::Winograd<T> *wino = winograd.at(tile).get();
+    if(wino->version() != weights_version) {
+        LOGD << gph() + "winograd: transforming filters for weights version " << weights_version;
+        wino->transform_filters(forward_weights(), weights_version);
+    }
+    return wino;
+}
+
+template<class T>
+Neural::Kernels::FFTConvolution<T> * Conv<T>::fft_filters() {
+    if(fft->version() != weights_version) {
+        LOGD << gph() + "fft: transforming filters for weights version " << weights_version;
+        fft->transform_filters(forward_weights(), weights_version);
+    }
+    return fft.get();
+}
+
+template<class T>
+const Neural::Kernels::PackedMatrix<T> * Conv<T>::im2col_filters(bool dgrad) {
+    Neural::Kernels::PackedMatrix<T> &packed = dgrad ? packed_filters_dgrad : packed_filters;
+    // left operand [OC x C*FH*FW] (dgrad: its transpose) for nchw, right operand OHWI^T (dgrad: OHWI) for nhwc
+    bool nhwc = layout == Neural::Layout::nhwc;
+    int out_channels = weights_shape[0], ckk = weights_shape[1]*weights_shape[2]*weights_shape[3];
+    int rows = (nhwc != dgrad) ? ckk : out_channels, cols = (nhwc != dgrad) ? out_channels : ckk;
+    if(packed.version() != weights_version || !packed.matches(nhwc, rows, cols)) {
+        LOGD << gph() + "im2col: packing filters of weights version " << weights_version << (dgrad ? " for dgrad" : "");
+        acc_pack_im2col_filters(forward_weights(), layout, dgrad, &packed, weights_version);
+    }
+    return &packed;
+}
+
+template<class T>
+void Conv<T>::pack_weights() {
+    if(packed_filters.version() >= 0) {
+        im2col_filters(false);
+    }
+    if(packed_filters_dgrad.version() >= 0) {
+        im2col_filters(true);
+    }
+}
+
+template<class T>
+Tensor4D<T> * Conv<T>::forward_calc_input(Tensor4D<T> &prev_output) {
     LOGD << gph() + "forward_calc_input";
 
     Shape4D prev_shape = prev_output.shape();
     assert_shape(prev_shape, prev_shape_proto);
 
-    t4d *input = new t4d(prev_shape[0], input_shape_proto[1], input_shape_proto[2], input_shape_proto[3]);
-    input->create_acc();
     _LLOG(debug, (&prev_output));
-    if(is_padded()) {
-        acc_zeros(input);
-        LOGD.printf("acc_pad2D(prev_output, input, %d, %d, %d, %d", padding[0], padding[1], padding[2], padding[3]);
-        acc_pad2D(prev_output, input, padding[0], padding[1], padding[2], padding[3]);
-    }
-    else {
-        LOGD << "acc_copy(prev_output, input)";
-        acc_copy(prev_output, input);
-    }
+    // no padded copy, the convolutions read prev_output with the padding applied by indexing
+    LOGD << "input = input_in_layout(prev_output)";
+    Tensor4D<T> *input = input_in_layout(prev_output);
     _LLOG(debug, input);
     return input;
 }
 
-t4d * Conv::forward_calc_output_preact(t4d &input) {
-    LOGD << gph() + "forward_calc_output_preact";
+template<class T>
+Tensor4D<T> * Conv<T>::forward_calc_output_fused(Tensor4D<T> &input, Neural::Kernels::Activation activation) {
+    LOGD << gph() + "forward_calc_output";
     Shape4D input_shape = input.shape();
     assert_shape(input_shape, input_shape_proto);
 
-    t4d *output_preact = new t4d(input_shape[0], output_shape_proto[1], output_shape_proto[2], output_shape_proto[3]);
-    output_preact->create_acc();
+    Tensor4D<T> *output = new Tensor4D<T>(input_shape[0], output_shape_proto[1], output_shape_proto[2], output_shape_proto[3]);
+    output->set_layout(input.layout());
+    output->create_acc();
 
     _LLOG(debug, (&input));
     _LLOG(debug, weights);
-    LOGD.printf("acc_convolution2D(input, *weights.get(), output_preact, stride={%d, %d})", stride[0], stride[1]);
-    acc_convolution2D(input, *weights.get(), output_preact, stride);
-    _LLOG_A(debug, output_preact, "output_preact non-biases");
     _LLOG(debug, biases);
-    LOGD << "AddVecDim<double, 1>(output_preact, *biases.get())";
-    AddVecDim<double, 1>(output_preact, *biases.get());
-    _LLOG(debug, output_preact);
-    return output_preact;
+    // one bias per output channel
+    Neural::Kernels::Epilogue<T> epilogue;
+    epilogue.row_bias = biases->data();
+    epilogue.activation = activation;
+
+    string algo = active_algorithm(plan.forward, backend->convolution2D == acc_convolution2D<T>);
+    if(is_winograd(algo)) {
+        LOGD << "winograd_filters(" << winograd_tile(algo) << ")->forward(input, output, padding, epilogue)";
+        winograd_filters(winograd_tile(algo))->forward(input, output, padding, epilogue);
+    }
+    else if(algo == "fft") {
+        LOGD << "fft_filters()->forward(input, output, epilogue)";
+        fft_filters()->forward(input, output, epilogue);
+    }
+    else if(algo == "im2col") {
+        LOGD.printf("acc_convolution2D_im2col(input, forward_weights(), output, stride={%d, %d}, padding={%d, %d, %d, %d}, epilogue, im2col_filters(false))", stride[0], stride[1], padding[0], padding[1], padding[2], padding[3]);
+        acc_convolution2D_im2col(input, forward_weights(), output, stride, padding, epilogue, im2col_filters(false));
+    }
+    else {
+        LOGD.printf("backend->convolution2D(input, forward_weights(), output, stride={%d, %d}, padding={%d, %d, %d, %d}, epilogue)", stride[0], stride[1], padding[0], padding[1], padding[2], padding[3]);
+        backend->convolution2D(input, forward_weights(), output, stride, padding, epilogue);
+    }
+    _LLOG(debug, output);
+    return output;
 }
 
-t4d * Conv::backprop_calc_drv_error_weights(t4d &drv_error_output_preact, t4d &input) {
+template<class T>
+Tensor4D<T> * Conv<T>::backprop_calc_drv_error_weights(Tensor4D<T> &drv_error_output_preact, Tensor4D<T> &input) {
     LOGD << gph() + "_backward_weights";
 
     Shape4D input_shape = input.shape(), output_shape = drv_error_output_preact.shape();
     assert_shape(input_shape, input_shape_proto);
     assert_shape(output_shape, output_shape_proto);
 
-    int rev_padding_h = filter_size[0] - 1 + input_shape[2] - output_shape[2], rev_padding_w = filter_size[1] - 1 + input_shape[3] - output_shape[3];
-
-    // TODO pad same tensor? transpose same tensor?
-    _LLOG(debug, (&drv_error_output_preact));
-    LOGD << "unique_ptr<t4d> drv_error_output_preact_transposed_flipped_padded(acc_transposed<double, 0, 1>(*drv_error_output_preact))";
-    unique_ptr<t4d> drv_error_output_preact_transposed_flipped_padded(acc_transposed<double, 0, 1>(drv_error_output_preact));
-    _LLOG_A(debug, drv_error_output_preact_transposed_flipped_padded, "drv_error_output_preact_transposed");
-
-    LOGD << "acc_flip_spatial(drv_error_output_preact_transposed_flipped_padded.get())";
-    acc_flip_spatial(drv_error_output_preact_transposed_flipped_padded.get());
-    _LLOG_A(debug, drv_error_output_preact_transposed_flipped_padded, "drv_error_output_preact_transposed_flipped");
-
-    LOGD << "drv_error_output_preact_transposed_flipped_padded.reset(acc_padded2D_inner(*drv_error_output_preact_transposed_flipped_padded.get(), rev_padding_h - rev_padding_h/2,  rev_padding_w - rev_padding_w/2, rev_padding_h/2,  rev_padding_w/2, 0, 0))";
-    drv_error_output_preact_transposed_flipped_padded.reset(acc_padded2D_inner(*drv_error_output_preact_transposed_flipped_padded.get(), rev_padding_h - rev_padding_h / 2, rev_padding_w - rev_padding_w / 2, rev_padding_h / 2, rev_padding_w / 2, 0, 0));
-    _LLOG(debug, drv_error_output_preact_transposed_flipped_padded);
+    string algo = active_algorithm(plan.wgrad, backend->convolution2D_wgrad == acc_convolution2D_wgrad<T>);
+    if(algo == "im2col" || algo == "fft") {
+        drv_error_biases_fused.reset();
+        Tensor4D<T> * drv_error_weights = new Tensor4D<T>(weights->shape());
+        drv_error_weights->create_acc();
+
+        _LLOG(debug, (&drv_error_output_preact));
+        _LLOG(debug, (&input));
+        if(algo == "fft") {
+            // the filter spectra are not needed here, only the plan
+            LOGD << "fft->backward_filters(input, drv_error_output_preact, drv_error_weights)";
+            fft->backward_filters(input, drv_error_output_preact, drv_error_weights);
+        }
+        else {
+            LOGD.printf("acc_convolution2D_im2col_wgrad(input, drv_error_output_preact, drv_error_weights, stride={%d, %d}, padding={%d, %d, %d, %d})", stride[0], stride[1], padding[0], padding[1], padding[2], padding[3]);
+            acc_convolution2D_im2col_wgrad(input, drv_error_output_preact, drv_error_weights, stride, padding);
+        }
+        _LLOG_A(debug, drv_error_weights, "drv_error_weights_non_normalized");
 
-    _LLOG(debug, (&input));
-    LOGD << "unique_ptr<t4d> input_transposed_flipped(acc_transposed<double, 0, 1>(*input))";
-    unique_ptr<t4d> input_transposed_flipped(acc_transposed<double, 0, 1>(input));
-    _LLOG_A(debug, input_transposed_flipped, "input_transposed");
+        double mltp = 1.0/input_shape[0];
+        backend->mltp(drv_error_weights, mltp);
+        _LLOG(debug, drv_error_weights);
 
-    LOGD << "acc_flip_spatial(input_transposed_flipped)";
-    acc_flip_spatial(input_transposed_flipped.get());
-    _LLOG(debug, input_transposed_flipped);
+        return drv_error_weights;
+    }
 
-    t4d * drv_error_weights = new t4d(weights->shape());
+    Tensor4D<T> * drv_error_weights = new Tensor4D<T>(weights->shape());
     drv_error_weights->create_acc();
-    
-    //TODO check if acc on anything new for return
-
-    LOGD << "acc_convolution2D(*drv_error_output_preact_transposed_flipped_padded.get(), *input_transposed_flipped.get(), drv_error_weights, {1, 1})";
-    acc_convolution2D(*drv_error_output_preact_transposed_flipped_padded.get(), *input_transposed_flipped.get(), drv_error_weights, {1, 1});
-    _LLOG_A(debug, drv_error_weights, "drv_error_weights_non_normalized");
+    drv_error_biases_fused = make_unique<Tensor4D<T>>(biases_shape);
+    drv_error_biases_fused->create_acc();
 
-    double mltp = 1.0f/input.shape()[0];
-    acc_mltp(drv_error_weights, mltp);
+    _LLOG(debug, (&drv_error_output_preact));
+    _LLOG(debug, (&input));
+    // reads both tensors in place, the 1/B normalization and the bias gradient come out of the same pass
+    double mltp = 1.0 / input_shape[0];
+    LOGD.printf("backend->convolution2D_wgrad(input, drv_error_output_preact, drv_error_weights, drv_error_biases_fused, stride={%d, %d}, padding={%d, %d, %d, %d}, %f)", stride[0], stride[1], padding[0], padding[1], padding[2], padding[3], mltp);
+    backend->convolution2D_wgrad(input, drv_error_output_preact, drv_error_weights, drv_error_biases_fused.get(), stride, padding, mltp);
     _LLOG(debug, drv_error_weights);
-    
+    _LLOG(debug, drv_error_biases_fused);
+
     return drv_error_weights;
 }
 
+template<class T>
+Tensor4D<T> * Conv<T>::backprop_calc_drv_error_biases(Tensor4D<T> &drv_error_output_preact) {
+    if(drv_error_biases_fused) {
+        LOGD << gph() + "drv_error_biases from the fused weights pass";
+        assert(drv_error_biases_fused->shape()[1] == drv_error_output_preact.shape()[1]);
+        return drv_error_biases_fused.release();
+    }
+    return Weighted<T>::backprop_calc_drv_error_biases(drv_error_output_preact);
+}
+
 // TODO input, drv_error_output not copies?
-t4d * Conv::backprop_calc_drv_error_prev_output(t4d &drv_error_output_preact, t4d &input) {
+template<class T>
+Tensor4D<T> * Conv<T>::backprop_calc_drv_error_prev_output(Tensor4D<T> &drv_error_output_preact, Tensor4D<T> &input) {
     LOGD << gph() + "_backward_input";
     
     _LLOG(debug, (&drv_error_output_preact));
@@ -513,38 +824,257 @@ t4d * Conv::backprop_calc_drv_error_prev_output(t4d &drv_error_output_preact, t4
     assert_shape(input_shape, input_shape_proto);
     assert_shape(output_shape, output_shape_proto);
 
-    _LLOG(debug, (&drv_error_output_preact));
-    // formula is rev_p = 2*(F-1) + (S-1)*(O-1)
-    // drv_error_output_preact[B D H2 W2]->drv_error_output_preact[B D (H2 + rev_p[0]) (W2 + rev_p[1]);
-    LOGD << "unique_ptr<t4d> drv_error_output_preact_padded(acc_padded2D_inner(*drv_error_output_preact,  filter_size[0]-1,  filter_size[0]-1, filter_size[1]-1,  filter_size[1]-1, stride[0]-1, stride[1]-1))";
-    unique_ptr<t4d> drv_error_output_preact_padded(acc_padded2D_inner(drv_error_output_preact, filter_size[0] - 1, filter_size[0] - 1, filter_size[1] - 1, filter_size[1] - 1, stride[0] - 1, stride[1] - 1));
-    _LLOG(debug, drv_error_output_preact_padded);
-
-    _LLOG(debug, weights);
-    // weights[D C F1 F2]->[C D F1 F2], and flip F1, F2 elements
-    LOGD << "unique_ptr<t4d> weights_transposed_flipped(acc_transposed<double, 0, 1>(*weights))";
-    unique_ptr<t4d> weights_transposed_flipped(acc_transposed<double, 0, 1>(*weights.get()));
-    _LLOG_A(debug, weights_transposed_flipped, "weights_transposed");
-
-    LOGD << "acc_flip_spatial(weights_transposed_flipped.get())";
-    acc_flip_spatial(weights_transposed_flipped.get());
-    _LLOG(debug, weights_transposed_flipped);
-
-    unique_ptr<t4d> drv_error_input = make_unique<t4d>(input.shape());
-    drv_error_input->create_acc();
-    // = ERROR_INPUT = ERROR_OUTPUT * WEIGHTS
-    
-    LOGD << "acc_convolution2D(*drv_error_output_preact_padded.get(), *weights_transposed_flipped.get(), drv_error_input, {1, 1})";
-    acc_convolution2D(*drv_error_output_preact_padded.get(), *weights_transposed_flipped.get(), drv_error_input.get(), {1, 1});
-    _LLOG(debug, drv_error_input);
-
-    t4d *prev_drv_error_output = new t4d(Shape4D(input.shape()[0], prev_shape_proto[1], prev_shape_proto[2], prev_shape_proto[3]));
+    // the input is unpadded, so its gradient already is the previous layer's output gradient
+    Tensor4D<T> *prev_drv_error_output = new Tensor4D<T>(input.shape());
+    prev_drv_error_output->set_layout(input.layout());
     prev_drv_error_output->create_acc();
-    // update prev drv error output act
-    // TODO transfer responsibly, maybe no padding was applied etc..no memory traces, no duplicates
-    LOGD << "acc_rev_pad2D(*drv_error_input, *prev_drv_error_output, padding[0], padding[1], padding[2], padding[3])";
-    acc_rev_pad2D(*drv_error_input.get(), prev_drv_error_output, padding[0], padding[1], padding[2], padding[3]);
+
+    string algo = active_algorithm(plan.dgrad, backend->convolution2D_dgrad == acc_convolution2D_dgrad<T>);
+    if(is_winograd(algo)) {
+        LOGD << "winograd_filters(" << winograd_tile(algo) << ")->backward_data(drv_error_output_preact, prev_drv_error_output, padding)";
+        winograd_filters(winograd_tile(algo))->backward_data(drv_error_output_preact, prev_drv_error_output, padding);
+    }
+    else if(algo == "im2col") {
+        _LLOG(debug, weights);
+        LOGD.printf("acc_convolution2D_im2col_dgrad(drv_error_output_preact, forward_weights(), prev_drv_error_output, stride={%d, %d}, padding={%d, %d, %d, %d}, im2col_filters(true))", stride[0], stride[1], padding[0], padding[1], padding[2], padding[3]);
+        acc_convolution2D_im2col_dgrad(drv_error_output_preact, forward_weights(), prev_drv_error_output, stride, padding, im2col_filters(true));
+    }
+    else {
+        _LLOG(debug, weights);
+        // = ERROR_INPUT = ERROR_OUTPUT * WEIGHTS, transposed convolution on the original tensors
+        LOGD.printf("backend->convolution2D_dgrad(drv_error_output_preact, forward_weights(), prev_drv_error_output, stride={%d, %d}, padding={%d, %d, %d, %d})", stride[0], stride[1], padding[0], padding[1], padding[2], padding[3]);
+        backend->convolution2D_dgrad(drv_error_output_preact, forward_weights(), prev_drv_error_output, stride, padding);
+    }
     _LLOG(debug, prev_drv_error_output);
     return prev_drv_error_output;
 }
+template<class T>
+void Conv<T>::autotune(int batch_size) {
+    if(algorithm != "auto") {
+        return;
+    }
+    if(Neural::get_device_type() == Neural::device_type_gpu) {
+        LOGD << gph() + "autotune: gpu runs the direct kernels";
+        return;
+    }
+    if(backend->convolution2D != acc_convolution2D<T> || backend->convolution2D_wgrad != acc_convolution2D_wgrad<T> || backend->convolution2D_dgrad != acc_convolution2D_dgrad<T>) {
+        LOGD << gph() + "autotune: backend " << backend->name << " runs its own convolutions";
+        return;
+    }
+
+    string shape_key = Neural::Autotune::conv_shape_key(batch_size, input_shape_proto[1], input_shape_proto[2], input_shape_proto[3], output_shape_proto[1], filter_size, stride, padding);
+    if constexpr(std::is_same_v<T, float>) {
+        // float kernels time differently, the double plans keep their keys
+        shape_key += "_f32";
+    }
+    if(layout == Neural::Layout::nhwc) {
+        shape_key += "_nhwc";
+    }
+    Neural::Autotune::ConvPlan tuned;
+    if(Neural::Autotune::lookup(shape_key, tuned)) {
+        LOGI << gph() + "autotune " << shape_key << ": cached plan forward " << tuned.forward << ", wgrad " << tuned.wgrad << ", dgrad " << tuned.dgrad;
+        set_plan(tuned);
+        return;
+    }
+
+    Tensor4D<T> input(batch_size, input_shape_proto[1], input_shape_proto[2], input_shape_proto[3]);
+    input.set_layout(layout);
+    input.create_acc();
+    acc_rng(&input, (T)1.0);
+    Tensor4D<T> drv_error_output_preact(batch_size, output_shape_proto[1], output_shape_proto[2], output_shape_proto[3]);
+    drv_error_output_preact.set_layout(layout);
+    drv_error_output_preact.create_acc();
+    acc_rng(&drv_error_output_preact, (T)1.0);
+
+    // best of a few runs after a warm-up one, which also transforms the filters and sizes the scratch buffers
+    auto fastest = [&](const vector<string> &candidates, string Neural::Autotune::ConvPlan::*pass, auto run) {
+        string best;
+        double best_time = 0;
+        for(const string &algo: candidates) {
+            // a candidate the layout replaces would only time its stand-in
+            if(active_algorithm(algo, true) != algo) {
+                continue;
+            }
+            Neural::Autotune::ConvPlan trial = plan;
+            trial.*pass = algo;
+            try {
+                set_plan(trial);
+            }
+            catch(const std::invalid_argument &) {
+                continue;
+            }
+
+            double algo_time = 0;
+            for(int r = 0; r < 4; r++) {
+                auto start = chrono::steady_clock::now();
+                delete run();
+                double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                if(r == 1 || (r > 1 && elapsed < algo_time)) {
+                    algo_time = elapsed;
+                }
+            }
+            LOGD << gph() + "autotune " << shape_key << ": " << algo << " " << algo_time * 1e3 << " ms";
+            if(best.empty() || algo_time < best_time) {
+                best = algo;
+                best_time = algo_time;
+            }
+        }
+
+        Neural::Autotune::ConvPlan chosen = plan;
+        chosen.*pass = best;
+        set_plan(chosen);
+        return best;
+    };
+
+    tuned.forward = fastest(conv_forward_candidates, &Neural::Autotune::ConvPlan::forward, [&] { return this->forward_calc_output_preact(input); });
+    tuned.wgrad = fastest(conv_wgrad_candidates, &Neural::Autotune::ConvPlan::wgrad, [&] { return backprop_calc_drv_error_weights(drv_error_output_preact, input); });
+    tuned.dgrad = fastest(conv_dgrad_candidates, &Neural::Autotune::ConvPlan::dgrad, [&] { return backprop_calc_drv_error_prev_output(drv_error_output_preact, input); });
+    drv_error_biases_fused.reset();
+
+    LOGI << gph() + "autotune " << shape_key << ": forward " << tuned.forward << ", wgrad " << tuned.wgrad << ", dgrad " << tuned.dgrad;
+    Neural::Autotune::store(shape_key, tuned);
+}
+/////////////////////////////////////////////////////////////////
+
+/////////////////////////// <BinaryFc> //////////////////////////////////////
+/*
+ */
+template<class T>
+BinaryFc<T>::BinaryFc(Shape4D prev_shape_proto, int features, string activation_fn) : Fc<T>(prev_shape_proto, features, activation_fn) {
+    this->layerType = "binary_fc";
+}
+
+template<class T>
+Tensor4D<T> & BinaryFc<T>::forward_weights() {
+    if(!weights_binary) {
+        weights_binary = make_unique<Tensor4D<T>>(weights_shape);
+        weights_binary->create_acc();
+    }
+    if(weights_binary_version != weights_version) {
+        LOGD << gph() + "forward weights: binarizing weights version " << weights_version;
+        // [inputs x features], one alpha per column
+        acc_binarize(*weights.get(), weights_binary.get(), true);
+        weights_binary_version = weights_version;
+    }
+    return *weights_binary.get();
+}
+
+template<class T>
+Tensor4D<T> * BinaryFc<T>::forward_calc_input(Tensor4D<T> &prev_output) {
+    unique_ptr<Tensor4D<T>> input(Fc<T>::forward_calc_input(prev_output));
+    LOGD << gph() + "acc_sign(input, input_sign)";
+    Tensor4D<T> *input_sign = new Tensor4D<T>(input->shape());
+    input_sign->create_acc();
+    acc_sign(*input.get(), input_sign);
+    return input_sign;
+}
+
+template<class T>
+Tensor4D<T> * BinaryFc<T>::forward_calc_output_fused(Tensor4D<T> &input, Neural::Kernels::Activation activation) {
+    if(Neural::get_device_type() == Neural::device_type_gpu) {
+        return Fc<T>::forward_calc_output_fused(input, activation);
+    }
+
+    LOGD << gph() + "BinaryFc::forward_calc_output";
+    Shape4D input_shape = input.shape();
+    assert_shape(input_shape, input_shape_proto);
+    Tensor4D<T> * output = new Tensor4D<T>(input_shape[0], this->output_shape_proto[1], this->output_shape_proto[2], this->output_shape_proto[3]);
+    output->create_acc();
+
+    if(xnor.version() != weights_version) {
+        LOGD << gph() + "xnor: packing weights version " << weights_version;
+        xnor.pack_weights(*weights.get(), weights_version);
+    }
+    // output is [batch x features], the bias runs along its columns
+    Neural::Kernels::Epilogue<T> epilogue;
+    epilogue.col_bias = biases->data();
+    epilogue.activation = activation;
+    LOGD << "xnor.forward_fc(input, output, epilogue)";
+    xnor.forward_fc(input, output, epilogue);
+    _LLOG(debug, output);
+    return output;
+}
+
+template<class T>
+void BinaryFc<T>::constrain_weights() {
+    acc_clip(weights.get(), (T)-1, (T)1);
+}
+
+/////////////////////////// <BinaryConv> //////////////////////////////////////
+/*
+ */
+template<class T>
+BinaryConv<T>::BinaryConv(Shape4D prev_shape, int features, string activation_fn, vector<int> _filter_size, vector<int> _stride, string _padding_type, string _algorithm) : Conv<T>(prev_shape, features, activation_fn, _filter_size, _stride, _padding_type, _algorithm) {
+    this->layerType = "binary_conv";
+}
+
+template<class T>
+Tensor4D<T> & BinaryConv<T>::forward_weights() {
+    if(!weights_binary) {
+        weights_binary = make_unique<Tensor4D<T>>(weights_shape);
+        weights_binary->create_acc();
+    }
+    if(weights_binary_version != weights_version) {
+        LOGD << gph() + "forward weights: binarizing weights version " << weights_version;
+        // [features][channels][rows][cols], one alpha per filter
+        acc_binarize(*weights.get(), weights_binary.get(), false);
+        weights_binary_version = weights_version;
+    }
+    return *weights_binary.get();
+}
+
+template<class T>
+Tensor4D<T> * BinaryConv<T>::forward_calc_input(Tensor4D<T> &prev_output) {
+    unique_ptr<Tensor4D<T>> input(Conv<T>::forward_calc_input(prev_output));
+    LOGD << gph() + "acc_sign(input, input_sign)";
+    Tensor4D<T> *input_sign = new Tensor4D<T>(input->shape());
+    input_sign->set_layout(input->layout());
+    input_sign->create_acc();
+    acc_sign(*input.get(), input_sign);
+    return input_sign;
+}
+
+template<class T>
+Tensor4D<T> * BinaryConv<T>::forward_calc_output_fused(Tensor4D<T> &input, Neural::Kernels::Activation activation) {
+    if(Neural::get_device_type() == Neural::device_type_gpu) {
+        return Conv<T>::forward_calc_output_fused(input, activation);
+    }
+
+    LOGD << gph() + "BinaryConv::forward_calc_output";
+    Shape4D input_shape = input.shape();
+    assert_shape(input_shape, input_shape_proto);
+    Tensor4D<T> *output = new Tensor4D<T>(input_shape[0], this->output_shape_proto[1], this->output_shape_proto[2], this->output_shape_proto[3]);
+    output->set_layout(input.layout());
+    output->create_acc();
+
+    if(xnor.version() != weights_version) {
+        LOGD << gph() + "xnor: packing filters of weights version " << weights_version;
+        xnor.pack_filters(*weights.get(), weights_version);
+    }
+    Neural::Kernels::Epilogue<T> epilogue;
+    epilogue.row_bias = biases->data();
+    epilogue.activation = activation;
+    LOGD << "xnor.forward(input, output, stride, padding, epilogue)";
+    xnor.forward(input, output, this->get_stride(), this->get_padding(), epilogue);
+    _LLOG(debug, output);
+    return output;
+}
+
+template<class T>
+void BinaryConv<T>::constrain_weights() {
+    acc_clip(weights.get(), (T)-1, (T)1);
+}
 /////////////////////////////////////////////////////////////////
+
+template class Neural::Layers::Layer<double>;
+template class Neural::Layers::Layer<float>;
+template class Neural::Layers::Weighted<double>;
+template class Neural::Layers::Weighted<float>;
+template class Neural::Layers::Fc<double>;
+template class Neural::Layers::Fc<float>;
+template class Neural::Layers::Conv<double>;
+template class Neural::Layers::Conv<float>;
+template class Neural::Layers::BinaryFc<double>;
+template class Neural::Layers::BinaryFc<float>;
+template class Neural::Layers::BinaryConv<double>;
+template class Neural::Layers::BinaryConv<float>;
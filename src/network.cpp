@@ -15,58 +15,57 @@ using Neural::Network;
 using Neural::Tensor4D;
 using Neural::Shape4D;
 
-typedef Tensor4D<double> t4d;
-
-Neural::Network::Network(const Shape4D &in_sh_pr) : __input_shape_proto(Shape4D(-1, in_sh_pr[1], in_sh_pr[2], in_sh_pr[3])) {
+template<class T>
+Neural::Network<T>::Network(const Shape4D &in_sh_pr) : __input_shape_proto(Shape4D(-1, in_sh_pr[1], in_sh_pr[2], in_sh_pr[3])), backend(Neural::default_backend<T>()) {
     LOGD << "Network::Network";
     LOGD << "input_shape_proto: " << __input_shape_proto.to_string();
 }
 
-Network::~Network() {
+template<class T>
+Network<T>::~Network() {
     LOGD << "Network destructor";
     for(int i=0; i < layers.size(); i++) {
         delete layers[i];
     }
 }
 
-t4d * Network::forward(t4d &init_input) {
+template<class T>
+Tensor4D<T> * Network<T>::forward(Tensor4D<T> &init_input) {
     clock_t op_start;
     string op_name;
     
-    t4d *prev_output = &init_input;
+    Tensor4D<T> *prev_output = &init_input;
     
     for(int i = 0; i < layers.size(); i++) {
         PLOGD.printf("Forward Layer %d", i);
         
         _LLOG(debug, prev_output);
 
-        _LOGXPC(debug, "forward_calc_input",  t4d *input_i = layers[i]->forward_calc_input(*prev_output));
+        _LOGXPC(debug, "forward_calc_input",  Tensor4D<T> *input_i = layers[i]->forward_calc_input(*prev_output));
         _LLOG(debug, input_i);
 
-        if(i>0) {
-            delete prev_output;
-        }
-
-        _LOGXPC(debug, "forward_calc_output_preact",  unique_ptr<t4d> output_preact(layers[i]->forward_calc_output_preact(*input_i)) );
-        _LLOG(debug, output_preact);
+        _LOGXPC(debug, "forward_calc_output", Tensor4D<T> * output_i = layers[i]->forward_calc_output(*input_i));
+        _LLOG(debug, output_i);
 
+        // input_i may borrow prev_output's data, release it first
         delete input_i;
 
-        _LOGXPC(debug, "forward_activate", t4d * output_i = layers[i]->forward_activate(*output_preact.get()));
-        _LLOG(debug, output_i);
+        if(i>0) {
+            delete prev_output;
+        }
         
         prev_output = output_i;
 
         // IF_PLOG(plog::debug) { op_name = "forward_calc_input"; PLOGD << op_name; op_start = clock(); }
-        // t4d *input_i = layers[i]->forward_calc_input(*prev_output);
+        // Tensor4D<T> *input_i = layers[i]->forward_calc_input(*prev_output);
         // PLOGD << "Execution time: " << op_name << " = " <<  std::setprecision(15) << std::fixed << dur(op_start);
 
         // IF_PLOG(plog::debug) { op_name = "forward_calc_output_preact"; PLOGD << op_name; op_start = clock(); }    
-        // unique_ptr<t4d> output_preact(layers[i]->forward_calc_output_preact(*input_i));
+        // unique_ptr<Tensor4D<T>> output_preact(layers[i]->forward_calc_output_preact(*input_i));
         // PLOGD << "Execution time: " << op_name << " = " <<  std::setprecision(15) << std::fixed << dur(op_start);
 
         // IF_PLOG(plog::debug) { op_name = "forward_activate"; PLOGD << op_name; op_start = clock(); }
-        // t4d * output_i = layers[i]->forward_activate(*output_preact.get());
+        // Tensor4D<T> * output_i = layers[i]->forward_activate(*output_preact.get());
         // PLOGD << "Execution time: " << op_name << " = " <<  std::setprecision(15) << std::fixed << dur(op_start);
 
     }
@@ -74,8 +73,9 @@ t4d * Network::forward(t4d &init_input) {
     return prev_output;
 }
 
-void Network::forward(t4d &init_input, vector<t4d *> &inputs, vector<t4d *> &outputs) {
-    t4d *prev_output = &init_input;
+template<class T>
+void Network<T>::forward(Tensor4D<T> &init_input, vector<Tensor4D<T> *> &inputs, vector<Tensor4D<T> *> &outputs, string loss_fn, Tensor4D<int> &labels, double &loss_value, Tensor4D<T> *&drv_error_output_preact) {
+    Tensor4D<T> *prev_output = &init_input;
 
     clock_t op_start;
     string op_name;
@@ -90,31 +90,115 @@ void Network::forward(t4d &init_input, vector<t4d *> &inputs, vector<t4d *> &out
         PLOGD << "Execution time: " << op_name << " = " <<  std::setprecision(15) << std::fixed << dur(op_start);
         _LLOG(debug, inputs[i]);
 
-        IF_PLOG(plog::debug) { op_name = "forward_calc_output_preact"; PLOGD << op_name; op_start = clock(); }    
-        unique_ptr<t4d> output_preact(layers[i]->forward_calc_output_preact(*(inputs[i])));
-        PLOGD << "Execution time: " << op_name << " = " <<  std::setprecision(15) << std::fixed << dur(op_start);
-        _LLOG(debug, output_preact);
-        
-        IF_PLOG(plog::debug) { op_name = "forward_activate"; PLOGD << op_name; op_start = clock(); }
-        outputs.push_back(layers[i]->forward_activate(*output_preact.get()));
+        if(i == (layers.size()-1)) {
+            IF_PLOG(plog::debug) { op_name = "forward_calc_output_loss"; PLOGD << op_name; op_start = clock(); }
+            outputs.push_back(layers[i]->forward_calc_output_loss(*(inputs[i]), loss_fn, loss_value, labels, drv_error_output_preact));
+        }
+        else {
+            IF_PLOG(plog::debug) { op_name = "forward_calc_output"; PLOGD << op_name; op_start = clock(); }
+            outputs.push_back(layers[i]->forward_calc_output(*(inputs[i])));
+        }
         PLOGD << "Execution time: " << op_name << " = " <<  std::setprecision(15) << std::fixed << dur(op_start);
         _LLOG(debug, outputs[i]);
         
         prev_output = outputs[i];
+
+        if(storage == "bf16" && i > 0) {
+            // layer i has read its input, the previous output waits for backward in bf16
+            stash_output(i-1, inputs, outputs);
+        }
+    }
+}
+
+template<class T>
+void Network<T>::stash_output(int i, vector<Tensor4D<T> *> &inputs, vector<Tensor4D<T> *> &outputs) {
+    PLOGD.printf("stash outputs[%d] as bf16", i);
+    stash.resize(layers.size());
+
+    // inputs[i+1] borrows outputs[i]
+    delete inputs[i+1];
+    inputs[i+1] = nullptr;
+
+    stash[i] = make_unique<Tensor4D<Neural::bfloat16>>(outputs[i]->shape());
+    stash[i]->set_layout(outputs[i]->layout());
+    stash[i]->create_acc();
+    acc_pack_bf16(*outputs[i], stash[i].get());
+    delete outputs[i];
+    outputs[i] = nullptr;
+}
+
+template<class T>
+void Network<T>::unstash(int i, vector<Tensor4D<T> *> &inputs, vector<Tensor4D<T> *> &outputs) {
+    for(int j: {i, i-1}) {
+        if(j >= 0 && !outputs[j]) {
+            PLOGD.printf("unstash outputs[%d]", j);
+            outputs[j] = new Tensor4D<T>(stash[j]->shape());
+            outputs[j]->set_layout(stash[j]->layout());
+            outputs[j]->create_acc();
+            acc_unpack_bf16(*stash[j], outputs[j]);
+            stash[j].reset();
+        }
+    }
+    if(i > 0 && !inputs[i]) {
+        inputs[i] = layers[i]->forward_calc_input(*outputs[i-1]);
+    }
+}
+
+template<class T>
+void Network<T>::set_backend(const string &spec) {
+    set_backend(Neural::make_backend<T>(spec));
+}
+
+template<class T>
+void Network<T>::set_backend(shared_ptr<const Neural::Backend<T>> _backend) {
+    backend = _backend;
+    for(auto it: layers) {
+        it->set_backend(backend);
+    }
+}
+
+template<class T>
+void Network<T>::set_storage(const string &_storage) {
+    if(_storage != "native" && _storage != "bf16") {
+        throw(std::invalid_argument("Storage not supported: " + _storage));
+    }
+    storage = _storage;
+    for(auto it: layers) {
+        it->set_storage(storage);
+    }
+}
+
+template<class T>
+void Network<T>::set_layout(const string &_layout) {
+    if(_layout != "nchw" && _layout != "nhwc") {
+        throw(std::invalid_argument("Layout not supported: " + _layout));
+    }
+    layout = _layout;
+    for(auto it: layers) {
+        it->set_layout((layout == "nhwc") ? Neural::Layout::nhwc : Neural::Layout::nchw);
     }
 }
 
-void Network::init() {
+template<class T>
+void Network<T>::init(int batch_size) {
     PLOGI << "Network::init";
+    PLOGI << "backend: " << backend->name;
+    PLOGI << "storage: " << storage;
+    PLOGI << "layout: " << layout;
     int lnn = 0;
 
     for(auto it: layers) {
         PLOGD << "Layer " << ++lnn << " init";
         it->init();
+        if(batch_size > 0) {
+            it->autotune(batch_size);
+        }
     }
 }
 
-void Network::eval(const Tensor4D<double> &eval_dataset, const Tensor4D<int> &eval_labels, double &recall, double &precision, double &accuracy, double &f1_score) {
+template<class T>
+template<class D>
+void Network<T>::eval(const Tensor4D<D> &eval_dataset, const Tensor4D<int> &eval_labels, double &recall, double &precision, double &accuracy, double &f1_score) {
     Shape4D eval_data_shape = eval_dataset.shape(), eval_labels_shape = eval_labels.shape();
 
     vector<Tensor4D<int> *> confusion_matrices;
@@ -126,17 +210,19 @@ void Network::eval(const Tensor4D<double> &eval_dataset, const Tensor4D<int> &ev
         LOGI_IF((v%10)==0) << v;
         int eval_batch_start = (v*eval_batch_size)%(eval_data_shape[0]-eval_batch_size+1);
 
-        unique_ptr<t4d> eval_batch_data = make_unique<t4d>(eval_batch_size, eval_data_shape[1], eval_data_shape[2], eval_data_shape[3]);
+        unique_ptr<Tensor4D<T>> eval_batch_data = make_unique<Tensor4D<T>>(eval_batch_size, eval_data_shape[1], eval_data_shape[2], eval_data_shape[3]);
         eval_batch_data->create_acc();
 
-        unique_ptr<Tensor4D<int>> eval_batch_labels = make_unique<Tensor4D<int>>(eval_batch_size, eval_labels_shape[1], eval_labels_shape[2], eval_labels_shape[3]);
-        eval_batch_labels->create_acc();
+        // batch windows borrow the dataset, only the window is copied to the device
+        Tensor4D<D> eval_batch_window(eval_dataset.view().slice(eval_batch_start, eval_batch_size));
+        eval_batch_window.copyin_acc();
+
+        unique_ptr<Tensor4D<int>> eval_batch_labels = make_unique<Tensor4D<int>>(eval_labels.view().slice(eval_batch_start, eval_batch_size));
+        eval_batch_labels->copyin_acc();
 
-        acc_make_batch(eval_dataset, eval_batch_data.get(), eval_batch_start);
-        acc_normalize_img(eval_batch_data.get());
-        acc_make_batch<int>(eval_labels, eval_batch_labels.get(), eval_batch_start);
+        acc_normalize_img(eval_batch_window, eval_batch_data.get());
         
-        t4d *eval_batch_output = this->forward(*eval_batch_data.get());
+        Tensor4D<T> *eval_batch_output = this->forward(*eval_batch_data.get());
         Tensor4D<int> *batch_conf_matrix = acc_calc_confusion_matrix(*eval_batch_output, *eval_batch_labels.get());
         confusion_matrices.push_back(batch_conf_matrix);
         delete eval_batch_output;
@@ -145,6 +231,7 @@ void Network::eval(const Tensor4D<double> &eval_dataset, const Tensor4D<int> &ev
     Tensor4D<int> *confusion_matrix_final = confusion_matrices[0];
     for(int i = 1; i < confusion_matrices.size(); i++) {
         acc_add(confusion_matrix_final, *confusion_matrices[i]);
+        delete confusion_matrices[i];
     }
 
     _LLOG(info, confusion_matrix_final);
@@ -179,9 +266,14 @@ void Network::eval(const Tensor4D<double> &eval_dataset, const Tensor4D<int> &ev
     accuracy /= accuracy_class->size();
     f1_score /= f1_class->size();
 
+    for(auto it: precision_recall_class) {
+        delete it;
+    }
     delete confusion_matrix_final;
 }
-void Network::train(const Tensor4D<double> &train_dataset, const Tensor4D<int> &train_labels, const Tensor4D<double> &valid_dataset, const Tensor4D<int> &valid_labels,  int batch_size, bool acc, double learning_rate, string loss_fn, int fepoch, int fsteps) {
+template<class T>
+template<class D>
+void Network<T>::train(const Tensor4D<D> &train_dataset, const Tensor4D<int> &train_labels, const Tensor4D<D> &valid_dataset, const Tensor4D<int> &valid_labels,  int batch_size, bool acc, double learning_rate, string loss_fn, int fepoch, int fsteps) {
     PLOGI << "Network::train | batch_size: " << batch_size;
 
     Shape4D train_shape = train_dataset.shape(), train_labels_shape = train_labels.shape(), valid_shape = valid_dataset.shape(), valid_labels_shape = valid_labels.shape();
@@ -192,7 +284,7 @@ void Network::train(const Tensor4D<double> &train_dataset, const Tensor4D<int> &
     assert_shape(train_labels_shape, valid_labels_shape);
     assert_shape(train_shape, __input_shape_proto);
 
-    this->init();
+    this->init(batch_size);
     
     int iters = train_shape[0]/batch_size, batch_start;
     
@@ -218,52 +310,53 @@ void Network::train(const Tensor4D<double> &train_dataset, const Tensor4D<int> &
                 printf("Step %d, batch_start: %d, batch_size: %d | ",iter, batch_start, batch_size);
             }
 
-            unique_ptr<t4d> batch_data = make_unique<t4d>(batch_size, train_shape[1], train_shape[2], train_shape[3]);
+            unique_ptr<Tensor4D<T>> batch_data = make_unique<Tensor4D<T>>(batch_size, train_shape[1], train_shape[2], train_shape[3]);
             batch_data->create_acc();
-            
-            unique_ptr<Tensor4D<int>> batch_labels = make_unique<Tensor4D<int>>(batch_size, train_labels_shape[1], train_labels_shape[2], train_labels_shape[3]);
-            batch_labels->create_acc(); 
     
             clock_t op_start;
             string op_name;
             
-            IF_PLOG(plog::debug) { op_name = "acc_make_batch"; PLOGD << op_name; op_start = clock(); }
-            acc_make_batch<double>(train_dataset, batch_data.get(),  batch_start);
+            // batch windows borrow the dataset, only the window is copied to the device
+            IF_PLOG(plog::debug) { op_name = "batch window"; PLOGD << op_name; op_start = clock(); }
+            Tensor4D<D> batch_window(train_dataset.view().slice(batch_start, batch_size));
+            batch_window.copyin_acc();
+
+            unique_ptr<Tensor4D<int>> batch_labels = make_unique<Tensor4D<int>>(train_labels.view().slice(batch_start, batch_size));
+            batch_labels->copyin_acc();
             PLOGD << "Execution time: " << op_name << " = " <<  std::setprecision(15) << std::fixed << dur(op_start);
-            _LLOG(debug, batch_data);            
+            _LLOG(debug, batch_labels);
 
             IF_PLOG(plog::debug) { op_name = "acc_normalize_img"; PLOGD << op_name; op_start = clock(); }
-            acc_normalize_img(batch_data.get());
+            acc_normalize_img(batch_window, batch_data.get());
             PLOGD << "Execution time: " << op_name << " = " <<  std::setprecision(15) << std::fixed << dur(op_start);
             _LLOG_A(debug, batch_data, "batch_data_normalized")
 
-            IF_PLOG(plog::debug) { op_name = "acc_make_batch[labels]"; PLOGD << op_name; op_start = clock(); }
-            acc_make_batch<int>(train_labels, batch_labels.get(), batch_start);
-            PLOGD << "Execution time: " << op_name << " = " <<  std::setprecision(15) << std::fixed << dur(op_start);
-            _LLOG(debug, batch_labels);
-
             PLOGD << "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< FORWARD " << iter <<" >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>";
-            vector<t4d *> inputs, outputs;
-            this->forward(*batch_data.get(), inputs, outputs);
+            vector<Tensor4D<T> *> inputs, outputs;
+            double loss;
+            Tensor4D<T> *drv_error_output_preact_loss;
+            this->forward(*batch_data.get(), inputs, outputs, loss_fn, *batch_labels.get(), loss, drv_error_output_preact_loss);
 
             PLOGD << "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< /FORWARD " << iter <<" >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>";
             
             PLOGD << "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< BACKWARD " << iter <<" >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>";
-            double loss;
-            unique_ptr<t4d> drv_error_output_preact, drv_error_prev_output;
+            unique_ptr<Tensor4D<T>> drv_error_output_preact, drv_error_prev_output;
 
             for(int i = layers.size()-1; i>=0; i--) {
                 PLOGD.printf("Backward Layer %d", i);
+
+                if(storage == "bf16") {
+                    unstash(i, inputs, outputs);
+                }
                 
                 _LLOG(debug, outputs[i]);
 
                 if(i==(layers.size()-1)) {
-                    IF_PLOG(plog::debug) { op_name = "backprop_calc_drv_error_output_preact(loss)"; PLOGD << op_name; op_start = clock(); }    
-                    drv_error_output_preact.reset(layers[i]->backprop_calc_drv_error_output_preact(loss_fn, loss, *(outputs[i]), *batch_labels.get()));
-                    PLOGD << "Execution time: " << op_name << " = " <<  std::setprecision(15) << std::fixed << dur(op_start);
-                    
+                    // loss and its drv_error_output_preact came with the forward pass
+                    drv_error_output_preact.reset(drv_error_output_preact_loss);
+
                     if(iter == 500) {
-                        acc_calc_confusion_matrix(*(outputs[i]), *batch_labels.get());
+                        delete acc_calc_confusion_matrix(*(outputs[i]), *batch_labels.get());
                     }
                     PLOGD << "Epoch loss: " << epoch_loss << " += " << loss;
                     epoch_loss += loss;
@@ -313,15 +406,28 @@ void Network::train(const Tensor4D<double> &train_dataset, const Tensor4D<int> &
         vec_epoch_f1.push_back(f1_epoch_macro);
 
         PLOGI << "[Epoch " << e << "] epoch_loss: " << epoch_loss << " | precision_avg: " << precision_epoch_macro << " | recall_avg: " << recall_epoch_macro << " | accuracy_avg: " << accuracy_epoch_macro << " | f1_avg: " << f1_epoch_macro << " | duration: " << dur(epoch_start);
+        PLOGI << "[Epoch " << e << "] tensor pool: " << Neural::Pool::stats().to_string();
         e++;
         
     }
-    while( (e>0 && ( (vec_epoch_f1[e-1]-vec_epoch_f1[e-2]) >= 0.0005 ) ) && ( (fepoch==0) || (e < fepoch)) );
+    while( (e>0 && ( e<2 || (vec_epoch_f1[e-1]-vec_epoch_f1[e-2]) >= 0.0005 ) ) && ( (fepoch==0) || (e < fepoch)) );
     
     PLOGI << "Train duration: " <<  std::setprecision(15) << std::fixed << dur(train_start);
 
  }
 
+template class Neural::Network<double>;
+template class Neural::Network<float>;
+
+template void Neural::Network<double>::eval<double>(const Tensor4D<double> &, const Tensor4D<int> &, double &, double &, double &, double &);
+template void Neural::Network<float>::eval<float>(const Tensor4D<float> &, const Tensor4D<int> &, double &, double &, double &, double &);
+template void Neural::Network<double>::eval<uint8_t>(const Tensor4D<uint8_t> &, const Tensor4D<int> &, double &, double &, double &, double &);
+template void Neural::Network<float>::eval<uint8_t>(const Tensor4D<uint8_t> &, const Tensor4D<int> &, double &, double &, double &, double &);
+template void Neural::Network<double>::train<double>(const Tensor4D<double> &, const Tensor4D<int> &, const Tensor4D<double> &, const Tensor4D<int> &, int, bool, double, string, int, int);
+template void Neural::Network<float>::train<float>(const Tensor4D<float> &, const Tensor4D<int> &, const Tensor4D<float> &, const Tensor4D<int> &, int, bool, double, string, int, int);
+template void Neural::Network<double>::train<uint8_t>(const Tensor4D<uint8_t> &, const Tensor4D<int> &, const Tensor4D<uint8_t> &, const Tensor4D<int> &, int, bool, double, string, int, int);
+template void Neural::Network<float>::train<uint8_t>(const Tensor4D<uint8_t> &, const Tensor4D<int> &, const Tensor4D<uint8_t> &, const Tensor4D<int> &, int, bool, double, string, int, int);
+
 void param2file_al(double *param, string path, string param_name, int num_param ) {
     ofstream out_param;
     out_param.open("NEURAL_NETWORK_TRAINED.xml", ios::out | ios::app);
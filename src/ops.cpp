@@ -1,15 +1,20 @@
 #include <cstdio>
 #include <cmath>
-#include <curand.h>
 #include <iostream>
 #include <vector>
 #include <type_traits>
 #include <cassert>
 #include <iomanip>
-#include "openacc.h"
+#include <algorithm>
 #include "utils.hpp"
 #include "ops.hpp"
 #include "tensor.hpp"
+#include "gemm.hpp"
+#include "parallel.hpp"
+#include "vmath.hpp"
+#include "host_kernels.hpp"
+#include "conv_direct.hpp"
+#include "random.hpp"
 
 using Neural::Tensor4D;
 using Neural::Shape4D;
@@ -18,104 +23,212 @@ typedef Tensor4D<double> t4d;
 
 using namespace std;
 
-class cuGenerator {
-
-private:
-    curandGenerator_t gen;
-    int istat, device_type;
+template<class T>
+void acc_copy(const Tensor4D<T> &A, Tensor4D<T> *B) {
+    assert(A.size() == B->size());
     
-public:
-    cuGenerator(int dvtype) {
-        device_type = dvtype;
-        
-        if (device_type == Neural::device_type_gpu) {
-            LOGD <<  "cuGenerator gpu";
-            istat = curandCreateGenerator(&gen, CURAND_RNG_PSEUDO_DEFAULT);
-            reportError();
-        }
-        else if (device_type == Neural::device_type_host) {
-            LOGD <<  "cuGenerator host";
-            istat = curandCreateGeneratorHost(&gen, CURAND_RNG_PSEUDO_DEFAULT);
-            reportError();
-        }
-        else {
-            throw(std::invalid_argument("Device type unknown"));
-        }
-    }
+    int asize = A.size();
     
-    cuGenerator() {}
+    const T* adata = A.data();
+    T *bdata = B->data();
     
-    ~cuGenerator() {
-        istat = curandDestroyGenerator(gen);
-        reportError();
+    #pragma acc parallel loop present(adata[:asize], bdata[:asize])
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < asize; i++) {
+        bdata[i] = adata[i];
     }
+}
+
+template void acc_copy(const Tensor4D<double> &A, Tensor4D<double> *B);
+template void acc_copy(const Tensor4D<float> &A, Tensor4D<float> *B);
+
+// gathers a (possibly strided) view into a contiguous tensor
+template<class T>
+void acc_copy(const Neural::TensorView4D<T> &A, Tensor4D<T> *B) {
+    Shape4D a_shape = A.shape();
+    assert(a_shape == B->shape());
     
-    void reportError() {
-        if (istat != CURAND_STATUS_SUCCESS) {
-            throw(std::runtime_error("Generator error"));
+    const T* adata = A.data();
+    T *bdata = B->data();
+    int aextent = A.extent(), bsize = B->size();
+    int AA = a_shape[0], AB = a_shape[1], AC = a_shape[2], AD = a_shape[3];
+    int s0 = A.stride(0), s1 = A.stride(1), s2 = A.stride(2), s3 = A.stride(3);
+
+    if constexpr(std::is_floating_point<T>::value) {
+        if(Neural::get_device_type() != Neural::device_type_gpu) {
+            int shape[4] = {AA, AB, AC, AD}, strides[4] = {s0, s1, s2, s3};
+            Neural::Kernels::host_kernels<T>().gather4D(adata, bdata, shape, strides);
+            return;
         }
     }
     
-    curandGenerator_t &get_gen() {
-        return gen;
+    #pragma acc parallel loop collapse(4) present(adata[:aextent], bdata[:bsize])
+    #pragma omp parallel for collapse(2) schedule(static)
+    for(int a = 0; a < AA; a++) {
+        for(int b = 0; b < AB; b++) {
+            for(int c = 0; c < AC; c++) {
+                for(int d = 0; d < AD; d++) {
+                    bdata[((a*AB + b)*AC + c)*AD + d] = adata[a*s0 + b*s1 + c*s2 + d*s3];
+                }
+            }
+        }
     }
-};
+}
 
+template void acc_copy(const Neural::TensorView4D<double> &A, Tensor4D<double> *B);
+template void acc_copy(const Neural::TensorView4D<float> &A, Tensor4D<float> *B);
+template void acc_copy(const Neural::TensorView4D<int> &A, Tensor4D<int> *B);
 
+// B holds A's elements in B's layout, a gather of A read in B's order
 template<class T>
-void generateNormal(T *data,  int n,  T mean,  T stddev) {
-    cuGenerator *gen;
-    int device_type = Neural::get_device_type();
-    bool is_present = Neural::is_present(data,  n*sizeof(T));
-    
-    T *adata = data;
-    
-    LOGD << "Generate normal | device type: " << device_type << " | present: " << is_present;
-    
-    if ( (device_type == Neural::device_type_gpu) && is_present ) {
-        LOGD << "Getting device ptr";
-        gen = new cuGenerator(Neural::device_type_gpu);
-        adata = (T*)Neural::deviceptr(data);
+void acc_convert_layout(const Tensor4D<T> &A, Tensor4D<T> *B) {
+    Shape4D a_shape = A.shape();
+    assert(a_shape == B->shape());
+
+    if(A.layout() == B->layout()) {
+        acc_copy(A, B);
+        return;
+    }
+
+    // A's strides permuted into B's dimension order, so that acc_copy writes B densely
+    Neural::TensorView4D<T> a_view = A.view();
+    if(B->layout() == Neural::Layout::nhwc) {
+        int strides[4] = {a_view.stride(0), a_view.stride(2), a_view.stride(3), a_view.stride(1)};
+        Tensor4D<T> b_nchw(Neural::TensorView4D<T>(B->data(), Shape4D(a_shape[0], a_shape[2], a_shape[3], a_shape[1])));
+        acc_copy(Neural::TensorView4D<T>(a_view.data(), b_nchw.shape(), strides), &b_nchw);
     }
     else {
-        gen = new cuGenerator(Neural::device_type_host);
+        Tensor4D<T> b_nchw(Neural::TensorView4D<T>(B->data(), a_shape));
+        acc_copy(a_view, &b_nchw);
     }
-    
-    if constexpr(std::is_same<T,  double>::value) {
-        LOGD << ("double generator");
-        
-        curandGenerateNormalDouble(gen->get_gen(), adata, n, mean, stddev);
+}
+
+template void acc_convert_layout(const Tensor4D<double> &A, Tensor4D<double> *B);
+template void acc_convert_layout(const Tensor4D<float> &A, Tensor4D<float> *B);
+
+template<class T>
+void acc_pack_bf16(const Tensor4D<T> &A, Tensor4D<Neural::bfloat16> *B) {
+    assert(A.size() == B->size());
+
+    int asize = A.size();
+
+    const T* adata = A.data();
+    Neural::bfloat16 *bdata = B->data();
+
+    #pragma acc parallel loop present(adata[:asize], bdata[:asize])
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < asize; i++) {
+        bdata[i] = Neural::bfloat16((float)adata[i]);
     }
-    else if constexpr(std::is_same<T,  float>::value) {
-        LOGD << ("float generator");
-        curandGenerateNormal(gen->get_gen(), adata, n, mean, stddev);
+}
+
+template void acc_pack_bf16(const Tensor4D<double> &A, Tensor4D<Neural::bfloat16> *B);
+template void acc_pack_bf16(const Tensor4D<float> &A, Tensor4D<Neural::bfloat16> *B);
+
+template<class T>
+void acc_unpack_bf16(const Tensor4D<Neural::bfloat16> &A, Tensor4D<T> *B) {
+    assert(A.size() == B->size());
+
+    int asize = A.size();
+
+    const Neural::bfloat16* adata = A.data();
+    T *bdata = B->data();
+
+    #pragma acc parallel loop present(adata[:asize], bdata[:asize])
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < asize; i++) {
+        bdata[i] = (T)(float)adata[i];
     }
-    else {
-        throw(std::invalid_argument("Data type not supported"));
+}
+
+template void acc_unpack_bf16(const Tensor4D<Neural::bfloat16> &A, Tensor4D<double> *B);
+template void acc_unpack_bf16(const Tensor4D<Neural::bfloat16> &A, Tensor4D<float> *B);
+
+template<class T>
+void acc_round_bf16(const Tensor4D<T> &A, Tensor4D<T> *B) {
+    assert(A.size() == B->size());
+
+    int asize = A.size();
+
+    const T* adata = A.data();
+    T *bdata = B->data();
+
+    #pragma acc parallel loop present(adata[:asize], bdata[:asize])
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < asize; i++) {
+        bdata[i] = (T)(float)Neural::bfloat16((float)adata[i]);
     }
-    
-    delete gen;
 }
 
-template void generateNormal(float *, int, float, float);
-template void generateNormal(double *, int, double, double);
+template void acc_round_bf16(const Tensor4D<double> &A, Tensor4D<double> *B);
+template void acc_round_bf16(const Tensor4D<float> &A, Tensor4D<float> *B);
 
 template<class T>
-void acc_copy(const Tensor4D<T> &A, Tensor4D<T> *B) {
+void acc_sign(const Tensor4D<T> &A, Tensor4D<T> *B) {
     assert(A.size() == B->size());
-    
+
     int asize = A.size();
-    
+
     const T* adata = A.data();
     T *bdata = B->data();
-    
+
     #pragma acc parallel loop present(adata[:asize], bdata[:asize])
+    #pragma omp parallel for schedule(static)
     for(int i = 0; i < asize; i++) {
-        bdata[i] = adata[i];
+        bdata[i] = (adata[i] > (T)0) ? (T)1 : (T)-1;
     }
 }
 
-template void acc_copy(const Tensor4D<double> &A, Tensor4D<double> *B);
+template void acc_sign(const Tensor4D<double> &A, Tensor4D<double> *B);
+template void acc_sign(const Tensor4D<float> &A, Tensor4D<float> *B);
+
+template<class T>
+void acc_binarize(const Tensor4D<T> &A, Tensor4D<T> *B, bool per_column) {
+    assert(A.size() == B->size());
+
+    int asize = A.size(), rows = A.shape()[0], cols = asize / rows;
+    // channel c holds the elements c*channel_stride + k*element_stride
+    int channels = per_column ? cols : rows, channel_size = per_column ? rows : cols;
+    int channel_stride = per_column ? 1 : cols, element_stride = per_column ? cols : 1;
+
+    const T* adata = A.data();
+    T *bdata = B->data();
+
+    #pragma acc parallel loop present(adata[:asize], bdata[:asize])
+    #pragma omp parallel for schedule(static)
+    for(int c = 0; c < channels; c++) {
+        double sum = 0;
+        #pragma acc loop seq
+        for(int k = 0; k < channel_size; k++) {
+            sum += fabs((double)adata[c*channel_stride + k*element_stride]);
+        }
+        T alpha = (T)(sum / channel_size);
+        #pragma acc loop seq
+        for(int k = 0; k < channel_size; k++) {
+            int i = c*channel_stride + k*element_stride;
+            bdata[i] = (adata[i] > (T)0) ? alpha : -alpha;
+        }
+    }
+}
+
+template void acc_binarize(const Tensor4D<double> &A, Tensor4D<double> *B, bool per_column);
+template void acc_binarize(const Tensor4D<float> &A, Tensor4D<float> *B, bool per_column);
+
+template<class T>
+void acc_clip(Tensor4D<T> *A, T lo, T hi) {
+    int asize = A->size();
+
+    T *adata = A->data();
+
+    #pragma acc parallel loop present(adata[:asize])
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < asize; i++) {
+        adata[i] = (adata[i] < lo) ? lo : ((adata[i] > hi) ? hi : adata[i]);
+    }
+}
+
+template void acc_clip(Tensor4D<double> *A, double lo, double hi);
+template void acc_clip(Tensor4D<float> *A, float lo, float hi);
 
 
 template<class T>
@@ -125,14 +238,24 @@ void acc_add(Tensor4D<T> *a, const Tensor4D<T> &b) {
     T* a_data = a->data();
     const T *b_data = b.data();
     int a_size = a->size();
+
+    // int tensors stay on the loop
+    if constexpr(std::is_floating_point<T>::value) {
+        if(Neural::get_device_type() != Neural::device_type_gpu) {
+            Neural::Kernels::host_kernels<T>().add(a_size, a_data, b_data);
+            return;
+        }
+    }
     
     #pragma acc parallel loop present(a_data[:a_size],  b_data[:a_size])
+    #pragma omp parallel for schedule(static)
     for (int i = 0; i < a_size; i++) {
         a_data[i] += b_data[i];
     }
 }
 
 template void acc_add(Tensor4D<double> *a, const Tensor4D<double> &b);
+template void acc_add(Tensor4D<float> *a, const Tensor4D<float> &b);
 template void acc_add(Tensor4D<int> *a, const Tensor4D<int> &b);
 
 template<class T>
@@ -141,12 +264,14 @@ void acc_val(Tensor4D<T> *A, T val) {
     
     T * a_data = A->data();
     #pragma acc parallel loop present(a_data[:asize])
+    #pragma omp parallel for schedule(static)
     for(int i = 0; i < asize; i++) {
         a_data[i] = val;
     }
 }
 
 template void acc_val(Tensor4D<double> *A, double val);
+template void acc_val(Tensor4D<float> *A, float val);
 
 template<class T>
 void acc_zeros(Tensor4D<T> *A) {
@@ -154,6 +279,7 @@ void acc_zeros(Tensor4D<T> *A) {
 }
 
 template void acc_zeros(Tensor4D<double> *A);
+template void acc_zeros(Tensor4D<float> *A);
 template void acc_zeros(Tensor4D<int> *A);
 
 template<class T>
@@ -161,6 +287,11 @@ void acc_mltp(Tensor4D<T> *A, T mltp) {
     int asize = A->size();
     
     T *a_data = A->data();
+    if(Neural::get_device_type() != Neural::device_type_gpu) {
+        Neural::Kernels::host_kernels<T>().mltp(asize, a_data, mltp);
+        return;
+    }
+
     #pragma acc parallel loop present(a_data[:asize])
     for(int i = 0; i < asize; i++) {
         a_data[i] *= mltp;
@@ -168,6 +299,7 @@ void acc_mltp(Tensor4D<T> *A, T mltp) {
 }
 
 template void acc_mltp(Tensor4D<double> *A, double mltp) ;
+template void acc_mltp(Tensor4D<float> *A, float mltp) ;
 
 template<class T>
 void acc_accumulate(const Tensor4D<T> &a, Tensor4D<T> *b) {
@@ -178,63 +310,63 @@ void acc_accumulate(const Tensor4D<T> &a, Tensor4D<T> *b) {
     const T* a_data = a.data();
     T* b_data = b->data();
     
-    int B = a_shape[0], M = a_shape[1];
+    // per channel sum over the batch and the spatial positions, HW is 1 for fc
+    int B = a_shape[0], M = a_shape[1], HW = a_shape[2]*a_shape[3];
     
-    #pragma acc parallel loop present(a_data[:B*M], b_data[:1*M])
+    if(a.layout() == Neural::Layout::nhwc) {
+        // channels-last: the channels of every pixel are contiguous, rows of M
+        #pragma acc parallel loop present(a_data[:B*M*HW], b_data[:1*M])
+        #pragma omp parallel for schedule(static)
+        for(int j = 0; j < M; j++) {
+            double accm = 0.0f;
+            #pragma acc loop reduction(+:accm)
+            for(int p = 0; p < B*HW; p++) {
+                accm+=a_data[p*M + j];
+            }
+            b_data[j] = accm;
+        }
+        return;
+    }
+    
+    #pragma acc parallel loop present(a_data[:B*M*HW], b_data[:1*M])
+    #pragma omp parallel for schedule(static)
     for(int j = 0; j < M; j++) {
         double accm = 0.0f;
-        #pragma acc loop reduction(+:accm)
+        #pragma acc loop collapse(2) reduction(+:accm)
         for(int i = 0; i < B; i++) {
-            accm+=a_data[i*M + j];
+            for(int k = 0; k < HW; k++) {
+                accm+=a_data[(i*M + j)*HW + k];
+            }
         }
         b_data[j] = accm;
     }
 }
 
 template void acc_accumulate(const Tensor4D<double> &, Tensor4D<double> *);
+template void acc_accumulate(const Tensor4D<float> &, Tensor4D<float> *);
 
-//added comment check makefile
 template<class T>
-void acc_rng(Tensor4D<T> *output, T mtlp) {
-    //bool acc = output->is_present_gpu();
+void acc_rng(Tensor4D<T> *output, T mtlp, Neural::Random::Stream stream) {
     T *a_data = output->data();
-    T *b_data = a_data;
     int n = output->size();
-    int pn = n;
-    bool resized{false};
 
-    LOGD << "acc_set_rngv n: " << n;
+    LOGD << "acc_rng n: " << n << " stream: " << stream.id << "." << stream.step;
 
-    if(n%2 == 1) {
-        pn = n + 1;
-        b_data = new T[pn];
-        resized=true;
-    }
-    
-    T stddev = 1.0f, mean = 0.0f;
-    
     T mx, mn, range, ml;
     
-    #pragma acc data present(a_data[:n]) create(b_data[:pn])
+    // drawn on the host, the device copy is updated if there is one
+    Neural::Random::normal<T>(a_data, n, 0, 1, stream);
+
+    #pragma acc data present(a_data[:n])
     {
-    // Tensor4D<T> * dptr = (Tensor4D<T> *)acc_deviceptr(a_data);
-    // Create Normal distribution
-    
-    generateNormal<T>(b_data, pn, mean, stddev);
-    
-    if(resized) {
-        //copy back to a_data
-        #pragma acc parallel loop
-        for(int i = 0; i < n; i++) {
-            a_data[i] = b_data[i];
-        }
-    }
-    
+    #pragma acc update device(a_data[:n]) if_present
+
     //find max, min
     mx = 0;
     mn = a_data[0];
     
     #pragma acc parallel loop reduction(max:mx) reduction(min:mn)
+    #pragma omp parallel for reduction(max:mx) reduction(min:mn) schedule(static)
     for(int i = 0; i < n; i++) {
         if(a_data[i] > mx) {
             mx = a_data[i];
@@ -249,18 +381,16 @@ void acc_rng(Tensor4D<T> *output, T mtlp) {
     range = mx - mn;
     ml = 2.0f * mtlp / range;
     #pragma acc parallel loop
+    #pragma omp parallel for schedule(static)
     for (int i = 0; i < n; i++) {
         a_data[i] *=  ml;
     }
     
     }
-    
-    if(resized) {
-        delete[] b_data;
-    }
 }
 
-template void acc_rng(Tensor4D<double> *output, double mtlp);
+template void acc_rng(Tensor4D<double> *output, double mtlp, Neural::Random::Stream stream);
+template void acc_rng(Tensor4D<float> *output, float mtlp, Neural::Random::Stream stream);
 
 
 template<class T>
@@ -270,26 +400,24 @@ void acc_flip_spatial(Tensor4D<T> *input) {
     int A = shape[0], B = shape[1], C = shape[2], D = shape[3];
     T *in_data = input->data();
     
-    #pragma acc parallel loop collapse(4) present(in_data[:A*B*C*D])
+    // rotating a CxD plane by 180 degrees reverses its flattened elements
+    int CD = C*D;
+    
+    #pragma acc parallel loop collapse(3) present(in_data[:A*B*C*D])
+    #pragma omp parallel for collapse(2) schedule(static)
     for(int i = 0; i < A; i++) {
         for(int j = 0; j < B; j++) {
-            for(int k = 0; k < (C/2); k++) {
-                for(int l = 0; l < (D/2); l++) {
-                    T tmp = in_data[(i*B + j)*C*D + k*D + l];
-                    
-                    // IF_PLOG(plog::verbose) {
-                    //     LOGD.printf("in_data[%d, %d, %d, %d] %+11.5f <-> in_data[%d, %d, %d, %d] %+11.5f\n", i, j, k, l, tmp, i, j, C-k-1, D-l-1, in_data[ (i*B + j)*C*D + (C-k-1)*D + (D-l-1)]);
-                    // }
-                    
-                    in_data[ (i*B + j)*C*D +     k*D +    l ] = in_data[ (i*B + j)*C*D + (C-k-1)*D + (D-l-1)];
-                    in_data[ (i*B + j)*C*D + (C-k-1)*D + (D-l-1)] = tmp;
-                }
+            for(int s = 0; s < (CD/2); s++) {
+                T tmp = in_data[(i*B + j)*CD + s];
+                in_data[(i*B + j)*CD + s] = in_data[(i*B + j)*CD + (CD-s-1)];
+                in_data[(i*B + j)*CD + (CD-s-1)] = tmp;
             }
         }
     }
 }
 
 template void acc_flip_spatial(Tensor4D<double> *input);
+template void acc_flip_spatial(Tensor4D<float> *input);
 
 template <class T>
 void acc_matrix_multiply_debug(const Tensor4D<T> &A, const Tensor4D<T> &B, Tensor4D<T> *C) {
@@ -344,9 +472,10 @@ void acc_matrix_multiply_debug(const Tensor4D<T> &A, const Tensor4D<T> &B, Tenso
 }
 
 template void acc_matrix_multiply_debug(const Tensor4D<double> &A, const Tensor4D<double> &B, Tensor4D<double> *C);
+template void acc_matrix_multiply_debug(const Tensor4D<float> &A, const Tensor4D<float> &B, Tensor4D<float> *C);
 
 template <class T>
-void acc_matrix_multiply(const Tensor4D<T> &A, const Tensor4D<T> &B, Tensor4D<T> *C) {
+void acc_matrix_multiply(const Tensor4D<T> &A, const Tensor4D<T> &B, Tensor4D<T> *C, bool transA, bool transB, const Neural::Kernels::Epilogue<T> &epilogue) {
     Shape4D a_shape = A.shape(), b_shape = B.shape(), c_shape = C->shape();
     Shape4D a_shape_flat = a_shape.flat(1);
     
@@ -354,15 +483,31 @@ void acc_matrix_multiply(const Tensor4D<T> &A, const Tensor4D<T> &B, Tensor4D<T>
         throw(std::invalid_argument("Error: B is not MxKx1. "));
     }
     
-    assert(a_shape_flat[1] == b_shape[0]);
-    assert(a_shape_flat[0] == c_shape[0]);
-    assert(b_shape[1] == c_shape[1]);
+    // A, B as stored are lda, ldb wide, op(A) is NxK and op(B) is KxM
+    int lda = a_shape_flat[1], ldb = b_shape[1];
+    int N = transA ? a_shape_flat[1] : a_shape_flat[0], K = transA ? a_shape_flat[0] : a_shape_flat[1];
+    int M = transB ? b_shape[0] : b_shape[1];
+    
+    assert(K == (transB ? b_shape[1] : b_shape[0]));
+    assert(N == c_shape[0]);
+    assert(M == c_shape[1]);
     
-    int N = a_shape[0], K = b_shape[0], M = b_shape[1];
     const T *a_data = A.data(), *b_data = B.data();
     T *c_data = C->data();
+
+    // on the host the blocked kernel is used, the loop nest below is only offloaded to the gpu
+    if(Neural::get_device_type() != Neural::device_type_gpu) {
+        Neural::Kernels::gemm<T>(transA, transB, N, M, K, (T)1, a_data, lda, b_data, ldb, (T)0, c_data, M, &epilogue);
+        return;
+    }
+    
+    int rsa = transA ? 1 : lda, csa = transA ? lda : 1, rsb = transB ? 1 : ldb, csb = transB ? ldb : 1;
+    // a missing bias is a zero-length section
+    const T *row_bias = epilogue.row_bias, *col_bias = epilogue.col_bias;
+    int n_row_bias = row_bias ? N : 0, n_col_bias = col_bias ? M : 0;
+    Neural::Kernels::Activation activation = epilogue.activation;
     
-    #pragma acc data copyin(a_data[:(N*K)], b_data[0:K*M]) copyout(c_data[0:N*M])
+    #pragma acc data copyin(a_data[:(N*K)], b_data[0:K*M], row_bias[:n_row_bias], col_bias[:n_col_bias]) copyout(c_data[0:N*M])
     {
 
     #pragma acc parallel loop collapse(2)
@@ -372,21 +517,193 @@ void acc_matrix_multiply(const Tensor4D<T> &A, const Tensor4D<T> &B, Tensor4D<T>
                 
             #pragma acc loop seq reduction(+:csumd)
             for(int t = 0; t < K; t++) {
-                csumd += a_data[i*K + t] * b_data[t*M + j];
+                csumd += a_data[i*rsa + t*csa] * b_data[t*rsb + j*csb];
             }
 
-            c_data[i*M + j] = csumd;
+            if(n_row_bias) {
+                csumd += row_bias[i];
+            }
+            if(n_col_bias) {
+                csumd += col_bias[j];
+            }
+            c_data[i*M + j] = Neural::Kernels::activate(csumd, activation);
         }
     }
 
     }
 }
 
-template void acc_matrix_multiply(const Tensor4D<double> &A, const Tensor4D<double> &B, Tensor4D<double> *C);
+template void acc_matrix_multiply(const Tensor4D<double> &A, const Tensor4D<double> &B, Tensor4D<double> *C, bool transA, bool transB, const Neural::Kernels::Epilogue<double> &epilogue);
+template void acc_matrix_multiply(const Tensor4D<float> &A, const Tensor4D<float> &B, Tensor4D<float> *C, bool transA, bool transB, const Neural::Kernels::Epilogue<float> &epilogue);
+
+template <class T>
+void acc_matrix_multiply_packed(const Tensor4D<T> &A, const Neural::Kernels::PackedMatrix<T> &B, Tensor4D<T> *C, const Neural::Kernels::Epilogue<T> &epilogue) {
+    Shape4D a_shape_flat = A.shape().flat(1), c_shape = C->shape();
+    int N = a_shape_flat[0], K = a_shape_flat[1], M = B.cols();
+
+    if(K != B.rows() || N != c_shape[0] || M != c_shape[1]) {
+        throw(std::invalid_argument("Error: matrix_multiply shapes not compatible"));
+    }
+
+    Neural::Kernels::gemm<T>(false, N, (T)1, A.data(), K, B, (T)0, C->data(), M, &epilogue);
+}
+
+template void acc_matrix_multiply_packed(const Tensor4D<double> &A, const Neural::Kernels::PackedMatrix<double> &B, Tensor4D<double> *C, const Neural::Kernels::Epilogue<double> &epilogue);
+template void acc_matrix_multiply_packed(const Tensor4D<float> &A, const Neural::Kernels::PackedMatrix<float> &B, Tensor4D<float> *C, const Neural::Kernels::Epilogue<float> &epilogue);
+
+// Channels-last direct convolutions, the input, output and error tensors in nhwc and the filters OIHW as always.
+// Each output pixel reads the channels of its input pixels contiguously; the gradients are gathers so that
+// every thread owns the elements it writes.
+template <class T>
+static void acc_convolution2D_nhwc(const Tensor4D<T> &input, const Tensor4D<T> &filters, Tensor4D<T> *output, const vector<int> &stride, const vector<int> &padding, const Neural::Kernels::Epilogue<T> &epilogue) {
+    Shape4D in_shape = input.shape(), filter_shape = filters.shape(), out_shape = output->shape();
+
+    int batch = in_shape[0], in_channels = in_shape[1], in_rows = in_shape[2], in_cols = in_shape[3];
+    int out_channels = out_shape[1], out_rows = out_shape[2], out_cols = out_shape[3];
+    int filter_height = filter_shape[2], filter_width = filter_shape[3];
+    int stride_r = stride[0], stride_c = stride[1], padding_top = padding[0], padding_left = padding[2];
+
+    const T *in_data = input.data(), *filter_data = filters.data();
+    T *out_data = output->data();
+    const T *bias_data = epilogue.row_bias;
+    int n_bias = bias_data ? out_channels : 0;
+    Neural::Kernels::Activation activation = epilogue.activation;
+
+    #pragma acc parallel loop collapse(4) present(in_data[:(batch*in_rows*in_cols*in_channels)]) \
+    present(filter_data[:out_channels*in_channels*filter_height*filter_width]) \
+    present(out_data[:(batch*out_rows*out_cols*out_channels)]) present(bias_data[:n_bias])
+    #pragma omp parallel for collapse(3) schedule(static)
+    for(int i = 0; i < batch; i++) {
+        for(int oh = 0; oh < out_rows; oh++) {
+            for(int ow = 0; ow < out_cols; ow++) {
+                for(int och = 0; och < out_channels; och++) {
+                    T sum = 0;
+                    #pragma acc loop seq collapse(2)
+                    for(int fi = 0; fi < filter_height; fi++) {
+                        for(int fj = 0; fj < filter_width; fj++) {
+                            int ih = oh*stride_r + fi - padding_top, iw = ow*stride_c + fj - padding_left;
+                            if(ih < 0 || ih >= in_rows || iw < 0 || iw >= in_cols) {
+                                continue;
+                            }
+
+                            const T *in_px = in_data + ((i*in_rows + ih)*in_cols + iw)*in_channels;
+                            const T *w = filter_data + (och*in_channels*filter_height + fi)*filter_width + fj;
+                            for(int ich = 0; ich < in_channels; ich++) {
+                                sum += in_px[ich] * w[ich*filter_height*filter_width];
+                            }
+                        }
+                    }
+
+                    if(n_bias) {
+                        sum += bias_data[och];
+                    }
+                    out_data[((i*out_rows + oh)*out_cols + ow)*out_channels + och] = Neural::Kernels::activate(sum, activation);
+                }
+            }
+        }
+    }
+}
+
+template <class T>
+static void acc_convolution2D_wgrad_nhwc(const Tensor4D<T> &input, const Tensor4D<T> &drv_error_output, Tensor4D<T> *drv_error_filters, Tensor4D<T> *drv_error_biases, const vector<int> &stride, const vector<int> &padding, T scale) {
+    Shape4D in_shape = input.shape(), out_shape = drv_error_output.shape(), filter_shape = drv_error_filters->shape();
+
+    int batch = in_shape[0], in_channels = in_shape[1], in_rows = in_shape[2], in_cols = in_shape[3];
+    int out_channels = out_shape[1], out_rows = out_shape[2], out_cols = out_shape[3];
+    int filter_height = filter_shape[2], filter_width = filter_shape[3];
+    int stride_r = stride[0], stride_c = stride[1], padding_top = padding[0], padding_left = padding[2];
+
+    const T *in_data = input.data(), *dout_data = drv_error_output.data();
+    T *dw_data = drv_error_filters->data(), *db_data = drv_error_biases->data();
+    int npix = batch*out_rows*out_cols;
+
+    #pragma acc parallel loop present(dout_data[:(npix*out_channels)], db_data[:out_channels])
+    #pragma omp parallel for schedule(static)
+    for(int oc = 0; oc < out_channels; oc++) {
+        T bsum = 0;
+        #pragma acc loop reduction(+:bsum)
+        for(int p = 0; p < npix; p++) {
+            bsum += dout_data[p*out_channels + oc];
+        }
+        db_data[oc] = bsum * scale;
+    }
+
+    #pragma acc parallel loop collapse(4) present(in_data[:(batch*in_rows*in_cols*in_channels)], dout_data[:(npix*out_channels)]) \
+    present(dw_data[:(out_channels*in_channels*filter_height*filter_width)])
+    #pragma omp parallel for collapse(2) schedule(static)
+    for(int oc = 0; oc < out_channels; oc++) {
+        for(int fi = 0; fi < filter_height; fi++) {
+            for(int fj = 0; fj < filter_width; fj++) {
+                for(int c = 0; c < in_channels; c++) {
+                    int oh_begin = conv_out_begin(0, padding_top, fi, stride_r, out_rows), oh_end = conv_out_begin(in_rows, padding_top, fi, stride_r, out_rows);
+                    int ow_begin = conv_out_begin(0, padding_left, fj, stride_c, out_cols), ow_end = conv_out_begin(in_cols, padding_left, fj, stride_c, out_cols);
+
+                    T sum = 0;
+                    for(int b = 0; b < batch; b++) {
+                        for(int oh = oh_begin; oh < oh_end; oh++) {
+                            int ih = oh*stride_r + fi - padding_top;
+                            for(int ow = ow_begin; ow < ow_end; ow++) {
+                                int iw = ow*stride_c + fj - padding_left;
+                                sum += dout_data[((b*out_rows + oh)*out_cols + ow)*out_channels + oc] * in_data[((b*in_rows + ih)*in_cols + iw)*in_channels + c];
+                            }
+                        }
+                    }
+                    dw_data[((oc*in_channels + c)*filter_height + fi)*filter_width + fj] = sum * scale;
+                }
+            }
+        }
+    }
+}
+
+template <class T>
+static void acc_convolution2D_dgrad_nhwc(const Tensor4D<T> &drv_error_output, const Tensor4D<T> &filters, Tensor4D<T> *drv_error_input, const vector<int> &stride, const vector<int> &padding) {
+    Shape4D out_shape = drv_error_output.shape(), filter_shape = filters.shape(), in_shape = drv_error_input->shape();
+
+    int batch = in_shape[0], in_channels = in_shape[1], in_rows = in_shape[2], in_cols = in_shape[3];
+    int out_channels = out_shape[1], out_rows = out_shape[2], out_cols = out_shape[3];
+    int filter_height = filter_shape[2], filter_width = filter_shape[3];
+    int stride_r = stride[0], stride_c = stride[1], padding_top = padding[0], padding_left = padding[2];
+
+    const T *dout_data = drv_error_output.data(), *filter_data = filters.data();
+    T *din_data = drv_error_input->data();
+
+    // din[b][ih][iw][c] gathers the output errors whose taps read (ih, iw)
+    #pragma acc parallel loop collapse(4) present(dout_data[:(batch*out_rows*out_cols*out_channels)], filter_data[:(out_channels*in_channels*filter_height*filter_width)]) \
+    present(din_data[:(batch*in_rows*in_cols*in_channels)])
+    #pragma omp parallel for collapse(3) schedule(static)
+    for(int b = 0; b < batch; b++) {
+        for(int ih = 0; ih < in_rows; ih++) {
+            for(int iw = 0; iw < in_cols; iw++) {
+                for(int c = 0; c < in_channels; c++) {
+                    T sum = 0;
+                    for(int fi = 0; fi < filter_height; fi++) {
+                        int th = ih + padding_top - fi;
+                        if(th < 0 || th % stride_r != 0 || th / stride_r >= out_rows) {
+                            continue;
+                        }
+                        for(int fj = 0; fj < filter_width; fj++) {
+                            int tw = iw + padding_left - fj;
+                            if(tw < 0 || tw % stride_c != 0 || tw / stride_c >= out_cols) {
+                                continue;
+                            }
+
+                            const T *dout_px = dout_data + ((b*out_rows + th/stride_r)*out_cols + tw/stride_c)*out_channels;
+                            const T *w = filter_data + (c*filter_height + fi)*filter_width + fj;
+                            for(int oc = 0; oc < out_channels; oc++) {
+                                sum += dout_px[oc] * w[oc*in_channels*filter_height*filter_width];
+                            }
+                        }
+                    }
+                    din_data[((b*in_rows + ih)*in_cols + iw)*in_channels + c] = sum;
+                }
+            }
+        }
+    }
+}
 
 //TODO stride 2D?
 template <class T>
-void acc_convolution2D(const Tensor4D<T> &input, const Tensor4D<T> &filters, Tensor4D<T> *output, const vector<int> &stride) { 
+void acc_convolution2D(const Tensor4D<T> &input, const Tensor4D<T> &filters, Tensor4D<T> *output, const vector<int> &stride, const vector<int> &padding, const Neural::Kernels::Epilogue<T> &epilogue) { 
     Shape4D in_shape = input.shape(), filter_shape = filters.shape(), out_shape = output->shape();
 
     int batch = in_shape[0];
@@ -396,6 +713,7 @@ void acc_convolution2D(const Tensor4D<T> &input, const Tensor4D<T> &filters, Ten
     
     int filter_height = filter_shape[2], filter_width = filter_shape[3];
     int stride_r = stride[0], stride_c = stride[1];
+    int padding_top = padding[0], padding_left = padding[2];
     int out_channels = filter_shape[0];
     
     int out_cols = out_shape[3];
@@ -415,13 +733,24 @@ void acc_convolution2D(const Tensor4D<T> &input, const Tensor4D<T> &filters, Ten
     
     const T *in_data = input.data(), *filter_data = filters.data();
     T* out_data = output->data();
+    // per output channel bias, a missing one is a zero-length section
+    const T *bias_data = epilogue.row_bias;
+    int n_bias = bias_data ? out_channels : 0;
+    Neural::Kernels::Activation activation = epilogue.activation;
+    
+    if(input.layout() == Neural::Layout::nhwc) {
+        acc_convolution2D_nhwc(input, filters, output, stride, padding, epilogue);
+        return;
+    }
     
     #pragma acc data present(in_data[:(batch*in_cols*in_rows*in_channels)]) \
     present(filter_data[:in_channels*out_channels*filter_height*filter_width]) \
-    present(out_data[:(batch* out_channels * out_cols * out_rows)])
+    present(out_data[:(batch* out_channels * out_cols * out_rows)]) \
+    present(bias_data[:n_bias])
     {
         
     #pragma acc parallel loop collapse(4)
+    #pragma omp parallel for collapse(4) schedule(static)
     for(int i = 0 ; i < batch; i++) {
         for(int och = 0; och < out_channels; och++) {
             for(int oh = 0; oh < out_rows; oh++) {
@@ -438,18 +767,28 @@ void acc_convolution2D(const Tensor4D<T> &input, const Tensor4D<T> &filters, Ten
     //                         double csum = 0.0f;
                         for(int fi = 0; fi < filter_height; fi++) {
                             for(int fj = 0; fj < filter_width; fj++) {
+                                // position in the unpadded input, the padding border reads as zero
+                                int ih = oh*stride_r + fi - padding_top, iw = ow*stride_c + fj - padding_left;
+                                if(ih < 0 || ih >= in_rows || iw < 0 || iw >= in_cols) {
+                                    continue;
+                                }
+
                                 #ifndef _OPENACC
                                 IF_PLOG(plog::debug) {
-                                    cout << " + [" << in_data[ (i*in_channels + ich)*in_rows*in_cols + (oh*stride_r + fi)*in_cols + ow*stride_c + fj ] << " x " << filter_data[ (och*in_channels + ich)*filter_height*filter_width + fi*filter_width + fj ] << "]";
+                                    cout << " + [" << in_data[ (i*in_channels + ich)*in_rows*in_cols + ih*in_cols + iw ] << " x " << filter_data[ (och*in_channels + ich)*filter_height*filter_width + fi*filter_width + fj ] << "]";
                                 }
                                 #endif
                                 
-                                bdhwsum += in_data[ (i*in_channels + ich)*in_rows*in_cols + (oh*stride_r + fi)*in_cols + ow*stride_c + fj ] * filter_data[ (och*in_channels + ich)*filter_height*filter_width + fi*filter_width + fj ];
+                                bdhwsum += in_data[ (i*in_channels + ich)*in_rows*in_cols + ih*in_cols + iw ] * filter_data[ (och*in_channels + ich)*filter_height*filter_width + fi*filter_width + fj ];
                             }
                         }
     //                         sum += csum;
                     }
                     
+                    if(n_bias) {
+                        bdhwsum += bias_data[och];
+                    }
+                    bdhwsum = Neural::Kernels::activate(bdhwsum, activation);
                     out_data[(i*out_channels + och)*out_cols*out_rows + oh*out_cols + ow] = bdhwsum;
                     #ifndef _OPENACC
                     IF_PLOG(plog::debug) {
@@ -465,7 +804,98 @@ void acc_convolution2D(const Tensor4D<T> &input, const Tensor4D<T> &filters, Ten
     
 }
 
-template void acc_convolution2D(const Tensor4D<double> &input, const Tensor4D<double> &filters, Tensor4D<double> *output, const vector<int> &stride);
+template void acc_convolution2D(const Tensor4D<double> &input, const Tensor4D<double> &filters, Tensor4D<double> *output, const vector<int> &stride, const vector<int> &padding, const Neural::Kernels::Epilogue<double> &epilogue);
+template void acc_convolution2D(const Tensor4D<float> &input, const Tensor4D<float> &filters, Tensor4D<float> *output, const vector<int> &stride, const vector<int> &padding, const Neural::Kernels::Epilogue<float> &epilogue);
+
+template <class T>
+void acc_convolution2D_wgrad(const Tensor4D<T> &input, const Tensor4D<T> &drv_error_output, Tensor4D<T> *drv_error_filters, Tensor4D<T> *drv_error_biases, const vector<int> &stride, const vector<int> &padding, T scale) {
+    Shape4D in_shape = input.shape(), out_shape = drv_error_output.shape(), filter_shape = drv_error_filters->shape();
+
+    int batch = in_shape[0], in_channels = in_shape[1], in_rows = in_shape[2], in_cols = in_shape[3];
+    int out_channels = out_shape[1], out_rows = out_shape[2], out_cols = out_shape[3];
+    int filter_height = filter_shape[2], filter_width = filter_shape[3];
+    int stride_r = stride[0], stride_c = stride[1], padding_top = padding[0], padding_left = padding[2];
+
+    if(in_channels != filter_shape[1]) {
+        throw(std::invalid_argument("Error: input channels != filter_shape[1]"));
+    }
+
+    if(out_channels != filter_shape[0] || out_channels != drv_error_biases->shape()[1]) {
+        throw(std::invalid_argument("Error: output channels != filter_shape[0] or biases_shape[1]"));
+    }
+
+    if(batch != out_shape[0]) {
+        throw(std::invalid_argument("Error: batch != output_shape[0]"));
+    }
+
+    if(input.layout() == Neural::Layout::nhwc) {
+        acc_convolution2D_wgrad_nhwc(input, drv_error_output, drv_error_filters, drv_error_biases, stride, padding, scale);
+        return;
+    }
+
+    const T *in_data = input.data(), *dout_data = drv_error_output.data();
+    T *dw_data = drv_error_filters->data(), *db_data = drv_error_biases->data();
+
+    if(Neural::get_device_type() != Neural::device_type_gpu) {
+        Neural::Kernels::host_kernels<T>().conv_wgrad(in_data, dout_data, dw_data, db_data, batch, in_channels, in_rows, in_cols, out_channels, out_rows, out_cols, filter_height, filter_width, stride_r, stride_c, padding_top, padding_left, scale);
+        return;
+    }
+
+    #pragma acc parallel loop gang present(in_data[:(batch*in_channels*in_rows*in_cols)], dout_data[:(batch*out_channels*out_rows*out_cols)]) \
+    present(dw_data[:(out_channels*in_channels*filter_height*filter_width)], db_data[:out_channels])
+    for(int oc = 0; oc < out_channels; oc++) {
+        conv_wgrad_channel(oc, in_data, dout_data, dw_data, db_data, batch, in_channels, in_rows, in_cols, out_channels, out_rows, out_cols, filter_height, filter_width, stride_r, stride_c, padding_top, padding_left, scale);
+    }
+}
+
+template void acc_convolution2D_wgrad(const Tensor4D<double> &input, const Tensor4D<double> &drv_error_output, Tensor4D<double> *drv_error_filters, Tensor4D<double> *drv_error_biases, const vector<int> &stride, const vector<int> &padding, double scale);
+template void acc_convolution2D_wgrad(const Tensor4D<float> &input, const Tensor4D<float> &drv_error_output, Tensor4D<float> *drv_error_filters, Tensor4D<float> *drv_error_biases, const vector<int> &stride, const vector<int> &padding, float scale);
+
+template <class T>
+void acc_convolution2D_dgrad(const Tensor4D<T> &drv_error_output, const Tensor4D<T> &filters, Tensor4D<T> *drv_error_input, const vector<int> &stride, const vector<int> &padding) {
+    Shape4D out_shape = drv_error_output.shape(), filter_shape = filters.shape(), in_shape = drv_error_input->shape();
+
+    int batch = in_shape[0], in_channels = in_shape[1], in_rows = in_shape[2], in_cols = in_shape[3];
+    int out_channels = out_shape[1], out_rows = out_shape[2], out_cols = out_shape[3];
+    int filter_height = filter_shape[2], filter_width = filter_shape[3];
+    int stride_r = stride[0], stride_c = stride[1], padding_top = padding[0], padding_left = padding[2];
+
+    if(in_channels != filter_shape[1]) {
+        throw(std::invalid_argument("Error: input channels != filter_shape[1]"));
+    }
+
+    if(out_channels != filter_shape[0]) {
+        throw(std::invalid_argument("Error: output channels != filter_shape[0]"));
+    }
+
+    if(batch != out_shape[0]) {
+        throw(std::invalid_argument("Error: batch != output_shape[0]"));
+    }
+
+    if(drv_error_output.layout() == Neural::Layout::nhwc) {
+        acc_convolution2D_dgrad_nhwc(drv_error_output, filters, drv_error_input, stride, padding);
+        return;
+    }
+
+    const T *dout_data = drv_error_output.data(), *filter_data = filters.data();
+    T *din_data = drv_error_input->data();
+
+    if(Neural::get_device_type() != Neural::device_type_gpu) {
+        Neural::Kernels::host_kernels<T>().conv_dgrad(dout_data, filter_data, din_data, batch, in_channels, in_rows, in_cols, out_channels, out_rows, out_cols, filter_height, filter_width, stride_r, stride_c, padding_top, padding_left);
+        return;
+    }
+
+    #pragma acc parallel loop gang collapse(2) present(dout_data[:(batch*out_channels*out_rows*out_cols)], filter_data[:(out_channels*in_channels*filter_height*filter_width)]) \
+    present(din_data[:(batch*in_channels*in_rows*in_cols)])
+    for(int b = 0; b < batch; b++) {
+        for(int c = 0; c < in_channels; c++) {
+            conv_dgrad_plane(b, c, dout_data, filter_data, din_data, in_channels, in_rows, in_cols, out_channels, out_rows, out_cols, filter_height, filter_width, stride_r, stride_c, padding_top, padding_left);
+        }
+    }
+}
+
+template void acc_convolution2D_dgrad(const Tensor4D<double> &drv_error_output, const Tensor4D<double> &filters, Tensor4D<double> *drv_error_input, const vector<int> &stride, const vector<int> &padding);
+template void acc_convolution2D_dgrad(const Tensor4D<float> &drv_error_output, const Tensor4D<float> &filters, Tensor4D<float> *drv_error_input, const vector<int> &stride, const vector<int> &padding);
 
 void tparallel_conv5(double *conv_input, double *conv_filters, double *conv_output, int batch_size, int in_channels, int in_height, int in_width, int out_channels , int out_height, int out_width, int filter_size, int stride, bool debug) { 
     
@@ -474,6 +904,7 @@ void tparallel_conv5(double *conv_input, double *conv_filters, double *conv_outp
     {
         
     #pragma acc parallel loop collapse(4)
+    #pragma omp parallel for collapse(4) schedule(static)
     for(int i = 0; i < batch_size; i++) {
         for(int d = 0; d < out_channels; d++) {
             for(int oh = 0; oh < out_height; oh++) {
@@ -508,6 +939,11 @@ void acc_relu(const Tensor4D<T> &input, Tensor4D<T> *output) {
     
     const T *in_data = input.data();
     T *out_data = output->data();
+
+    if(Neural::get_device_type() != Neural::device_type_gpu) {
+        Neural::Kernels::host_kernels<T>().relu(size, in_data, out_data);
+        return;
+    }
     
     #pragma acc data present(in_data[:size]) present(out_data[:size])
     {
@@ -526,6 +962,7 @@ void acc_relu(const Tensor4D<T> &input, Tensor4D<T> *output) {
 }
 
 template void acc_relu(const Tensor4D<double> &input, Tensor4D<double> *output);
+template void acc_relu(const Tensor4D<float> &input, Tensor4D<float> *output);
 
 template<class T>
 void acc_relu_backprop(const Tensor4D<T> &drv_error_output, const Tensor4D<T> &output, Tensor4D<T> *drv_error_output_preact) {
@@ -539,6 +976,11 @@ void acc_relu_backprop(const Tensor4D<T> &drv_error_output, const Tensor4D<T> &o
     
     const T *drv_error_output_data = drv_error_output.data(), *output_data = output.data();
     T *drv_error_output_preact_data = drv_error_output_preact->data();
+
+    if(Neural::get_device_type() != Neural::device_type_gpu) {
+        Neural::Kernels::host_kernels<T>().relu_backprop(B*M, drv_error_output_data, output_data, drv_error_output_preact_data);
+        return;
+    }
     
     #pragma acc parallel loop collapse(2) present(drv_error_output_data[:B*M]) present(output_data[:B*M]) present(drv_error_output_preact_data[:B*M])
     for(int i = 0; i < B; i++) {
@@ -555,6 +997,7 @@ void acc_relu_backprop(const Tensor4D<T> &drv_error_output, const Tensor4D<T> &o
 }
 
 template void acc_relu_backprop(const Tensor4D<double> &drv_error_output, const Tensor4D<double> &output, Tensor4D<double> *drv_error_output_preact);
+template void acc_relu_backprop(const Tensor4D<float> &drv_error_output, const Tensor4D<float> &output, Tensor4D<float> *drv_error_output_preact);
 
 
 template <class T>
@@ -564,6 +1007,11 @@ void acc_sigmoid(const Tensor4D<T> &input, Tensor4D<T> *output) {
     const T *in_data = input.data();
     T *out_data = output->data();
     
+    if(Neural::get_device_type() != Neural::device_type_gpu) {
+        Neural::Math::vsigmoid(size, in_data, out_data);
+        return;
+    }
+    
     #pragma acc data present(in_data[:size]) present(out_data[:size])
     {
     #pragma acc parallel loop
@@ -576,6 +1024,7 @@ void acc_sigmoid(const Tensor4D<T> &input, Tensor4D<T> *output) {
 }
 
 template void acc_sigmoid(const Tensor4D<double> &input, Tensor4D<double> *output);
+template void acc_sigmoid(const Tensor4D<float> &input, Tensor4D<float> *output);
 
 
 //TODO template with constexpr for any non-softmax activations
@@ -594,6 +1043,7 @@ void acc_sigmoid_backprop(const Tensor4D<T> &drv_error_output, const Tensor4D<T>
     T *drv_error_output_preact_data = drv_error_output_preact->data();
     
     #pragma acc parallel loop collapse(2) present(drv_error_output_data[:B*M]) present(output_data[:B*M]) present(drv_error_output_preact_data[:B*M])
+    #pragma omp parallel for collapse(2) schedule(static)
     for(int i = 0; i < B; i++) {
         for(int j = 0; j < M; j++) {
             double output_m = output_data[i*M + j];
@@ -603,6 +1053,7 @@ void acc_sigmoid_backprop(const Tensor4D<T> &drv_error_output, const Tensor4D<T>
 }
 
 template void acc_sigmoid_backprop(const Tensor4D<double> &drv_error_output, const Tensor4D<double> &output, Tensor4D<double> *drv_error_output_preact);
+template void acc_sigmoid_backprop(const Tensor4D<float> &drv_error_output, const Tensor4D<float> &output, Tensor4D<float> *drv_error_output_preact);
 
 template <class T>
 void acc_softmax(const Tensor4D<T> &input, Tensor4D<T> *output) {
@@ -613,24 +1064,53 @@ void acc_softmax(const Tensor4D<T> &input, Tensor4D<T> *output) {
     
     const T *in_data = input.data();
     T *out_data = output->data();
+
+    // host: shift every row by its max, one vector exp over the whole batch, then normalize
+    if(Neural::get_device_type() != Neural::device_type_gpu) {
+        #pragma omp parallel for schedule(static)
+        for(int i = 0; i < B; i++) {
+            T inmaxi = *std::max_element(in_data + i*M, in_data + (i + 1)*M);
+            for(int j = 0; j < M; j++) {
+                out_data[i*M + j] = in_data[i*M + j] - inmaxi;
+            }
+        }
+
+        Neural::Math::vexp(size, out_data, out_data);
+
+        #pragma omp parallel for schedule(static)
+        for(int i = 0; i < B; i++) {
+            T outsumi = 0.0f;
+            for(int j = 0; j < M; j++) {
+                outsumi += out_data[i*M + j];
+            }
+            for(int j = 0; j < M; j++) {
+                out_data[i*M + j] /= outsumi;
+            }
+        }
+        return;
+    }
         
-    #pragma acc data copyin(in_data[:size]) copyout(out_data[:size])
+    #pragma acc data present(in_data[:size]) present(out_data[:size])
     {
     
+    // exp of the logits less their row max, so the largest term is exp(0) and nothing overflows
     #pragma acc parallel loop
     for(int i = 0; i < B; i++) {
+        T inmaxi = in_data[i*M];
         T outsumi = 0.0f;
 
-        #pragma acc loop
-        for(int j = 0; j < M; j++) {
-            out_data[i*M + j] = exp(in_data[i*M + j]);
+        #pragma acc loop reduction(max:inmaxi)
+        for(int j = 1; j < M; j++) {
+            inmaxi = fmax(inmaxi, in_data[i*M + j]);
         }
 
         #pragma acc loop reduction(+:outsumi)
         for(int j = 0; j < M; j++) {
-            outsumi += out_data[i*M + j];
-            
+            T val = exp(in_data[i*M + j] - inmaxi);
+            out_data[i*M + j] = val;
+            outsumi += val;
         }
+
         #pragma acc loop
         for(int j = 0; j < M; j++) {
             out_data[i*M + j] /= outsumi;
@@ -641,8 +1121,102 @@ void acc_softmax(const Tensor4D<T> &input, Tensor4D<T> *output) {
 }
 
 template void acc_softmax(const Tensor4D<double> &input, Tensor4D<double> *output);
+template void acc_softmax(const Tensor4D<float> &input, Tensor4D<float> *output);
+
+template<class T>
+T acc_softmax_cross_entropy(const Tensor4D<T> &logits, const Tensor4D<int> &labels, Tensor4D<T> *output, Tensor4D<T> *drv_error_logits) {
+    Shape4D data_shape = logits.shape().flat(1);
+    int size = data_shape.size();
+    int B = data_shape[0];
+    int M = data_shape[1];
+
+    assert(labels.shape() == logits.shape());
+    assert(output->shape() == logits.shape());
+    assert(drv_error_logits->shape() == logits.shape());
+
+    const T *z_data = logits.data();
+    const int *labels_data = labels.data();
+    T *out_data = output->data(), *drv_data = drv_error_logits->data();
+    T loss_value = 0.0f;
+
+    // host: as acc_softmax, with the row maxima and sums kept for the log-sum-exp
+    if(Neural::get_device_type() != Neural::device_type_gpu) {
+        vector<T> zmax(B), expsum(B), lse(B);
+
+        #pragma omp parallel for schedule(static)
+        for(int i = 0; i < B; i++) {
+            zmax[i] = *std::max_element(z_data + i*M, z_data + (i + 1)*M);
+            for(int j = 0; j < M; j++) {
+                out_data[i*M + j] = z_data[i*M + j] - zmax[i];
+            }
+        }
+
+        Neural::Math::vexp(size, out_data, out_data);
+
+        #pragma omp parallel for schedule(static)
+        for(int i = 0; i < B; i++) {
+            T expsumi = 0.0f;
+            for(int j = 0; j < M; j++) {
+                expsumi += out_data[i*M + j];
+            }
+            expsum[i] = expsumi;
+        }
+
+        Neural::Math::vlog(B, expsum.data(), lse.data());
+
+        #pragma omp parallel for reduction(+:loss_value) schedule(static)
+        for(int i = 0; i < B; i++) {
+            T lsei = zmax[i] + lse[i];
+            for(int j = 0; j < M; j++) {
+                T lbl = (T)labels_data[i*M + j];
+                T p = out_data[i*M + j] / expsum[i];
+                out_data[i*M + j] = p;
+                drv_data[i*M + j] = p - lbl;
+                loss_value += lbl * (lsei - z_data[i*M + j]);
+            }
+        }
+
+        return loss_value / B;
+    }
+
+    // per row: log(sum_k exp(z_k)) = zmax + log(sum_k exp(z_k - zmax)), loss = sum_j y_j * (lse - z_j),
+    // softmax = exp(z_j - zmax) / sum and the gradient is softmax - y
+    #pragma acc parallel loop reduction(+:loss_value) present(z_data[:size], labels_data[:size], out_data[:size], drv_data[:size])
+    for(int i = 0; i < B; i++) {
+        T zmaxi = z_data[i*M];
+        T expsumi = 0.0f, lossi = 0.0f;
+
+        #pragma acc loop reduction(max:zmaxi)
+        for(int j = 1; j < M; j++) {
+            zmaxi = fmax(zmaxi, z_data[i*M + j]);
+        }
+
+        #pragma acc loop reduction(+:expsumi)
+        for(int j = 0; j < M; j++) {
+            T val = exp(z_data[i*M + j] - zmaxi);
+            out_data[i*M + j] = val;
+            expsumi += val;
+        }
+
+        T lsei = zmaxi + log(expsumi);
+
+        #pragma acc loop reduction(+:lossi)
+        for(int j = 0; j < M; j++) {
+            T lbl = (T)labels_data[i*M + j];
+            T p = out_data[i*M + j] / expsumi;
+            out_data[i*M + j] = p;
+            drv_data[i*M + j] = p - lbl;
+            lossi += lbl * (lsei - z_data[i*M + j]);
+        }
 
+        loss_value += lossi;
+    }
+
+    return loss_value / B;
+}
 
+template double acc_softmax_cross_entropy(const Tensor4D<double> &logits, const Tensor4D<int> &labels, Tensor4D<double> *output, Tensor4D<double> *drv_error_logits);
+template float acc_softmax_cross_entropy(const Tensor4D<float> &logits, const Tensor4D<int> &labels, Tensor4D<float> *output, Tensor4D<float> *drv_error_logits);
 
 template<class T>
 void acc_softmax_backprop(const Tensor4D<T> &drv_error_output, const Tensor4D<T> &output, Tensor4D<T> *drv_error_output_preact) {
@@ -657,40 +1231,27 @@ void acc_softmax_backprop(const Tensor4D<T> &drv_error_output, const Tensor4D<T>
     const T *drv_error_output_data = drv_error_output.data(), *output_data = output.data();
     T *drv_error_output_preact_data = drv_error_output_preact->data();
     
-    #pragma acc parallel loop collapse(2) present(drv_error_output_data[:B*M]) present(output_data[:B*M]) present(drv_error_output_preact_data[:B*M])
+    // vector-Jacobian product with J = diag(y) - y y^T: dz_j = y_j * (dy_j - sum_k dy_k y_k), O(M) per row
+    #pragma acc parallel loop present(drv_error_output_data[:B*M]) present(output_data[:B*M]) present(drv_error_output_preact_data[:B*M])
+    #pragma omp parallel for schedule(static)
     for(int i = 0; i < B; i++) {
+        T doti = 0.0f;
+
+        #pragma acc loop reduction(+:doti)
+        for(int k = 0; k < M; k++) {
+            doti += drv_error_output_data[i*M + k] * output_data[i*M + k];
+        }
+
+        #pragma acc loop
         for(int j = 0; j < M; j++) {
-            double drv_error_output_preact_j = 0.0f;
-            double output_j = output_data[i*M + j];
-            
-            #pragma acc loop reduction(+:drv_error_output_preact_j)
-            for(int k = 0; k < M; k++) {
-                double drv_output_k_preact_j;
-                double drv_error_output_k;
-                
-                #pragma acc atomic read
-                drv_error_output_k = drv_error_output_data[i*M + k];
-                
-                if(k==j) {
-                    drv_output_k_preact_j = (output_j)*(1 - output_j);
-                }
-                else {
-                    double output_k;
-                    #pragma acc atomic read
-                    output_k = output_data[i*M + k];
-                    drv_output_k_preact_j = -1.0f * output_j * output_k;
-                }
-                
-                drv_error_output_preact_j += drv_error_output_k * drv_output_k_preact_j;
-            }
-            
-            drv_error_output_preact_data[i*M + j] = drv_error_output_preact_j;
+            drv_error_output_preact_data[i*M + j] = output_data[i*M + j] * (drv_error_output_data[i*M + j] - doti);
         }
     }
     
 }
 
 template void acc_softmax_backprop(const Tensor4D<double> &drv_error_output, const Tensor4D<double> &output, Tensor4D<double> *drv_error_output_preact);
+template void acc_softmax_backprop(const Tensor4D<float> &drv_error_output, const Tensor4D<float> &output, Tensor4D<float> *drv_error_output_preact);
 
 
 
@@ -708,6 +1269,33 @@ void acc_pad2D_inner(const Tensor4D<T> &pre_pad, Tensor4D<T> *post_pad, int padd
 
     const T *pre_pad_data = pre_pad.data();
     T *post_pad_data = post_pad->data();
+
+    if(pre_pad.layout() == Neural::Layout::nhwc) {
+        // channels-last rows are M pixels of C channels: without inner columns a row is one plane row of M*C
+        if(Neural::get_device_type() != Neural::device_type_gpu && padding_inner_columns == 0) {
+            Neural::Kernels::host_kernels<T>().pad2D(pre_pad_data, post_pad_data, B, N, M*C, padded_N, padded_M*C, padding_top, padding_left*C, padding_inner_rows, 0);
+            return;
+        }
+
+        acc_zeros(post_pad);
+        #pragma acc parallel loop collapse(4) present(pre_pad_data[:(B*N*M*C)], post_pad_data[:(B*padded_N*padded_M*C)])
+        #pragma omp parallel for collapse(2) schedule(static)
+        for(int b = 0; b < B; b++) {
+            for(int i = 0; i < N; i++) {
+                for(int j = 0; j < M; j++) {
+                    for(int c = 0; c < C; c++) {
+                        post_pad_data[((b*padded_N + i + padding_top + i*padding_inner_rows)*padded_M + j + padding_left + j*padding_inner_columns)*C + c] = pre_pad_data[((b*N + i)*M + j)*C + c];
+                    }
+                }
+            }
+        }
+        return;
+    }
+
+    if(Neural::get_device_type() != Neural::device_type_gpu) {
+        Neural::Kernels::host_kernels<T>().pad2D(pre_pad_data, post_pad_data, B*C, N, M, padded_N, padded_M, padding_top, padding_left, padding_inner_rows, padding_inner_columns);
+        return;
+    }
     
     LOGV << ("Entering loop collapse(4)");
     #pragma acc data present(pre_pad_data[:(B*C*M*N)], post_pad_data[:(B*C*padded_N*padded_M)])
@@ -740,6 +1328,7 @@ void acc_pad2D_inner(const Tensor4D<T> &pre_pad, Tensor4D<T> *post_pad, int padd
 }
 
 template void acc_pad2D_inner(const Tensor4D<double> &pre_pad, Tensor4D<double> *post_pad, int padding_top, int padding_bottom, int padding_left, int padding_right, int padding_inner_rows, int padding_inner_columns);
+template void acc_pad2D_inner(const Tensor4D<float> &pre_pad, Tensor4D<float> *post_pad, int padding_top, int padding_bottom, int padding_left, int padding_right, int padding_inner_rows, int padding_inner_columns);
 
 
 template <class T>
@@ -748,6 +1337,7 @@ void acc_pad2D(const Tensor4D<T> &pre_pad, Tensor4D<T> *post_pad, int padding_to
 }
 
 template void acc_pad2D(const Tensor4D<double> &pre_pad, Tensor4D<double> *post_pad, int padding_top, int padding_bottom, int padding_left, int padding_right);
+template void acc_pad2D(const Tensor4D<float> &pre_pad, Tensor4D<float> *post_pad, int padding_top, int padding_bottom, int padding_left, int padding_right);
 
 
 template <class T>
@@ -756,6 +1346,7 @@ Tensor4D<T>* acc_padded2D_inner(const Tensor4D<T> &pre_pad, int padding_top, int
     int B = pre_pad_shape[0], C = pre_pad_shape[1], N = pre_pad_shape[2], M = pre_pad_shape[3];
     
     Tensor4D<T> *ret = new Tensor4D<T>(B, C, N + padding_top + padding_bottom + (N-1)*padding_inner_rows, M + padding_left + padding_right + (M-1)*padding_inner_columns);
+    ret->set_layout(pre_pad.layout());
     ret->create_acc();
     LOGV << ("acc_pad2D_inner(pre_pad, ret, padding_top, padding_bottom, padding_left, padding_right, padding_inner_rows, padding_inner_columns)");
     
@@ -765,6 +1356,7 @@ Tensor4D<T>* acc_padded2D_inner(const Tensor4D<T> &pre_pad, int padding_top, int
 }
 
 template Tensor4D<double>* acc_padded2D_inner(const Tensor4D<double> &pre_pad, int padding_top, int padding_bottom, int padding_left, int padding_right, int padding_inner_rows, int padding_inner_columns);
+template Tensor4D<float>* acc_padded2D_inner(const Tensor4D<float> &pre_pad, int padding_top, int padding_bottom, int padding_left, int padding_right, int padding_inner_rows, int padding_inner_columns);
 
 
 template <class T>
@@ -780,6 +1372,28 @@ void acc_rev_pad2D(const Tensor4D<T> &post_pad, Tensor4D<T> *pre_pad, int paddin
 
     const T *post_pad_data = post_pad.data();
     T *pre_pad_data = pre_pad->data();
+
+    if(post_pad.layout() == Neural::Layout::nhwc) {
+        if(Neural::get_device_type() != Neural::device_type_gpu) {
+            Neural::Kernels::host_kernels<T>().crop2D(post_pad_data, pre_pad_data, B, N, M*C, padded_N, padded_M*C, padding_top, padding_left*C);
+            return;
+        }
+
+        #pragma acc parallel loop collapse(3) present(pre_pad_data[:(B*N*M*C)], post_pad_data[:(B*padded_N*padded_M*C)])
+        for(int b = 0; b < B; b++) {
+            for(int i = 0; i < N; i++) {
+                for(int k = 0; k < M*C; k++) {
+                    pre_pad_data[(b*N + i)*M*C + k] = post_pad_data[(b*padded_N + i + padding_top)*padded_M*C + padding_left*C + k];
+                }
+            }
+        }
+        return;
+    }
+
+    if(Neural::get_device_type() != Neural::device_type_gpu) {
+        Neural::Kernels::host_kernels<T>().crop2D(post_pad_data, pre_pad_data, B*C, N, M, padded_N, padded_M, padding_top, padding_left);
+        return;
+    }
     
     #pragma acc data present(pre_pad_data[:(B*C*M*N)], post_pad_data[:(B*C*padded_N*padded_M)])
     {
@@ -799,6 +1413,7 @@ void acc_rev_pad2D(const Tensor4D<T> &post_pad, Tensor4D<T> *pre_pad, int paddin
 }
 
 template void acc_rev_pad2D(const Tensor4D<double> &post_pad, Tensor4D<double> *pre_pad, int padding_top, int padding_bottom, int padding_left, int padding_right);
+template void acc_rev_pad2D(const Tensor4D<float> &post_pad, Tensor4D<float> *pre_pad, int padding_top, int padding_bottom, int padding_left, int padding_right);
 
 template<class T>
 void acc_normalize_img(Tensor4D<T> *output) {
@@ -812,6 +1427,7 @@ void acc_normalize_img(Tensor4D<T> *output) {
     #pragma acc data present(out_data[:B*input_size])
     {
     #pragma acc parallel loop collapse(2)
+    #pragma omp parallel for collapse(2) schedule(static)
     for(int i = 0; i < B; i++) {
         for(int k = 0; k < input_size; k++) {
             //bring values to [-0.5, 0.5]
@@ -823,6 +1439,30 @@ void acc_normalize_img(Tensor4D<T> *output) {
 }
 
 template void acc_normalize_img(Tensor4D<double> *output);
+template void acc_normalize_img(Tensor4D<float> *output);
+
+// out-of-place variant, copies a batch window and normalizes it in one pass, converting uint8 pixels on the way
+template<class S, class T>
+void acc_normalize_img(const Tensor4D<S> &input, Tensor4D<T> *output) {
+    assert(input.shape() == output->shape());
+    
+    int size = output->size();
+    
+    const S *in_data = input.data();
+    T *out_data = output->data();
+    
+    #pragma acc parallel loop present(in_data[:size], out_data[:size])
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < size; i++) {
+        //bring values to [-0.5, 0.5]
+        out_data[i] = ((T)in_data[i] - 255.0f/2)/255.0f;
+    }
+}
+
+template void acc_normalize_img(const Tensor4D<double> &input, Tensor4D<double> *output);
+template void acc_normalize_img(const Tensor4D<float> &input, Tensor4D<float> *output);
+template void acc_normalize_img(const Tensor4D<uint8_t> &input, Tensor4D<double> *output);
+template void acc_normalize_img(const Tensor4D<uint8_t> &input, Tensor4D<float> *output);
 
 template<class T>
 void acc_make_batch(const Neural::Tensor4D<T> &inputs, Neural::Tensor4D<T> *batch, int batch_start) {
@@ -839,6 +1479,7 @@ void acc_make_batch(const Neural::Tensor4D<T> &inputs, Neural::Tensor4D<T> *batc
     #pragma acc data copyin(inputs_data[(batch_start*input_size):(batch_size*input_size)]) present(batch_data[:(batch_size*input_size)])
     {
     #pragma acc parallel loop collapse(2)
+    #pragma omp parallel for collapse(2) schedule(static)
     for(int i = 0; i < batch_size; i++) {
         for(int k = 0; k < input_size; k++) {
             batch_data[i*input_size + k] = inputs_data[(i+batch_start)*input_size + k];
@@ -851,6 +1492,7 @@ void acc_make_batch(const Neural::Tensor4D<T> &inputs, Neural::Tensor4D<T> *batc
 //comment 2
 
 template void acc_make_batch<double>(const Neural::Tensor4D<double> &, Neural::Tensor4D<double> *, int);
+template void acc_make_batch<float>(const Neural::Tensor4D<float> &, Neural::Tensor4D<float> *, int);
 template void acc_make_batch<int>(const Neural::Tensor4D<int> &, Neural::Tensor4D<int> *, int);
 
 template<class T>
@@ -882,6 +1524,7 @@ Tensor4D<int> * acc_calc_confusion_matrix(Tensor4D<T> &output, Tensor4D<int> &la
     int psize = predicted->size();
 
     #pragma acc parallel loop present(output_data[:B*M], labels_data[:B*M]) copy(conf_data[:M*4]) copy(predicted_data[:psize])
+    #pragma omp parallel for schedule(static)
     for(int i = 0; i < B; i++) {
         int predicted_idx = 0, actual_idx = 0;
         T max_pred = 0.0f;
@@ -912,21 +1555,25 @@ Tensor4D<int> * acc_calc_confusion_matrix(Tensor4D<T> &output, Tensor4D<int> &la
             if( (predicted_idx==j) && (j==actual_idx) ) {
                 //true positive
                 #pragma acc atomic update
+                #pragma omp atomic update
                 conf_data[j*4 + 0]++;
             }
             else if( (predicted_idx!=j) && (j==actual_idx) ) {
                 //false negative
                 #pragma acc atomic update
+                #pragma omp atomic update
                 conf_data[j*4 + 1]++;
             }
             else if( (predicted_idx==j) && (j!=actual_idx) ) {
                 //false positive
                 #pragma acc atomic update
+                #pragma omp atomic update
                 conf_data[j*4 + 2]++;
             }
             else if( (predicted_idx!=j) && (j!=actual_idx) ) {
                 //true negative
                 #pragma acc atomic update
+                #pragma omp atomic update
                 conf_data[j*4 + 3]++;
             }
         }
@@ -940,6 +1587,7 @@ Tensor4D<int> * acc_calc_confusion_matrix(Tensor4D<T> &output, Tensor4D<int> &la
 }
 
 template Tensor4D<int> * acc_calc_confusion_matrix<double>(Tensor4D<double> &, Tensor4D<int> &);
+template Tensor4D<int> * acc_calc_confusion_matrix<float>(Tensor4D<float> &, Tensor4D<int> &);
 
 vector<Tensor4D<double> *> calc_metrics(Tensor4D<int> &confusion_matrix) {
     int M = confusion_matrix.shape()[0];
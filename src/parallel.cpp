@@ -0,0 +1,185 @@
+#include "parallel.hpp"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdlib>
+#include <condition_variable>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace {
+    thread_local bool is_worker = false;
+
+    class WorkerPool {
+        vector<thread> workers;
+        mutex mtx;
+        condition_variable cv_job, cv_done;
+
+        // current job, workers pick indices from next until n is reached.
+        // The job fields only change under mtx while no worker is active.
+        const function<void(int)> *job_fn{nullptr};
+        int job_n{0};
+        atomic<int> next{0}, pending{0};
+        int active{0};
+        long generation{0};
+        bool stopping{false};
+
+        void work() {
+            int i;
+            while((i = next.fetch_add(1)) < job_n) {
+                (*job_fn)(i);
+                if(pending.fetch_sub(1) == 1) {
+                    lock_guard<mutex> lock(mtx);
+                    cv_done.notify_all();
+                }
+            }
+        }
+
+        void worker_loop() {
+            is_worker = true;
+            long seen = 0;
+
+            while(true) {
+                {
+                    unique_lock<mutex> lock(mtx);
+                    cv_job.wait(lock, [&] { return stopping || generation != seen; });
+                    if(stopping) {
+                        return;
+                    }
+                    seen = generation;
+                    active++;
+                }
+                work();
+                {
+                    lock_guard<mutex> lock(mtx);
+                    if(--active == 0) {
+                        cv_done.notify_all();
+                    }
+                }
+            }
+        }
+
+    public:
+        int size{1};
+        mutex run_mtx;
+
+        void start(int nthreads) {
+            stop();
+            size = nthreads < 1 ? 1 : nthreads;
+            stopping = false;
+#ifdef _OPENMP
+            // the omp loops of the acc_* ops run on as many threads as the pool
+            omp_set_num_threads(size);
+#endif
+
+            for(int t = 1; t < size; t++) {
+                workers.emplace_back(&WorkerPool::worker_loop, this);
+            }
+        }
+
+        void stop() {
+            {
+                lock_guard<mutex> lock(mtx);
+                stopping = true;
+            }
+            cv_job.notify_all();
+
+            for(auto &w: workers) {
+                w.join();
+            }
+            workers.clear();
+        }
+
+        void run(int n, const function<void(int)> &fn) {
+            {
+                // a worker woken late for the previous job may still be in work(): publishing now would let it
+                // compare a stale index against the new job_n
+                unique_lock<mutex> lock(mtx);
+                cv_done.wait(lock, [&] { return active == 0; });
+                job_fn = &fn;
+                job_n = n;
+                pending = n;
+                next = 0;
+                generation++;
+            }
+            cv_job.notify_all();
+
+            // the calling thread takes part as well
+            is_worker = true;
+            work();
+            is_worker = false;
+
+            unique_lock<mutex> lock(mtx);
+            cv_done.wait(lock, [&] { return pending.load() == 0 && active == 0; });
+            job_n = 0;
+        }
+
+        ~WorkerPool() {
+            stop();
+        }
+    };
+
+    int default_threads() {
+        const char *env = getenv("NEURAL_NUM_THREADS");
+        if(env && atoi(env) > 0) {
+            return atoi(env);
+        }
+
+        int hw = thread::hardware_concurrency();
+        return hw > 0 ? hw : 1;
+    }
+
+    WorkerPool &pool() {
+        static WorkerPool wpool;
+        static once_flag started;
+        call_once(started, [] { wpool.start(default_threads()); });
+        return wpool;
+    }
+}
+
+int Neural::Parallel::num_threads() {
+    return pool().size;
+}
+
+void Neural::Parallel::set_num_threads(int nthreads) {
+    WorkerPool &wpool = pool();
+    lock_guard<mutex> lock(wpool.run_mtx);
+    wpool.start(nthreads);
+}
+
+bool Neural::Parallel::in_parallel() {
+    return is_worker;
+}
+
+void Neural::Parallel::run(int n, const function<void(int)> &fn) {
+    if(n <= 0) {
+        return;
+    }
+
+    WorkerPool &wpool = pool();
+
+    if(n == 1 || is_worker || wpool.size == 1) {
+        for(int i = 0; i < n; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    lock_guard<mutex> lock(wpool.run_mtx);
+    wpool.run(n, fn);
+}
+
+void Neural::Parallel::run_outer(int n, const function<void(int)> &fn) {
+    if(n >= num_threads()) {
+        run(n, fn);
+        return;
+    }
+
+    for(int i = 0; i < n; i++) {
+        fn(i);
+    }
+}
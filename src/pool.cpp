@@ -0,0 +1,174 @@
+#include "pool.hpp"
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+
+using namespace std;
+
+namespace {
+    // per-thread buffers kept per size class before spilling to the shared lists
+    constexpr size_t thread_cache_depth = 4;
+
+    typedef unordered_map<size_t, vector<void *>> FreeLists;
+
+    struct SharedPool {
+        mutex mtx;
+        FreeLists free_lists;
+        atomic<size_t> hits{0}, misses{0}, bytes_held{0}, bytes_in_use{0};
+    };
+
+    // never destroyed, tensors with static storage can still release into it at exit
+    SharedPool &shared_pool() {
+        static SharedPool *pool = new SharedPool();
+        return *pool;
+    }
+
+    struct ThreadCache {
+        FreeLists free_lists;
+    };
+
+    thread_local ThreadCache *tcache = nullptr;
+
+    void free_all(FreeLists &lists) {
+        SharedPool &pool = shared_pool();
+
+        for(auto &it: lists) {
+            for(void *ptr: it.second) {
+                ::operator delete(ptr, align_val_t(Neural::Pool::alignment));
+                pool.bytes_held -= it.first;
+            }
+            it.second.clear();
+        }
+    }
+
+    // hands the thread cache back to the shared lists when the thread exits
+    struct ThreadCacheGuard {
+        ThreadCache cache;
+
+        ThreadCacheGuard() { tcache = &cache; }
+
+        ~ThreadCacheGuard() {
+            tcache = nullptr;
+            SharedPool &pool = shared_pool();
+            lock_guard<mutex> lock(pool.mtx);
+
+            for(auto &it: cache.free_lists) {
+                vector<void *> &shared = pool.free_lists[it.first];
+                shared.insert(shared.end(), it.second.begin(), it.second.end());
+            }
+        }
+    };
+
+    ThreadCache *thread_cache() {
+        thread_local ThreadCacheGuard guard;
+        return tcache;
+    }
+
+    // 4 size classes per power of two, 256 bytes minimum
+    size_t size_class(size_t bytes) {
+        if(bytes <= 256) {
+            return 256;
+        }
+
+        int e = 0;
+        while((size_t(1) << e) < bytes) {
+            e++;
+        }
+
+        size_t step = size_t(1) << (e - 3);
+        return ((bytes - 1) / step + 1) * step;
+    }
+}
+
+void *Neural::Pool::acquire(size_t bytes) {
+    if(bytes == 0) {
+        return nullptr;
+    }
+
+    SharedPool &pool = shared_pool();
+    size_t cls = size_class(bytes);
+    void *ptr = nullptr;
+
+    ThreadCache *cache = thread_cache();
+    if(cache) {
+        auto it = cache->free_lists.find(cls);
+        if(it != cache->free_lists.end() && !it->second.empty()) {
+            ptr = it->second.back();
+            it->second.pop_back();
+        }
+    }
+
+    if(!ptr) {
+        lock_guard<mutex> lock(pool.mtx);
+        auto it = pool.free_lists.find(cls);
+        if(it != pool.free_lists.end() && !it->second.empty()) {
+            ptr = it->second.back();
+            it->second.pop_back();
+        }
+    }
+
+    if(ptr) {
+        pool.hits++;
+        pool.bytes_held -= cls;
+    }
+    else {
+        pool.misses++;
+        ptr = ::operator new(cls, align_val_t(alignment));
+    }
+
+    pool.bytes_in_use += cls;
+    return ptr;
+}
+
+void Neural::Pool::release(void *ptr, size_t bytes) {
+    if(!ptr) {
+        return;
+    }
+
+    SharedPool &pool = shared_pool();
+    size_t cls = size_class(bytes);
+
+    pool.bytes_in_use -= cls;
+    pool.bytes_held += cls;
+
+    ThreadCache *cache = thread_cache();
+    if(cache) {
+        vector<void *> &local = cache->free_lists[cls];
+        if(local.size() < thread_cache_depth) {
+            local.push_back(ptr);
+            return;
+        }
+    }
+
+    lock_guard<mutex> lock(pool.mtx);
+    pool.free_lists[cls].push_back(ptr);
+}
+
+Neural::PoolStats Neural::Pool::stats() {
+    SharedPool &pool = shared_pool();
+    PoolStats ret;
+
+    ret.hits = pool.hits;
+    ret.misses = pool.misses;
+    ret.bytes_held = pool.bytes_held;
+    ret.bytes_in_use = pool.bytes_in_use;
+
+    return ret;
+}
+
+void Neural::Pool::trim() {
+    ThreadCache *cache = thread_cache();
+    if(cache) {
+        free_all(cache->free_lists);
+    }
+
+    SharedPool &pool = shared_pool();
+    lock_guard<mutex> lock(pool.mtx);
+    free_all(pool.free_lists);
+}
+
+string Neural::PoolStats::to_string() const {
+    return "PoolStats(hits=" + std::to_string(hits) + ", misses=" + std::to_string(misses) + ", bytes_held=" + std::to_string(bytes_held) + ", bytes_in_use=" + std::to_string(bytes_in_use) + ")";
+}
@@ -0,0 +1,324 @@
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <algorithm>
+#include "quantize.hpp"
+#include "layer.hpp"
+#include "ops.hpp"
+#include "parallel.hpp"
+#include "utils.hpp"
+
+using namespace std;
+using Neural::Tensor4D;
+using Neural::Shape4D;
+using Neural::Kernels::Activation;
+using Neural::Quantize::Int8Layer;
+using Neural::Quantize::Int8Network;
+using Neural::Quantize::Metrics;
+
+namespace {
+    // calibration batches, like the eval batches of Network::eval
+    constexpr int CALIBRATION_BATCH = 100;
+
+    int8_t quantize_value(double x, double scale_inv) {
+        double q = nearbyint(x * scale_inv);
+        return (int8_t)max(-127.0, min(127.0, q));
+    }
+
+    // max |x| / 127, 1 for an all-zero tensor
+    float symmetric_scale(double absmax) {
+        return (absmax > 0) ? (float)(absmax / 127.0) : 1.0f;
+    }
+
+    template<class T>
+    double absmax(Tensor4D<T> &tensor) {
+        tensor.update_self_acc();
+        const T *data = tensor.data();
+        double value = 0;
+        for(int i = 0; i < tensor.size(); i++) {
+            value = max(value, fabs((double)data[i]));
+        }
+        return value;
+    }
+
+    // the macro averages of Network::eval over the per-class metrics of the confusion matrix
+    Metrics macro_metrics(Tensor4D<int> &confusion_matrix) {
+        vector<Tensor4D<double> *> per_class = calc_metrics(confusion_matrix);
+        Metrics metrics;
+        int classes = per_class[0]->size();
+        for(int m = 0; m < classes; m++) {
+            metrics.precision += per_class[0]->iat(m);
+            metrics.recall += per_class[1]->iat(m);
+            metrics.accuracy += per_class[2]->iat(m);
+            metrics.f1_score += per_class[3]->iat(m);
+        }
+        metrics.precision /= classes;
+        metrics.recall /= classes;
+        metrics.accuracy /= classes;
+        metrics.f1_score /= classes;
+
+        for(auto it: per_class) {
+            delete it;
+        }
+        return metrics;
+    }
+}
+
+Int8Network::Int8Network(const Shape4D &in_sh_pr, vector<Int8Layer> _layers) : layers(std::move(_layers)), input_shape_proto(Shape4D(-1, in_sh_pr[1], in_sh_pr[2], in_sh_pr[3])) {}
+
+size_t Int8Network::size_bytes() const {
+    size_t bytes = 0;
+    for(const Int8Layer &l: layers) {
+        bytes += l.weights.size() * sizeof(int8_t) + l.biases.size() * sizeof(int32_t);
+    }
+    return bytes;
+}
+
+template<class T>
+Tensor4D<T> * Int8Network::forward(Tensor4D<T> &input) {
+    const Neural::Kernels::Int8Kernels &kernels = Neural::Kernels::host_kernel_set().i8;
+    Shape4D input_shape = input.shape();
+    assert_shape(input_shape, input_shape_proto);
+    int B = input_shape[0];
+
+    input.update_self_acc();
+    vector<int8_t> x(input.size());
+    double input_scale_inv = 1.0 / layers[0].input_scale;
+    for(int i = 0; i < input.size(); i++) {
+        x[i] = quantize_value(input.data()[i], input_scale_inv);
+    }
+
+    const Int8Layer &last = layers.back();
+    vector<float> logits((size_t)B * last.output_shape_proto[1] * last.output_shape_proto[2] * last.output_shape_proto[3]);
+
+    for(size_t l = 0; l < layers.size(); l++) {
+        const Int8Layer &layer = layers[l];
+        bool is_last = (l + 1 == layers.size());
+        int features = layer.output_shape_proto[1], out_plane = layer.output_shape_proto[2] * layer.output_shape_proto[3];
+        int patch = (int)(layer.weights.size() / features);
+
+        Neural::Kernels::Int8Epilogue epilogue;
+        epilogue.bias = layer.biases.data();
+        epilogue.scale = layer.scales.data();
+        epilogue.activation = layer.activation;
+        epilogue.output_scale_inv = is_last ? 1.0f : 1.0f / layer.output_scale;
+
+        vector<int8_t> y(is_last ? 0 : (size_t)B * features * out_plane);
+        if(layer.type == "conv") {
+            // per image: weights [features x patch] times the patch rows, one output plane per feature
+            int C = layer.input_shape_proto[1], H = layer.input_shape_proto[2], W = layer.input_shape_proto[3];
+            epilogue.per_row = true;
+            Neural::Parallel::run_outer(B, [&](int b) {
+                int8_t *patches = Neural::Parallel::thread_scratch<int8_t>((size_t)out_plane * patch);
+                kernels.im2col(x.data() + (size_t)b*C*H*W, patches, C, H, W, layer.filter_size[0], layer.filter_size[1], layer.stride[0], layer.stride[1], layer.padding[0], layer.padding[2], layer.output_shape_proto[2], layer.output_shape_proto[3]);
+                size_t offset = (size_t)b * features * out_plane;
+                kernels.gemm(features, out_plane, patch, layer.weights.data(), patch, patches, patch, epilogue, is_last ? nullptr : y.data() + offset, is_last ? logits.data() + offset : nullptr, out_plane);
+            });
+        }
+        else {
+            // the NCHW output of the previous layer already is the flattened [B x patch] input
+            epilogue.per_row = false;
+            kernels.gemm(B, features, patch, x.data(), patch, layer.weights.data(), patch, epilogue, is_last ? nullptr : y.data(), is_last ? logits.data() : nullptr, features);
+        }
+        x.swap(y);
+    }
+
+    Shape4D output_shape(B, last.output_shape_proto[1], last.output_shape_proto[2], last.output_shape_proto[3]);
+    Tensor4D<T> last_output(output_shape);
+    for(int i = 0; i < last_output.size(); i++) {
+        last_output.data()[i] = (T)logits[i];
+    }
+    last_output.copyin_acc();
+
+    Tensor4D<T> *output = new Tensor4D<T>(output_shape);
+    output->create_acc();
+    if(last.softmax) {
+        acc_softmax(last_output, output);
+    }
+    else {
+        acc_copy(last_output, output);
+    }
+    return output;
+}
+
+template<class T>
+Metrics Int8Network::eval(const Tensor4D<T> &eval_dataset, const Tensor4D<int> &eval_labels) {
+    return eval_batches<T, T>(eval_dataset, eval_labels);
+}
+
+template<class T>
+Metrics Int8Network::eval(const Tensor4D<uint8_t> &eval_dataset, const Tensor4D<int> &eval_labels) {
+    return eval_batches<T, uint8_t>(eval_dataset, eval_labels);
+}
+
+template<class T, class D>
+Metrics Int8Network::eval_batches(const Tensor4D<D> &eval_dataset, const Tensor4D<int> &eval_labels) {
+    Shape4D eval_data_shape = eval_dataset.shape();
+    int eval_batch_size = eval_data_shape[0]/100;
+    int iters_eval = eval_data_shape[0]/eval_batch_size;
+
+    LOGI.printf("Int8Network::eval | eval_batch_size: %d, iters_eval: %d", eval_batch_size, iters_eval);
+    unique_ptr<Tensor4D<int>> confusion_matrix;
+    for(int v = 0; v < iters_eval; v++) {
+        int eval_batch_start = (v*eval_batch_size)%(eval_data_shape[0]-eval_batch_size+1);
+
+        Tensor4D<T> eval_batch_data(eval_batch_size, eval_data_shape[1], eval_data_shape[2], eval_data_shape[3]);
+        eval_batch_data.create_acc();
+        Tensor4D<D> eval_batch_window(eval_dataset.view().slice(eval_batch_start, eval_batch_size));
+        eval_batch_window.copyin_acc();
+        Tensor4D<int> eval_batch_labels(eval_labels.view().slice(eval_batch_start, eval_batch_size));
+        eval_batch_labels.copyin_acc();
+
+        acc_normalize_img(eval_batch_window, &eval_batch_data);
+        unique_ptr<Tensor4D<T>> eval_batch_output(this->forward(eval_batch_data));
+        unique_ptr<Tensor4D<int>> batch_conf_matrix(acc_calc_confusion_matrix(*eval_batch_output.get(), eval_batch_labels));
+        if(confusion_matrix) {
+            acc_add(confusion_matrix.get(), *batch_conf_matrix.get());
+        }
+        else {
+            confusion_matrix = std::move(batch_conf_matrix);
+        }
+    }
+
+    _LLOG(info, confusion_matrix);
+    return macro_metrics(*confusion_matrix.get());
+}
+
+template<class T, class D>
+Int8Network Neural::Quantize::quantize(Neural::Network<T> &net, const Tensor4D<D> &dataset, int samples) {
+    const vector<Neural::Layers::Layer<T> *> &net_layers = net.get_layers();
+    // the int8 kernels and the Fc weight rows follow the nchw order
+    if(net.get_layout() != "nchw") {
+        throw(std::invalid_argument("Quantize: layout not supported: " + net.get_layout()));
+    }
+    Shape4D data_shape = dataset.shape();
+    samples = min(samples, data_shape[0]);
+    PLOGI << "Quantize::quantize | layers: " << net_layers.size() << ", calibration samples: " << samples;
+
+    // max |x| of every layer's input over the calibration sample, through the trained network
+    vector<double> input_absmax(net_layers.size(), 0.0);
+    for(int start = 0; start < samples; start += CALIBRATION_BATCH) {
+        int batch_size = min(CALIBRATION_BATCH, samples - start);
+        Tensor4D<D> batch_window(dataset.view().slice(start, batch_size));
+        batch_window.copyin_acc();
+        Tensor4D<T> *prev_output = new Tensor4D<T>(batch_size, data_shape[1], data_shape[2], data_shape[3]);
+        prev_output->create_acc();
+        acc_normalize_img(batch_window, prev_output);
+
+        for(size_t i = 0; i < net_layers.size(); i++) {
+            unique_ptr<Tensor4D<T>> input_i(net_layers[i]->forward_calc_input(*prev_output));
+            input_absmax[i] = max(input_absmax[i], absmax(*input_i.get()));
+            Tensor4D<T> *output_i = net_layers[i]->forward_calc_output(*input_i.get());
+            input_i.reset();
+            delete prev_output;
+            prev_output = output_i;
+        }
+        delete prev_output;
+    }
+
+    vector<Int8Layer> layers(net_layers.size());
+    for(size_t i = 0; i < net_layers.size(); i++) {
+        Neural::Layers::Weighted<T> *weighted = dynamic_cast<Neural::Layers::Weighted<T> *>(net_layers[i]);
+        // the binary layers read the signs of their weights and inputs, not the values quantized here
+        if(!weighted || (weighted->type() != "conv" && weighted->type() != "fc")) {
+            throw(std::invalid_argument("Quantize: layer type not supported: " + net_layers[i]->type()));
+        }
+
+        Int8Layer &layer = layers[i];
+        layer.type = weighted->type();
+        layer.input_shape_proto = weighted->get_input_shape_proto();
+        layer.output_shape_proto = weighted->get_output_shape_proto();
+        layer.input_scale = symmetric_scale(input_absmax[i]);
+        layer.output_scale = (i + 1 < net_layers.size()) ? symmetric_scale(input_absmax[i+1]) : 0.0f;
+
+        string activation = weighted->get_activation_name();
+        if(activation == "relu") {
+            layer.activation = Activation::relu;
+        }
+        else if(activation == "sigmoid") {
+            layer.activation = Activation::sigmoid;
+        }
+        else if(activation == "softmax") {
+            if(i + 1 != net_layers.size()) {
+                throw(std::invalid_argument("Quantize: softmax only on the output layer"));
+            }
+            layer.softmax = true;
+        }
+
+        if(Neural::Layers::Conv<T> *conv = dynamic_cast<Neural::Layers::Conv<T> *>(weighted)) {
+            layer.filter_size = conv->get_filter_size();
+            layer.stride = conv->get_stride();
+            layer.padding = conv->get_padding();
+        }
+
+        // conv weights are [features][channels][rows][cols] already, fc ones [inputs][features] and get transposed
+        Tensor4D<T> &weights = weighted->get_weights(), &biases = weighted->get_biases();
+        weights.update_self_acc();
+        biases.update_self_acc();
+        Shape4D weights_shape = weights.shape();
+        int features = layer.output_shape_proto[1];
+        int patch = weights.size() / features;
+        auto weight = [&](int c, int k) -> double {
+            return (layer.type == "conv") ? weights.data()[(size_t)c*patch + k] : weights.data()[(size_t)k*weights_shape[1] + c];
+        };
+
+        layer.weights.resize((size_t)features * patch);
+        layer.biases.resize(features);
+        layer.scales.resize(features);
+        for(int c = 0; c < features; c++) {
+            double channel_absmax = 0;
+            for(int k = 0; k < patch; k++) {
+                channel_absmax = max(channel_absmax, fabs(weight(c, k)));
+            }
+            double weight_scale = symmetric_scale(channel_absmax);
+            for(int k = 0; k < patch; k++) {
+                layer.weights[(size_t)c*patch + k] = quantize_value(weight(c, k), 1.0 / weight_scale);
+            }
+            layer.scales[c] = (float)(layer.input_scale * weight_scale);
+            layer.biases[c] = (int32_t)nearbyint(biases.data()[c] / ((double)layer.input_scale * weight_scale));
+        }
+
+        PLOGI << "Quantize::quantize | layer " << i << " " << layer.type << ": input_scale " << layer.input_scale << ", output_scale " << layer.output_scale;
+    }
+
+    return Int8Network(net.get_input_shape_proto(), std::move(layers));
+}
+
+template<class T, class D>
+Neural::Quantize::Report Neural::Quantize::report(Neural::Network<T> &net, Int8Network &int8net, const Tensor4D<D> &dataset, const Tensor4D<int> &labels) {
+    Report report;
+    LOGI << "Quantize::report | reference Network::eval";
+    net.eval(dataset, labels, report.reference.recall, report.reference.precision, report.reference.accuracy, report.reference.f1_score);
+    LOGI << "Quantize::report | Int8Network::eval";
+    report.quantized = int8net.eval<T>(dataset, labels);
+
+    for(auto it: net.get_layers()) {
+        if(Neural::Layers::Weighted<T> *weighted = dynamic_cast<Neural::Layers::Weighted<T> *>(it)) {
+            report.reference_bytes += (weighted->get_weights().size() + weighted->get_biases().size()) * sizeof(T);
+        }
+    }
+    report.quantized_bytes = int8net.size_bytes();
+
+    PLOGI.printf("Quantize::report |           %12s %12s %12s", "reference", "int8", "delta");
+    PLOGI.printf("Quantize::report | precision %12.6f %12.6f %+12.6f", report.reference.precision, report.quantized.precision, report.quantized.precision - report.reference.precision);
+    PLOGI.printf("Quantize::report | recall    %12.6f %12.6f %+12.6f", report.reference.recall, report.quantized.recall, report.quantized.recall - report.reference.recall);
+    PLOGI.printf("Quantize::report | accuracy  %12.6f %12.6f %+12.6f", report.reference.accuracy, report.quantized.accuracy, report.quantized.accuracy - report.reference.accuracy);
+    PLOGI.printf("Quantize::report | f1_score  %12.6f %12.6f %+12.6f", report.reference.f1_score, report.quantized.f1_score, report.quantized.f1_score - report.reference.f1_score);
+    PLOGI.printf("Quantize::report | weights   %12zu %12zu bytes", report.reference_bytes, report.quantized_bytes);
+    return report;
+}
+
+template Tensor4D<double> * Int8Network::forward(Tensor4D<double> &);
+template Tensor4D<float> * Int8Network::forward(Tensor4D<float> &);
+template Metrics Int8Network::eval(const Tensor4D<double> &, const Tensor4D<int> &);
+template Metrics Int8Network::eval(const Tensor4D<float> &, const Tensor4D<int> &);
+template Metrics Int8Network::eval<double>(const Tensor4D<uint8_t> &, const Tensor4D<int> &);
+template Metrics Int8Network::eval<float>(const Tensor4D<uint8_t> &, const Tensor4D<int> &);
+template Int8Network Neural::Quantize::quantize(Neural::Network<double> &, const Tensor4D<double> &, int);
+template Int8Network Neural::Quantize::quantize(Neural::Network<float> &, const Tensor4D<float> &, int);
+template Int8Network Neural::Quantize::quantize(Neural::Network<double> &, const Tensor4D<uint8_t> &, int);
+template Int8Network Neural::Quantize::quantize(Neural::Network<float> &, const Tensor4D<uint8_t> &, int);
+template Neural::Quantize::Report Neural::Quantize::report(Neural::Network<double> &, Int8Network &, const Tensor4D<double> &, const Tensor4D<int> &);
+template Neural::Quantize::Report Neural::Quantize::report(Neural::Network<float> &, Int8Network &, const Tensor4D<float> &, const Tensor4D<int> &);
+template Neural::Quantize::Report Neural::Quantize::report(Neural::Network<double> &, Int8Network &, const Tensor4D<uint8_t> &, const Tensor4D<int> &);
+template Neural::Quantize::Report Neural::Quantize::report(Neural::Network<float> &, Int8Network &, const Tensor4D<uint8_t> &, const Tensor4D<int> &);
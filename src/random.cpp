@@ -0,0 +1,109 @@
+#include "random.hpp"
+#include "parallel.hpp"
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+using Neural::Random::Stream;
+
+namespace {
+    constexpr uint32_t PHILOX_M0 = 0xD2511F53, PHILOX_M1 = 0xCD9E8D57;
+    constexpr uint32_t PHILOX_W0 = 0x9E3779B9, PHILOX_W1 = 0xBB67AE85;
+    // elements per Parallel::run item
+    constexpr long FILL_CHUNK = 1 << 14;
+
+    atomic<uint64_t> &seed_value() {
+        static atomic<uint64_t> value([] {
+            const char *env = getenv("NEURAL_SEED");
+            return (env && *env) ? strtoull(env, nullptr, 10) : 0ull;
+        }());
+        return value;
+    }
+
+    // two uniforms in (0, 1] from the 4 words of counter {pair, stream.id, stream.step}
+    inline void uniform_pair(uint64_t pair, Stream stream, const uint32_t key[2], double &u0, double &u1) {
+        uint32_t counter[4] = {(uint32_t)pair, (uint32_t)(pair >> 32), stream.id, stream.step}, out[4];
+        Neural::Random::philox4x32(counter, key, out);
+
+        uint64_t w0 = ((uint64_t)out[1] << 32) | out[0], w1 = ((uint64_t)out[3] << 32) | out[2];
+        u0 = ((w0 >> 11) + 1) * 0x1.0p-53;
+        u1 = ((w1 >> 11) + 1) * 0x1.0p-53;
+    }
+
+    // fn(first, last, key) over chunks of the workers, fn writes elements [first, last)
+    template<class F>
+    void fill(long n, F fn) {
+        uint64_t s = Neural::Random::seed();
+        uint32_t key[2] = {(uint32_t)s, (uint32_t)(s >> 32)};
+
+        long chunks = (n + FILL_CHUNK - 1) / FILL_CHUNK;
+        Neural::Parallel::run((int)chunks, [&](int c) {
+            long first = c * FILL_CHUNK, last = min(n, first + FILL_CHUNK);
+            fn(first, last, key);
+        });
+    }
+}
+
+uint64_t Neural::Random::seed() {
+    return seed_value().load();
+}
+
+void Neural::Random::set_seed(uint64_t s) {
+    seed_value().store(s);
+}
+
+void Neural::Random::philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+
+    for(int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0, p1 = (uint64_t)PHILOX_M1 * c2;
+        uint32_t hi0 = (uint32_t)(p0 >> 32), lo0 = (uint32_t)p0, hi1 = (uint32_t)(p1 >> 32), lo1 = (uint32_t)p1;
+
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+template<class T>
+void Neural::Random::uniform(T *data, long n, T low, T high, Stream stream) {
+    double range = (double)high - (double)low;
+    fill(n, [&](long first, long last, const uint32_t key[2]) {
+        for(long i = first; i < last; i++) {
+            double u0, u1;
+            uniform_pair(i / 2, stream, key, u0, u1);
+            data[i] = (T)(low + range * ((i % 2) ? u1 : u0));
+        }
+    });
+}
+
+template void Neural::Random::uniform(float *, long, float, float, Stream);
+template void Neural::Random::uniform(double *, long, double, double, Stream);
+
+template<class T>
+void Neural::Random::normal(T *data, long n, T mean, T stddev, Stream stream) {
+    fill(n, [&](long first, long last, const uint32_t key[2]) {
+        for(long i = first; i < last; i++) {
+            double u0, u1;
+            uniform_pair(i / 2, stream, key, u0, u1);
+
+            // Box-Muller: elements 2k and 2k+1 are the cosine and the sine of pair k
+            double r = sqrt(-2.0 * log(u0)), theta = 2.0 * M_PI * u1;
+            data[i] = (T)(mean + stddev * r * ((i % 2) ? sin(theta) : cos(theta)));
+        }
+    });
+}
+
+template void Neural::Random::normal(float *, long, float, float, Stream);
+template void Neural::Random::normal(double *, long, double, double, Stream);
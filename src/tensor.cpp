@@ -1,11 +1,12 @@
 #include "tensor.hpp"
+#include "bfloat16.hpp"
 #include "utils.hpp"
 #include <vector>
 #include <string>
 #include <iostream>
 #include <sstream>
 #include <memory>
-#include "openacc.h"
+#include <cstdint>
 
 using namespace std;
 using Neural::Shape4D;
@@ -89,6 +90,18 @@ template<class T> Tensor4D<T>::Tensor4D(int a, int b, int c, int d) : Tensor4D(S
 
 template<class T> Tensor4D<T>::Tensor4D() {}
 
+template<class T> Tensor4D<T>::Tensor4D(const TensorView4D<T> &view) : _shape(view.shape()), _data(view.data()), _borrowed(true) {
+    if(view.is_contiguous()) {
+        _layout = Neural::Layout::nchw;
+    }
+    else if(view.is_channels_last()) {
+        _layout = Neural::Layout::nhwc;
+    }
+    else {
+        throw(std::invalid_argument("Error: cannot borrow a non-contiguous view, use acc_copy"));
+    }
+}
+
 template<class T> Tensor4D<T>::~Tensor4D() {
     LOGD << "<~Tensor4D>";
     LOGD << _shape.to_string();
@@ -98,9 +111,8 @@ template<class T> Tensor4D<T>::~Tensor4D() {
 
 //TODO can delegate other ctor (T*, Shape4D) if same functionality?\
 //copy ctor
-template<class T> Tensor4D<T>::Tensor4D(const Tensor4D &other) : _shape(other._shape), _allocated(other._allocated) {
-    reset_data();
-    _data = new T[this->size()];
+template<class T> Tensor4D<T>::Tensor4D(const Tensor4D &other) : _shape(other._shape), _layout(other._layout) {
+    this->reserve();
     
     const T *odata = other._data;
     int osize = this->size();
@@ -110,7 +122,8 @@ template<class T> Tensor4D<T>::Tensor4D(const Tensor4D &other) : _shape(other._s
         this->create_acc();
     }
     
-    #pragma acc parallel loop present(_data[:osize], adata[:osize]) if(other_is_present)
+    #pragma acc parallel loop present(_data[:osize], odata[:osize]) if(other_is_present)
+    #pragma omp parallel for schedule(static)
     for(int i = 0; i < osize; i++) {
         _data[i] = odata[i];
     }
@@ -118,12 +131,13 @@ template<class T> Tensor4D<T>::Tensor4D(const Tensor4D &other) : _shape(other._s
 
 //move ctor
 //TODO if not & does use count increase?
-template<class T> Tensor4D<T>::Tensor4D(Tensor4D &&other) : _shape(other._shape), _allocated(other._allocated) {
-    reset_data();
-    
+template<class T> Tensor4D<T>::Tensor4D(Tensor4D &&other) : _shape(other._shape), _allocated(other._allocated), _borrowed(other._borrowed), _acc_entered(other._acc_entered), _layout(other._layout) {
     this->_data = other.data();
     
     other._data = nullptr;
+    other._allocated = false;
+    other._borrowed = false;
+    other._acc_entered = 0;
 }
 
 //copy assignment
@@ -131,8 +145,8 @@ template<class T> Tensor4D<T> & Tensor4D<T>::operator=(const Tensor4D &other) {
     reset_data();
     
     this->_shape = other._shape;
-    this->_data = new T[this->size()];
-    this->_allocated = other._allocated;
+    this->_layout = other._layout;
+    this->reserve();
     
     const T *odata = other._data;
     int osize = this->size();
@@ -142,7 +156,8 @@ template<class T> Tensor4D<T> & Tensor4D<T>::operator=(const Tensor4D &other) {
         this->create_acc();
     }
     
-    #pragma acc parallel loop present(_data[:osize], adata[:osize]) if(other_is_present)
+    #pragma acc parallel loop present(_data[:osize], odata[:osize]) if(other_is_present)
+    #pragma omp parallel for schedule(static)
     for(int i = 0; i < osize; i++) {
         _data[i] = odata[i];
     }
@@ -157,8 +172,14 @@ template<class T> Tensor4D<T> & Tensor4D<T>::operator=(Tensor4D &&other) {
     this->_shape = other.shape();
     this->_data = other._data;
     this->_allocated = other._allocated;
+    this->_borrowed = other._borrowed;
+    this->_acc_entered = other._acc_entered;
+    this->_layout = other._layout;
     
     other._data = nullptr;
+    other._allocated = false;
+    other._borrowed = false;
+    other._acc_entered = 0;
     return *this;
 }
 
@@ -167,13 +188,19 @@ template<class T> void Tensor4D<T>::reset_data() {
     LOGD << "this->delete_acc";
     bool ispr = this->is_present_acc();
     LOGD << "is_present_acc: " << ispr;
-    this->delete_acc();
+    // a borrowed tensor must not exit the data region of the tensor it borrows from
+    if(!_borrowed || _acc_entered > 0) {
+        this->delete_acc();
+    }
+    _borrowed = false;
+    _acc_entered = 0;
 
     LOGD << "_allocated: " << _allocated;
 
     if(_allocated) {
-        LOGD << "delete[] _data: ";
-        delete[] _data;
+        LOGD << "Pool::release(_data): ";
+        Neural::Pool::release(_data, this->size());
+        _data = nullptr;
         LOGD << "_allocated = false ";
         _allocated = false;
     }
@@ -181,27 +208,30 @@ template<class T> void Tensor4D<T>::reset_data() {
 template<class T> void Tensor4D<T>::create_acc() {
     int _size = this->size();
     #pragma acc enter data create(_data[:_size])
+    _acc_entered++;
 }
 
 template<class T> void Tensor4D<T>::copyin_acc() {
     int _size = this->size();
     #pragma acc enter data copyin(_data[:_size])
+    _acc_entered++;
 }
 
 template<class T> void Tensor4D<T>::copyout_acc() {
     int _size = this->size();
     #pragma acc exit data copyout(_data[:_size])
+    if(_acc_entered > 0) _acc_entered--;
 }
 
 template<class T> void Tensor4D<T>::delete_acc() {
     int _size = this->size();
     #pragma acc exit data delete(_data[:_size])
+    if(_acc_entered > 0) _acc_entered--;
 }
 
 template<class T> bool Tensor4D<T>::is_present_acc() const {
     LOGV << "Tensor4D::is_present_acc!";
-    // return Neural::is_present(this->data(), this->size() * sizeof(T));
-    return ::acc_is_present(_data, this->size() * sizeof(T) );
+    return mispresent(_data, this->size() * sizeof(T));
 }
 
 template<class T> void Tensor4D<T>::update_self_acc() {
@@ -289,9 +319,19 @@ template<class T> std::string Tensor4D<T>::to_string() {
                     else {
                         format2 = "%+011.5f|";
                     }
-                    int size2 = snprintf(nullptr, 0, format2, _data[ ( (b* C + c)* H +  h) * W + w]);
-                    string temp2(size2+1, '\0');
-                    sprintf(&temp2[0], format2, _data[ ( (b* C + c)* H +  h) * W + w]);
+                    int size2;
+                    T value = at(b, c, h, w);
+                    string temp2;
+                    if constexpr(is_same<T, int>::value) {
+                        size2 = snprintf(nullptr, 0, format2, value);
+                        temp2.assign(size2+1, '\0');
+                        sprintf(&temp2[0], format2, value);
+                    }
+                    else {
+                        size2 = snprintf(nullptr, 0, format2, (double)value);
+                        temp2.assign(size2+1, '\0');
+                        sprintf(&temp2[0], format2, (double)value);
+                    }
                     ret += temp2;
                 }
                 ret += "  ";
@@ -325,10 +365,10 @@ template<class T> void Tensor4D<T>::print() {
                 printf("|");
                 for(int w = 0; w < W; w++) {
                     if constexpr(is_same<T, int>::value) {
-                        printf("%5d|", _data[ ( (b* C + c)* H +  h) * W + w]);
+                        printf("%5d|", at(b, c, h, w));
                     }
                     else {
-                        printf("%+011.5f|", _data[ ( (b* C + c)* H +  h) * W + w]);
+                        printf("%+011.5f|", (double)at(b, c, h, w));
                     }
                 }
                 printf("  ");
@@ -345,10 +385,14 @@ template<class T> void Tensor4D<T>::print() {
 template class Tensor4D<double>;
 template class Tensor4D<float>;
 template class Tensor4D<int>;
+template class Tensor4D<Neural::bfloat16>;
+// datasets kept as their raw bytes (idx.hpp)
+template class Tensor4D<uint8_t>;
 
 template<class T> LabeledData<T>::LabeledData(Tensor4D<T> *cdata, Tensor4D<int> *clabels) : data(cdata), labels(clabels) {}
 template class LabeledData<double>;
 template class LabeledData<float>;
+template class LabeledData<uint8_t>;
 
 void assert_shape(Shape4D actual, Shape4D proto) {
     assert((actual[0]!=-1) && (actual[1]==proto[1]) && (actual[2]==proto[2]) && (actual[3]==proto[3]));
@@ -0,0 +1,58 @@
+#include "vmath.hpp"
+#include "host_kernels.hpp"
+#include <cstdlib>
+#include <atomic>
+
+using namespace std;
+
+namespace {
+    bool default_use_libm() {
+        const char *env = getenv("NEURAL_LIBM_MATH");
+        if(env) {
+            return atoi(env) != 0;
+        }
+        return Neural::get_isa() == Neural::Isa::generic;
+    }
+
+    atomic<bool> &libm_flag() {
+        static atomic<bool> flag(default_use_libm());
+        return flag;
+    }
+}
+
+bool Neural::Math::use_libm() {
+    return libm_flag().load(memory_order_relaxed);
+}
+
+void Neural::Math::set_use_libm(bool libm) {
+    libm_flag().store(libm);
+}
+
+template<class T>
+void Neural::Math::vexp(int n, const T *x, T *y) {
+    Neural::Kernels::host_kernels<T>().vexp(n, x, y);
+}
+
+template<class T>
+void Neural::Math::vlog(int n, const T *x, T *y) {
+    Neural::Kernels::host_kernels<T>().vlog(n, x, y);
+}
+
+template<class T>
+void Neural::Math::vsigmoid(int n, const T *x, T *y) {
+    Neural::Kernels::host_kernels<T>().vsigmoid(n, x, y);
+}
+
+template<class T>
+void Neural::Math::vtanh(int n, const T *x, T *y) {
+    Neural::Kernels::host_kernels<T>().vtanh(n, x, y);
+}
+
+template void Neural::Math::vexp<double>(int, const double *, double *);
+template void Neural::Math::vexp<float>(int, const float *, float *);
+template void Neural::Math::vlog<double>(int, const double *, double *);
+template void Neural::Math::vlog<float>(int, const float *, float *);
+template void Neural::Math::vsigmoid<double>(int, const double *, double *);
+template void Neural::Math::vsigmoid<float>(int, const float *, float *);
+template void Neural::Math::vtanh<double>(int, const double *, double *);
+template void Neural::Math::vtanh<float>(int, const float *, float *);
@@ -0,0 +1,299 @@
+#include <stdexcept>
+#include <algorithm>
+#include "winograd.hpp"
+#include "gemm.hpp"
+#include "parallel.hpp"
+
+using Neural::Tensor4D;
+using Neural::Shape4D;
+using Neural::Kernels::Winograd;
+
+using namespace std;
+
+namespace {
+    // interpolation points in the order that keeps the transforms best conditioned
+    const double cook_toom_points[] = {0.0, 1.0, -1.0, 2.0, -2.0, 0.5, -0.5, 3.0, -3.0};
+
+    // row-major small matrix product, C[a x c] = A[a x b] * B[b x c]
+    template<class T>
+    void matmul(const T *A, const T *B, T *C, int a, int b, int c) {
+        for(int i = 0; i < a; i++) {
+            for(int j = 0; j < c; j++) {
+                T sum = 0;
+                for(int k = 0; k < b; k++) {
+                    sum += A[i*b + k] * B[k*c + j];
+                }
+                C[i*c + j] = sum;
+            }
+        }
+    }
+
+    // C[a x a2] = A[a x b] * X[b x b2] * A2^T, A2 being [a2 x b2]
+    template<class T>
+    void sandwich(const T *A, int a, int b, const T *X, int b2, const T *A2, int a2, T *tmp, T *C) {
+        matmul(A, X, tmp, a, b, b2);
+        for(int i = 0; i < a; i++) {
+            for(int j = 0; j < a2; j++) {
+                T sum = 0;
+                for(int k = 0; k < b2; k++) {
+                    sum += tmp[i*b2 + k] * A2[j*b2 + k];
+                }
+                C[i*a2 + j] = sum;
+            }
+        }
+    }
+}
+
+template<class T>
+Winograd<T>::Winograd(int m, int r) : _m(m), _r(r), _n(m + r - 1) {
+    int n = _n, np = n - 1;
+
+    // tiles are staged in 8x8 stack buffers
+    if(m < 1 || r < 1 || n > 8) {
+        throw(std::invalid_argument("Winograd: unsupported F(" + to_string(m) + ", " + to_string(r) + ")"));
+    }
+
+    const double *p = cook_toom_points;
+    AT.assign(m*n, 0);
+    G.assign(n*r, 0);
+    BT.assign(n*n, 0);
+
+    // finite points p_0..p_{n-2} plus the point at infinity as the last row/column
+    for(int j = 0; j < np; j++) {
+        double norm = 1.0;
+        for(int l = 0; l < np; l++) {
+            if(l != j) {
+                norm *= p[j] - p[l];
+            }
+        }
+
+        double pw = 1.0;
+        for(int i = 0; i < max(m, r); i++) {
+            if(i < m) AT[i*n + j] = pw;
+            if(i < r) G[j*r + i] = pw / norm;
+            pw *= p[j];
+        }
+
+        // BT row j: coefficients of prod_{l != j} (x - p_l)
+        vector<double> poly{1.0};
+        for(int l = 0; l < np; l++) {
+            if(l == j) {
+                continue;
+            }
+            vector<double> next(poly.size() + 1, 0.0);
+            for(size_t k = 0; k < poly.size(); k++) {
+                next[k + 1] += poly[k];
+                next[k] -= p[l] * poly[k];
+            }
+            poly.swap(next);
+        }
+        for(size_t k = 0; k < poly.size(); k++) {
+            BT[j*n + k] = poly[k];
+        }
+    }
+
+    AT[(m - 1)*n + np] = 1;
+    G[np*r + r - 1] = 1;
+
+    // BT last row: coefficients of prod_l (x - p_l)
+    vector<double> poly{1.0};
+    for(int l = 0; l < np; l++) {
+        vector<double> next(poly.size() + 1, 0.0);
+        for(size_t k = 0; k < poly.size(); k++) {
+            next[k + 1] += poly[k];
+            next[k] -= p[l] * poly[k];
+        }
+        poly.swap(next);
+    }
+    for(size_t k = 0; k < poly.size(); k++) {
+        BT[np*n + k] = poly[k];
+    }
+}
+
+template<class T>
+bool Winograd<T>::supports(int filter_height, int filter_width, int stride_r, int stride_c) {
+    return filter_height == filter_width && (filter_height == 3 || filter_height == 5) && stride_r == 1 && stride_c == 1;
+}
+
+template<class T>
+void Winograd<T>::transform_filters(const Tensor4D<T> &filters, long version) {
+    Shape4D shape = filters.shape();
+    int n = _n, r = _r, nn = n*n;
+
+    if(shape[2] != r || shape[3] != r) {
+        throw(std::invalid_argument("Winograd: filter is not " + to_string(r) + "x" + to_string(r)));
+    }
+
+    out_channels = shape[0];
+    in_channels = shape[1];
+    int OC = out_channels, C = in_channels;
+
+    U_fwd.resize((size_t)nn*OC*C);
+    U_bwd.resize((size_t)nn*OC*C);
+    const T *w = filters.data();
+
+    Neural::Parallel::run(OC, [&](int oc) {
+        vector<T> tmp(n*r), u(nn), g_flip(r*r);
+
+        for(int c = 0; c < C; c++) {
+            const T *g = w + (oc*C + c)*r*r;
+            sandwich(G.data(), n, r, g, r, G.data(), n, tmp.data(), u.data());
+            for(int xi = 0; xi < nn; xi++) {
+                U_fwd[((size_t)xi*OC + oc)*C + c] = u[xi];
+            }
+
+            // input gradient correlates with the 180-degree rotated filter, channels swapped
+            for(int k = 0; k < r*r; k++) {
+                g_flip[k] = g[r*r - 1 - k];
+            }
+            sandwich(G.data(), n, r, g_flip.data(), r, G.data(), n, tmp.data(), u.data());
+            for(int xi = 0; xi < nn; xi++) {
+                U_bwd[((size_t)xi*C + c)*OC + oc] = u[xi];
+            }
+        }
+    });
+
+    _version = version;
+}
+
+// out[OC x OH x OW] = in[C x H x W] (*) U, reading the input shifted by -pad_r rows and -pad_c columns
+// with zeros outside.
+// The tile transforms run on all P tiles of a channel at once: every tile element is a P-long row,
+// so the small transform matrices become sums of whole rows.
+template<class T>
+void Winograd<T>::correlate(const T *in, int C, int H, int W, int pad_r, int pad_c, const T *U, int OC, T *out, int OH, int OW, const Epilogue<T> *ep) const {
+    int m = _m, n = _n, nn = n*n;
+    int tiles_h = (OH + m - 1) / m, tiles_w = (OW + m - 1) / m, P = tiles_h * tiles_w;
+
+    T *V = Neural::Parallel::thread_scratch<T, 0>((size_t)nn*C*P);
+    T *M = Neural::Parallel::thread_scratch<T, 1>((size_t)nn*OC*P);
+    T *D = Neural::Parallel::thread_scratch<T, 2>((size_t)nn*P);
+    T *tmp = Neural::Parallel::thread_scratch<T, 3>((size_t)nn*P);
+
+    // rows[a*cols_out + b] = sum_i sum_j L[a][i] L[b][j] src[i*n + j], all rows P long
+    auto transform = [&](const T *L, int rows, const T *src, T *dst_base, size_t dst_stride) {
+        for(int a = 0; a < rows; a++) {
+            for(int j = 0; j < n; j++) {
+                T *t = tmp + (size_t)(a*n + j)*P;
+                fill(t, t + P, (T)0);
+                for(int i = 0; i < n; i++) {
+                    T coef = L[a*n + i];
+                    if(coef == (T)0) continue;
+                    const T *sr = src + (size_t)(i*n + j)*P;
+                    for(int p = 0; p < P; p++) {
+                        t[p] += coef * sr[p];
+                    }
+                }
+            }
+        }
+
+        for(int a = 0; a < rows; a++) {
+            for(int b = 0; b < rows; b++) {
+                T *dst = dst_base + (size_t)(a*rows + b)*dst_stride;
+                fill(dst, dst + P, (T)0);
+                for(int j = 0; j < n; j++) {
+                    T coef = L[b*n + j];
+                    if(coef == (T)0) continue;
+                    const T *t = tmp + (size_t)(a*n + j)*P;
+                    for(int p = 0; p < P; p++) {
+                        dst[p] += coef * t[p];
+                    }
+                }
+            }
+        }
+    };
+
+    for(int c = 0; c < C; c++) {
+        const T *in_c = in + (size_t)c*H*W;
+
+        for(int i = 0; i < n; i++) {
+            for(int j = 0; j < n; j++) {
+                T *d = D + (size_t)(i*n + j)*P;
+                for(int ty = 0; ty < tiles_h; ty++) {
+                    int y = ty*m - pad_r + i;
+                    bool row_in = (y >= 0 && y < H);
+                    for(int tx = 0; tx < tiles_w; tx++) {
+                        int x = tx*m - pad_c + j;
+                        d[ty*tiles_w + tx] = (row_in && x >= 0 && x < W) ? in_c[y*W + x] : (T)0;
+                    }
+                }
+            }
+        }
+
+        transform(BT.data(), n, D, V + (size_t)c*P, (size_t)C*P);
+    }
+
+    for(int xi = 0; xi < nn; xi++) {
+        Neural::Kernels::gemm<T>(OC, P, C, (T)1, U + (size_t)xi*OC*C, C, V + (size_t)xi*C*P, P, (T)0, M + (size_t)xi*OC*P, P);
+    }
+
+    for(int oc = 0; oc < OC; oc++) {
+        T *out_oc = out + (size_t)oc*OH*OW;
+
+        for(int xi = 0; xi < nn; xi++) {
+            copy(M + ((size_t)xi*OC + oc)*P, M + ((size_t)xi*OC + oc + 1)*P, D + (size_t)xi*P);
+        }
+
+        // the m x m results land in V's first m*m rows, V is free again after the GEMMs
+        transform(AT.data(), m, D, V, (size_t)P);
+
+        for(int i = 0; i < m; i++) {
+            for(int j = 0; j < m; j++) {
+                const T *y = V + (size_t)(i*m + j)*P;
+                for(int ty = 0; ty < tiles_h && ty*m + i < OH; ty++) {
+                    for(int tx = 0; tx < tiles_w; tx++) {
+                        if(tx*m + j < OW) {
+                            out_oc[(ty*m + i)*OW + tx*m + j] = y[ty*tiles_w + tx];
+                        }
+                    }
+                }
+            }
+        }
+
+        // the whole plane is one row with the channel's bias
+        if(ep) {
+            apply_epilogue(*ep, out_oc, 1, OH*OW, OH*OW, oc, 0);
+        }
+    }
+}
+
+template<class T>
+void Winograd<T>::forward(const Tensor4D<T> &input, Tensor4D<T> *output, const vector<int> &padding, const Epilogue<T> &epilogue) const {
+    Shape4D in_shape = input.shape(), out_shape = output->shape();
+    int batch = in_shape[0], C = in_shape[1], H = in_shape[2], W = in_shape[3];
+    int OC = out_shape[1], OH = out_shape[2], OW = out_shape[3];
+
+    if(C != in_channels || OC != out_channels || OH != H + padding[0] + padding[1] - _r + 1 || OW != W + padding[2] + padding[3] - _r + 1 || batch != out_shape[0]) {
+        throw(std::invalid_argument("Winograd::forward: shapes do not match the transformed filters"));
+    }
+
+    const T *in_data = input.data();
+    T *out_data = output->data();
+
+    Neural::Parallel::run_outer(batch, [&](int i) {
+        correlate(in_data + (size_t)i*C*H*W, C, H, W, padding[0], padding[2], U_fwd.data(), OC, out_data + (size_t)i*OC*OH*OW, OH, OW, &epilogue);
+    });
+}
+
+template<class T>
+void Winograd<T>::backward_data(const Tensor4D<T> &drv_error_output, Tensor4D<T> *drv_error_input, const vector<int> &padding) const {
+    Shape4D out_shape = drv_error_output.shape(), in_shape = drv_error_input->shape();
+    int batch = out_shape[0], OC = out_shape[1], OH = out_shape[2], OW = out_shape[3];
+    int C = in_shape[1], H = in_shape[2], W = in_shape[3];
+
+    if(C != in_channels || OC != out_channels || H + padding[0] + padding[1] != OH + _r - 1 || W + padding[2] + padding[3] != OW + _r - 1 || batch != in_shape[0]) {
+        throw(std::invalid_argument("Winograd::backward_data: shapes do not match the transformed filters"));
+    }
+
+    const T *dout_data = drv_error_output.data();
+    T *din_data = drv_error_input->data();
+
+    // full correlation: the output gradient read with r-1 zeros around it, less the rows and columns
+    // that would land on the input padding
+    Neural::Parallel::run_outer(batch, [&](int i) {
+        correlate(dout_data + (size_t)i*OC*OH*OW, OC, OH, OW, _r - 1 - padding[0], _r - 1 - padding[2], U_bwd.data(), C, din_data + (size_t)i*C*H*W, H, W, nullptr);
+    });
+}
+
+template class Neural::Kernels::Winograd<double>;
+template class Neural::Kernels::Winograd<float>;
@@ -0,0 +1,180 @@
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include "xnor.hpp"
+#include "host_kernels.hpp"
+#include "parallel.hpp"
+
+using Neural::Tensor4D;
+using Neural::Shape4D;
+using Neural::Kernels::Xnor;
+
+using namespace std;
+
+// w(o, c, fh, fw) = filters[o*out_stride + c*in_stride + fh*cols + fw]
+template<class T>
+void Xnor<T>::pack(const T *filters, int _out_channels, int _in_channels, int rows, int cols, size_t out_stride, size_t in_stride, long version) {
+    out_channels = _out_channels;
+    in_channels = _in_channels;
+    filter_rows = rows;
+    filter_cols = cols;
+    channel_words = (in_channels + 63) / 64;
+
+    int taps = rows * cols;
+    bits.assign((size_t)out_channels * taps * channel_words, 0);
+    alpha.resize(out_channels);
+
+    Neural::Parallel::run(out_channels, [&](int o) {
+        uint64_t *o_bits = bits.data() + (size_t)o * taps * channel_words;
+        double sum = 0;
+        for(int c = 0; c < in_channels; c++) {
+            for(int t = 0; t < taps; t++) {
+                T w = filters[o*out_stride + c*in_stride + t];
+                sum += fabs((double)w);
+                if(w > (T)0) {
+                    o_bits[(size_t)t*channel_words + c/64] |= (uint64_t)1 << (c%64);
+                }
+            }
+        }
+        alpha[o] = (T)(sum / ((double)in_channels * taps));
+    });
+    _version = version;
+}
+
+template<class T>
+void Xnor<T>::pack_filters(const Tensor4D<T> &filters, long version) {
+    Shape4D shape = filters.shape();
+    pack(filters.data(), shape[0], shape[1], shape[2], shape[3], (size_t)shape[1]*shape[2]*shape[3], (size_t)shape[2]*shape[3], version);
+}
+
+template<class T>
+void Xnor<T>::pack_weights(const Tensor4D<T> &weights, long version) {
+    Shape4D shape = weights.shape();
+    pack(weights.data(), shape[1], shape[0], 1, 1, 1, shape[1], version);
+}
+
+template<class T>
+void Xnor<T>::forward(const Tensor4D<T> &input, Tensor4D<T> *output, const vector<int> &stride, const vector<int> &padding, const Epilogue<T> &epilogue) const {
+    Shape4D input_shape = input.shape(), output_shape = output->shape();
+    int B = input_shape[0], C = input_shape[1], H = input_shape[2], W = input_shape[3];
+    int OC = output_shape[1], OH = output_shape[2], OW = output_shape[3];
+    assert(C == in_channels && OC == out_channels && output_shape[0] == B);
+
+    int taps = filter_rows * filter_cols, cw = channel_words, words = taps * cw, K = C * taps, P = OH * OW;
+    bool padded = padding[0] != 0 || padding[1] != 0 || padding[2] != 0 || padding[3] != 0;
+    // the valid bits of one pixel
+    vector<uint64_t> channel_mask(cw, ~(uint64_t)0);
+    if(C % 64) {
+        channel_mask[cw-1] = ((uint64_t)1 << (C % 64)) - 1;
+    }
+
+    const Neural::Kernels::HostKernelSet &kernels = Neural::Kernels::host_kernel_set();
+    const T *in_data = input.data();
+    T *out_data = output->data();
+    // channels-last: the channels of a pixel are adjacent and the output pixels are the rows, so is the bias
+    bool in_nhwc = input.layout() == Neural::Layout::nhwc, out_nhwc = output->layout() == Neural::Layout::nhwc;
+    int c_stride = in_nhwc ? 1 : H*W, hw_stride = in_nhwc ? C : 1;
+    Epilogue<T> out_epilogue = epilogue;
+    if(out_nhwc) {
+        out_epilogue.row_bias = nullptr;
+        out_epilogue.col_bias = epilogue.row_bias;
+    }
+
+    Neural::Parallel::run_outer(B, [&](int b) {
+        // channel bits per pixel, [H][W][cw]
+        uint64_t *pixels = Neural::Parallel::thread_scratch<uint64_t, 0>((size_t)H * W * cw);
+        fill(pixels, pixels + (size_t)H * W * cw, 0);
+        const T *image = in_data + (size_t)b * C * H * W;
+        for(int c = 0; c < C; c++) {
+            uint64_t bit = (uint64_t)1 << (c%64);
+            for(int hw = 0; hw < H*W; hw++) {
+                if(image[(size_t)c*c_stride + (size_t)hw*hw_stride] > (T)0) {
+                    pixels[(size_t)hw*cw + c/64] |= bit;
+                }
+            }
+        }
+
+        // patch rows [P][taps][cw] in the order of the filter bits, and their masks when padded
+        uint64_t *patches = Neural::Parallel::thread_scratch<uint64_t, 1>((size_t)P * words);
+        uint64_t *masks = padded ? Neural::Parallel::thread_scratch<uint64_t, 2>((size_t)P * words) : nullptr;
+        for(int oh = 0; oh < OH; oh++) {
+            for(int ow = 0; ow < OW; ow++) {
+                size_t row = (size_t)(oh*OW + ow) * words;
+                for(int fh = 0; fh < filter_rows; fh++) {
+                    int h = oh*stride[0] + fh - padding[0];
+                    for(int fw = 0; fw < filter_cols; fw++) {
+                        int w = ow*stride[1] + fw - padding[2];
+                        size_t tap = row + (size_t)(fh*filter_cols + fw) * cw;
+                        bool inside = h >= 0 && h < H && w >= 0 && w < W;
+                        for(int k = 0; k < cw; k++) {
+                            patches[tap + k] = inside ? pixels[((size_t)h*W + w)*cw + k] : 0;
+                            if(masks) {
+                                masks[tap + k] = inside ? channel_mask[k] : 0;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        int32_t *dots = Neural::Parallel::thread_scratch<int32_t, 3>((size_t)OC * P);
+        kernels.xnor.gemm(OC, P, words, K, bits.data(), words, patches, masks, words, dots, P);
+
+        T *out = out_data + (size_t)b * OC * P;
+        if(out_nhwc) {
+            for(int p = 0; p < P; p++) {
+                for(int o = 0; o < OC; o++) {
+                    out[(size_t)p*OC + o] = alpha[o] * (T)dots[(size_t)o*P + p];
+                }
+            }
+            Neural::Kernels::host_kernels<T>().apply_epilogue(out_epilogue, out, P, OC, OC, 0, 0);
+            return;
+        }
+        for(int o = 0; o < OC; o++) {
+            for(int p = 0; p < P; p++) {
+                out[(size_t)o*P + p] = alpha[o] * (T)dots[(size_t)o*P + p];
+            }
+        }
+        Neural::Kernels::host_kernels<T>().apply_epilogue(out_epilogue, out, OC, P, P, 0, 0);
+    });
+}
+
+template<class T>
+void Xnor<T>::forward_fc(const Tensor4D<T> &input, Tensor4D<T> *output, const Epilogue<T> &epilogue) const {
+    Shape4D input_shape = input.shape(), output_shape = output->shape();
+    int B = input_shape[0], K = input_shape[1] * input_shape[2] * input_shape[3];
+    int N = output_shape[1] * output_shape[2] * output_shape[3], cw = channel_words;
+    assert(K == in_channels && N == out_channels && filter_rows == 1 && filter_cols == 1 && output_shape[0] == B);
+
+    const Neural::Kernels::HostKernelSet &kernels = Neural::Kernels::host_kernel_set();
+    const T *in_data = input.data();
+    T *out_data = output->data();
+
+    // sign bits per row, [B][cw], the same words as the packed weights; the bits past K stay 0 in both
+    uint64_t *rows = Neural::Parallel::thread_scratch<uint64_t, 0>((size_t)B * cw);
+    Neural::Parallel::run(B, [&](int b) {
+        uint64_t *row = rows + (size_t)b * cw;
+        fill(row, row + cw, 0);
+        const T *x = in_data + (size_t)b * K;
+        for(int k = 0; k < K; k++) {
+            if(x[k] > (T)0) {
+                row[k/64] |= (uint64_t)1 << (k%64);
+            }
+        }
+    });
+
+    int32_t *dots = Neural::Parallel::thread_scratch<int32_t, 3>((size_t)B * N);
+    kernels.xnor.gemm(B, N, cw, K, rows, cw, bits.data(), nullptr, cw, dots, N);
+
+    Neural::Parallel::run(B, [&](int b) {
+        T *out = out_data + (size_t)b * N;
+        const int32_t *dot = dots + (size_t)b * N;
+        for(int o = 0; o < N; o++) {
+            out[o] = alpha[o] * (T)dot[o];
+        }
+        Neural::Kernels::host_kernels<T>().apply_epilogue(epilogue, out, 1, N, N, b, 0);
+    });
+}
+
+template class Neural::Kernels::Xnor<double>;
+template class Neural::Kernels::Xnor<float>;